@@ -0,0 +1,2 @@
+/* Without systemtap's sys/sdt.h the USDT probes compile to nothing */
+#define STAP_PROBEV(provider, name, ...) do { } while (0)
@@ -79,6 +79,7 @@ static inline void atomic_init(atomic_t *atomic)
 typedef struct { volatile int val; } atomic_t;
 #define atomic_inc(v) (__sync_add_and_fetch(&(v)->val, 1))
 #define atomic_dec(v) (__sync_sub_and_fetch(&(v)->val, 1))
+#define atomic_add(v, n) (__sync_add_and_fetch(&(v)->val, n))
 #define atomic_init(v) ((v)->val = 0)
 #endif
 #define atomic_get(v) ((v)->val)
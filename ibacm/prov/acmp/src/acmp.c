@@ -38,6 +38,8 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <infiniband/acm.h>
@@ -119,6 +121,8 @@ struct acmp_dest {
 	uint64_t	       addr_timeout;
 	uint64_t	       route_timeout;
 	uint8_t                addr_type;
+	uint8_t                restored;
+	struct list_node       reval_entry;
 	struct acmp_ep         *ep;
 };
 
@@ -195,6 +199,9 @@ struct acmp_ep {
 	int		      nmbr_ep_addrs;
 	struct acmp_addr      *addr_info;
 	atomic_t              counters[ACM_MAX_COUNTER];
+	/* restored dests waiting for revalidation, protected by lock */
+	struct list_head      reval_list;
+	int                   reval_pending;
 };
 
 struct acmp_send_msg {
@@ -221,6 +228,39 @@ struct acmp_request {
 	struct acmp_ep	*ep;
 };
 
+/*
+ * Route cache file: a header followed by count records.  Lifetimes are
+ * stored in minutes left at the time the file was saved, which is
+ * recorded in wall clock seconds.
+ */
+#define ACMP_CACHE_MAGIC   "ACMPRC\0\0"
+#define ACMP_CACHE_VERSION 1
+#define ACMP_CACHE_NEVER   ((uint64_t) ~0ULL)
+
+struct acmp_cache_hdr {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	rec_size;
+	uint32_t	count;
+	uint32_t	generation;
+	uint64_t	saved;
+	uint64_t	lookups;
+	uint64_t	hits;
+};
+
+struct acmp_cache_rec {
+	__be64		       dev_guid;
+	uint16_t	       pkey;
+	uint8_t		       port_num;
+	uint8_t		       addr_type;
+	uint32_t	       remote_qpn;
+	uint64_t	       addr_ttl;
+	uint64_t	       route_ttl;
+	uint8_t		       address[ACM_MAX_ADDRESS];
+	union ibv_gid	       mgid;
+	struct ibv_path_record path;
+};
+
 static int acmp_open_dev(const struct acm_device *device, void **dev_context);
 static void acmp_close_dev(void *dev_context);
 static int acmp_open_port(const struct acm_port *port, void *dev_context,
@@ -265,6 +305,17 @@ static atomic_t wait_cnt;
 static pthread_t retry_thread_id;
 static int retry_thread_started = 0;
 
+static const struct acmp_cache_hdr *cache_map;
+static size_t cache_map_size;
+static pthread_t cache_thread_id;
+static int cache_thread_started;
+static volatile int cache_thread_stop;
+static event_t cache_event;
+static atomic_t cache_restored;
+static atomic_t cache_restored_hits;
+static atomic_t cache_revalidated;
+static atomic_t cache_invalidated;
+
 static __thread char log_data[ACM_MAX_ADDRESS];
 
 /*
@@ -286,6 +337,9 @@ static uint8_t min_mtu = IBV_MTU_2048;
 static uint8_t min_rate = IBV_RATE_10_GBPS;
 static enum acmp_route_preload route_preload;
 static enum acmp_addr_preload addr_preload;
+static char route_cache_file[128] = "none";
+static int route_cache_interval = 300;
+static int route_cache_batch = 16;
 
 static int acmp_initialized = 0;
 
@@ -792,42 +846,47 @@ static void acmp_init_path_query(struct ib_sa_mad *mad)
 	mad->attr_id = IB_SA_ATTR_PATH_REC;
 }
 
-/* Caller must hold dest lock */
-static uint8_t acmp_resolve_path_sa(struct acmp_ep *ep, struct acmp_dest *dest,
-				    void (*handler)(struct acm_sa_mad *))
+static uint8_t acmp_send_path_sa(struct acmp_ep *ep, struct acmp_dest *dest,
+				 struct ibv_path_record *path,
+				 void (*handler)(struct acm_sa_mad *))
 {
 	struct ib_sa_mad *mad;
-	uint8_t ret;
 	struct acm_sa_mad *sa_mad;
 
-	acm_log(2, "%s\n", dest->name);
-
 	sa_mad = acm_alloc_sa_mad(ep->endpoint, dest, handler);
 	if (!sa_mad) {
 		acm_log(0, "Error - failed to allocate sa_mad\n");
-		ret = ACM_STATUS_ENOMEM;
-		goto err;
+		return ACM_STATUS_ENOMEM;
 	}
 
 	mad = (struct ib_sa_mad *) &sa_mad->sa_mad;
 	acmp_init_path_query(mad);
 
-	memcpy(mad->data, &dest->path, sizeof(dest->path));
-	mad->comp_mask = acm_path_comp_mask(&dest->path);
+	memcpy(mad->data, path, sizeof(*path));
+	mad->comp_mask = acm_path_comp_mask(path);
 
 	acm_increment_counter(ACM_CNTR_ROUTE_QUERY);
 	atomic_inc(&ep->counters[ACM_CNTR_ROUTE_QUERY]);
-	dest->state = ACMP_QUERY_ROUTE;
 	if (acm_send_sa_mad(sa_mad)) {
 		acm_log(0, "Error - Failed to send sa mad\n");
-		ret = ACM_STATUS_ENODATA;
-		goto free_mad;
+		acm_free_sa_mad(sa_mad);
+		return ACM_STATUS_ENODATA;
 	}
 	return ACM_STATUS_SUCCESS;
-free_mad:
-	acm_free_sa_mad(sa_mad);
-err:
-	dest->state = ACMP_INIT;
+}
+
+/* Caller must hold dest lock */
+static uint8_t acmp_resolve_path_sa(struct acmp_ep *ep, struct acmp_dest *dest,
+				    void (*handler)(struct acm_sa_mad *))
+{
+	uint8_t ret;
+
+	acm_log(2, "%s\n", dest->name);
+
+	dest->state = ACMP_QUERY_ROUTE;
+	ret = acmp_send_path_sa(ep, dest, &dest->path, handler);
+	if (ret)
+		dest->state = ACMP_INIT;
 	return ret;
 }
 
@@ -1747,10 +1806,12 @@ static int acmp_dest_timeout(struct acmp_dest *dest)
 	if (timestamp > dest->addr_timeout) {
 		acm_log(2, "%s address timed out\n", dest->name);
 		dest->state = ACMP_INIT;
+		dest->restored = 0;
 		return 1;
 	} else if (timestamp > dest->route_timeout) {
 		acm_log(2, "%s route timed out\n", dest->name);
 		dest->state = ACMP_ADDR_RESOLVED;
+		dest->restored = 0;
 		return 1;
 	}
 	return 0;
@@ -1853,6 +1914,8 @@ test:
 		acm_log(2, "request satisfied from local cache\n");
 		acm_increment_counter(ACM_CNTR_ROUTE_CACHE);
 		atomic_inc(&ep->counters[ACM_CNTR_ROUTE_CACHE]);
+		if (dest->restored)
+			atomic_inc(&cache_restored_hits);
 		status = ACM_STATUS_SUCCESS;
 		break;
 	case ACMP_ADDR_RESOLVED:
@@ -1929,6 +1992,8 @@ test:
 		acm_log(2, "request satisfied from local cache\n");
 		acm_increment_counter(ACM_CNTR_ROUTE_CACHE);
 		atomic_inc(&ep->counters[ACM_CNTR_ROUTE_CACHE]);
+		if (dest->restored)
+			atomic_inc(&cache_restored_hits);
 		status = ACM_STATUS_SUCCESS;
 		break;
 	case ACMP_INIT:
@@ -2358,6 +2423,439 @@ static void acmp_parse_hosts_file(struct acmp_ep *ep)
 	fclose(f);
 }
 
+static uint64_t acmp_cache_ttl(uint64_t expires, uint64_t now)
+{
+	if (expires == ACMP_CACHE_NEVER)
+		return ACMP_CACHE_NEVER;
+	return expires > now ? expires - now : 0;
+}
+
+static void acmp_cache_open(void)
+{
+	const struct acmp_cache_hdr *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(route_cache_file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		acm_log(1, "no route cache %s\n", route_cache_file);
+		return;
+	}
+
+	if (fstat(fd, &st) || st.st_size < (off_t) sizeof(*hdr))
+		goto bad;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		acm_log(0, "ERROR - unable to map %s\n", route_cache_file);
+		goto out;
+	}
+
+	hdr = map;
+	if (memcmp(hdr->magic, ACMP_CACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != ACMP_CACHE_VERSION ||
+	    hdr->rec_size != sizeof(struct acmp_cache_rec) ||
+	    (st.st_size - sizeof(*hdr)) / hdr->rec_size < hdr->count) {
+		munmap(map, st.st_size);
+		goto bad;
+	}
+
+	cache_map = hdr;
+	cache_map_size = st.st_size;
+	acm_log(0, "route cache %s: %u entries, generation %u, "
+		"%" PRIu64 " of %" PRIu64 " lookups hit so far\n",
+		route_cache_file, hdr->count, hdr->generation,
+		hdr->hits, hdr->lookups);
+	goto out;
+bad:
+	acm_log(0, "ERROR - ignoring invalid route cache %s\n",
+		route_cache_file);
+out:
+	close(fd);
+}
+
+/*
+ * Reload the routes saved for this endpoint.  They are served right away
+ * and queued to be checked against the SA by the cache thread.
+ */
+static void acmp_cache_restore(struct acmp_ep *ep)
+{
+	const struct acmp_cache_rec *rec;
+	struct acmp_dest *dest;
+	uint64_t elapsed, now;
+	uint32_t i, cnt = 0;
+
+	if (!cache_map)
+		return;
+
+	now = time(NULL);
+	elapsed = now > cache_map->saved ? (now - cache_map->saved) / 60 : 0;
+	rec = (const struct acmp_cache_rec *) (cache_map + 1);
+	for (i = 0; i < cache_map->count; i++, rec++) {
+		if (rec->dev_guid != ep->port->dev->guid ||
+		    rec->port_num != ep->port->port_num ||
+		    rec->pkey != ep->pkey ||
+		    !rec->addr_type || rec->addr_type >= ACM_ADDRESS_RESERVED)
+			continue;
+		if (rec->addr_ttl <= elapsed || rec->route_ttl <= elapsed)
+			continue;
+		/* The subnet manager gave us a new LID, the path is stale */
+		if (rec->path.slid && rec->path.slid != htobe16(ep->port->lid))
+			continue;
+
+		dest = acmp_acquire_dest(ep, rec->addr_type, rec->address);
+		if (!dest) {
+			acm_log(0, "ERROR - unable to create dest\n");
+			break;
+		}
+
+		pthread_mutex_lock(&dest->lock);
+		if (dest->state != ACMP_INIT) {
+			pthread_mutex_unlock(&dest->lock);
+			acmp_put_dest(dest);
+			continue;
+		}
+		dest->path = rec->path;
+		dest->mgid = rec->mgid;
+		dest->remote_qpn = rec->remote_qpn;
+		acmp_init_path_av(ep->port, dest);
+		dest->addr_timeout = rec->addr_ttl == ACMP_CACHE_NEVER ?
+			ACMP_CACHE_NEVER :
+			time_stamp_min() + rec->addr_ttl - elapsed;
+		dest->route_timeout = rec->route_ttl == ACMP_CACHE_NEVER ?
+			ACMP_CACHE_NEVER :
+			time_stamp_min() + rec->route_ttl - elapsed;
+		dest->restored = 1;
+		dest->state = ACMP_READY;
+		pthread_mutex_unlock(&dest->lock);
+		acm_log(2, "restored cached dest %s\n", dest->name);
+
+		/* The reference is dropped once the dest is revalidated */
+		pthread_mutex_lock(&ep->lock);
+		list_add_tail(&ep->reval_list, &dest->reval_entry);
+		pthread_mutex_unlock(&ep->lock);
+		cnt++;
+	}
+
+	if (cnt) {
+		atomic_add(&cache_restored, cnt);
+		acm_log(1, "%s: restored %u cached routes\n", ep->id_string, cnt);
+		event_signal(&cache_event);
+	}
+}
+
+static void acmp_revalidate_sa_resp(struct acm_sa_mad *mad)
+{
+	struct acmp_dest *dest = (struct acmp_dest *) mad->context;
+	struct ib_sa_mad *sa_mad = (struct ib_sa_mad *) &mad->sa_mad;
+	struct acmp_ep *ep = dest->ep;
+
+	pthread_mutex_lock(&dest->lock);
+	if (dest->state == ACMP_READY && dest->restored) {
+		if (mad->umad.status) {
+			/* No answer, keep using the saved route until it expires */
+			acm_log(1, "notice - %s not revalidated\n", dest->name);
+		} else if (sa_mad->status) {
+			acm_log(1, "%s is no longer valid, status 0x%x\n",
+				dest->name, be16toh(sa_mad->status));
+			dest->state = ACMP_INIT;
+			atomic_inc(&cache_invalidated);
+		} else {
+			memcpy(&dest->path, sa_mad->data, sizeof(dest->path));
+			acmp_init_path_av(ep->port, dest);
+			dest->route_timeout = time_stamp_min() +
+					      (unsigned) route_timeout;
+			atomic_inc(&cache_revalidated);
+		}
+		dest->restored = 0;
+	}
+	pthread_mutex_unlock(&dest->lock);
+
+	pthread_mutex_lock(&ep->lock);
+	ep->reval_pending--;
+	pthread_mutex_unlock(&ep->lock);
+	event_signal(&cache_event);
+
+	acmp_put_dest(dest);
+	acm_free_sa_mad(mad);
+}
+
+/*
+ * Keep up to route_cache_batch path queries outstanding per endpoint, so a
+ * restart does not flood the SA while the cached routes are rechecked.
+ * Returns true while routes of the endpoint are still waiting.
+ */
+static bool acmp_ep_revalidate(struct acmp_ep *ep)
+{
+	struct ibv_path_record path;
+	struct acmp_dest *dest;
+	uint8_t status;
+	bool waiting;
+
+	pthread_mutex_lock(&ep->lock);
+	while (ep->state == ACMP_READY &&
+	       ep->reval_pending < route_cache_batch &&
+	       (dest = list_pop(&ep->reval_list, struct acmp_dest,
+				reval_entry))) {
+		ep->reval_pending++;
+		pthread_mutex_unlock(&ep->lock);
+
+		pthread_mutex_lock(&dest->lock);
+		if (dest->state == ACMP_READY && dest->restored) {
+			memset(&path, 0, sizeof(path));
+			path.sgid = dest->path.sgid;
+			path.dgid = dest->path.dgid;
+			path.slid = dest->path.slid;
+			path.dlid = dest->path.dlid;
+			path.pkey = dest->path.pkey;
+			path.reversible_numpath = IBV_PATH_RECORD_REVERSIBLE;
+			status = acmp_send_path_sa(ep, dest, &path,
+						   acmp_revalidate_sa_resp);
+		} else {
+			status = ACM_STATUS_EINVAL;
+		}
+		pthread_mutex_unlock(&dest->lock);
+
+		pthread_mutex_lock(&ep->lock);
+		if (status) {
+			ep->reval_pending--;
+			pthread_mutex_unlock(&ep->lock);
+			acmp_put_dest(dest);
+			pthread_mutex_lock(&ep->lock);
+		}
+	}
+	waiting = !list_empty(&ep->reval_list);
+	pthread_mutex_unlock(&ep->lock);
+	return waiting;
+}
+
+static struct {
+	struct acmp_dest **dest;
+	size_t cnt;
+	size_t size;
+} cache_walk;
+
+/* twalk() callback, the ep lock is held */
+static void acmp_cache_collect(const void *node, VISIT which, int depth)
+{
+	struct acmp_dest *dest = *(struct acmp_dest **) node;
+	struct acmp_dest **tmp;
+
+	if (which != postorder && which != leaf)
+		return;
+
+	if (cache_walk.cnt == cache_walk.size) {
+		tmp = realloc(cache_walk.dest, (cache_walk.size + 256) *
+			      sizeof(*cache_walk.dest));
+		if (!tmp)
+			return;
+		cache_walk.dest = tmp;
+		cache_walk.size += 256;
+	}
+	(void) atomic_inc(&dest->refcnt);
+	cache_walk.dest[cache_walk.cnt++] = dest;
+}
+
+static int acmp_cache_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void acmp_cache_add_ep(struct acmp_ep *ep, int fd,
+			      struct acmp_cache_hdr *hdr)
+{
+	struct acmp_cache_rec rec;
+	struct acmp_dest *dest;
+	uint64_t now = time_stamp_min();
+	size_t i;
+	int type;
+
+	cache_walk.cnt = 0;
+	pthread_mutex_lock(&ep->lock);
+	for (type = 0; type < ACM_ADDRESS_RESERVED - 1; type++)
+		twalk(ep->dest_map[type], acmp_cache_collect);
+	pthread_mutex_unlock(&ep->lock);
+
+	for (i = 0; i < cache_walk.cnt; i++) {
+		dest = cache_walk.dest[i];
+
+		pthread_mutex_lock(&dest->lock);
+		/* Loopback routes are rebuilt when the address is added */
+		if (dest->state != ACMP_READY ||
+		    dest->addr_timeout == ACMP_CACHE_NEVER ||
+		    dest->addr_timeout <= now || dest->route_timeout <= now) {
+			pthread_mutex_unlock(&dest->lock);
+			acmp_put_dest(dest);
+			continue;
+		}
+
+		memset(&rec, 0, sizeof(rec));
+		rec.dev_guid = ep->port->dev->guid;
+		rec.pkey = ep->pkey;
+		rec.port_num = ep->port->port_num;
+		rec.addr_type = dest->addr_type;
+		rec.remote_qpn = dest->remote_qpn;
+		rec.addr_ttl = acmp_cache_ttl(dest->addr_timeout, now);
+		rec.route_ttl = acmp_cache_ttl(dest->route_timeout, now);
+		memcpy(rec.address, dest->address, sizeof(rec.address));
+		rec.mgid = dest->mgid;
+		rec.path = dest->path;
+		pthread_mutex_unlock(&dest->lock);
+		acmp_put_dest(dest);
+
+		if (fd >= 0 && !acmp_cache_write(fd, &rec, sizeof(rec)))
+			hdr->count++;
+	}
+
+	hdr->lookups += atomic_get(&ep->counters[ACM_CNTR_RESOLVE]);
+	hdr->hits += atomic_get(&ep->counters[ACM_CNTR_ROUTE_CACHE]);
+}
+
+/*
+ * Only called from the cache thread, or at exit once that has stopped.
+ * The file is replaced atomically, so a mapping of the previous one stays
+ * valid.
+ */
+static void acmp_cache_save(void)
+{
+	struct acmp_cache_hdr hdr;
+	struct acmp_device *dev;
+	struct acmp_port *port;
+	struct acmp_ep *ep;
+	char tmp_file[sizeof(route_cache_file) + 4];
+	uint64_t lookups, hits;
+	int fd, i;
+
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", route_cache_file);
+	fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		acm_log(0, "ERROR - unable to create %s\n", tmp_file);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, ACMP_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = ACMP_CACHE_VERSION;
+	hdr.rec_size = sizeof(struct acmp_cache_rec);
+	hdr.generation = cache_map ? cache_map->generation + 1 : 1;
+	if (fd >= 0 && lseek(fd, sizeof(hdr), SEEK_SET) < 0) {
+		close(fd);
+		fd = -1;
+	}
+
+	pthread_mutex_lock(&acmp_dev_lock);
+	list_for_each(&acmp_dev_list, dev, entry) {
+		pthread_mutex_unlock(&acmp_dev_lock);
+
+		for (i = 0; i < dev->port_cnt; i++) {
+			port = &dev->port[i];
+
+			pthread_mutex_lock(&port->lock);
+			list_for_each(&port->ep_list, ep, entry) {
+				pthread_mutex_unlock(&port->lock);
+				acmp_cache_add_ep(ep, fd, &hdr);
+				pthread_mutex_lock(&port->lock);
+			}
+			pthread_mutex_unlock(&port->lock);
+		}
+		pthread_mutex_lock(&acmp_dev_lock);
+	}
+	pthread_mutex_unlock(&acmp_dev_lock);
+
+	lookups = hdr.lookups;
+	hits = hdr.hits;
+	acm_log(0, "route cache: %" PRIu64 " of %" PRIu64 " lookups hit, "
+		"%d routes restored, %d hits on restored routes, "
+		"%d revalidated, %d invalidated\n", hits, lookups,
+		atomic_get(&cache_restored), atomic_get(&cache_restored_hits),
+		atomic_get(&cache_revalidated), atomic_get(&cache_invalidated));
+
+	if (fd < 0)
+		return;
+
+	/* Totals carry over restarts */
+	hdr.saved = time(NULL);
+	if (cache_map) {
+		hdr.lookups += cache_map->lookups;
+		hdr.hits += cache_map->hits;
+	}
+	if (lseek(fd, 0, SEEK_SET) < 0 ||
+	    acmp_cache_write(fd, &hdr, sizeof(hdr)) || fsync(fd)) {
+		acm_log(0, "ERROR - unable to write %s\n", tmp_file);
+		close(fd);
+		unlink(tmp_file);
+		return;
+	}
+	close(fd);
+
+	if (rename(tmp_file, route_cache_file)) {
+		acm_log(0, "ERROR - unable to rename %s\n", tmp_file);
+		unlink(tmp_file);
+		return;
+	}
+	acm_log(1, "saved %u routes, generation %u, %" PRIu64 " of %" PRIu64
+		" lookups hit since the first start\n", hdr.count,
+		hdr.generation, hdr.hits, hdr.lookups);
+}
+
+static void *acmp_cache_handler(void *context)
+{
+	struct acmp_device *dev;
+	struct acmp_port *port;
+	struct acmp_ep *ep;
+	uint64_t next_save, now;
+	bool waiting;
+	int i;
+
+	acm_log(0, "started\n");
+	next_save = time_stamp_sec() + route_cache_interval;
+
+	while (!cache_thread_stop) {
+		waiting = false;
+		pthread_mutex_lock(&acmp_dev_lock);
+		list_for_each(&acmp_dev_list, dev, entry) {
+			pthread_mutex_unlock(&acmp_dev_lock);
+
+			for (i = 0; i < dev->port_cnt; i++) {
+				port = &dev->port[i];
+
+				pthread_mutex_lock(&port->lock);
+				list_for_each(&port->ep_list, ep, entry) {
+					pthread_mutex_unlock(&port->lock);
+					waiting |= acmp_ep_revalidate(ep);
+					pthread_mutex_lock(&port->lock);
+				}
+				pthread_mutex_unlock(&port->lock);
+			}
+			pthread_mutex_lock(&acmp_dev_lock);
+		}
+		pthread_mutex_unlock(&acmp_dev_lock);
+
+		now = time_stamp_sec();
+		if (now >= next_save) {
+			acmp_cache_save();
+			next_save = now + route_cache_interval;
+		}
+		/* Poll while endpoints that have restored routes come up */
+		event_wait(&cache_event, waiting ? 1000 :
+			   (int) (next_save - now) * 1000);
+	}
+
+	return NULL;
+}
+
 /*
  * We currently require that the routing data be preloaded in order to
  * load the address data.  This is backwards from normal operation, which
@@ -2381,6 +2879,8 @@ static void acmp_ep_preload(struct acmp_ep *ep)
 	default:
 		break;
 	}
+
+	acmp_cache_restore(ep);
 }
 
 /* rwlock must be held write-locked */
@@ -2594,6 +3094,7 @@ acmp_alloc_ep(struct acmp_port *port, struct acm_endpoint *endpoint)
 	list_head_init(&ep->resp_queue.pending);
 	list_head_init(&ep->active_queue);
 	list_head_init(&ep->wait_queue);
+	list_head_init(&ep->reval_list);
 	pthread_mutex_init(&ep->lock, NULL);
 	sprintf(ep->id_string, "%s-%d-0x%x", port->dev->verbs->device->name,
 		port->port_num, endpoint->pkey);
@@ -2987,6 +3488,12 @@ static void acmp_set_options(void)
 			addr_preload = acmp_convert_addr_preload(value);
 		else if (!strcasecmp("addr_data_file", opt))
 			strcpy(addr_data_file, value);
+		else if (!strcasecmp("route_cache_file", opt))
+			strcpy(route_cache_file, value);
+		else if (!strcasecmp("route_cache_interval", opt))
+			route_cache_interval = atoi(value);
+		else if (!strcasecmp("route_cache_batch", opt))
+			route_cache_batch = atoi(value);
 	}
 
 	fclose(f);
@@ -3010,6 +3517,9 @@ static void acmp_log_options(void)
 	acm_log(0, "route data file %s\n", route_data_file);
 	acm_log(0, "address preload %d\n", addr_preload);
 	acm_log(0, "address data file %s\n", addr_data_file);
+	acm_log(0, "route cache file %s\n", route_cache_file);
+	acm_log(0, "route cache interval %d s\n", route_cache_interval);
+	acm_log(0, "route cache batch %d\n", route_cache_batch);
 }
 
 static void __attribute__((constructor)) acmp_init(void)
@@ -3032,9 +3542,57 @@ static void __attribute__((constructor)) acmp_init(void)
 		return;
 	}
 
+	atomic_init(&cache_restored);
+	atomic_init(&cache_restored_hits);
+	atomic_init(&cache_revalidated);
+	atomic_init(&cache_invalidated);
+	if (strcasecmp(route_cache_file, "none")) {
+		if (route_cache_interval <= 0)
+			route_cache_interval = 300;
+		if (route_cache_batch <= 0)
+			route_cache_batch = 1;
+		event_init(&cache_event);
+		acmp_cache_open();
+
+		acm_log(1, "starting route cache thread\n");
+		if (pthread_create(&cache_thread_id, NULL, acmp_cache_handler,
+				   NULL))
+			acm_log(0, "Error: failed to create the route cache thread");
+		else
+			cache_thread_started = 1;
+	}
+
 	acmp_initialized = 1;
 }
 
+/*
+ * Called when ibacm unloads the provider on shutdown.  Save the route
+ * cache, then stop the threads before the module goes away.
+ */
+static void __attribute__((destructor)) acmp_fini(void)
+{
+	struct acmp_device *dev;
+
+	if (cache_thread_started) {
+		cache_thread_stop = 1;
+		event_signal(&cache_event);
+		pthread_join(cache_thread_id, NULL);
+		acmp_cache_save();
+	}
+
+	list_for_each(&acmp_dev_list, dev, entry) {
+		pthread_cancel(dev->comp_thread_id);
+		pthread_join(dev->comp_thread_id, NULL);
+	}
+	if (retry_thread_started) {
+		pthread_cancel(retry_thread_id);
+		pthread_join(retry_thread_id, NULL);
+	}
+
+	if (cache_map)
+		munmap((void *) cache_map, cache_map_size);
+}
+
 int provider_query(struct acm_provider **provider, uint32_t *version)
 {
 	acm_log(1, "\n");
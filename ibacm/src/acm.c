@@ -59,6 +59,7 @@
 #include <rdma/rdma_netlink.h>
 #include <rdma/ib_user_sa.h>
 #include <poll.h>
+#include <signal.h>
 #include <inttypes.h>
 #include <getopt.h>
 #include <systemd/sd-daemon.h>
@@ -184,6 +185,8 @@ static LIST_HEAD(dev_list);
 
 static int listen_socket;
 static int ip_mon_socket;
+static volatile sig_atomic_t acm_stopping;
+static sigset_t server_sigmask;
 static struct acmc_client client_array[FD_SETSIZE - 1];
 
 static FILE *flog;
@@ -1933,7 +1936,10 @@ static void acm_server(bool systemd)
 			n = max(n, (int) dev->device.verbs->async_fd);
 		}
 
-		ret = select(n + 1, &readfds, NULL, NULL, NULL);
+		/* SIGTERM and SIGINT are only unblocked while waiting here */
+		ret = pselect(n + 1, &readfds, NULL, NULL, NULL, &server_sigmask);
+		if (acm_stopping)
+			break;
 		if (ret == -1) {
 			acm_log(0, "ERROR - server select error\n");
 			continue;
@@ -3288,6 +3294,32 @@ static int acm_open_lock_file(void)
 	return 0;
 }
 
+static void acm_stop_handler(int signo)
+{
+	acm_stopping = 1;
+}
+
+/*
+ * Block SIGTERM and SIGINT in every thread, including those started by the
+ * providers, and let the server loop take them so that the providers are
+ * closed cleanly on shutdown.
+ */
+static void acm_init_signals(void)
+{
+	struct sigaction act = { .sa_handler = acm_stop_handler };
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, &server_sigmask);
+	sigdelset(&server_sigmask, SIGTERM);
+	sigdelset(&server_sigmask, SIGINT);
+
+	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGINT, &act, NULL);
+}
+
 static void show_usage(char *program)
 {
 	printf("usage: %s\n", program);
@@ -3339,6 +3371,7 @@ int main(int argc, char **argv)
 	}
 
 	acm_set_options();
+	acm_init_signals();
 
 	/* usage of systemd implies unix-domain communication */
 	if (systemd)
@@ -3392,8 +3425,8 @@ int main(int argc, char **argv)
 	acm_log(0, "shutting down\n");
 	if (client_array[NL_CLIENT_INDEX].sock != -1)
 		close(client_array[NL_CLIENT_INDEX].sock);
-	acm_close_providers();
 	acm_stop_sa_handler();
+	acm_close_providers();
 	umad_done();
 	acm_fini_if_iter_sys();
 	fclose(flog);
@@ -318,6 +318,25 @@ static void gen_opts_temp(FILE *f)
 	fprintf(f, "# Default is %s/ibacm_route.data\n", ACM_CONF_DIR);
 	fprintf(f, "# route_data_file %s/ibacm_route.data\n", ACM_CONF_DIR);
 	fprintf(f, "\n");
+	fprintf(f, "# route_cache_file:\n");
+	fprintf(f, "# Specifies a file where the resolved routes are saved periodically and\n");
+	fprintf(f, "# when ibacm stops.  They are reloaded on start, used right away and\n");
+	fprintf(f, "# checked against the SA in the background.  The default is none, which\n");
+	fprintf(f, "# disables the route cache file.\n");
+	fprintf(f, "\n");
+	fprintf(f, "route_cache_file none\n");
+	fprintf(f, "\n");
+	fprintf(f, "# route_cache_interval:\n");
+	fprintf(f, "# Number of seconds between two saves of the route cache file.\n");
+	fprintf(f, "\n");
+	fprintf(f, "route_cache_interval 300\n");
+	fprintf(f, "\n");
+	fprintf(f, "# route_cache_batch:\n");
+	fprintf(f, "# Maximum number of SA path record queries outstanding per endpoint\n");
+	fprintf(f, "# while the routes reloaded from route_cache_file are checked.\n");
+	fprintf(f, "\n");
+	fprintf(f, "route_cache_batch 16\n");
+	fprintf(f, "\n");
 	fprintf(f, "# addr_preload:\n");
 	fprintf(f, "# Specifies if the ACM address cache should be preloaded, or built on demand.\n");
 	fprintf(f, "# If preloaded, indicates the method used to build the cache.\n");
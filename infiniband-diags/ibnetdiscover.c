@@ -988,6 +988,41 @@ static int diff(ibnd_fabric_t *orig_fabric, ibnd_fabric_t *new_fabric)
 
 static int list, group, ports_report;
 
+static int add_local_port(struct ibnd_config *cfg, char *arg)
+{
+	ibnd_local_port_t *ports;
+	char *p;
+
+	ports = realloc(cfg->local_ports,
+			(cfg->num_local_ports + 1) * sizeof(*ports));
+	if (!ports)
+		IBEXIT("out of memory, realloc for local ports failed");
+	cfg->local_ports = ports;
+
+	ports[cfg->num_local_ports].ca_port = 0;
+	p = strchr(arg, ':');
+	if (p) {
+		*p++ = '\0';
+		ports[cfg->num_local_ports].ca_port = strtoul(p, NULL, 0);
+	}
+	ports[cfg->num_local_ports].ca_name = strdup(arg);
+	if (!ports[cfg->num_local_ports].ca_name)
+		IBEXIT("out of memory, strdup for local port failed");
+	cfg->num_local_ports++;
+	return 0;
+}
+
+static void free_local_ports(struct ibnd_config *cfg)
+{
+	unsigned i;
+
+	for (i = 0; i < cfg->num_local_ports; i++)
+		free(cfg->local_ports[i].ca_name);
+	free(cfg->local_ports);
+	cfg->local_ports = NULL;
+	cfg->num_local_ports = 0;
+}
+
 static int process_opt(void *context, int ch)
 {
 	struct ibnd_config *cfg = context;
@@ -1032,6 +1067,8 @@ static int process_opt(void *context, int ch)
 			p = strtok(NULL, ",");
 		}
 		break;
+	case 6:
+		return add_local_port(cfg, optarg);
 	case 's':
 		cfg->show_progress = 1;
 		break;
@@ -1092,6 +1129,8 @@ int main(int argc, char **argv)
 		 "filename of ibnetdiscover cache to diff"},
 		{"diffcheck", 5, 1, "<key(s)>",
 		 "specify checks to execute for --diff"},
+		{"local-port", 6, 1, "<ca>[:<port>]",
+		 "additional local port to discover through in parallel"},
 		{"ports", 'p', 0, NULL, "obtain a ports report"},
 		{"max_hops", 'm', 0, NULL,
 		 "report max hops discovered by the library"},
@@ -1152,5 +1191,6 @@ int main(int argc, char **argv)
 	if (diff_fabric)
 		ibnd_destroy_fabric(diff_fabric);
 	close_node_name_map(node_name_map);
+	free_local_ports(&config);
 	exit(0);
 }
@@ -33,6 +33,8 @@
  *
  */
 
+#include <endian.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -1003,7 +1005,7 @@ static const ib_field_t ib_mad_f[] = {
 	/*
 	 * Another PortCounters field
 	 */
-	{160, 16, "QP1Dropped", mad_dump_uint},
+	{BITSOFFS(160, 16), "QP1Dropped", mad_dump_uint},
 
 	/*
 	 * More PortInfoExtended fields (HDR)
@@ -1022,6 +1024,61 @@ static const ib_field_t ib_mad_f[] = {
 	{}			/* IB_FIELD_LAST_ */
 };
 
+/*
+ * Precomputed field descriptors.  Every field of up to 32 bits that does
+ * not straddle a 32 bit word is a shift and mask of a big endian word, and
+ * every word aligned 64 bit field is a pair of words, which is what the
+ * byte swizzling in _get_field()/_set_field() computes the slow way.
+ */
+enum {
+	FD_SLOW,		/* use the generic code */
+	FD_WORD,		/* (be32(word) >> shift) & mask */
+	FD_QWORD,		/* be64(word, word + 1) */
+};
+
+struct field_desc {
+	uint16_t word;
+	uint8_t shift;
+	uint8_t kind;
+	uint32_t mask;
+};
+
+static struct field_desc ib_mad_fd[IB_FIELD_LAST_];
+
+static void build_field_descs(void)
+{
+	const ib_field_t *f;
+	int i;
+
+	for (i = 1; i < IB_FIELD_LAST_; i++) {
+		f = ib_mad_f + i;
+		ib_mad_fd[i].word = f->bitoffs / 32;
+		ib_mad_fd[i].shift = f->bitoffs & 31;
+		if (!f->bitlen)
+			continue;
+		if (f->bitlen <= 32 && (f->bitoffs & 31) + f->bitlen <= 32) {
+			ib_mad_fd[i].kind = FD_WORD;
+			ib_mad_fd[i].mask = f->bitlen == 32 ?
+				0xffffffff : (1u << f->bitlen) - 1;
+		} else if (f->bitlen == 64 && !(f->bitoffs & 31))
+			ib_mad_fd[i].kind = FD_QWORD;
+	}
+}
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return be32toh(v);
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v)
+{
+	v = htobe32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
 static void _set_field64(void *buf, int base_offs, const ib_field_t * f,
 			 uint64_t val)
 {
@@ -1123,15 +1180,43 @@ static void _get_array(void *buf, int base_offs, const ib_field_t * f,
 	memcpy(val, (uint8_t *) buf + base_offs + bitoffs / 8, f->bitlen / 8);
 }
 
+/* The swizzled byte order of _get_field() only matches a word load when
+ * base_offs is word aligned, which it is for every caller in the tree.
+ */
+static inline int fast_field(enum MAD_FIELDS field, int base_offs)
+{
+	return ib_mad_fd[field].kind == FD_WORD && !(base_offs & 3);
+}
+
+static inline uint32_t fast_get_field(const void *buf, int base_offs,
+				      const struct field_desc *fd)
+{
+	return (load_be32((const uint8_t *)buf + base_offs + fd->word * 4) >>
+		fd->shift) & fd->mask;
+}
+
 uint32_t mad_get_field(void *buf, int base_offs, enum MAD_FIELDS field)
 {
+	if (fast_field(field, base_offs))
+		return fast_get_field(buf, base_offs, ib_mad_fd + field);
 	return _get_field(buf, base_offs, ib_mad_f + field);
 }
 
 void mad_set_field(void *buf, int base_offs, enum MAD_FIELDS field,
 		   uint32_t val)
 {
-	_set_field(buf, base_offs, ib_mad_f + field, val);
+	const struct field_desc *fd = ib_mad_fd + field;
+	uint8_t *p;
+	uint32_t w;
+
+	if (!fast_field(field, base_offs)) {
+		_set_field(buf, base_offs, ib_mad_f + field, val);
+		return;
+	}
+
+	p = (uint8_t *)buf + base_offs + fd->word * 4;
+	w = load_be32(p) & ~(fd->mask << fd->shift);
+	store_be32(p, w | (val & fd->mask) << fd->shift);
 }
 
 uint64_t mad_get_field64(void *buf, int base_offs, enum MAD_FIELDS field)
@@ -1163,6 +1248,10 @@ void mad_decode_field(uint8_t * buf, enum MAD_FIELDS field, void *val)
 		*(int *)val = *(int *)buf;
 		return;
 	}
+	if (ib_mad_fd[field].kind == FD_WORD) {
+		*(uint32_t *) val = fast_get_field(buf, 0, ib_mad_fd + field);
+		return;
+	}
 	if (f->bitlen <= 32) {
 		*(uint32_t *) val = _get_field(buf, 0, f);
 		return;
@@ -1174,6 +1263,224 @@ void mad_decode_field(uint8_t * buf, enum MAD_FIELDS field, void *val)
 	_get_array(buf, 0, f, val);
 }
 
+/*
+ * Bulk decode.  The attribute is byte swapped once into host order words
+ * and every member is then a shift and mask of one of them.
+ */
+#define BULK_MAX_WORDS	(IB_SMP_DATA_SIZE * 2 / 4)
+
+struct bulk_field {
+	struct field_desc fd;	/* copied from ib_mad_fd at load time */
+	enum MAD_FIELDS field;
+	uint16_t offs;
+	uint8_t size;
+};
+
+#define BULK(f, type, m) \
+	{ .field = f, .offs = offsetof(type, m), \
+	  .size = sizeof(((type *)0)->m) }
+
+static void decode_bulk(const uint8_t *buf, unsigned attr_size,
+			const struct bulk_field *map, unsigned n, void *out)
+{
+	uint32_t w[BULK_MAX_WORDS];
+	const struct field_desc *fd;
+	unsigned nwords = attr_size / 4, i;
+	uint64_t v;
+
+	for (i = 0; i < nwords; i++)
+		w[i] = load_be32(buf + i * 4);
+
+	for (i = 0; i < n; i++) {
+		fd = &map[i].fd;
+		switch (fd->kind) {
+		case FD_WORD:
+			v = (w[fd->word] >> fd->shift) & fd->mask;
+			break;
+		case FD_QWORD:
+			v = (uint64_t)w[fd->word] << 32 | w[fd->word + 1];
+			break;
+		default:
+			v = _get_field((void *)buf, 0, ib_mad_f + map[i].field);
+			break;
+		}
+
+		switch (map[i].size) {
+		case 1:
+			*((uint8_t *)out + map[i].offs) = v;
+			break;
+		case 2:
+			*(uint16_t *)((uint8_t *)out + map[i].offs) = v;
+			break;
+		case 4:
+			*(uint32_t *)((uint8_t *)out + map[i].offs) = v;
+			break;
+		default:
+			*(uint64_t *)((uint8_t *)out + map[i].offs) = v;
+			break;
+		}
+	}
+}
+
+static struct bulk_field node_info_map[] = {
+	BULK(IB_NODE_BASE_VERS_F, ibmad_node_info_t, base_version),
+	BULK(IB_NODE_CLASS_VERS_F, ibmad_node_info_t, class_version),
+	BULK(IB_NODE_TYPE_F, ibmad_node_info_t, node_type),
+	BULK(IB_NODE_NPORTS_F, ibmad_node_info_t, num_ports),
+	BULK(IB_NODE_SYSTEM_GUID_F, ibmad_node_info_t, system_guid),
+	BULK(IB_NODE_GUID_F, ibmad_node_info_t, node_guid),
+	BULK(IB_NODE_PORT_GUID_F, ibmad_node_info_t, port_guid),
+	BULK(IB_NODE_PARTITION_CAP_F, ibmad_node_info_t, partition_cap),
+	BULK(IB_NODE_DEVID_F, ibmad_node_info_t, device_id),
+	BULK(IB_NODE_REVISION_F, ibmad_node_info_t, revision),
+	BULK(IB_NODE_LOCAL_PORT_F, ibmad_node_info_t, local_port),
+	BULK(IB_NODE_VENDORID_F, ibmad_node_info_t, vendor_id),
+};
+
+static struct bulk_field port_info_map[] = {
+	BULK(IB_PORT_MKEY_F, ibmad_port_info_t, mkey),
+	BULK(IB_PORT_GID_PREFIX_F, ibmad_port_info_t, gid_prefix),
+	BULK(IB_PORT_LID_F, ibmad_port_info_t, lid),
+	BULK(IB_PORT_SMLID_F, ibmad_port_info_t, sm_lid),
+	BULK(IB_PORT_CAPMASK_F, ibmad_port_info_t, capmask),
+	BULK(IB_PORT_DIAG_F, ibmad_port_info_t, diag_code),
+	BULK(IB_PORT_MKEY_LEASE_F, ibmad_port_info_t, mkey_lease_period),
+	BULK(IB_PORT_LOCAL_PORT_F, ibmad_port_info_t, local_port),
+	BULK(IB_PORT_LINK_WIDTH_ENABLED_F, ibmad_port_info_t, link_width_enabled),
+	BULK(IB_PORT_LINK_WIDTH_SUPPORTED_F, ibmad_port_info_t,
+	     link_width_supported),
+	BULK(IB_PORT_LINK_WIDTH_ACTIVE_F, ibmad_port_info_t, link_width_active),
+	BULK(IB_PORT_LINK_SPEED_SUPPORTED_F, ibmad_port_info_t,
+	     link_speed_supported),
+	BULK(IB_PORT_STATE_F, ibmad_port_info_t, state),
+	BULK(IB_PORT_PHYS_STATE_F, ibmad_port_info_t, phys_state),
+	BULK(IB_PORT_LINK_DOWN_DEF_F, ibmad_port_info_t, link_down_def_state),
+	BULK(IB_PORT_MKEY_PROT_BITS_F, ibmad_port_info_t, mkey_prot_bits),
+	BULK(IB_PORT_LMC_F, ibmad_port_info_t, lmc),
+	BULK(IB_PORT_LINK_SPEED_ACTIVE_F, ibmad_port_info_t, link_speed_active),
+	BULK(IB_PORT_LINK_SPEED_ENABLED_F, ibmad_port_info_t, link_speed_enabled),
+	BULK(IB_PORT_NEIGHBOR_MTU_F, ibmad_port_info_t, neighbor_mtu),
+	BULK(IB_PORT_SMSL_F, ibmad_port_info_t, sm_sl),
+	BULK(IB_PORT_VL_CAP_F, ibmad_port_info_t, vl_cap),
+	BULK(IB_PORT_INIT_TYPE_F, ibmad_port_info_t, init_type),
+	BULK(IB_PORT_VL_HIGH_LIMIT_F, ibmad_port_info_t, vl_high_limit),
+	BULK(IB_PORT_VL_ARBITRATION_HIGH_CAP_F, ibmad_port_info_t,
+	     vl_arb_high_cap),
+	BULK(IB_PORT_VL_ARBITRATION_LOW_CAP_F, ibmad_port_info_t, vl_arb_low_cap),
+	BULK(IB_PORT_INIT_TYPE_REPLY_F, ibmad_port_info_t, init_type_reply),
+	BULK(IB_PORT_MTU_CAP_F, ibmad_port_info_t, mtu_cap),
+	BULK(IB_PORT_VL_STALL_COUNT_F, ibmad_port_info_t, vl_stall_count),
+	BULK(IB_PORT_HOQ_LIFE_F, ibmad_port_info_t, hoq_life),
+	BULK(IB_PORT_OPER_VLS_F, ibmad_port_info_t, oper_vls),
+	BULK(IB_PORT_PART_EN_INB_F, ibmad_port_info_t, part_enforce_inb),
+	BULK(IB_PORT_PART_EN_OUTB_F, ibmad_port_info_t, part_enforce_outb),
+	BULK(IB_PORT_FILTER_RAW_INB_F, ibmad_port_info_t, filter_raw_inb),
+	BULK(IB_PORT_FILTER_RAW_OUTB_F, ibmad_port_info_t, filter_raw_outb),
+	BULK(IB_PORT_MKEY_VIOL_F, ibmad_port_info_t, mkey_violations),
+	BULK(IB_PORT_PKEY_VIOL_F, ibmad_port_info_t, pkey_violations),
+	BULK(IB_PORT_QKEY_VIOL_F, ibmad_port_info_t, qkey_violations),
+	BULK(IB_PORT_GUID_CAP_F, ibmad_port_info_t, guid_cap),
+	BULK(IB_PORT_CLIENT_REREG_F, ibmad_port_info_t, client_reregister),
+	BULK(IB_PORT_MCAST_PKEY_SUPR_ENAB_F, ibmad_port_info_t,
+	     mcast_pkey_trap_suppr),
+	BULK(IB_PORT_SUBN_TIMEOUT_F, ibmad_port_info_t, subnet_timeout),
+	BULK(IB_PORT_RESP_TIME_VAL_F, ibmad_port_info_t, resp_time_value),
+	BULK(IB_PORT_LOCAL_PHYS_ERR_F, ibmad_port_info_t, local_phys_errors),
+	BULK(IB_PORT_OVERRUN_ERR_F, ibmad_port_info_t, overrun_errors),
+	BULK(IB_PORT_MAX_CREDIT_HINT_F, ibmad_port_info_t, max_credit_hint),
+	BULK(IB_PORT_LINK_ROUND_TRIP_F, ibmad_port_info_t, link_round_trip),
+};
+
+static struct bulk_field port_counters_map[] = {
+	BULK(IB_PC_PORT_SELECT_F, ibmad_port_counters_t, port_select),
+	BULK(IB_PC_COUNTER_SELECT_F, ibmad_port_counters_t, counter_select),
+	BULK(IB_PC_ERR_SYM_F, ibmad_port_counters_t, symbol_errors),
+	BULK(IB_PC_LINK_RECOVERS_F, ibmad_port_counters_t, link_error_recovery),
+	BULK(IB_PC_LINK_DOWNED_F, ibmad_port_counters_t, link_downed),
+	BULK(IB_PC_ERR_RCV_F, ibmad_port_counters_t, rcv_errors),
+	BULK(IB_PC_ERR_PHYSRCV_F, ibmad_port_counters_t, rcv_remote_phys_errors),
+	BULK(IB_PC_ERR_SWITCH_REL_F, ibmad_port_counters_t,
+	     rcv_switch_relay_errors),
+	BULK(IB_PC_XMT_DISCARDS_F, ibmad_port_counters_t, xmit_discards),
+	BULK(IB_PC_ERR_XMTCONSTR_F, ibmad_port_counters_t,
+	     xmit_constraint_errors),
+	BULK(IB_PC_ERR_RCVCONSTR_F, ibmad_port_counters_t, rcv_constraint_errors),
+	BULK(IB_PC_COUNTER_SELECT2_F, ibmad_port_counters_t, counter_select2),
+	BULK(IB_PC_ERR_LOCALINTEG_F, ibmad_port_counters_t,
+	     local_link_integrity_errors),
+	BULK(IB_PC_ERR_EXCESS_OVR_F, ibmad_port_counters_t,
+	     excessive_buffer_overrun_errors),
+	BULK(IB_PC_QP1_DROP_F, ibmad_port_counters_t, qp1_dropped),
+	BULK(IB_PC_VL15_DROPPED_F, ibmad_port_counters_t, vl15_dropped),
+	BULK(IB_PC_XMT_BYTES_F, ibmad_port_counters_t, xmit_data),
+	BULK(IB_PC_RCV_BYTES_F, ibmad_port_counters_t, rcv_data),
+	BULK(IB_PC_XMT_PKTS_F, ibmad_port_counters_t, xmit_pkts),
+	BULK(IB_PC_RCV_PKTS_F, ibmad_port_counters_t, rcv_pkts),
+	BULK(IB_PC_XMT_WAIT_F, ibmad_port_counters_t, xmit_wait),
+};
+
+static struct bulk_field port_counters_ext_map[] = {
+	BULK(IB_PC_EXT_PORT_SELECT_F, ibmad_port_counters_ext_t, port_select),
+	BULK(IB_PC_EXT_COUNTER_SELECT_F, ibmad_port_counters_ext_t,
+	     counter_select),
+	BULK(IB_PC_EXT_XMT_BYTES_F, ibmad_port_counters_ext_t, xmit_data),
+	BULK(IB_PC_EXT_RCV_BYTES_F, ibmad_port_counters_ext_t, rcv_data),
+	BULK(IB_PC_EXT_XMT_PKTS_F, ibmad_port_counters_ext_t, xmit_pkts),
+	BULK(IB_PC_EXT_RCV_PKTS_F, ibmad_port_counters_ext_t, rcv_pkts),
+	BULK(IB_PC_EXT_XMT_UPKTS_F, ibmad_port_counters_ext_t, unicast_xmit_pkts),
+	BULK(IB_PC_EXT_RCV_UPKTS_F, ibmad_port_counters_ext_t, unicast_rcv_pkts),
+	BULK(IB_PC_EXT_XMT_MPKTS_F, ibmad_port_counters_ext_t,
+	     multicast_xmit_pkts),
+	BULK(IB_PC_EXT_RCV_MPKTS_F, ibmad_port_counters_ext_t,
+	     multicast_rcv_pkts),
+};
+
+static void compile_bulk_map(struct bulk_field *map, unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i < n; i++)
+		map[i].fd = ib_mad_fd[map[i].field];
+}
+
+/* runs after build_field_descs() */
+static __attribute__((constructor(200))) void compile_bulk_maps(void)
+{
+	build_field_descs();
+	compile_bulk_map(node_info_map, sizeof(node_info_map) /
+					sizeof(node_info_map[0]));
+	compile_bulk_map(port_info_map, sizeof(port_info_map) /
+					sizeof(port_info_map[0]));
+	compile_bulk_map(port_counters_map, sizeof(port_counters_map) /
+					    sizeof(port_counters_map[0]));
+	compile_bulk_map(port_counters_ext_map,
+			 sizeof(port_counters_ext_map) /
+			 sizeof(port_counters_ext_map[0]));
+}
+
+#define BULK_DECODE(buf, size, map, out) \
+	decode_bulk(buf, size, map, sizeof(map) / sizeof(map[0]), out)
+
+void mad_decode_node_info(void *buf, ibmad_node_info_t *ni)
+{
+	BULK_DECODE(buf, 40, node_info_map, ni);
+}
+
+void mad_decode_port_info(void *buf, ibmad_port_info_t *pi)
+{
+	BULK_DECODE(buf, IB_SMP_DATA_SIZE, port_info_map, pi);
+}
+
+void mad_decode_port_counters(void *buf, ibmad_port_counters_t *pc)
+{
+	BULK_DECODE(buf, 44, port_counters_map, pc);
+}
+
+void mad_decode_port_counters_ext(void *buf, ibmad_port_counters_ext_t *pc)
+{
+	BULK_DECODE(buf, 72, port_counters_ext_map, pc);
+}
+
 void mad_encode_field(uint8_t * buf, enum MAD_FIELDS field, void *val)
 {
 	const ib_field_t *f = ib_mad_f + field;
@@ -1463,6 +1463,118 @@ char *mad_dump_field(enum MAD_FIELDS field, char *buf, int bufsz, void *val);
 char *mad_dump_val(enum MAD_FIELDS field, char *buf, int bufsz, void *val);
 const char *mad_field_name(enum MAD_FIELDS field);
 
+/*
+ * Bulk attribute decode: extract every field of an attribute in one pass
+ * over its words.  buf points to the attribute data, as for
+ * mad_decode_field().
+ */
+typedef struct ibmad_node_info {
+	uint8_t base_version;
+	uint8_t class_version;
+	uint8_t node_type;
+	uint8_t num_ports;
+	uint64_t system_guid;
+	uint64_t node_guid;
+	uint64_t port_guid;
+	uint16_t partition_cap;
+	uint16_t device_id;
+	uint32_t revision;
+	uint8_t local_port;
+	uint32_t vendor_id;
+} ibmad_node_info_t;
+
+typedef struct ibmad_port_info {
+	uint64_t mkey;
+	uint64_t gid_prefix;
+	uint16_t lid;
+	uint16_t sm_lid;
+	uint32_t capmask;
+	uint16_t diag_code;
+	uint16_t mkey_lease_period;
+	uint8_t local_port;
+	uint8_t link_width_enabled;
+	uint8_t link_width_supported;
+	uint8_t link_width_active;
+	uint8_t link_speed_supported;
+	uint8_t state;
+	uint8_t phys_state;
+	uint8_t link_down_def_state;
+	uint8_t mkey_prot_bits;
+	uint8_t lmc;
+	uint8_t link_speed_active;
+	uint8_t link_speed_enabled;
+	uint8_t neighbor_mtu;
+	uint8_t sm_sl;
+	uint8_t vl_cap;
+	uint8_t init_type;
+	uint8_t vl_high_limit;
+	uint8_t vl_arb_high_cap;
+	uint8_t vl_arb_low_cap;
+	uint8_t init_type_reply;
+	uint8_t mtu_cap;
+	uint8_t vl_stall_count;
+	uint8_t hoq_life;
+	uint8_t oper_vls;
+	uint8_t part_enforce_inb;
+	uint8_t part_enforce_outb;
+	uint8_t filter_raw_inb;
+	uint8_t filter_raw_outb;
+	uint16_t mkey_violations;
+	uint16_t pkey_violations;
+	uint16_t qkey_violations;
+	uint8_t guid_cap;
+	uint8_t client_reregister;
+	uint8_t mcast_pkey_trap_suppr;
+	uint8_t subnet_timeout;
+	uint8_t resp_time_value;
+	uint8_t local_phys_errors;
+	uint8_t overrun_errors;
+	uint16_t max_credit_hint;
+	uint32_t link_round_trip;
+} ibmad_port_info_t;
+
+typedef struct ibmad_port_counters {
+	uint8_t port_select;
+	uint16_t counter_select;
+	uint16_t symbol_errors;
+	uint8_t link_error_recovery;
+	uint8_t link_downed;
+	uint16_t rcv_errors;
+	uint16_t rcv_remote_phys_errors;
+	uint16_t rcv_switch_relay_errors;
+	uint16_t xmit_discards;
+	uint8_t xmit_constraint_errors;
+	uint8_t rcv_constraint_errors;
+	uint8_t counter_select2;
+	uint8_t local_link_integrity_errors;
+	uint8_t excessive_buffer_overrun_errors;
+	uint16_t qp1_dropped;
+	uint16_t vl15_dropped;
+	uint32_t xmit_data;
+	uint32_t rcv_data;
+	uint32_t xmit_pkts;
+	uint32_t rcv_pkts;
+	uint32_t xmit_wait;
+} ibmad_port_counters_t;
+
+typedef struct ibmad_port_counters_ext {
+	uint8_t port_select;
+	uint16_t counter_select;
+	uint64_t xmit_data;
+	uint64_t rcv_data;
+	uint64_t xmit_pkts;
+	uint64_t rcv_pkts;
+	uint64_t unicast_xmit_pkts;
+	uint64_t unicast_rcv_pkts;
+	uint64_t multicast_xmit_pkts;
+	uint64_t multicast_rcv_pkts;
+} ibmad_port_counters_ext_t;
+
+void mad_decode_node_info(void *buf, ibmad_node_info_t *ni);
+void mad_decode_port_info(void *buf, ibmad_port_info_t *pi);
+void mad_decode_port_counters(void *buf, ibmad_port_counters_t *pc);
+void mad_decode_port_counters_ext(void *buf, ibmad_port_counters_ext_t *pc);
+
 /* mad.c */
 void *mad_encode(void *buf, ib_rpc_t *rpc, ib_dr_path_t *drpath, void *data);
 uint64_t mad_trid(void);
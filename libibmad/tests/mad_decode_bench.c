@@ -0,0 +1,284 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Decode throughput of libibmad: field by field mad_decode_field(), as
+ * perfquery and ibqueryerrors do it, against the bulk decoders.  Both are
+ * first checked against attributes laid out by hand from the IBA spec, so
+ * that a wrong field descriptor is caught as well as a wrong bulk map.
+ */
+#include <config.h>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <infiniband/mad.h>
+
+#define NUM_BUFS 1024
+
+static uint8_t bufs[NUM_BUFS][IB_SMP_DATA_SIZE * 2];
+static volatile uint64_t sink;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t field_val(uint8_t *buf, enum MAD_FIELDS f)
+{
+	uint64_t v64 = 0;
+	uint32_t v32 = 0;
+
+	if (f >= IB_PC_EXT_XMT_BYTES_F && f < IB_PC_EXT_LAST_F) {
+		mad_decode_field(buf, f, &v64);
+		return v64;
+	}
+	if (f == IB_NODE_SYSTEM_GUID_F || f == IB_NODE_GUID_F ||
+	    f == IB_NODE_PORT_GUID_F || f == IB_PORT_MKEY_F ||
+	    f == IB_PORT_GID_PREFIX_F) {
+		mad_decode_field(buf, f, &v64);
+		return v64;
+	}
+	mad_decode_field(buf, f, &v32);
+	return v32;
+}
+
+/* Attribute layouts of IBA 14.2.5.3, 14.2.5.6, 16.1.3.5 and 16.1.4.11 */
+static uint8_t node_info_buf[IB_SMP_DATA_SIZE * 2] = {
+	[0] = 0x01, [1] = 0x01, [2] = 0x02, [3] = 0x24,
+	[4] = 0x00, 0x02, 0xc9, 0x03, 0x00, 0xa1, 0xb2, 0xc3,
+	[12] = 0x00, 0x02, 0xc9, 0x03, 0x00, 0xa1, 0xb2, 0xc4,
+	[20] = 0x00, 0x02, 0xc9, 0x03, 0x00, 0xa1, 0xb2, 0xc5,
+	[28] = 0x00, 0x80, 0xcb, 0x20,
+	[32] = 0x00, 0x00, 0x00, 0xa0,
+	[36] = 0x07, 0x00, 0x02, 0xc9,
+};
+
+static uint8_t port_info_buf[IB_SMP_DATA_SIZE * 2] = {
+	[0] = 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+	[8] = 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0xa1,
+	[16] = 0x12, 0x34, 0x00, 0x01,
+	[20] = 0x02, 0x51, 0x08, 0x4a,
+	[31] = 0x02,
+	[32] = 0x34, 0x52, 0x03, 0x21, 0x50,
+	[42] = 0x33, 0x4f,
+	[51] = 0x4a, 0x12,
+	[57] = 0x0a, 0xbc, 0xde,
+};
+
+static uint8_t port_counters_buf[IB_SMP_DATA_SIZE * 2] = {
+	[1] = 0x05, 0xf0, 0x0f,
+	[4] = 0x12, 0x34, 0x21, 0x42,
+	[8] = 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+	[16] = 0x11, 0x22, 0x33, 0xa5,
+	[20] = 0x09, 0x0a, 0x0b, 0x0c,
+	[24] = 0x10, 0x20, 0x30, 0x40,
+	[28] = 0x50, 0x60, 0x70, 0x80,
+	[32] = 0x0a, 0x0b, 0x0c, 0x0d,
+	[36] = 0x01, 0x02, 0x03, 0x04,
+	[40] = 0xde, 0xad, 0xbe, 0xef,
+};
+
+static uint8_t port_counters_ext_buf[IB_SMP_DATA_SIZE * 2] = {
+	[1] = 0x06, 0x0f, 0xf0,
+	[8] = 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+	[16] = 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+	[24] = 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	[32] = 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,
+	[40] = 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	[48] = 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	[56] = 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	[64] = 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+};
+
+/* Checks the field and the bulk decoded member against the spec value */
+#define CHECK(buf, f, member, val)                                             \
+	do {                                                                   \
+		if (field_val(buf, f) != (uint64_t)(val)) {                    \
+			fprintf(stderr, "mad_decode_field: wrong %s\n",        \
+				mad_field_name(f));                            \
+			return -1;                                             \
+		}                                                              \
+		if ((uint64_t)(member) != (uint64_t)(val)) {                   \
+			fprintf(stderr, "bulk decode: wrong %s\n",             \
+				mad_field_name(f));                            \
+			return -1;                                             \
+		}                                                              \
+	} while (0)
+
+static int verify(void)
+{
+	uint8_t *buf;
+	ibmad_port_counters_ext_t pce;
+	ibmad_port_counters_t pc;
+	ibmad_node_info_t ni;
+	ibmad_port_info_t pi;
+
+	buf = port_counters_buf;
+	mad_decode_port_counters(buf, &pc);
+	CHECK(buf, IB_PC_PORT_SELECT_F, pc.port_select, 0x05);
+	CHECK(buf, IB_PC_COUNTER_SELECT_F, pc.counter_select, 0xf00f);
+	CHECK(buf, IB_PC_ERR_SYM_F, pc.symbol_errors, 0x1234);
+	CHECK(buf, IB_PC_LINK_RECOVERS_F, pc.link_error_recovery, 0x21);
+	CHECK(buf, IB_PC_LINK_DOWNED_F, pc.link_downed, 0x42);
+	CHECK(buf, IB_PC_ERR_RCV_F, pc.rcv_errors, 0x0102);
+	CHECK(buf, IB_PC_ERR_PHYSRCV_F, pc.rcv_remote_phys_errors, 0x0304);
+	CHECK(buf, IB_PC_ERR_SWITCH_REL_F, pc.rcv_switch_relay_errors,
+	      0x0506);
+	CHECK(buf, IB_PC_XMT_DISCARDS_F, pc.xmit_discards, 0x0708);
+	CHECK(buf, IB_PC_ERR_XMTCONSTR_F, pc.xmit_constraint_errors, 0x11);
+	CHECK(buf, IB_PC_ERR_RCVCONSTR_F, pc.rcv_constraint_errors, 0x22);
+	CHECK(buf, IB_PC_COUNTER_SELECT2_F, pc.counter_select2, 0x33);
+	CHECK(buf, IB_PC_ERR_LOCALINTEG_F, pc.local_link_integrity_errors,
+	      0xa);
+	CHECK(buf, IB_PC_ERR_EXCESS_OVR_F, pc.excessive_buffer_overrun_errors,
+	      0x5);
+	CHECK(buf, IB_PC_QP1_DROP_F, pc.qp1_dropped, 0x090a);
+	CHECK(buf, IB_PC_VL15_DROPPED_F, pc.vl15_dropped, 0x0b0c);
+	CHECK(buf, IB_PC_XMT_BYTES_F, pc.xmit_data, 0x10203040);
+	CHECK(buf, IB_PC_RCV_BYTES_F, pc.rcv_data, 0x50607080);
+	CHECK(buf, IB_PC_XMT_PKTS_F, pc.xmit_pkts, 0x0a0b0c0d);
+	CHECK(buf, IB_PC_RCV_PKTS_F, pc.rcv_pkts, 0x01020304);
+	CHECK(buf, IB_PC_XMT_WAIT_F, pc.xmit_wait, 0xdeadbeef);
+
+	buf = port_counters_ext_buf;
+	mad_decode_port_counters_ext(buf, &pce);
+	CHECK(buf, IB_PC_EXT_PORT_SELECT_F, pce.port_select, 0x06);
+	CHECK(buf, IB_PC_EXT_COUNTER_SELECT_F, pce.counter_select, 0x0ff0);
+	CHECK(buf, IB_PC_EXT_XMT_BYTES_F, pce.xmit_data,
+	      0x0102030405060708ULL);
+	CHECK(buf, IB_PC_EXT_RCV_BYTES_F, pce.rcv_data,
+	      0x1112131415161718ULL);
+	CHECK(buf, IB_PC_EXT_XMT_PKTS_F, pce.xmit_pkts,
+	      0x2122232425262728ULL);
+	CHECK(buf, IB_PC_EXT_RCV_PKTS_F, pce.rcv_pkts,
+	      0x3132333435363738ULL);
+	CHECK(buf, IB_PC_EXT_XMT_UPKTS_F, pce.unicast_xmit_pkts,
+	      0x4142434445464748ULL);
+	CHECK(buf, IB_PC_EXT_RCV_UPKTS_F, pce.unicast_rcv_pkts,
+	      0x5152535455565758ULL);
+	CHECK(buf, IB_PC_EXT_XMT_MPKTS_F, pce.multicast_xmit_pkts,
+	      0x6162636465666768ULL);
+	CHECK(buf, IB_PC_EXT_RCV_MPKTS_F, pce.multicast_rcv_pkts,
+	      0x7172737475767778ULL);
+
+	buf = node_info_buf;
+	mad_decode_node_info(buf, &ni);
+	CHECK(buf, IB_NODE_BASE_VERS_F, ni.base_version, 0x01);
+	CHECK(buf, IB_NODE_TYPE_F, ni.node_type, IB_NODE_SWITCH);
+	CHECK(buf, IB_NODE_NPORTS_F, ni.num_ports, 36);
+	CHECK(buf, IB_NODE_SYSTEM_GUID_F, ni.system_guid,
+	      0x0002c90300a1b2c3ULL);
+	CHECK(buf, IB_NODE_GUID_F, ni.node_guid, 0x0002c90300a1b2c4ULL);
+	CHECK(buf, IB_NODE_PORT_GUID_F, ni.port_guid, 0x0002c90300a1b2c5ULL);
+	CHECK(buf, IB_NODE_DEVID_F, ni.device_id, 0xcb20);
+	CHECK(buf, IB_NODE_REVISION_F, ni.revision, 0xa0);
+	CHECK(buf, IB_NODE_LOCAL_PORT_F, ni.local_port, 7);
+	CHECK(buf, IB_NODE_VENDORID_F, ni.vendor_id, 0x0002c9);
+
+	buf = port_info_buf;
+	mad_decode_port_info(buf, &pi);
+	CHECK(buf, IB_PORT_MKEY_F, pi.mkey, 0x0102030405060708ULL);
+	CHECK(buf, IB_PORT_GID_PREFIX_F, pi.gid_prefix, 0xfe800000000000a1ULL);
+	CHECK(buf, IB_PORT_LID_F, pi.lid, 0x1234);
+	CHECK(buf, IB_PORT_CAPMASK_F, pi.capmask, 0x0251084a);
+	CHECK(buf, IB_PORT_LINK_WIDTH_ACTIVE_F, pi.link_width_active, 0x02);
+	CHECK(buf, IB_PORT_STATE_F, pi.state, 4);		/* Active */
+	CHECK(buf, IB_PORT_PHYS_STATE_F, pi.phys_state, 5);	/* LinkUp */
+	CHECK(buf, IB_PORT_LMC_F, pi.lmc, 3);
+	CHECK(buf, IB_PORT_LINK_SPEED_ACTIVE_F, pi.link_speed_active, 2);
+	CHECK(buf, IB_PORT_NEIGHBOR_MTU_F, pi.neighbor_mtu, 5);
+	CHECK(buf, IB_PORT_HOQ_LIFE_F, pi.hoq_life, 19);
+	CHECK(buf, IB_PORT_OPER_VLS_F, pi.oper_vls, 4);
+	CHECK(buf, IB_PORT_MCAST_PKEY_SUPR_ENAB_F, pi.mcast_pkey_trap_suppr,
+	      2);
+	CHECK(buf, IB_PORT_RESP_TIME_VAL_F, pi.resp_time_value, 18);
+	CHECK(buf, IB_PORT_LINK_ROUND_TRIP_F, pi.link_round_trip, 0x0abcde);
+	return 0;
+}
+
+static void bench_fields(unsigned iters)
+{
+	enum MAD_FIELDS f;
+	unsigned i;
+	uint64_t sum = 0;
+
+	for (i = 0; i < iters; i++) {
+		uint8_t *buf = bufs[i % NUM_BUFS];
+
+		for (f = IB_PC_FIRST_F; f < IB_PC_LAST_F; f++)
+			sum += field_val(buf, f);
+		for (f = IB_PC_EXT_FIRST_F; f < IB_PC_EXT_LAST_F; f++)
+			sum += field_val(buf, f);
+	}
+	sink = sum;
+}
+
+static void bench_bulk(unsigned iters)
+{
+	ibmad_port_counters_ext_t pce;
+	ibmad_port_counters_t pc;
+	unsigned i;
+	uint64_t sum = 0;
+
+	for (i = 0; i < iters; i++) {
+		uint8_t *buf = bufs[i % NUM_BUFS];
+
+		mad_decode_port_counters(buf, &pc);
+		mad_decode_port_counters_ext(buf, &pce);
+		sum += pc.symbol_errors + pc.xmit_wait + pce.xmit_data +
+		       pce.multicast_rcv_pkts;
+	}
+	sink = sum;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-n iterations]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned iters = 1000000;
+	double t, t_fields, t_bulk;
+	unsigned i, j;
+	int op;
+
+	while ((op = getopt(argc, argv, "n:h")) != -1) {
+		switch (op) {
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return op == 'h' ? 0 : 1;
+		}
+	}
+
+	srand(1);
+	for (i = 0; i < NUM_BUFS; i++)
+		for (j = 0; j < sizeof(bufs[i]); j++)
+			bufs[i][j] = rand();
+
+	if (verify())
+		return 1;
+
+	t = now_sec();
+	bench_fields(iters);
+	t_fields = now_sec() - t;
+
+	t = now_sec();
+	bench_bulk(iters);
+	t_bulk = now_sec() - t;
+
+	printf("PortCounters + PortCountersExtended, %u iterations\n", iters);
+	printf("%-20s %10.1f ns/attr pair %10.2f M/s\n", "mad_decode_field",
+	       t_fields * 1e9 / iters, iters / t_fields / 1e6);
+	printf("%-20s %10.1f ns/attr pair %10.2f M/s\n", "bulk decode",
+	       t_bulk * 1e9 / iters, iters / t_bulk / 1e6);
+	return 0;
+}
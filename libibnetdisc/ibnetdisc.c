@@ -228,7 +228,7 @@ static int is_mlnx_ext_port_info_supported(ibnd_port_t * port)
 int mlnx_ext_port_info_err(smp_engine_t * engine, ibnd_smp_t * smp,
 			   uint8_t * mad, void *cb_data)
 {
-	f_internal_t *f_int = ((ibnd_scan_t *) engine->user_data)->f_int;
+	ibnd_scan_t *scan = engine->user_data;
 	ibnd_node_t *node = cb_data;
 	ibnd_port_t *port;
 	uint8_t port_num, local_port;
@@ -247,12 +247,12 @@ int mlnx_ext_port_info_err(smp_engine_t * engine, ibnd_smp_t * smp,
 	if (port_num && mad_get_field(port->info, 0, IB_PORT_PHYS_STATE_F)
 	    == IB_PORT_PHYS_STATE_LINKUP
 	    && ((node->type == IB_NODE_SWITCH && port_num != local_port) ||
-		(node == f_int->fabric.from_node && port_num == f_int->fabric.from_portnum))) {
+		(node == scan->start_node && port_num == scan->start_portnum))) {
 		int rc = 0;
 		ib_portid_t path = smp->path;
 
 		if (node->type != IB_NODE_SWITCH &&
-		    node == f_int->fabric.from_node &&
+		    node == scan->start_node &&
 		    path.drpath.cnt > 1)
 			rc = retract_dpath(engine, &path);
 		else {
@@ -275,7 +275,7 @@ int mlnx_ext_port_info_err(smp_engine_t * engine, ibnd_smp_t * smp,
 static int recv_mlnx_ext_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 				   uint8_t * mad, void *cb_data)
 {
-	f_internal_t *f_int = ((ibnd_scan_t *) engine->user_data)->f_int;
+	ibnd_scan_t *scan = engine->user_data;
 	ibnd_node_t *node = cb_data;
 	ibnd_port_t *port;
 	uint8_t *ext_port_info = mad + IB_SMP_DATA_OFFS;
@@ -296,12 +296,12 @@ static int recv_mlnx_ext_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 	if (port_num && mad_get_field(port->info, 0, IB_PORT_PHYS_STATE_F)
 	    == IB_PORT_PHYS_STATE_LINKUP
 	    && ((node->type == IB_NODE_SWITCH && port_num != local_port) ||
-		(node == f_int->fabric.from_node && port_num == f_int->fabric.from_portnum))) {
+		(node == scan->start_node && port_num == scan->start_portnum))) {
 		int rc = 0;
 		ib_portid_t path = smp->path;
 
 		if (node->type != IB_NODE_SWITCH &&
-		    node == f_int->fabric.from_node &&
+		    node == scan->start_node &&
 		    path.drpath.cnt > 1)
 			rc = retract_dpath(engine, &path);
 		else {
@@ -330,6 +330,18 @@ static int query_mlnx_ext_port_info(smp_engine_t * engine, ib_portid_t * portid,
 			 recv_mlnx_ext_port_info, node);
 }
 
+/* A CA port reached by more than one scan is already in the port hashes */
+static int port_in_fabric(ibnd_port_t * port, ibnd_port_t * hash[])
+{
+	ibnd_port_t *tblport;
+
+	for (tblport = hash[HASHGUID(port->guid) % HTSZ]; tblport;
+	     tblport = tblport->htnext)
+		if (tblport == port)
+			return 1;
+	return 0;
+}
+
 static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 			  uint8_t * mad, void *cb_data)
 {
@@ -374,13 +386,15 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 		port->lmc = node->smalmc;
 	}
 
-	int rc1 = add_to_portguid_hash(port, f_int->fabric.portstbl);
-	if (rc1)
-		IBND_ERROR("Error Occurred when trying"
-			   " to insert new port guid 0x%016" PRIx64 " to DB\n",
-			   port->guid);
+	if (!port_in_fabric(port, f_int->fabric.portstbl)) {
+		int rc1 = add_to_portguid_hash(port, f_int->fabric.portstbl);
+		if (rc1)
+			IBND_ERROR("Error Occurred when trying"
+				   " to insert new port guid 0x%016" PRIx64
+				   " to DB\n", port->guid);
 
-	add_to_portlid_hash(port, f_int);
+		add_to_portlid_hash(port, f_int);
+	}
 
 	if ((scan->cfg->flags & IBND_CONFIG_MLX_EPI)
 	    && is_mlnx_ext_port_info_supported(port)) {
@@ -410,13 +424,13 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 	if (port_num && mad_get_field(port->info, 0, IB_PORT_PHYS_STATE_F)
 	    == IB_PORT_PHYS_STATE_LINKUP
 	    && ((node->type == IB_NODE_SWITCH && port_num != local_port) ||
-		(node == f_int->fabric.from_node && port_num == f_int->fabric.from_portnum))) {
+		(node == scan->start_node && port_num == scan->start_portnum))) {
 
 		int rc = 0;
 		ib_portid_t path = smp->path;
 
 		if (node->type != IB_NODE_SWITCH &&
-		    node == f_int->fabric.from_node &&
+		    node == scan->start_node &&
 		    path.drpath.cnt > 1)
 			rc = retract_dpath(engine, &path);
 		else {
@@ -459,10 +473,28 @@ static int query_port_info(smp_engine_t * engine, ib_portid_t * portid,
 			 portnum ? recv_port_info : recv_port0_info, node);
 }
 
+static int track_scan_node(ibnd_scan_t * scan, ibnd_node_t * node)
+{
+	ibnd_node_t **nodes;
+	unsigned max_nodes;
+
+	if (scan->num_nodes == scan->max_nodes) {
+		max_nodes = scan->max_nodes ? scan->max_nodes * 2 : 64;
+		nodes = realloc(scan->nodes, max_nodes * sizeof(*nodes));
+		if (!nodes)
+			return -1;
+		scan->nodes = nodes;
+		scan->max_nodes = max_nodes;
+	}
+	scan->nodes[scan->num_nodes++] = node;
+	return 0;
+}
+
 static ibnd_node_t *create_node(smp_engine_t * engine, ib_portid_t * path,
 				uint8_t * node_info)
 {
-	f_internal_t *f_int = ((ibnd_scan_t *) engine->user_data)->f_int;
+	ibnd_scan_t *scan = engine->user_data;
+	f_internal_t *f_int = scan->f_int;
 	ibnd_node_t *rc = calloc(1, sizeof(*rc));
 	if (!rc) {
 		IBND_ERROR("OOM: node creation failed\n");
@@ -481,6 +513,13 @@ static ibnd_node_t *create_node(smp_engine_t * engine, ib_portid_t * path,
 		return NULL;
 	}
 
+	if (!scan->primary && track_scan_node(scan, rc)) {
+		free(rc->ports);
+		free(rc);
+		IBND_ERROR("OOM: node creation failed\n");
+		return NULL;
+	}
+
 	rc->path_portid = *path;
 	memcpy(rc->info, node_info, sizeof(rc->info));
 
@@ -575,8 +614,12 @@ static int recv_node_info(smp_engine_t * engine, ibnd_smp_t * smp,
 			     node, port);
 
 	if (rem_node == NULL) {	/* this is the start node */
-		f_int->fabric.from_node = node;
-		f_int->fabric.from_portnum = port_num;
+		scan->start_node = node;
+		scan->start_portnum = port_num;
+		if (scan->primary) {
+			f_int->fabric.from_node = node;
+			f_int->fabric.from_portnum = port_num;
+		}
 	} else {
 		/* link ports... */
 		if (!rem_node->ports[rem_port_num]) {
@@ -764,6 +807,66 @@ f_internal_t *allocate_fabric_internal(void)
 	return (f);
 }
 
+static int resolve_self(char *ca_name, int ca_port, ib_portid_t *selfportid,
+			struct ibnd_config *config)
+{
+	struct ibmad_port *ibmad_port;
+	int mc[2] = { IB_SMI_CLASS, IB_SMI_DIRECT_CLASS };
+	int rc;
+
+	ibmad_port = mad_rpc_open_port(ca_name, ca_port, mc, 2);
+	if (!ibmad_port) {
+		IBND_ERROR("can't open MAD port (%s:%d)\n", ca_name, ca_port);
+		return -1;
+	}
+	mad_rpc_set_timeout(ibmad_port, config->timeout_ms);
+	mad_rpc_set_retries(ibmad_port, config->retries);
+	smp_mkey_set(ibmad_port, config->mkey);
+
+	rc = ib_resolve_self_via(selfportid, NULL, NULL, ibmad_port);
+	if (rc < 0)
+		IBND_ERROR("Failed to resolve self (%s:%d)\n", ca_name,
+			   ca_port);
+	mad_rpc_close_port(ibmad_port);
+	return rc < 0 ? -1 : 0;
+}
+
+/* DR paths found through an additional local port are only meaningful from
+ * that port.  Switch to LID routing so callers can use path_portid from the
+ * port they opened, as they do for the rest of the fabric.
+ */
+static void relocate_scan_paths(ibnd_scan_t * scan)
+{
+	ibnd_node_t *node;
+	ibnd_port_t *port;
+	unsigned i;
+	int port_num;
+	uint16_t lid;
+
+	for (i = 0; i < scan->num_nodes; i++) {
+		node = scan->nodes[i];
+		if (node->type == IB_NODE_SWITCH) {
+			lid = node->smalid;
+		} else {
+			port_num = mad_get_field(node->info, 0,
+						 IB_NODE_LOCAL_PORT_F);
+			port = node->ports[port_num];
+			lid = port ? port->base_lid : 0;
+		}
+
+		if (!lid) {
+			IBND_ERROR("No LID for node 0x%016" PRIx64
+				   "; path %s is relative to local port %s\n",
+				   node->guid, portid2str(&node->path_portid),
+				   portid2str(&scan->selfportid));
+			continue;
+		}
+
+		memset(&node->path_portid, 0, sizeof(node->path_portid));
+		ib_portid_set(&node->path_portid, lid, 0, 0);
+	}
+}
+
 ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 				    ib_portid_t * from,
 				    struct ibnd_config *cfg)
@@ -771,11 +874,10 @@ ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 	struct ibnd_config config = { 0 };
 	f_internal_t *f_int = NULL;
 	ib_portid_t my_portid = { 0 };
-	smp_engine_t engine;
-	ibnd_scan_t scan;
-	struct ibmad_port *ibmad_port;
-	int nc = 2;
-	int mc[2] = { IB_SMI_CLASS, IB_SMI_DIRECT_CLASS };
+	ib_portid_t local_portid = { 0 };
+	smp_engine_t *engines = NULL;
+	ibnd_scan_t *scans = NULL;
+	unsigned num_scans = 1, num_engines = 0, i;
 
 	/* If not specified start from "my" port */
 	if (!from)
@@ -786,56 +888,87 @@ ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 		return NULL;
 	}
 
+	/* Additional local ports only make sense when scanning the whole
+	 * fabric; a partial scan is centered on "from" */
+	if (config.local_ports && !from->drpath.cnt && !from->lid &&
+	    !config.max_hops)
+		num_scans += config.num_local_ports;
+
 	f_int = allocate_fabric_internal();
 	if (!f_int) {
 		IBND_ERROR("OOM: failed to calloc ibnd_fabric_t\n");
 		return NULL;
 	}
 
-	memset(&scan.selfportid, 0, sizeof(scan.selfportid));
-	scan.f_int = f_int;
-	scan.cfg = &config;
-	scan.initial_hops = from->drpath.cnt;
-
-	ibmad_port = mad_rpc_open_port(ca_name, ca_port, mc, nc);
-	if (!ibmad_port) {
-		IBND_ERROR("can't open MAD port (%s:%d)\n", ca_name, ca_port);
-		goto error_int;
-	}
-	mad_rpc_set_timeout(ibmad_port, cfg->timeout_ms);
-	mad_rpc_set_retries(ibmad_port, cfg->retries);
-	smp_mkey_set(ibmad_port, cfg->mkey);
-
-	if (ib_resolve_self_via(&scan.selfportid,
-				NULL, NULL, ibmad_port) < 0) {
-		IBND_ERROR("Failed to resolve self\n");
-		mad_rpc_close_port(ibmad_port);
+	scans = calloc(num_scans, sizeof(*scans));
+	engines = calloc(num_scans, sizeof(*engines));
+	if (!scans || !engines) {
+		IBND_ERROR("OOM: failed to allocate scan state\n");
 		goto error_int;
 	}
-	mad_rpc_close_port(ibmad_port);
 
-	if (smp_engine_init(&engine, ca_name, ca_port, &scan, &config)) {
-		goto error_int;
+	for (i = 0; i < num_scans; i++) {
+		char *name = i ? config.local_ports[i - 1].ca_name : ca_name;
+		int port = i ? config.local_ports[i - 1].ca_port : ca_port;
+
+		scans[i].f_int = f_int;
+		scans[i].cfg = &config;
+		scans[i].primary = (i == 0);
+		scans[i].initial_hops = i ? 0 : from->drpath.cnt;
+
+		if (resolve_self(name, port, &scans[i].selfportid, &config))
+			goto error;
+
+		if (smp_engine_init(&engines[i], name, port, &scans[i],
+				    &config))
+			goto error;
+		num_engines++;
 	}
 
 	IBND_DEBUG("from %s\n", portid2str(from));
 
-	if (!query_node_info(&engine, from, NULL))
-		if (process_mads(&engine) != 0)
-			goto error;
+	if (query_node_info(&engines[0], from, NULL))
+		goto done;
 
-	f_int->fabric.total_mads_used = engine.total_smps;
-	f_int->fabric.maxhops_discovered += scan.initial_hops;
+	/* Each additional port starts from its own CA.  The frontier is
+	 * partitioned by whichever port reaches a node first; nodes already
+	 * in the GUID hash are linked but not expanded again.
+	 */
+	for (i = 1; i < num_engines; i++)
+		query_node_info(&engines[i], &local_portid, NULL);
+
+	if (process_mads_multi(engines, num_engines) != 0)
+		goto error;
+
+done:
+	for (i = 0; i < num_engines; i++) {
+		f_int->fabric.total_mads_used += engines[i].total_smps;
+		relocate_scan_paths(&scans[i]);
+	}
+	f_int->fabric.maxhops_discovered += scans[0].initial_hops;
 
 	if (group_nodes(&f_int->fabric))
 		goto error;
 
-	smp_engine_destroy(&engine);
+	for (i = 0; i < num_engines; i++) {
+		smp_engine_destroy(&engines[i]);
+		free(scans[i].nodes);
+	}
+	free(engines);
+	free(scans);
 	return (ibnd_fabric_t *)f_int;
 error:
-	smp_engine_destroy(&engine);
+	for (i = 0; i < num_engines; i++) {
+		smp_engine_destroy(&engines[i]);
+		free(scans[i].nodes);
+	}
+	free(engines);
+	free(scans);
 	ibnd_destroy_fabric(&f_int->fabric);
+	return NULL;
 error_int:
+	free(engines);
+	free(scans);
 	free(f_int);
 	return NULL;
 }
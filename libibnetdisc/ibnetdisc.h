@@ -56,7 +56,10 @@ typedef struct ibnd_node {
 
 	ib_portid_t path_portid;	/* path from "from_node" */
 					/* NOTE: this is not valid on a fabric
-					 * read from a cache file */
+					 * read from a cache file.  Nodes
+					 * reached through one of
+					 * config->local_ports are LID routed
+					 * when the LID is known */
 	uint16_t smalid;
 	uint8_t smalmc;
 
@@ -142,6 +145,12 @@ typedef struct ibnd_chassis {
 /* define config flags */
 #define IBND_CONFIG_MLX_EPI (1 << 0)
 
+/* additional local CA port used for parallel discovery */
+typedef struct ibnd_local_port {
+	char *ca_name;
+	int ca_port;
+} ibnd_local_port_t;
+
 typedef struct ibnd_config {
 	unsigned max_smps;
 	unsigned show_progress;
@@ -151,7 +160,10 @@ typedef struct ibnd_config {
 	unsigned retries;
 	uint32_t flags;
 	uint64_t mkey;
-	uint8_t pad[44];
+	/* (optional) more local ports to scan through in parallel */
+	ibnd_local_port_t *local_ports;
+	unsigned num_local_ports;
+	uint8_t pad[36];
 } ibnd_config_t;
 
 /** =========================================================================
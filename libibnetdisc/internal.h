@@ -71,6 +71,16 @@ typedef struct ibnd_scan {
 	f_internal_t *f_int;
 	struct ibnd_config *cfg;
 	unsigned initial_hops;
+	/* node/port this scan was started from */
+	ibnd_node_t *start_node;
+	int start_portnum;
+	/* nodes created by a scan through an additional local port; their
+	 * DR paths are relative to that port and get rewritten when the
+	 * discovery completes */
+	int primary;
+	ibnd_node_t **nodes;
+	unsigned num_nodes;
+	unsigned max_nodes;
 } ibnd_scan_t;
 
 typedef struct ibnd_smp ibnd_smp_t;
@@ -103,6 +113,7 @@ int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
 int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 	      unsigned attrid, unsigned mod, smp_comp_cb_t cb, void *cb_data);
 int process_mads(smp_engine_t * engine);
+int process_mads_multi(smp_engine_t * engines, unsigned num_engines);
 void smp_engine_destroy(smp_engine_t * engine);
 
 int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[]);
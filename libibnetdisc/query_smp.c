@@ -33,10 +33,13 @@
  */
 
 #include <errno.h>
+#include <poll.h>
 #include <infiniband/ibnetdisc.h>
 #include <infiniband/umad.h>
 #include "internal.h"
 
+#define RECV_BATCH 8
+
 static void queue_smp(smp_engine_t * engine, ibnd_smp_t * smp)
 {
 	smp->qnext = NULL;
@@ -150,24 +153,13 @@ int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 	return process_smp_queue(engine);
 }
 
-static int process_one_recv(smp_engine_t * engine)
+static int handle_one_recv(smp_engine_t * engine, uint8_t * umad)
 {
 	int rc = 0;
 	int status = 0;
 	ibnd_smp_t *smp;
 	uint8_t *mad;
 	uint32_t trid;
-	uint8_t umad[sizeof(struct ib_user_mad) + IB_MAD_SIZE];
-	int length = umad_size() + IB_MAD_SIZE;
-
-	memset(umad, 0, sizeof(umad));
-
-	/* wait for the next message */
-	if ((rc = umad_recv(engine->umad_fd, umad, &length,
-			    -1)) < 0) {
-		IBND_ERROR("umad_recv failed: %d\n", rc);
-		return -1;
-	}
 
 	mad = umad_get_mad(umad);
 	trid = (uint32_t) mad_get_field64(mad, 0, IB_MAD_TRID_F);
@@ -204,6 +196,33 @@ error:
 	return rc;
 }
 
+/* Receive whatever is queued on the port, up to RECV_BATCH MADs per call,
+ * and complete the matching SMPs.
+ */
+static int process_recv_batch(smp_engine_t * engine, int timeout_ms)
+{
+	uint8_t umads[RECV_BATCH][sizeof(struct ib_user_mad) + IB_MAD_SIZE];
+	struct umad_buf bufs[RECV_BATCH];
+	int i, n, rc = 0;
+
+	for (i = 0; i < RECV_BATCH; i++) {
+		memset(umads[i], 0, sizeof(umads[i]));
+		bufs[i].umad = umads[i];
+		bufs[i].length = IB_MAD_SIZE;
+	}
+
+	/* wait for the next messages */
+	if ((n = umad_recv_many(engine->umad_fd, bufs, RECV_BATCH,
+				timeout_ms)) < 0) {
+		IBND_ERROR("umad_recv_many failed: %d\n", n);
+		return -1;
+	}
+
+	for (i = 0; i < n && !rc; i++)
+		rc = handle_one_recv(engine, umads[i]);
+	return rc;
+}
+
 int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
 		    void *user_data, ibnd_config_t *cfg)
 {
@@ -273,7 +292,61 @@ int process_mads(smp_engine_t * engine)
 {
 	int rc;
 	while (!cl_is_qmap_empty(&engine->smps_on_wire))
-		if ((rc = process_one_recv(engine)) != 0)
+		if ((rc = process_recv_batch(engine, -1)) != 0)
 			return rc;
 	return 0;
 }
+
+/* Drive several engines, one per local port, from a single thread.  Each
+ * engine keeps up to cfg->max_smps SMPs on its own port so the total number
+ * of SMPs in flight scales with the number of local ports.
+ */
+int process_mads_multi(smp_engine_t * engines, unsigned num_engines)
+{
+	struct pollfd *fds;
+	unsigned *idx;
+	unsigned i, nfds;
+	int rc = 0;
+
+	if (num_engines == 1)
+		return process_mads(engines);
+
+	fds = calloc(num_engines, sizeof(*fds));
+	idx = calloc(num_engines, sizeof(*idx));
+	if (!fds || !idx) {
+		IBND_ERROR("OOM\n");
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	while (!rc) {
+		nfds = 0;
+		for (i = 0; i < num_engines; i++) {
+			if (cl_is_qmap_empty(&engines[i].smps_on_wire))
+				continue;
+			fds[nfds].fd = engines[i].umad_fd;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			idx[nfds++] = i;
+		}
+		if (!nfds)
+			break;
+
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			IBND_ERROR("poll failed: %s\n", strerror(errno));
+			rc = -errno;
+			break;
+		}
+
+		for (i = 0; i < nfds && !rc; i++)
+			if (fds[i].revents & POLLIN)
+				rc = process_recv_batch(&engines[idx[i]], 0);
+	}
+
+out:
+	free(idx);
+	free(fds);
+	return rc;
+}
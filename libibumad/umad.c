@@ -43,6 +43,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <dirent.h>
 #include <ctype.h>
 #include <inttypes.h>
@@ -54,6 +55,7 @@
 
 #include <valgrind/memcheck.h>
 #include "sysfs.h"
+#include "umad_sim.h"
 
 typedef struct ib_user_mad_reg_req {
 	uint32_t id;
@@ -86,6 +88,7 @@ struct ib_user_mad_reg_req2 {
 static int umaddebug = 0;
 
 #define UMAD_DEV_FILE_SZ	256
+#define UMAD_MAX_BATCH		64
 
 static const char *def_ca_name = "mthca0";
 static int def_ca_port = 1;
@@ -596,6 +599,9 @@ int umad_get_cas_names(char cas[][UMAD_CA_NAME_LEN], int max)
 
 	TRACE("max %d", max);
 
+	if (umad_sim_enabled())
+		return umad_sim_get_cas_names(cas, max);
+
 	n = scandir(SYS_INFINIBAND, &namelist, NULL, alphasort);
 	if (n > 0) {
 		for (i = 0; i < n; i++) {
@@ -619,6 +625,27 @@ int umad_get_cas_names(char cas[][UMAD_CA_NAME_LEN], int max)
 	return j;
 }
 
+static int sim_get_ca_portguids(const char *ca_name, __be64 *portguids,
+				int max)
+{
+	umad_ca_t ca;
+	int i, result;
+
+	if (umad_sim_get_ca(ca_name, &ca) < 0)
+		return -ENODEV;
+
+	result = ca.numports + 1;
+	if (portguids && result > max)
+		result = -ENOMEM;
+	else if (portguids)
+		for (i = 0; i <= ca.numports; i++)
+			portguids[i] = ca.ports[i] ?
+				ca.ports[i]->port_guid : htobe64(0);
+
+	release_ca(&ca);
+	return result;
+}
+
 int umad_get_ca_portguids(const char *ca_name, __be64 *portguids, int max)
 {
 	umad_ca_t ca;
@@ -626,6 +653,9 @@ int umad_get_ca_portguids(const char *ca_name, __be64 *portguids, int max)
 	char *found_ca_name;
 
 	TRACE("ca name %s max port guids %d", ca_name, max);
+	if (umad_sim_enabled())
+		return sim_get_ca_portguids(ca_name, portguids, max);
+
 	if (resolve_ca_name(ca_name, NULL, &found_ca_name) < 0) {
 		result = -ENODEV;
 		goto exit;
@@ -689,11 +719,19 @@ int umad_open_port(const char *ca_name, int portnum)
 {
 	char dev_file[UMAD_DEV_FILE_SZ];
 	int umad_id, fd, result;
-	unsigned int abi_version = get_abi_version();
+	unsigned int abi_version;
 	char *found_ca_name = NULL;
 
 	TRACE("ca %s port %d", ca_name, portnum);
 
+	if (umad_sim_enabled()) {
+		fd = umad_sim_open_port(ca_name, portnum);
+		if (fd >= 0)
+			new_user_mad_api = 1;
+		return fd;
+	}
+
+	abi_version = get_abi_version();
 	if (!abi_version) {
 		result = -EOPNOTSUPP;
 		goto exit;
@@ -741,6 +779,9 @@ int umad_get_ca(const char *ca_name, umad_ca_t *ca)
 	char *found_ca_name;
 
 	TRACE("ca_name %s", ca_name);
+	if (umad_sim_enabled())
+		return umad_sim_get_ca(ca_name, ca);
+
 	if (resolve_ca_name(ca_name, NULL, &found_ca_name) < 0) {
 		r = -ENODEV;
 		goto exit;
@@ -783,6 +824,9 @@ int umad_get_port(const char *ca_name, int portnum, umad_port_t *port)
 
 	TRACE("ca_name %s portnum %d", ca_name, portnum);
 
+	if (umad_sim_enabled())
+		return umad_sim_get_port(ca_name, portnum, port);
+
 	if (resolve_ca_name(ca_name, &portnum, &found_ca_name) < 0) {
 		result = -ENODEV;
 		goto exit;
@@ -815,6 +859,9 @@ int umad_release_port(umad_port_t * port)
 
 int umad_close_port(int fd)
 {
+	if (umad_sim_enabled())
+		return umad_sim_close_port(fd);
+
 	close(fd);
 	DEBUG("closed fd %d", fd);
 	return 0;
@@ -915,6 +962,10 @@ int umad_send(int fd, int agentid, void *umad, int length,
 	if (umaddebug > 1)
 		umad_dump(mad);
 
+	if (umad_sim_enabled())
+		return umad_sim_send(fd, agentid, umad, length, timeout_ms,
+				     retries);
+
 	n = write(fd, mad, length + umad_size());
 	if (n == length + umad_size())
 		return 0;
@@ -926,6 +977,70 @@ int umad_send(int fd, int agentid, void *umad, int length,
 	return -EIO;
 }
 
+int umad_send_many(int fd, struct umad_buf *bufs, int count)
+{
+	struct iovec iov[UMAD_MAX_BATCH];
+	int done = 0, num, sent, i;
+	ssize_t n;
+
+	TRACE("fd %d bufs %p count %d", fd, bufs, count);
+	errno = 0;
+
+	if (!bufs || count <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (umad_sim_enabled()) {
+		for (; done < count; done++)
+			if (umad_sim_send(fd, bufs[done].agent_id,
+					  bufs[done].umad, bufs[done].length,
+					  bufs[done].timeout_ms,
+					  bufs[done].retries) < 0)
+				break;
+		return done ? done : -EIO;
+	}
+
+	while (done < count) {
+		num = count - done < UMAD_MAX_BATCH ? count - done :
+						      UMAD_MAX_BATCH;
+		for (i = 0; i < num; i++) {
+			struct umad_buf *buf = &bufs[done + i];
+			struct ib_user_mad *mad = buf->umad;
+
+			mad->timeout_ms = buf->timeout_ms;
+			mad->retries = buf->retries;
+			mad->agent_id = buf->agent_id;
+			if (umaddebug > 1)
+				umad_dump(mad);
+			iov[i].iov_base = mad;
+			iov[i].iov_len = buf->length + umad_size();
+		}
+
+		/*
+		 * The umad device takes one MAD per write, writev() feeds it
+		 * the iovecs one by one and stops at the first failure.
+		 */
+		n = writev(fd, iov, num);
+		if (n < 0) {
+			DEBUG("writev of %d mads failed (%m)", num);
+			break;
+		}
+		for (sent = 0; sent < num && n >= (ssize_t)iov[sent].iov_len;
+		     sent++)
+			n -= iov[sent].iov_len;
+		done += sent;
+		if (sent < num)
+			break;
+	}
+
+	if (done)
+		return done;
+	if (!errno)
+		errno = EIO;
+	return -EIO;
+}
+
 static int dev_poll(int fd, int timeout_ms)
 {
 	struct pollfd ufds;
@@ -943,11 +1058,43 @@ static int dev_poll(int fd, int timeout_ms)
 	return -EIO;
 }
 
-int umad_recv(int fd, void *umad, int *length, int timeout_ms)
+/* One read(); the kernel returns exactly one MAD (or coalesced RMPP
+ * transfer) per call and requeues it if the buffer is too short.
+ */
+static int read_mad(int fd, void *umad, int *length)
 {
 	struct ib_user_mad *mad = umad;
 	int n;
 
+	n = read(fd, umad, umad_size() + *length);
+
+	VALGRIND_MAKE_MEM_DEFINED(umad, umad_size() + *length);
+
+	if ((n >= 0) && (n <= umad_size() + *length)) {
+		DEBUG("mad received by agent %d length %d", mad->agent_id, n);
+		if (n > umad_size())
+			*length = n - umad_size();
+		else
+			*length = 0;
+		return mad->agent_id;
+	}
+
+	if (errno == EWOULDBLOCK)
+		return -EWOULDBLOCK;
+
+	DEBUG("read returned %zu > sizeof umad %zu + length %d (%m)",
+	      mad->length - umad_size(), umad_size(), *length);
+
+	*length = mad->length - umad_size();
+	if (!errno)
+		errno = EIO;
+	return -errno;
+}
+
+int umad_recv(int fd, void *umad, int *length, int timeout_ms)
+{
+	int n;
+
 	errno = 0;
 	TRACE("fd %d umad %p timeout %u", fd, umad, timeout_ms);
 
@@ -956,38 +1103,55 @@ int umad_recv(int fd, void *umad, int *length, int timeout_ms)
 		return -EINVAL;
 	}
 
+	if (umad_sim_enabled())
+		return umad_sim_recv(fd, umad, length, timeout_ms);
+
 	if (timeout_ms && (n = dev_poll(fd, timeout_ms)) < 0) {
 		if (!errno)
 			errno = -n;
 		return n;
 	}
 
-	n = read(fd, umad, umad_size() + *length);
+	return read_mad(fd, umad, length);
+}
 
-	VALGRIND_MAKE_MEM_DEFINED(umad, umad_size() + *length);
+int umad_recv_many(int fd, struct umad_buf *bufs, int count, int timeout_ms)
+{
+	int i, n;
 
-	if ((n >= 0) && (n <= umad_size() + *length)) {
-		DEBUG("mad received by agent %d length %d", mad->agent_id, n);
-		if (n > umad_size())
-			*length = n - umad_size();
-		else
-			*length = 0;
-		return mad->agent_id;
+	errno = 0;
+	TRACE("fd %d bufs %p count %d timeout %u", fd, bufs, count,
+	      timeout_ms);
+
+	if (!bufs || count <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
 	}
 
-	if (n == -EWOULDBLOCK) {
+	if (!umad_sim_enabled() && timeout_ms &&
+	    (n = dev_poll(fd, timeout_ms)) < 0) {
 		if (!errno)
-			errno = EWOULDBLOCK;
+			errno = -n;
 		return n;
 	}
 
-	DEBUG("read returned %zu > sizeof umad %zu + length %d (%m)",
-	      mad->length - umad_size(), umad_size(), *length);
+	/* the fd is non blocking, drain what is queued after a single poll */
+	for (i = 0; i < count; i++) {
+		if (umad_sim_enabled())
+			n = umad_sim_recv(fd, bufs[i].umad, &bufs[i].length,
+					  i ? 0 : timeout_ms);
+		else
+			n = read_mad(fd, bufs[i].umad, &bufs[i].length);
+		if (n < 0)
+			break;
+		bufs[i].agent_id = n;
+	}
 
-	*length = mad->length - umad_size();
-	if (!errno)
-		errno = EIO;
-	return -errno;
+	if (i) {
+		errno = 0;
+		return i;
+	}
+	return n;
 }
 
 int umad_poll(int fd, int timeout_ms)
@@ -1016,6 +1180,14 @@ int umad_register_oui(int fd, int mgmt_class, uint8_t rmpp_version,
 		return -EINVAL;
 	}
 
+	if (umad_sim_enabled()) {
+		uint32_t id;
+
+		if (umad_sim_register(fd, mgmt_class, 1, &id))
+			return -EPERM;
+		return id;
+	}
+
 	req.qpn = 1;
 	req.mgmt_class = mgmt_class;
 	req.mgmt_class_version = 1;
@@ -1052,6 +1224,14 @@ int umad_register(int fd, int mgmt_class, int mgmt_version,
 	    ("fd %d mgmt_class %u mgmt_version %u rmpp_version %d method_mask %p",
 	     fd, mgmt_class, mgmt_version, rmpp_version, method_mask);
 
+	if (umad_sim_enabled()) {
+		uint32_t id;
+
+		if (umad_sim_register(fd, mgmt_class, mgmt_version, &id))
+			return -EPERM;
+		return id;
+	}
+
 	req.qpn = qp = (mgmt_class == 0x1 || mgmt_class == 0x81) ? 0 : 1;
 	req.mgmt_class = mgmt_class;
 	req.mgmt_class_version = mgmt_version;
@@ -1098,6 +1278,11 @@ int umad_register2(int port_fd, struct umad_reg_attr *attr, uint32_t *agent_id)
 		return EINVAL;
 	}
 
+	if (umad_sim_enabled())
+		return umad_sim_register(port_fd, attr->mgmt_class,
+					 attr->mgmt_class_version, agent_id) ?
+		       ENOSPC : 0;
+
 	memset(&req, 0, sizeof(req));
 
 	req.mgmt_class = attr->mgmt_class;
@@ -1162,6 +1347,8 @@ int umad_register2(int port_fd, struct umad_reg_attr *attr, uint32_t *agent_id)
 int umad_unregister(int fd, int agentid)
 {
 	TRACE("fd %d unregistering agent %d", fd, agentid);
+	if (umad_sim_enabled())
+		return umad_sim_unregister(fd, agentid);
 	return ioctl(fd, IB_USER_MAD_UNREGISTER_AGENT, &agentid);
 }
 
@@ -1274,6 +1461,9 @@ struct umad_device_node *umad_get_ca_device_list(void)
 	size_t d_name_size;
 	int errsv = 0;
 
+	if (umad_sim_enabled())
+		return umad_sim_get_ca_device_list();
+
 	dir = opendir(SYS_INFINIBAND);
 	if (!dir) {
 		if (errno == ENOENT)
@@ -206,6 +206,20 @@ int umad_send(int portid, int agentid, void *umad, int length,
 	      int timeout_ms, int retries);
 int umad_recv(int portid, void *umad, int *length, int timeout_ms);
 int umad_poll(int portid, int timeout_ms);
+
+/* One entry of a umad_send_many()/umad_recv_many() batch */
+struct umad_buf {
+	void *umad;		/* umad_size() + length bytes */
+	int length;		/* MAD length; for recv the buffer size on
+				 * input and the received length on output */
+	int agent_id;		/* agent to send on, or that received */
+	int timeout_ms;		/* send only */
+	int retries;		/* send only */
+};
+
+int umad_send_many(int portid, struct umad_buf *bufs, int count);
+int umad_recv_many(int portid, struct umad_buf *bufs, int count,
+		   int timeout_ms);
 int umad_get_fd(int portid);
 
 int umad_register(int portid, int mgmt_class, int mgmt_version,
@@ -0,0 +1,1767 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * In-process fabric simulator for libibumad.
+ *
+ * The fabric is read from an ibnetdiscover topology file named by
+ * UMAD_SIM_TOPOLOGY.  Every port opened through umad_open_port() gets a
+ * timerfd instead of a umad device; MADs sent on it are answered from the
+ * topology and the responses become readable once their simulated round
+ * trip has elapsed, so poll()/umad_poll() based consumers work unchanged.
+ *
+ * Answered:
+ *   SMP (LID routed and directed route): NodeInfo, NodeDescription,
+ *     PortInfo, SwitchInfo, LinearForwardingTable
+ *   PMA: ClassPortInfo, PortCounters, PortCountersExtended (all zero)
+ *   SA:  ClassPortInfo, NodeRecord, PortInfoRecord, PathRecord
+ *
+ * Knobs:
+ *   UMAD_SIM_HOP_LATENCY  one way latency per hop in microseconds
+ *   UMAD_SIM_LOSS         percentage of MADs lost per attempt
+ *   UMAD_SIM_SEED         seed for the loss generator
+ *   UMAD_SIM_NODE         node GUID of the local CA, default the first CA
+ *   UMAD_SIM_SM_LID       LID of the SA, default the local port LID
+ *   UMAD_SIM_CA_NAME      name of the simulated CA, default "sim0"
+ */
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <infiniband/umad.h>
+#include <infiniband/umad_types.h>
+#include <infiniband/umad_sm.h>
+#include <infiniband/umad_sa.h>
+
+#include "umad_sim.h"
+
+#define SIM_WARN(fmt, args...) \
+	fprintf(stderr, "ibwarn: [%d] umad_sim: " fmt "\n", getpid(), ## args)
+
+#define SIM_MAX_LID		0xC000
+#define SIM_GID_PREFIX		0xfe80000000000000ULL
+#define SIM_DEF_CA_NAME		"sim0"
+#define SIM_NO_HOPS		0xffff
+
+enum {
+	SIM_NODE_CA = 1,
+	SIM_NODE_SWITCH = 2,
+	SIM_NODE_ROUTER = 3,
+};
+
+enum {
+	SIM_PM_ATTR_PORT_CNTRS = 0x0012,
+	SIM_PM_ATTR_PORT_CNTRS_EXT = 0x001D,
+	SIM_PM_CAP_ALL_PORT_SELECT = 1 << 8,
+	SIM_PM_CAP_EXT_WIDTH = 1 << 9,
+};
+
+enum {
+	SIM_PORT_CAP_HAS_EXT_SPEEDS = 1 << 14,
+};
+
+struct sim_port {
+	uint64_t guid;
+	uint32_t remote;	/* remote node index + 1, 0 if unconnected */
+	uint16_t lid;		/* CA/router ports only */
+	uint8_t remote_port;
+	uint8_t lmc;
+	uint8_t width;
+	uint8_t speed;
+	uint8_t espeed;
+};
+
+struct sim_node {
+	uint64_t guid;
+	uint64_t sysimgguid;
+	uint64_t port_guid;	/* switch management port */
+	uint32_t vendid;
+	uint16_t devid;
+	uint16_t lid;		/* switch port 0 */
+	uint8_t lmc;
+	uint8_t type;
+	uint8_t numports;
+	uint8_t enhanced_sp0;
+	uint8_t ext_speeds;
+	char desc[UMAD_LEN_SMP_DATA];
+	struct sim_port *ports;	/* [0 .. numports] */
+	uint8_t *lft;		/* computed on first LFT query */
+};
+
+struct sim_hash_ent {
+	uint64_t guid;
+	uint32_t node;		/* node index + 1, 0 if empty */
+	uint8_t port;
+};
+
+struct sim_hash {
+	struct sim_hash_ent *ents;
+	uint32_t mask;
+};
+
+struct sim_fabric {
+	struct sim_node *nodes;
+	uint32_t num_nodes;
+	struct sim_hash node_guids;
+	struct sim_hash port_guids;
+	uint32_t *lid_node;	/* node index + 1, indexed by LID */
+	uint8_t *lid_port;
+	uint16_t max_lid;
+	uint16_t *dist;		/* hops from the local node */
+	uint32_t local;
+	uint16_t sm_lid;
+	uint64_t hop_ns;
+	double loss;
+	unsigned seed;
+	char ca_name[UMAD_CA_NAME_LEN];
+	pthread_mutex_t lock;	/* lazily computed LFTs */
+};
+
+struct sim_resp {
+	uint64_t due;
+	uint64_t seq;
+	size_t len;		/* bytes of umad, header included */
+	struct ib_user_mad umad;
+};
+
+struct sim_agent {
+	uint8_t used;
+	uint8_t mgmt_class;
+};
+
+struct sim_fd {
+	struct sim_fd *next;
+	int fd;
+	int portnum;
+	unsigned rand_state;
+	uint64_t seq;
+	struct sim_agent agents[UMAD_CA_MAX_AGENTS];
+	struct sim_resp **heap;
+	unsigned nheap;
+	unsigned max_heap;
+	pthread_mutex_t lock;
+};
+
+static struct sim_fabric fabric = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static pthread_once_t fabric_once = PTHREAD_ONCE_INIT;
+static int fabric_status = -ENODEV;
+
+static struct sim_fd *sim_fds;
+static pthread_mutex_t sim_fds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void put_be16(uint8_t *p, uint16_t v)
+{
+	__be16 b = htobe16(v);
+
+	memcpy(p, &b, sizeof(b));
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+	__be32 b = htobe32(v);
+
+	memcpy(p, &b, sizeof(b));
+}
+
+static inline void put_be64(uint8_t *p, uint64_t v)
+{
+	__be64 b = htobe64(v);
+
+	memcpy(p, &b, sizeof(b));
+}
+
+static inline uint16_t get_be16(const uint8_t *p)
+{
+	__be16 b;
+
+	memcpy(&b, p, sizeof(b));
+	return be16toh(b);
+}
+
+static inline uint64_t get_be64(const uint8_t *p)
+{
+	__be64 b;
+
+	memcpy(&b, p, sizeof(b));
+	return be64toh(b);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool umad_sim_enabled(void)
+{
+	static int enabled = -1;
+
+	if (enabled < 0)
+		enabled = getenv(UMAD_SIM_ENV_TOPOLOGY) != NULL;
+	return enabled;
+}
+
+/*
+ * Topology
+ */
+static uint32_t hash_guid(uint64_t guid)
+{
+	guid ^= guid >> 33;
+	guid *= 0xff51afd7ed558ccdULL;
+	guid ^= guid >> 33;
+	return (uint32_t)guid;
+}
+
+static int hash_init(struct sim_hash *h, uint32_t num)
+{
+	uint32_t size = 64;
+
+	while (size < num * 2)
+		size <<= 1;
+	h->ents = calloc(size, sizeof(*h->ents));
+	if (!h->ents)
+		return -ENOMEM;
+	h->mask = size - 1;
+	return 0;
+}
+
+static void hash_add(struct sim_hash *h, uint64_t guid, uint32_t node,
+		     uint8_t port)
+{
+	uint32_t i = hash_guid(guid) & h->mask;
+
+	while (h->ents[i].node && h->ents[i].guid != guid)
+		i = (i + 1) & h->mask;
+	h->ents[i].guid = guid;
+	h->ents[i].node = node + 1;
+	h->ents[i].port = port;
+}
+
+static struct sim_hash_ent *hash_find(struct sim_hash *h, uint64_t guid)
+{
+	uint32_t i = hash_guid(guid) & h->mask;
+
+	while (h->ents[i].node) {
+		if (h->ents[i].guid == guid)
+			return &h->ents[i];
+		i = (i + 1) & h->mask;
+	}
+	return NULL;
+}
+
+struct sim_link {
+	uint64_t remote_guid;
+	uint32_t node;
+	uint8_t port;
+	uint8_t remote_port;
+};
+
+struct sim_parse {
+	struct sim_link *links;
+	uint32_t num_links;
+	uint32_t max_links;
+	uint32_t max_nodes;
+	uint32_t vendid;
+	uint16_t devid;
+	uint64_t sysimgguid;
+	uint64_t port_guid;
+};
+
+static void parse_link_speed(const char *str, struct sim_port *port)
+{
+	static const struct {
+		const char *name;
+		uint8_t speed;
+		uint8_t espeed;
+	} speeds[] = {
+		{ "SDR", 1, 0 }, { "DDR", 2, 0 }, { "QDR", 4, 0 },
+		{ "FDR10", 4, 0 }, { "FDR", 1, 1 }, { "EDR", 1, 2 },
+		{ "HDR", 1, 4 }, { "NDR", 1, 8 },
+	};
+	static const struct {
+		const char *name;
+		uint8_t width;
+	} widths[] = {
+		{ "1x", 1 }, { "4x", 2 }, { "8x", 4 }, { "12x", 8 }, { "2x", 16 },
+	};
+	const char *x = strchr(str, 'x');
+	unsigned i;
+
+	port->width = 2;
+	port->speed = 1;
+	port->espeed = 0;
+	if (!x)
+		return;
+
+	for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++)
+		if (!strncmp(str, widths[i].name, x + 1 - str) &&
+		    strlen(widths[i].name) == x + 1 - str)
+			port->width = widths[i].width;
+	for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++)
+		if (!strcmp(x + 1, speeds[i].name)) {
+			port->speed = speeds[i].speed;
+			port->espeed = speeds[i].espeed;
+		}
+}
+
+/* "S-0002c90200400f2c" -> guid */
+static int parse_node_name(const char *p, uint64_t *guid, const char **end)
+{
+	char *e;
+
+	p = strchr(p, '"');
+	if (!p || !p[1] || p[2] != '-')
+		return -1;
+	*guid = strtoull(p + 3, &e, 16);
+	if (*e != '"')
+		return -1;
+	*end = e + 1;
+	return 0;
+}
+
+static struct sim_node *parse_node(struct sim_parse *ps, const char *p,
+				   int type)
+{
+	struct sim_node *node;
+	const char *desc, *desc_end, *s;
+	char *e;
+	unsigned numports;
+
+	numports = strtoul(p, &e, 10);
+	if (!numports || numports > 254)
+		return NULL;
+
+	if (fabric.num_nodes == ps->max_nodes) {
+		uint32_t max = ps->max_nodes ? ps->max_nodes * 2 : 1024;
+
+		node = realloc(fabric.nodes, max * sizeof(*node));
+		if (!node)
+			return NULL;
+		fabric.nodes = node;
+		ps->max_nodes = max;
+	}
+
+	node = &fabric.nodes[fabric.num_nodes];
+	memset(node, 0, sizeof(*node));
+	if (parse_node_name(e, &node->guid, &s))
+		return NULL;
+
+	node->ports = calloc(numports + 1, sizeof(*node->ports));
+	if (!node->ports)
+		return NULL;
+
+	node->type = type;
+	node->numports = numports;
+	node->vendid = ps->vendid;
+	node->devid = ps->devid;
+	node->sysimgguid = ps->sysimgguid ? ps->sysimgguid : node->guid;
+	node->port_guid = ps->port_guid ? ps->port_guid : node->guid;
+	node->ports[0].guid = node->port_guid;
+
+	/* # "desc" base port 0 lid 3 lmc 0 */
+	desc = strchr(s, '#');
+	desc = desc ? strchr(desc, '"') : NULL;
+	if (desc) {
+		desc++;
+		if (type == SIM_NODE_SWITCH) {
+			desc_end = strstr(desc, "\" enhanced port 0");
+			if (desc_end)
+				node->enhanced_sp0 = 1;
+			else
+				desc_end = strstr(desc, "\" base port 0");
+		} else
+			desc_end = strrchr(desc, '"');
+		if (desc_end && desc_end >= desc)
+			memcpy(node->desc, desc,
+			       desc_end - desc < sizeof(node->desc) - 1 ?
+			       desc_end - desc : sizeof(node->desc) - 1);
+	}
+
+	s = strstr(s, " port 0 lid ");
+	if (s && type == SIM_NODE_SWITCH)
+		sscanf(s, " port 0 lid %hu lmc %hhu", &node->lid, &node->lmc);
+
+	ps->vendid = 0;
+	ps->devid = 0;
+	ps->sysimgguid = 0;
+	ps->port_guid = 0;
+	fabric.num_nodes++;
+	return node;
+}
+
+static int parse_port(struct sim_parse *ps, struct sim_node *node,
+		      const char *p)
+{
+	struct sim_link *link;
+	struct sim_port *port;
+	const char *s, *r, *last;
+	char speed[16];
+	unsigned portnum;
+	char *e;
+
+	portnum = strtoul(p + 1, &e, 10);
+	if (!portnum || portnum > node->numports || *e != ']')
+		return -1;
+	port = &node->ports[portnum];
+
+	/* skip "[ext N]" */
+	for (s = e + 1; *s == '['; s = strchr(s, ']') + 1)
+		if (!strchr(s, ']'))
+			return -1;
+	if (*s == '(')
+		port->guid = strtoull(s + 1, NULL, 16);
+
+	if (ps->num_links == ps->max_links) {
+		uint32_t max = ps->max_links ? ps->max_links * 2 : 4096;
+
+		link = realloc(ps->links, max * sizeof(*link));
+		if (!link)
+			return -ENOMEM;
+		ps->links = link;
+		ps->max_links = max;
+	}
+	link = &ps->links[ps->num_links];
+	if (parse_node_name(s, &link->remote_guid, &s) || *s != '[')
+		return -1;
+	link->remote_port = strtoul(s + 1, NULL, 10);
+	link->node = fabric.num_nodes - 1;
+	link->port = portnum;
+	ps->num_links++;
+
+	s = strchr(s, '#');
+	if (!s)
+		return 0;
+	if (node->type != SIM_NODE_SWITCH)
+		sscanf(s, "# lid %hu lmc %hhu", &port->lid, &port->lmc);
+
+	/* the link speed follows the last "lid N" of the comment */
+	last = NULL;
+	for (r = strstr(s, "\" lid "); r; r = strstr(r + 1, "\" lid "))
+		last = r;
+	if (last && sscanf(last, "\" lid %*u %15s", speed) == 1)
+		parse_link_speed(speed, port);
+	else
+		parse_link_speed("", port);
+	if (port->espeed)
+		node->ext_speeds = 1;
+
+	return 0;
+}
+
+static int parse_topology(FILE *f)
+{
+	struct sim_parse ps = {};
+	struct sim_node *node = NULL;
+	char line[2048];
+	unsigned lineno = 0;
+	uint32_t i;
+	char *p;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		for (p = line; *p == ' ' || *p == '\t'; p++)
+			;
+		if (!*p || *p == '\n' || *p == '#')
+			continue;
+
+		if (!strncmp(p, "vendid=", 7))
+			ps.vendid = strtoul(p + 7, NULL, 0);
+		else if (!strncmp(p, "devid=", 6))
+			ps.devid = strtoul(p + 6, NULL, 0);
+		else if (!strncmp(p, "sysimgguid=", 11))
+			ps.sysimgguid = strtoull(p + 11, NULL, 0);
+		else if (!strncmp(p, "switchguid=", 11)) {
+			p = strchr(p, '(');
+			if (p)
+				ps.port_guid = strtoull(p + 1, NULL, 16);
+		} else if (!strncmp(p, "Switch", 6) && (p[6] == '\t' || p[6] == ' '))
+			node = parse_node(&ps, p + 6, SIM_NODE_SWITCH);
+		else if (!strncmp(p, "Ca", 2) && (p[2] == '\t' || p[2] == ' '))
+			node = parse_node(&ps, p + 2, SIM_NODE_CA);
+		else if (!strncmp(p, "Rt", 2) && (p[2] == '\t' || p[2] == ' '))
+			node = parse_node(&ps, p + 2, SIM_NODE_ROUTER);
+		else if (*p == '[') {
+			if (!node || parse_port(&ps, node, p)) {
+				SIM_WARN("bad port line %u", lineno);
+				node = NULL;
+			}
+			continue;
+		} else
+			continue;
+
+		if (!node && (*p == 'S' || *p == 'C' || *p == 'R')) {
+			SIM_WARN("bad node line %u", lineno);
+			goto err;
+		}
+	}
+
+	if (!fabric.num_nodes) {
+		SIM_WARN("no nodes in topology");
+		goto err;
+	}
+
+	if (hash_init(&fabric.node_guids, fabric.num_nodes) ||
+	    hash_init(&fabric.port_guids, ps.num_links + fabric.num_nodes))
+		goto err;
+
+	for (i = 0; i < fabric.num_nodes; i++)
+		hash_add(&fabric.node_guids, fabric.nodes[i].guid, i, 0);
+
+	for (i = 0; i < ps.num_links; i++) {
+		struct sim_link *link = &ps.links[i];
+		struct sim_hash_ent *ent;
+		struct sim_node *rnode;
+
+		ent = hash_find(&fabric.node_guids, link->remote_guid);
+		if (!ent) {
+			SIM_WARN("unknown node 0x%016" PRIx64, link->remote_guid);
+			continue;
+		}
+		rnode = &fabric.nodes[ent->node - 1];
+		if (!link->remote_port || link->remote_port > rnode->numports)
+			continue;
+		fabric.nodes[link->node].ports[link->port].remote = ent->node;
+		fabric.nodes[link->node].ports[link->port].remote_port =
+			link->remote_port;
+		rnode->ports[link->remote_port].remote = link->node + 1;
+		rnode->ports[link->remote_port].remote_port = link->port;
+	}
+	free(ps.links);
+	return 0;
+
+err:
+	free(ps.links);
+	return -EINVAL;
+}
+
+static void add_lids(uint32_t node, uint8_t port, uint16_t lid, uint8_t lmc)
+{
+	uint32_t l;
+
+	if (!lid || lid >= SIM_MAX_LID)
+		return;
+	for (l = lid; l < lid + (1U << lmc) && l < SIM_MAX_LID; l++) {
+		fabric.lid_node[l] = node + 1;
+		fabric.lid_port[l] = port;
+		if (l > fabric.max_lid)
+			fabric.max_lid = l;
+	}
+}
+
+/*
+ * Breadth first walk from @src.  dist[] gets the hop count of every node,
+ * first_port[] (optional) the egress port of @src on that shortest path.
+ * Only switches forward, so CAs other than @src are leaves.
+ */
+static int sim_bfs(uint32_t src, uint16_t *dist, uint8_t *first_port)
+{
+	uint32_t *queue, head = 0, tail = 0, i;
+	unsigned p;
+
+	queue = malloc(fabric.num_nodes * sizeof(*queue));
+	if (!queue)
+		return -ENOMEM;
+
+	for (i = 0; i < fabric.num_nodes; i++)
+		dist[i] = SIM_NO_HOPS;
+	dist[src] = 0;
+	if (first_port)
+		first_port[src] = 0;
+	queue[tail++] = src;
+
+	while (head != tail) {
+		struct sim_node *node = &fabric.nodes[queue[head]];
+		uint32_t cur = queue[head++];
+
+		if (cur != src && node->type != SIM_NODE_SWITCH)
+			continue;
+		for (p = 1; p <= node->numports; p++) {
+			uint32_t r = node->ports[p].remote;
+
+			if (!r || dist[r - 1] != SIM_NO_HOPS)
+				continue;
+			dist[r - 1] = dist[cur] + 1;
+			if (first_port)
+				first_port[r - 1] = cur == src ? p :
+						    first_port[cur];
+			queue[tail++] = r - 1;
+		}
+	}
+
+	free(queue);
+	return 0;
+}
+
+static int env_uint(const char *name, unsigned long long *val)
+{
+	const char *s = getenv(name);
+
+	if (!s || !*s)
+		return 0;
+	*val = strtoull(s, NULL, 0);
+	return 1;
+}
+
+static void sim_fabric_load(void)
+{
+	const char *file = getenv(UMAD_SIM_ENV_TOPOLOGY);
+	const char *s;
+	unsigned long long val;
+	struct sim_hash_ent *ent;
+	uint32_t i;
+	unsigned p;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f) {
+		SIM_WARN("can't open topology %s: %m", file);
+		return;
+	}
+	if (parse_topology(f)) {
+		fclose(f);
+		return;
+	}
+	fclose(f);
+
+	fabric.lid_node = calloc(SIM_MAX_LID, sizeof(*fabric.lid_node));
+	fabric.lid_port = calloc(SIM_MAX_LID, sizeof(*fabric.lid_port));
+	fabric.dist = calloc(fabric.num_nodes, sizeof(*fabric.dist));
+	if (!fabric.lid_node || !fabric.lid_port || !fabric.dist)
+		return;
+
+	for (i = 0; i < fabric.num_nodes; i++) {
+		struct sim_node *node = &fabric.nodes[i];
+
+		if (node->type == SIM_NODE_SWITCH) {
+			add_lids(i, 0, node->lid, node->lmc);
+			hash_add(&fabric.port_guids, node->port_guid, i, 0);
+			continue;
+		}
+		for (p = 1; p <= node->numports; p++) {
+			add_lids(i, p, node->ports[p].lid, node->ports[p].lmc);
+			if (node->ports[p].guid)
+				hash_add(&fabric.port_guids,
+					 node->ports[p].guid, i, p);
+		}
+	}
+
+	fabric.local = UINT32_MAX;
+	if (env_uint("UMAD_SIM_NODE", &val)) {
+		ent = hash_find(&fabric.node_guids, val);
+		if (ent)
+			fabric.local = ent->node - 1;
+		else
+			SIM_WARN("UMAD_SIM_NODE 0x%llx not in topology", val);
+	}
+	for (i = 0; i < fabric.num_nodes && fabric.local == UINT32_MAX; i++)
+		if (fabric.nodes[i].type == SIM_NODE_CA)
+			fabric.local = i;
+	if (fabric.local == UINT32_MAX) {
+		SIM_WARN("no local CA in topology");
+		return;
+	}
+
+	if (sim_bfs(fabric.local, fabric.dist, NULL))
+		return;
+
+	if (env_uint("UMAD_SIM_HOP_LATENCY", &val))
+		fabric.hop_ns = val * 1000;
+	s = getenv("UMAD_SIM_LOSS");
+	if (s)
+		fabric.loss = strtod(s, NULL) / 100.0;
+	fabric.seed = 1;
+	if (env_uint("UMAD_SIM_SEED", &val))
+		fabric.seed = val;
+
+	for (p = 1; p <= fabric.nodes[fabric.local].numports; p++)
+		if (fabric.nodes[fabric.local].ports[p].lid) {
+			fabric.sm_lid = fabric.nodes[fabric.local].ports[p].lid;
+			break;
+		}
+	if (env_uint("UMAD_SIM_SM_LID", &val))
+		fabric.sm_lid = val;
+
+	s = getenv("UMAD_SIM_CA_NAME");
+	snprintf(fabric.ca_name, sizeof(fabric.ca_name), "%s",
+		 s && *s ? s : SIM_DEF_CA_NAME);
+
+	fabric_status = 0;
+}
+
+static int sim_fabric_get(void)
+{
+	pthread_once(&fabric_once, sim_fabric_load);
+	return fabric_status;
+}
+
+/*
+ * Attribute builders
+ */
+static void fill_node_info(struct sim_node *node, unsigned in_port,
+			   uint8_t *d)
+{
+	uint64_t port_guid;
+
+	if (node->type == SIM_NODE_SWITCH || !node->ports[in_port].guid)
+		port_guid = node->port_guid;
+	else
+		port_guid = node->ports[in_port].guid;
+
+	d[0] = 1;		/* BaseVersion */
+	d[1] = 1;		/* ClassVersion */
+	d[2] = node->type;
+	d[3] = node->numports;
+	put_be64(d + 4, node->sysimgguid);
+	put_be64(d + 12, node->guid);
+	put_be64(d + 20, port_guid);
+	put_be16(d + 28, 128);	/* PartitionCap */
+	put_be16(d + 30, node->devid);
+	put_be32(d + 32, 0);	/* Revision */
+	put_be32(d + 36, (in_port << 24) | (node->vendid & 0xffffff));
+}
+
+static int fill_port_info(struct sim_node *node, unsigned portnum,
+			  unsigned in_port, uint8_t *d)
+{
+	struct sim_port *port;
+	uint16_t lid = 0;
+	uint8_t lmc = 0, width = 2, speed = 1, espeed = 0;
+	int up;
+
+	if (node->type != SIM_NODE_SWITCH && !portnum)
+		portnum = in_port;
+	if (portnum > node->numports)
+		return UMAD_STATUS_INVALID_ATTR_VALUE;
+	port = &node->ports[portnum];
+
+	if (node->type == SIM_NODE_SWITCH) {
+		up = !portnum || port->remote;
+		if (!portnum) {
+			lid = node->lid;
+			lmc = node->lmc;
+		}
+	} else {
+		up = port->remote != 0;
+		lid = port->lid;
+		lmc = port->lmc;
+	}
+	if (portnum && port->width) {
+		width = port->width;
+		speed = port->speed;
+		espeed = port->espeed;
+	}
+
+	put_be64(d + 8, SIM_GID_PREFIX);
+	put_be16(d + 16, lid);
+	put_be16(d + 18, fabric.sm_lid);
+	put_be32(d + 20, node->ext_speeds ? SIM_PORT_CAP_HAS_EXT_SPEEDS : 0);
+	d[28] = in_port;
+	d[29] = width;			/* LinkWidthEnabled */
+	d[30] = width;			/* LinkWidthSupported */
+	d[31] = width;			/* LinkWidthActive */
+	d[32] = (speed << 4) | (up ? 4 : 1);	/* LinkSpeedSupported, state */
+	d[33] = ((up ? 5 : 2) << 4) | 2;	/* PhysState, LinkDownDef */
+	d[34] = lmc & 7;
+	d[35] = (speed << 4) | speed;	/* LinkSpeedActive, Enabled */
+	d[36] = 5 << 4;			/* NeighborMTU 4096 */
+	d[37] = 4 << 4;			/* VLCap VL0-7 */
+	d[41] = 5;			/* MtuCap 4096 */
+	d[43] = 4 << 4;			/* OperVLs */
+	d[62] = (espeed << 4) | espeed;	/* LinkSpeedExtActive, Supported */
+	return 0;
+}
+
+static void fill_switch_info(struct sim_node *node, uint8_t *d)
+{
+	put_be16(d + 0, SIM_MAX_LID);	/* LinearFDBCap */
+	put_be16(d + 4, 0x4000);	/* MulticastFDBCap */
+	put_be16(d + 6, fabric.max_lid);	/* LinearFDBTop */
+	put_be16(d + 14, 32);		/* PartitionEnforcementCap */
+	if (node->enhanced_sp0)
+		d[16] |= 0x08;
+}
+
+static int fill_lft(uint32_t ni, unsigned block, uint8_t *d)
+{
+	struct sim_node *node = &fabric.nodes[ni];
+	uint16_t *dist = NULL;
+	uint8_t *first = NULL;
+	unsigned lid, i;
+	int rc = 0;
+
+	if (node->type != SIM_NODE_SWITCH)
+		return UMAD_STATUS_ATTR_NOT_SUPPORTED;
+	if (block >= SIM_MAX_LID / UMAD_LEN_SMP_DATA)
+		return UMAD_STATUS_INVALID_ATTR_VALUE;
+
+	pthread_mutex_lock(&fabric.lock);
+	if (!node->lft) {
+		dist = malloc(fabric.num_nodes * sizeof(*dist));
+		first = malloc(fabric.num_nodes);
+		node->lft = malloc(SIM_MAX_LID);
+		if (!dist || !first || !node->lft || sim_bfs(ni, dist, first)) {
+			free(node->lft);
+			node->lft = NULL;
+			rc = UMAD_STATUS_BUSY;
+			goto out;
+		}
+		for (lid = 0; lid < SIM_MAX_LID; lid++) {
+			uint32_t dst = fabric.lid_node[lid];
+
+			if (!dst || dist[dst - 1] == SIM_NO_HOPS)
+				node->lft[lid] = 0xff;
+			else
+				node->lft[lid] = first[dst - 1];
+		}
+	}
+	for (i = 0; i < UMAD_LEN_SMP_DATA; i++)
+		d[i] = node->lft[block * UMAD_LEN_SMP_DATA + i];
+out:
+	pthread_mutex_unlock(&fabric.lock);
+	free(dist);
+	free(first);
+	return rc;
+}
+
+/*
+ * MAD processing
+ */
+static struct sim_resp *alloc_resp(const struct ib_user_mad *req,
+				   size_t req_len, size_t mad_len)
+{
+	struct sim_resp *resp;
+
+	resp = calloc(1, sizeof(*resp) + mad_len);
+	if (!resp)
+		return NULL;
+	resp->len = sizeof(struct ib_user_mad) + mad_len;
+	memcpy(&resp->umad, req, sizeof(*req) +
+	       (req_len < mad_len ? req_len : mad_len));
+	resp->umad.length = resp->len;
+	resp->umad.timeout_ms = 0;
+	resp->umad.retries = 0;
+	resp->umad.status = 0;
+	return resp;
+}
+
+static struct sim_node *lid_to_node(uint16_t lid, uint32_t *ni,
+				    unsigned *port)
+{
+	if (!lid || lid >= SIM_MAX_LID || !fabric.lid_node[lid])
+		return NULL;
+	*ni = fabric.lid_node[lid] - 1;
+	*port = fabric.lid_port[lid];
+	return &fabric.nodes[*ni];
+}
+
+/* Follow the directed route; returns the responder or NULL if it is lost */
+static struct sim_node *dr_walk(struct sim_fd *sfd, struct umad_smp *smp,
+				uint16_t dlid, uint32_t *ni, unsigned *in_port,
+				unsigned *hops)
+{
+	struct sim_node *node;
+	unsigned i, exit_port;
+	uint32_t cur;
+
+	if (be16toh(smp->dr_slid) != 0xffff && dlid && dlid != 0xffff) {
+		/* LID routed part first */
+		if (!lid_to_node(dlid, &cur, in_port) ||
+		    fabric.dist[cur] == SIM_NO_HOPS)
+			return NULL;
+		*hops = fabric.dist[cur];
+	} else {
+		cur = fabric.local;
+		*in_port = sfd->portnum;
+		*hops = 0;
+	}
+
+	if (smp->hop_cnt >= UMAD_SMP_MAX_HOPS)
+		return NULL;
+
+	for (i = 1; i <= smp->hop_cnt; i++) {
+		node = &fabric.nodes[cur];
+		exit_port = smp->initial_path[i];
+		if (i == 1 && cur == fabric.local &&
+		    node->type != SIM_NODE_SWITCH && exit_port != sfd->portnum)
+			return NULL;
+		if (i > 1 && node->type != SIM_NODE_SWITCH)
+			return NULL;
+		if (!exit_port || exit_port > node->numports ||
+		    !node->ports[exit_port].remote)
+			return NULL;
+		*in_port = node->ports[exit_port].remote_port;
+		cur = node->ports[exit_port].remote - 1;
+		(*hops)++;
+	}
+
+	*ni = cur;
+	return &fabric.nodes[cur];
+}
+
+static int process_smp(struct sim_fd *sfd, const struct ib_user_mad *req,
+		       int length, struct sim_resp **out, unsigned *hops)
+{
+	struct umad_smp *smp;
+	struct sim_resp *resp;
+	struct sim_node *node;
+	unsigned in_port, attr_mod;
+	uint16_t status = 0;
+	uint32_t ni;
+
+	resp = alloc_resp(req, length, sizeof(*smp));
+	if (!resp)
+		return -ENOMEM;
+	smp = (struct umad_smp *)resp->umad.data;
+
+	if (smp->mgmt_class == UMAD_CLASS_SUBN_DIRECTED_ROUTE)
+		node = dr_walk(sfd, smp, be16toh(req->addr.lid), &ni,
+			       &in_port, hops);
+	else {
+		node = lid_to_node(be16toh(req->addr.lid), &ni, &in_port);
+		if (node)
+			*hops = fabric.dist[ni];
+		if (node && *hops == SIM_NO_HOPS)
+			node = NULL;
+	}
+	if (!node) {
+		free(resp);
+		return 0;
+	}
+
+	attr_mod = be32toh(smp->attr_mod);
+	if (smp->method != UMAD_METHOD_GET && smp->method != UMAD_METHOD_SET) {
+		status = UMAD_STATUS_METHOD_NOT_SUPPORTED;
+		goto done;
+	}
+
+	/* Set is answered with the current value */
+	memset(smp->data, 0, sizeof(smp->data));
+	switch (be16toh(smp->attr_id)) {
+	case UMAD_SM_ATTR_NODE_DESC:
+		memcpy(smp->data, node->desc, sizeof(node->desc));
+		break;
+	case UMAD_SM_ATTR_NODE_INFO:
+		fill_node_info(node, in_port, smp->data);
+		break;
+	case UMAD_SM_ATTR_PORT_INFO:
+		status = fill_port_info(node, attr_mod, in_port, smp->data);
+		break;
+	case UMAD_SM_ATTR_SWITCH_INFO:
+		if (node->type != SIM_NODE_SWITCH)
+			status = UMAD_STATUS_ATTR_NOT_SUPPORTED;
+		else
+			fill_switch_info(node, smp->data);
+		break;
+	case UMAD_SM_ATTR_LINEAR_FT:
+		status = fill_lft(ni, attr_mod, smp->data);
+		break;
+	default:
+		status = UMAD_STATUS_ATTR_NOT_SUPPORTED;
+		break;
+	}
+
+done:
+	smp->method = UMAD_METHOD_GET_RESP;
+	if (smp->mgmt_class == UMAD_CLASS_SUBN_DIRECTED_ROUTE) {
+		smp->status = htobe16(status | UMAD_SMP_DIRECTION);
+		smp->hop_ptr = smp->hop_cnt;
+	} else
+		smp->status = htobe16(status);
+	resp->umad.addr.lid = htobe16(node->type == SIM_NODE_SWITCH ?
+				      node->lid : node->ports[in_port].lid);
+	*out = resp;
+	return 0;
+}
+
+static int process_pma(struct sim_fd *sfd, const struct ib_user_mad *req,
+		       int length, struct sim_resp **out, unsigned *hops)
+{
+	struct umad_dm_packet *pkt;
+	struct sim_resp *resp;
+	uint16_t status = 0;
+	unsigned in_port;
+	uint8_t sel[3];
+	uint32_t ni;
+
+	if (!lid_to_node(be16toh(req->addr.lid), &ni, &in_port) ||
+	    fabric.dist[ni] == SIM_NO_HOPS)
+		return 0;
+	*hops = fabric.dist[ni];
+
+	resp = alloc_resp(req, length, sizeof(*pkt));
+	if (!resp)
+		return -ENOMEM;
+	pkt = (struct umad_dm_packet *)resp->umad.data;
+
+	switch (be16toh(pkt->mad_hdr.attr_id)) {
+	case UMAD_ATTR_CLASS_PORT_INFO:
+		memset(pkt->data, 0, sizeof(pkt->data));
+		pkt->data[0] = 1;
+		pkt->data[1] = 1;
+		put_be16(pkt->data + 2, SIM_PM_CAP_ALL_PORT_SELECT |
+					SIM_PM_CAP_EXT_WIDTH);
+		break;
+	case SIM_PM_ATTR_PORT_CNTRS:
+	case SIM_PM_ATTR_PORT_CNTRS_EXT:
+		/* keep PortSelect and CounterSelect, counters read as zero */
+		memcpy(sel, pkt->data + 1, sizeof(sel));
+		memset(pkt->data, 0, sizeof(pkt->data));
+		memcpy(pkt->data + 1, sel, sizeof(sel));
+		break;
+	default:
+		status = UMAD_STATUS_ATTR_NOT_SUPPORTED;
+		break;
+	}
+
+	pkt->mad_hdr.method = UMAD_METHOD_GET_RESP;
+	pkt->mad_hdr.status = htobe16(status);
+	*out = resp;
+	return 0;
+}
+
+/* SA record enumeration */
+struct sa_query {
+	uint16_t attr;
+	uint64_t comp_mask;
+	const uint8_t *rec;
+	size_t rec_size;
+	uint8_t *out;
+	size_t num;
+	size_t max;
+	const struct ib_user_mad *req;
+	struct sim_fd *sfd;
+};
+
+static uint8_t *sa_next_rec(struct sa_query *q)
+{
+	if (q->num == q->max)
+		return NULL;
+	return q->out + q->num++ * q->rec_size;
+}
+
+#define SA_COMP(q, bit) ((q)->comp_mask & (1ULL << (bit)))
+
+static void sa_node_records(struct sa_query *q, uint32_t ni)
+{
+	struct sim_node *node = &fabric.nodes[ni];
+	unsigned p, first = 1, last = node->numports;
+	uint8_t info[40];
+	uint8_t *rec;
+
+	if (node->type == SIM_NODE_SWITCH)
+		first = last = 0;
+	for (p = first; p <= last; p++) {
+		uint16_t lid = p ? node->ports[p].lid : node->lid;
+
+		if (!lid)
+			continue;
+		if (SA_COMP(q, 0) && get_be16(q->rec) != lid)
+			continue;
+		fill_node_info(node, p, info);
+		if (SA_COMP(q, 4) && q->rec[4 + 2] != info[2])
+			continue;
+		if (SA_COMP(q, 8) && get_be64(q->rec + 4 + 20) !=
+				     get_be64(info + 20))
+			continue;
+		rec = sa_next_rec(q);
+		if (!rec)
+			return;
+		put_be16(rec, lid);
+		memcpy(rec + 4, info, sizeof(info));
+		memcpy(rec + 44, node->desc, sizeof(node->desc));
+	}
+}
+
+static void sa_port_info_records(struct sa_query *q, uint32_t ni)
+{
+	struct sim_node *node = &fabric.nodes[ni];
+	unsigned p, first = 1;
+	uint8_t *rec;
+
+	if (node->type == SIM_NODE_SWITCH)
+		first = 0;
+	for (p = first; p <= node->numports; p++) {
+		uint16_t lid = node->type == SIM_NODE_SWITCH ?
+			       node->lid : node->ports[p].lid;
+
+		if (!lid)
+			continue;
+		if (SA_COMP(q, 0) && get_be16(q->rec) != lid)
+			continue;
+		if (SA_COMP(q, 1) && q->rec[2] != p)
+			continue;
+		rec = sa_next_rec(q);
+		if (!rec)
+			return;
+		put_be16(rec, lid);
+		rec[2] = p;
+		fill_port_info(node, p, p, rec + 4);
+	}
+}
+
+static int sa_resolve_port(const uint8_t *gid, uint16_t lid, int use_gid,
+			   uint32_t *ni, unsigned *port)
+{
+	struct sim_hash_ent *ent;
+
+	if (use_gid) {
+		ent = hash_find(&fabric.port_guids, get_be64(gid + 8));
+		if (!ent)
+			return -1;
+		*ni = ent->node - 1;
+		*port = ent->port;
+		return 0;
+	}
+	return lid_to_node(lid, ni, port) ? 0 : -1;
+}
+
+static uint8_t sa_rate(const struct sim_port *port)
+{
+	static const uint8_t sdr_rates[] = { 3, 3, 6, 6, 7 };
+
+	switch (port->espeed) {
+	case 1: return 12;	/* 56 Gb/s */
+	case 2: return 17;	/* 100 Gb/s */
+	case 4: return 18;	/* 200 Gb/s */
+	case 8: return 22;	/* 400 Gb/s */
+	}
+	return port->speed <= 4 ? sdr_rates[port->speed] : 3;
+}
+
+static void sa_path_record(struct sa_query *q)
+{
+	struct sim_node *snode, *dnode;
+	uint32_t sni, dni;
+	unsigned sport, dport;
+	uint16_t slid, dlid;
+	uint8_t *rec;
+
+	if (sa_resolve_port(q->rec + 8, get_be16(q->rec + 40),
+			    SA_COMP(q, 2) && !SA_COMP(q, 4), &dni, &dport))
+		return;
+	if (SA_COMP(q, 3) || SA_COMP(q, 5)) {
+		if (sa_resolve_port(q->rec + 24, get_be16(q->rec + 42),
+				    SA_COMP(q, 3) && !SA_COMP(q, 5),
+				    &sni, &sport))
+			return;
+	} else {
+		sni = fabric.local;
+		sport = q->sfd->portnum;
+	}
+	snode = &fabric.nodes[sni];
+	dnode = &fabric.nodes[dni];
+	slid = snode->type == SIM_NODE_SWITCH ? snode->lid :
+	       snode->ports[sport].lid;
+	dlid = dnode->type == SIM_NODE_SWITCH ? dnode->lid :
+	       dnode->ports[dport].lid;
+
+	rec = sa_next_rec(q);
+	if (!rec)
+		return;
+	put_be64(rec + 8, SIM_GID_PREFIX);
+	put_be64(rec + 16, dport ? dnode->ports[dport].guid : dnode->port_guid);
+	put_be64(rec + 24, SIM_GID_PREFIX);
+	put_be64(rec + 32, sport ? snode->ports[sport].guid : snode->port_guid);
+	put_be16(rec + 40, dlid);
+	put_be16(rec + 42, slid);
+	rec[49] = 0x80 | 1;		/* Reversible, NumbPath */
+	put_be16(rec + 50, SA_COMP(q, 13) ? get_be16(q->rec + 50) : 0xffff);
+	rec[54] = umad_sa_set_rate_mtu_or_life(UMAD_SA_SELECTOR_EXACTLY, 5);
+	rec[55] = umad_sa_set_rate_mtu_or_life(UMAD_SA_SELECTOR_EXACTLY,
+					       sa_rate(&dnode->ports[dport]));
+	rec[56] = umad_sa_set_rate_mtu_or_life(UMAD_SA_SELECTOR_EXACTLY, 18);
+}
+
+static int process_sa(struct sim_fd *sfd, const struct ib_user_mad *req,
+		      int length, struct sim_resp **out, unsigned *hops)
+{
+	const struct umad_sa_packet *in = (const void *)req->data;
+	struct umad_sa_packet *pkt;
+	struct sa_query q = {};
+	struct sim_resp *resp;
+	uint16_t status = 0;
+	size_t mad_len;
+	unsigned in_port;
+	uint32_t ni, i;
+	int table;
+
+	if (!lid_to_node(fabric.sm_lid, &ni, &in_port) ||
+	    fabric.dist[ni] == SIM_NO_HOPS)
+		return 0;
+	*hops = fabric.dist[ni];
+
+	if (length < offsetof(struct umad_sa_packet, data))
+		return 0;
+
+	q.attr = be16toh(in->mad_hdr.attr_id);
+	q.comp_mask = be64toh(in->comp_mask);
+	q.rec = in->data;
+	q.req = req;
+	q.sfd = sfd;
+	table = in->mad_hdr.method == UMAD_SA_METHOD_GET_TABLE;
+
+	switch (q.attr) {
+	case UMAD_SA_ATTR_NODE_REC:
+		q.rec_size = 112;
+		break;
+	case UMAD_SA_ATTR_PORT_INFO_REC:
+		q.rec_size = 72;
+		break;
+	case UMAD_SA_ATTR_PATH_REC:
+		q.rec_size = 64;
+		break;
+	default:
+		q.rec_size = 0;
+		break;
+	}
+
+	if (q.rec_size && (table || in->mad_hdr.method == UMAD_METHOD_GET)) {
+		q.max = table ? fabric.num_nodes * 2 + 64 : 1;
+		if (q.attr == UMAD_SA_ATTR_PORT_INFO_REC && table)
+			q.max = fabric.num_nodes * 40ULL;
+		q.out = calloc(q.max, q.rec_size);
+		if (!q.out)
+			return -ENOMEM;
+
+		if (q.attr == UMAD_SA_ATTR_PATH_REC)
+			sa_path_record(&q);
+		else if (SA_COMP(&q, 0)) {
+			/* fast path for a LID qualified query */
+			if (lid_to_node(get_be16(q.rec), &ni, &in_port)) {
+				if (q.attr == UMAD_SA_ATTR_NODE_REC)
+					sa_node_records(&q, ni);
+				else
+					sa_port_info_records(&q, ni);
+			}
+		} else
+			for (i = 0; i < fabric.num_nodes && q.num < q.max; i++) {
+				if (q.attr == UMAD_SA_ATTR_NODE_REC)
+					sa_node_records(&q, i);
+				else
+					sa_port_info_records(&q, i);
+			}
+
+		if (!q.num && !table)
+			status = UMAD_SA_STATUS_NO_RECORDS << 8;
+	} else if (q.attr != UMAD_ATTR_CLASS_PORT_INFO ||
+		   in->mad_hdr.method != UMAD_METHOD_GET)
+		status = q.rec_size ? UMAD_STATUS_METHOD_NOT_SUPPORTED :
+				      UMAD_STATUS_ATTR_NOT_SUPPORTED;
+
+	mad_len = offsetof(struct umad_sa_packet, data) + q.num * q.rec_size;
+	/* a reassembled RMPP table is exactly as long as its payload */
+	if (!table && mad_len < sizeof(*pkt))
+		mad_len = sizeof(*pkt);
+	resp = alloc_resp(req, length, mad_len);
+	if (!resp) {
+		free(q.out);
+		return -ENOMEM;
+	}
+	pkt = (struct umad_sa_packet *)resp->umad.data;
+	memset(pkt->data, 0, mad_len - offsetof(struct umad_sa_packet, data));
+
+	if (q.attr == UMAD_ATTR_CLASS_PORT_INFO && !status) {
+		struct umad_class_port_info *cpi = (void *)pkt->data;
+
+		cpi->base_ver = 1;
+		cpi->class_ver = UMAD_SA_CLASS_VERSION;
+		cpi->cap_mask2_resp_time = htobe32(18);
+	} else if (q.num)
+		memcpy(pkt->data, q.out, q.num * q.rec_size);
+	free(q.out);
+
+	pkt->mad_hdr.method = table ? UMAD_SA_METHOD_GET_TABLE_RESP :
+				      UMAD_METHOD_GET_RESP;
+	pkt->mad_hdr.status = htobe16(status);
+	pkt->attr_offset = htobe16(q.rec_size / 8);
+	if (table) {
+		pkt->rmpp_hdr.rmpp_version = UMAD_RMPP_VERSION;
+		pkt->rmpp_hdr.rmpp_type = 1;	/* DATA */
+		pkt->rmpp_hdr.rmpp_rtime_flags = UMAD_RMPP_FLAG_ACTIVE | 0x6;
+		pkt->rmpp_hdr.seg_num = htobe32(1);
+		pkt->rmpp_hdr.paylen_newwin =
+			htobe32(mad_len - offsetof(struct umad_sa_packet,
+						   sm_key));
+	}
+	resp->umad.addr.lid = htobe16(fabric.sm_lid);
+	*out = resp;
+	return 0;
+}
+
+/*
+ * Response queue, a binary min heap on (due, seq).  The timerfd is kept
+ * armed at the earliest due time so the fd polls readable exactly when a
+ * response can be received.
+ */
+static int resp_before(struct sim_resp *a, struct sim_resp *b)
+{
+	return a->due < b->due || (a->due == b->due && a->seq < b->seq);
+}
+
+static int heap_push(struct sim_fd *sfd, struct sim_resp *resp)
+{
+	unsigned i;
+
+	if (sfd->nheap == sfd->max_heap) {
+		unsigned max = sfd->max_heap ? sfd->max_heap * 2 : 64;
+		struct sim_resp **heap;
+
+		heap = realloc(sfd->heap, max * sizeof(*heap));
+		if (!heap)
+			return -ENOMEM;
+		sfd->heap = heap;
+		sfd->max_heap = max;
+	}
+
+	resp->seq = sfd->seq++;
+	for (i = sfd->nheap++; i; i = (i - 1) / 2) {
+		if (!resp_before(resp, sfd->heap[(i - 1) / 2]))
+			break;
+		sfd->heap[i] = sfd->heap[(i - 1) / 2];
+	}
+	sfd->heap[i] = resp;
+	return 0;
+}
+
+static struct sim_resp *heap_pop(struct sim_fd *sfd)
+{
+	struct sim_resp *top = sfd->heap[0];
+	struct sim_resp *last = sfd->heap[--sfd->nheap];
+	unsigned i = 0, c;
+
+	while ((c = 2 * i + 1) < sfd->nheap) {
+		if (c + 1 < sfd->nheap &&
+		    resp_before(sfd->heap[c + 1], sfd->heap[c]))
+			c++;
+		if (!resp_before(sfd->heap[c], last))
+			break;
+		sfd->heap[i] = sfd->heap[c];
+		i = c;
+	}
+	if (sfd->nheap)
+		sfd->heap[i] = last;
+	return top;
+}
+
+static void arm_timer(struct sim_fd *sfd)
+{
+	struct itimerspec its = {};
+	uint64_t due;
+
+	if (sfd->nheap) {
+		due = sfd->heap[0]->due ? sfd->heap[0]->due : 1;
+		its.it_value.tv_sec = due / 1000000000ULL;
+		its.it_value.tv_nsec = due % 1000000000ULL;
+	}
+	timerfd_settime(sfd->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static struct sim_fd *find_fd(int fd)
+{
+	struct sim_fd *sfd;
+
+	pthread_mutex_lock(&sim_fds_lock);
+	for (sfd = sim_fds; sfd; sfd = sfd->next)
+		if (sfd->fd == fd)
+			break;
+	pthread_mutex_unlock(&sim_fds_lock);
+	return sfd;
+}
+
+static int lost(struct sim_fd *sfd)
+{
+	return fabric.loss > 0 &&
+	       (double)rand_r(&sfd->rand_state) / RAND_MAX < fabric.loss;
+}
+
+int umad_sim_send(int fd, int agent_id, void *umad, int length,
+		  int timeout_ms, int retries)
+{
+	struct ib_user_mad *req = umad;
+	struct umad_hdr *hdr = (struct umad_hdr *)req->data;
+	struct sim_resp *resp = NULL;
+	struct sim_fd *sfd = find_fd(fd);
+	unsigned hops = 0, attempt;
+	uint64_t now, timeout_ns;
+	int rc;
+
+	if (!sfd) {
+		errno = EBADF;
+		return -EIO;
+	}
+	if (agent_id < 0 || agent_id >= UMAD_CA_MAX_AGENTS ||
+	    !sfd->agents[agent_id].used || length < sizeof(*hdr)) {
+		errno = EINVAL;
+		return -EIO;
+	}
+
+	/* responses and traps are sunk by the fabric */
+	if (hdr->method & UMAD_METHOD_RESP_MASK ||
+	    hdr->method == UMAD_METHOD_TRAP)
+		return 0;
+
+	switch (hdr->mgmt_class) {
+	case UMAD_CLASS_SUBN_LID_ROUTED:
+	case UMAD_CLASS_SUBN_DIRECTED_ROUTE:
+		rc = process_smp(sfd, req, length, &resp, &hops);
+		break;
+	case UMAD_CLASS_PERF_MGMT:
+		rc = process_pma(sfd, req, length, &resp, &hops);
+		break;
+	case UMAD_CLASS_SUBN_ADM:
+		rc = process_sa(sfd, req, length, &resp, &hops);
+		break;
+	default:
+		rc = 0;
+		break;
+	}
+	if (rc) {
+		errno = -rc;
+		return -EIO;
+	}
+
+	pthread_mutex_lock(&sfd->lock);
+	now = now_ns();
+	timeout_ns = (uint64_t)timeout_ms * 1000000ULL;
+
+	/* every attempt, the first send and each retry, can be lost */
+	for (attempt = 0; resp && attempt <= retries; attempt++) {
+		if (lost(sfd))
+			continue;
+		resp->due = now + attempt * timeout_ns +
+			    2ULL * hops * fabric.hop_ns;
+		resp->umad.agent_id = agent_id;
+		break;
+	}
+	if (resp && attempt > retries) {
+		free(resp);
+		resp = NULL;
+	}
+
+	if (!resp && timeout_ms) {
+		/* the kernel hands the request back with ETIMEDOUT */
+		resp = alloc_resp(req, length, length);
+		if (!resp) {
+			pthread_mutex_unlock(&sfd->lock);
+			errno = ENOMEM;
+			return -EIO;
+		}
+		resp->umad.agent_id = agent_id;
+		resp->umad.status = ETIMEDOUT;
+		resp->due = now + (retries + 1) * timeout_ns;
+	}
+
+	if (resp) {
+		if (heap_push(sfd, resp)) {
+			pthread_mutex_unlock(&sfd->lock);
+			free(resp);
+			errno = ENOMEM;
+			return -EIO;
+		}
+		arm_timer(sfd);
+	}
+	pthread_mutex_unlock(&sfd->lock);
+	return 0;
+}
+
+int umad_sim_recv(int fd, void *umad, int *length, int timeout_ms)
+{
+	struct ib_user_mad *mad = umad;
+	struct sim_fd *sfd = find_fd(fd);
+	struct sim_resp *resp;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint64_t now, deadline = 0, expirations;
+	size_t mad_len;
+	int n, wait_ms;
+
+	if (!sfd) {
+		errno = EBADF;
+		return -EBADF;
+	}
+	if (timeout_ms > 0)
+		deadline = now_ns() + (uint64_t)timeout_ms * 1000000ULL;
+
+	for (;;) {
+		pthread_mutex_lock(&sfd->lock);
+		if (read(fd, &expirations, sizeof(expirations)) < 0 &&
+		    errno != EAGAIN) {
+			pthread_mutex_unlock(&sfd->lock);
+			return -errno;
+		}
+
+		now = now_ns();
+		resp = sfd->nheap ? sfd->heap[0] : NULL;
+		if (resp && resp->due <= now) {
+			mad_len = resp->len - sizeof(struct ib_user_mad);
+			if (mad_len > *length) {
+				/* leave it queued, as the kernel does */
+				memcpy(mad, &resp->umad, sizeof(*mad));
+				*length = mad_len;
+				arm_timer(sfd);
+				pthread_mutex_unlock(&sfd->lock);
+				errno = ENOSPC;
+				return -ENOSPC;
+			}
+			heap_pop(sfd);
+			arm_timer(sfd);
+			pthread_mutex_unlock(&sfd->lock);
+
+			memcpy(mad, &resp->umad, resp->len);
+			*length = mad_len;
+			n = resp->umad.agent_id;
+			free(resp);
+			return n;
+		}
+		arm_timer(sfd);
+		pthread_mutex_unlock(&sfd->lock);
+
+		if (!timeout_ms) {
+			errno = EWOULDBLOCK;
+			return -EWOULDBLOCK;
+		}
+		if (timeout_ms < 0)
+			wait_ms = -1;
+		else if (now >= deadline)
+			wait_ms = 0;
+		else
+			wait_ms = (deadline - now + 999999) / 1000000;
+
+		n = poll(&pfd, 1, wait_ms);
+		if (n < 0 && errno != EINTR)
+			return -EIO;
+		if (!n) {
+			errno = ETIMEDOUT;
+			return -ETIMEDOUT;
+		}
+	}
+}
+
+/*
+ * Port and CA emulation
+ */
+static int resolve_port(int portnum)
+{
+	struct sim_node *local = &fabric.nodes[fabric.local];
+	int p;
+
+	if (portnum > 0)
+		return portnum <= local->numports ? portnum : -ENODEV;
+	for (p = 1; p <= local->numports; p++)
+		if (local->ports[p].remote)
+			return p;
+	return 1;
+}
+
+static int check_ca_name(const char *ca_name)
+{
+	if (sim_fabric_get())
+		return -ENODEV;
+	if (ca_name && *ca_name && strcmp(ca_name, fabric.ca_name))
+		return -ENODEV;
+	return 0;
+}
+
+static int fill_umad_port(int portnum, umad_port_t *port)
+{
+	struct sim_node *local = &fabric.nodes[fabric.local];
+	struct sim_port *sp = &local->ports[portnum];
+	static const unsigned gbps[] = { 10, 10, 20, 20, 40 };
+
+	memset(port, 0, sizeof(*port));
+	snprintf(port->ca_name, sizeof(port->ca_name), "%s", fabric.ca_name);
+	port->portnum = portnum;
+	port->base_lid = sp->lid;
+	port->lmc = sp->lmc;
+	port->sm_lid = fabric.sm_lid;
+	port->state = sp->remote ? 4 : 1;
+	port->phys_state = sp->remote ? 5 : 2;
+	port->rate = sp->espeed ? 56 * sp->espeed : gbps[sp->speed <= 4 ?
+							  sp->speed : 0];
+	port->capmask = htobe32(local->ext_speeds ?
+				SIM_PORT_CAP_HAS_EXT_SPEEDS : 0);
+	port->gid_prefix = htobe64(SIM_GID_PREFIX);
+	port->port_guid = htobe64(sp->guid);
+	port->pkeys = calloc(1, sizeof(*port->pkeys));
+	if (!port->pkeys)
+		return -ENOMEM;
+	port->pkeys[0] = 0xffff;
+	port->pkeys_size = 1;
+	snprintf(port->link_layer, sizeof(port->link_layer), "InfiniBand");
+	return 0;
+}
+
+int umad_sim_get_cas_names(char cas[][UMAD_CA_NAME_LEN], int max)
+{
+	if (sim_fabric_get() || max < 1)
+		return 0;
+	snprintf(cas[0], UMAD_CA_NAME_LEN, "%s", fabric.ca_name);
+	return 1;
+}
+
+int umad_sim_get_ca(const char *ca_name, umad_ca_t *ca)
+{
+	struct sim_node *local;
+	int p;
+
+	if (check_ca_name(ca_name))
+		return -ENODEV;
+	local = &fabric.nodes[fabric.local];
+
+	memset(ca, 0, sizeof(*ca));
+	snprintf(ca->ca_name, sizeof(ca->ca_name), "%s", fabric.ca_name);
+	ca->node_type = local->type;
+	ca->numports = local->numports < UMAD_CA_MAX_PORTS ?
+		       local->numports : UMAD_CA_MAX_PORTS - 1;
+	snprintf(ca->fw_ver, sizeof(ca->fw_ver), "0.0.0");
+	snprintf(ca->ca_type, sizeof(ca->ca_type), "umad_sim");
+	snprintf(ca->hw_ver, sizeof(ca->hw_ver), "0x%x", local->devid);
+	ca->node_guid = htobe64(local->guid);
+	ca->system_guid = htobe64(local->sysimgguid);
+
+	for (p = 1; p <= ca->numports; p++) {
+		ca->ports[p] = calloc(1, sizeof(*ca->ports[p]));
+		if (!ca->ports[p] || fill_umad_port(p, ca->ports[p]))
+			goto err;
+	}
+	return 0;
+
+err:
+	for (p = 1; p <= ca->numports; p++) {
+		if (ca->ports[p])
+			free(ca->ports[p]->pkeys);
+		free(ca->ports[p]);
+		ca->ports[p] = NULL;
+	}
+	return -ENOMEM;
+}
+
+int umad_sim_get_port(const char *ca_name, int portnum, umad_port_t *port)
+{
+	if (check_ca_name(ca_name))
+		return -ENODEV;
+	portnum = resolve_port(portnum);
+	if (portnum < 0)
+		return portnum;
+	return fill_umad_port(portnum, port) ? -EIO : 0;
+}
+
+struct umad_device_node *umad_sim_get_ca_device_list(void)
+{
+	struct umad_device_node *node;
+	size_t len;
+
+	if (sim_fabric_get())
+		return NULL;
+	len = strlen(fabric.ca_name) + 1;
+	node = calloc(1, sizeof(*node) + len);
+	if (!node) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(node + 1, fabric.ca_name, len);
+	node->ca_name = (char *)(node + 1);
+	return node;
+}
+
+int umad_sim_open_port(const char *ca_name, int portnum)
+{
+	struct sim_fd *sfd;
+
+	if (check_ca_name(ca_name))
+		return -ENODEV;
+	portnum = resolve_port(portnum);
+	if (portnum < 0)
+		return -ENODEV;
+
+	sfd = calloc(1, sizeof(*sfd));
+	if (!sfd)
+		return -ENOMEM;
+	sfd->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (sfd->fd < 0) {
+		free(sfd);
+		return -EIO;
+	}
+	sfd->portnum = portnum;
+	sfd->rand_state = fabric.seed + portnum;
+	pthread_mutex_init(&sfd->lock, NULL);
+
+	pthread_mutex_lock(&sim_fds_lock);
+	sfd->next = sim_fds;
+	sim_fds = sfd;
+	pthread_mutex_unlock(&sim_fds_lock);
+	return sfd->fd;
+}
+
+int umad_sim_close_port(int fd)
+{
+	struct sim_fd **prev, *sfd;
+
+	pthread_mutex_lock(&sim_fds_lock);
+	for (prev = &sim_fds; (sfd = *prev); prev = &sfd->next)
+		if (sfd->fd == fd) {
+			*prev = sfd->next;
+			break;
+		}
+	pthread_mutex_unlock(&sim_fds_lock);
+	if (!sfd)
+		return -EBADF;
+
+	while (sfd->nheap)
+		free(heap_pop(sfd));
+	free(sfd->heap);
+	pthread_mutex_destroy(&sfd->lock);
+	close(sfd->fd);
+	free(sfd);
+	return 0;
+}
+
+int umad_sim_register(int fd, int mgmt_class, int mgmt_version,
+		      uint32_t *agent_id)
+{
+	struct sim_fd *sfd = find_fd(fd);
+	int i;
+
+	if (!sfd)
+		return -EBADF;
+
+	pthread_mutex_lock(&sfd->lock);
+	for (i = 0; i < UMAD_CA_MAX_AGENTS; i++)
+		if (!sfd->agents[i].used) {
+			sfd->agents[i].used = 1;
+			sfd->agents[i].mgmt_class = mgmt_class;
+			break;
+		}
+	pthread_mutex_unlock(&sfd->lock);
+	if (i == UMAD_CA_MAX_AGENTS)
+		return -ENOSPC;
+	*agent_id = i;
+	return 0;
+}
+
+int umad_sim_unregister(int fd, int agent_id)
+{
+	struct sim_fd *sfd = find_fd(fd);
+
+	if (!sfd || agent_id < 0 || agent_id >= UMAD_CA_MAX_AGENTS) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&sfd->lock);
+	sfd->agents[agent_id].used = 0;
+	pthread_mutex_unlock(&sfd->lock);
+	return 0;
+}
@@ -0,0 +1,32 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#ifndef _UMAD_SIM_H
+#define _UMAD_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <infiniband/umad.h>
+
+/*
+ * In-process fabric simulator.  When UMAD_SIM_TOPOLOGY names an
+ * ibnetdiscover topology file, the port level libibumad entry points are
+ * served from that topology instead of /dev/infiniband/umad*.
+ */
+#define UMAD_SIM_ENV_TOPOLOGY	"UMAD_SIM_TOPOLOGY"
+
+bool umad_sim_enabled(void);
+
+int umad_sim_get_cas_names(char cas[][UMAD_CA_NAME_LEN], int max);
+int umad_sim_get_ca(const char *ca_name, umad_ca_t *ca);
+int umad_sim_get_port(const char *ca_name, int portnum, umad_port_t *port);
+struct umad_device_node *umad_sim_get_ca_device_list(void);
+
+int umad_sim_open_port(const char *ca_name, int portnum);
+int umad_sim_close_port(int fd);
+int umad_sim_register(int fd, int mgmt_class, int mgmt_version,
+		      uint32_t *agent_id);
+int umad_sim_unregister(int fd, int agent_id);
+int umad_sim_send(int fd, int agent_id, void *umad, int length,
+		  int timeout_ms, int retries);
+int umad_sim_recv(int fd, void *umad, int *length, int timeout_ms);
+
+#endif /* _UMAD_SIM_H */
@@ -0,0 +1,201 @@
+/* Licensed under the OpenIB.org BSD license (FreeBSD Variant) - See COPYING.md
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ccan/minmax.h>
+#include <util/util.h>
+#include "ibverbs.h"
+
+/*
+ * ibv_query_device(), ibv_query_device_ex() and ibv_query_port() are served
+ * from a copy of the device attributes and of the attributes of each port,
+ * so callers that check them for every connection don't go to the kernel
+ * each time.
+ *
+ * The copies are dropped when ibv_get_async_event() returns a port, LID,
+ * P_Key, SM or fatal event.  The link state may change without an event the
+ * application reads, so a port copy is also dropped ATTR_CACHE_TTL_MS after
+ * it was read.  ibv_query_port_fresh() always reads the port, and
+ * IBV_ATTR_CACHE=0 in the environment turns the cache off.
+ */
+#define ATTR_CACHE_TTL_MS 1000
+
+struct attr_cache_port {
+	/* 0 when the copy must be read again */
+	uint64_t		expires_ms;
+	struct ibv_port_attr	attr;
+};
+
+struct verbs_attr_cache {
+	/* The provider's, the context op is attr_cache_query_device() */
+	int (*query_device_ex)(struct ibv_context *context,
+			       const struct ibv_query_device_ex_input *input,
+			       struct ibv_device_attr_ex *attr,
+			       size_t attr_size);
+	bool			device_valid;
+	struct ibv_device_attr_ex device_attr;
+	uint32_t		num_ports;
+	struct attr_cache_port	*ports;
+};
+
+static uint64_t attr_cache_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* Called with attr_cache_lock held */
+static int attr_cache_load_device(struct ibv_context *context,
+				  struct verbs_attr_cache *cache)
+{
+	uint32_t num_ports;
+	int ret;
+
+	if (cache->device_valid)
+		return 0;
+
+	memset(&cache->device_attr, 0, sizeof(cache->device_attr));
+	ret = cache->query_device_ex(context, NULL, &cache->device_attr,
+				     sizeof(cache->device_attr));
+	if (ret)
+		return ret;
+
+	num_ports = cache->device_attr.orig_attr.phys_port_cnt;
+	if (num_ports != cache->num_ports) {
+		free(cache->ports);
+		cache->ports = calloc(num_ports, sizeof(*cache->ports));
+		cache->num_ports = cache->ports ? num_ports : 0;
+	}
+	cache->device_valid = true;
+	return 0;
+}
+
+static int attr_cache_query_device(struct ibv_context *context,
+				   const struct ibv_query_device_ex_input *input,
+				   struct ibv_device_attr_ex *attr,
+				   size_t attr_size)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+	struct verbs_attr_cache *cache = priv->attr_cache;
+	int ret;
+
+	/* The copy only holds what this library knows of */
+	if ((input && input->comp_mask) || attr_size > sizeof(*attr))
+		return cache->query_device_ex(context, input, attr, attr_size);
+
+	pthread_mutex_lock(&priv->attr_cache_lock);
+	ret = attr_cache_load_device(context, cache);
+	if (!ret)
+		memcpy(attr, &cache->device_attr, attr_size);
+	pthread_mutex_unlock(&priv->attr_cache_lock);
+
+	return ret;
+}
+
+/* Called once the provider has set up the context ops */
+void verbs_attr_cache_init(struct verbs_context *vctx)
+{
+	struct verbs_attr_cache *cache;
+	const char *env;
+
+	env = getenv("IBV_ATTR_CACHE");
+	if (env && !strcmp(env, "0"))
+		return;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return;
+
+	cache->query_device_ex = vctx->query_device_ex;
+	vctx->query_device_ex = attr_cache_query_device;
+	vctx->priv->attr_cache = cache;
+}
+
+/*
+ * Returns false if the cache can't be used, otherwise *ret is 0 and
+ * port_attr is filled, or *ret is the error of reading the port.
+ */
+bool verbs_attr_cache_query_port(struct ibv_context *context,
+				 uint8_t port_num,
+				 struct ibv_port_attr *port_attr,
+				 size_t port_attr_len, int *ret)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+	struct verbs_attr_cache *cache = priv->attr_cache;
+	struct attr_cache_port *port;
+	uint64_t now;
+
+	if (!cache)
+		return false;
+
+	pthread_mutex_lock(&priv->attr_cache_lock);
+	if (attr_cache_load_device(context, cache) || !port_num ||
+	    port_num > cache->num_ports) {
+		pthread_mutex_unlock(&priv->attr_cache_lock);
+		return false;
+	}
+
+	port = &cache->ports[port_num - 1];
+	now = attr_cache_now_ms();
+	*ret = 0;
+	if (now >= port->expires_ms) {
+		memset(&port->attr, 0, sizeof(port->attr));
+		*ret = get_ops(context)->query_port(context, port_num,
+						    &port->attr);
+		port->expires_ms = *ret ? 0 : now + ATTR_CACHE_TTL_MS;
+	}
+	if (!*ret) {
+		memset(port_attr, 0, port_attr_len);
+		memcpy(port_attr, &port->attr,
+		       min(port_attr_len, sizeof(port->attr)));
+	}
+	pthread_mutex_unlock(&priv->attr_cache_lock);
+
+	return true;
+}
+
+/* port_num 0 drops the device and all the ports */
+void verbs_attr_cache_invalidate(struct ibv_context *context,
+				 uint8_t port_num)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+	struct verbs_attr_cache *cache = priv->attr_cache;
+	uint32_t i;
+
+	if (!cache)
+		return;
+
+	pthread_mutex_lock(&priv->attr_cache_lock);
+	if (!port_num)
+		cache->device_valid = false;
+	for (i = 0; i < cache->num_ports; i++)
+		if (!port_num || port_num == i + 1)
+			cache->ports[i].expires_ms = 0;
+	pthread_mutex_unlock(&priv->attr_cache_lock);
+}
+
+void verbs_attr_cache_cleanup(struct verbs_ex_private *priv)
+{
+	if (priv->attr_cache)
+		free(priv->attr_cache->ports);
+	free(priv->attr_cache);
+	priv->attr_cache = NULL;
+	pthread_mutex_destroy(&priv->attr_cache_lock);
+}
+
+int _ibv_query_port_fresh(struct ibv_context *context, uint8_t port_num,
+			  struct ibv_port_attr *port_attr, size_t port_attr_size)
+{
+	/* 0 would drop the whole device for an invalid port */
+	if (port_num)
+		verbs_attr_cache_invalidate(context, port_num);
+	return __lib_query_port(context, port_num, port_attr, port_attr_size);
+}
@@ -36,6 +36,7 @@
 #include <dirent.h>
 #include <infiniband/cmd_write.h>
 #include <util/util.h>
+#include "ibverbs.h"
 
 #include <net/if.h>
 
@@ -442,6 +443,10 @@ int __ibv_query_gid_ex(struct ibv_context *context, uint32_t port_num,
 			       UVERBS_METHOD_QUERY_GID_ENTRY, 4);
 	int ret;
 
+	if (!flags && entry_size == sizeof(*entry) &&
+	    verbs_gid_cache_query(context, port_num, gid_index, entry, &ret))
+		return ret;
+
 	fill_attr_const_in(cmdb, UVERBS_ATTR_QUERY_GID_ENTRY_PORT, port_num);
 	fill_attr_const_in(cmdb, UVERBS_ATTR_QUERY_GID_ENTRY_GID_INDEX,
 			   gid_index);
@@ -230,12 +230,29 @@ static int ioctl_write(struct ibv_context *ctx, unsigned int write_method,
 	return execute_ioctl(ctx, cmdb);
 }
 
+static int execute_write(struct ibv_context *ctx, unsigned int write_method,
+			 const void *req, size_t req_size)
+{
+	struct verbs_ex_private *priv = get_priv(ctx);
+	uint64_t start;
+	int ret;
+
+	ibv_trace(cmd_write_start, ctx, write_method);
+	start = verbs_stats_cmd_start(priv);
+	ret = write(ctx->cmd_fd, req, req_size) != req_size ? errno : 0;
+	verbs_stats_cmd_done(priv, start);
+	ibv_trace(cmd_write_done, ctx, write_method, ret);
+
+	return ret;
+}
+
 int _execute_cmd_write(struct ibv_context *ctx, unsigned int write_method,
 		       struct ib_uverbs_cmd_hdr *req, size_t core_req_size,
 		       size_t req_size, void *resp, size_t core_resp_size,
 		       size_t resp_size)
 {
 	struct verbs_ex_private *priv = get_priv(ctx);
+	int ret;
 
 	if (!VERBS_WRITE_ONLY && (VERBS_IOCTL_ONLY || priv->use_ioctl_write))
 		return ioctl_write(ctx, write_method, req + 1,
@@ -247,8 +264,9 @@ int _execute_cmd_write(struct ibv_context *ctx, unsigned int write_method,
 	req->in_words = __check_divide(req_size, 4);
 	req->out_words = __check_divide(resp_size, 4);
 
-	if (write(ctx->cmd_fd, req, req_size) != req_size)
-		return errno;
+	ret = execute_write(ctx, write_method, req, req_size);
+	if (ret)
+		return ret;
 
 	if (resp)
 		VALGRIND_MAKE_MEM_DEFINED(resp, resp_size);
@@ -265,6 +283,7 @@ int _execute_cmd_write_ex(struct ibv_context *ctx, unsigned int write_method,
 		       size_t resp_size)
 {
 	struct verbs_ex_private *priv = get_priv(ctx);
+	int ret;
 
 	if (!VERBS_WRITE_ONLY && (VERBS_IOCTL_ONLY || priv->use_ioctl_write))
 		return ioctl_write(
@@ -292,8 +311,10 @@ int _execute_cmd_write_ex(struct ibv_context *ctx, unsigned int write_method,
 	if (resp)
 		memset(resp, 0, resp_size);
 
-	if (write(ctx->cmd_fd, req, req_size) != req_size)
-		return errno;
+	ret = execute_write(ctx, IB_USER_VERBS_CMD_FLAG_EXTENDED | write_method,
+			    req, req_size);
+	if (ret)
+		return ret;
 
 	if (resp)
 		VALGRIND_MAKE_MEM_DEFINED(resp, resp_size);
@@ -128,6 +128,8 @@ static void finalize_attrs(struct ibv_command_buffer *cmd)
 int execute_ioctl(struct ibv_context *context, struct ibv_command_buffer *cmd)
 {
 	struct verbs_context *vctx = verbs_get_ctx(context);
+	uint64_t start;
+	int ret;
 
 	/*
 	 * One of the fill functions was given input that cannot be marshaled
@@ -144,8 +146,15 @@ int execute_ioctl(struct ibv_context *context, struct ibv_command_buffer *cmd)
 	cmd->hdr.reserved2 = 0;
 	cmd->hdr.driver_id = vctx->priv->driver_id;
 
-	if (ioctl(context->cmd_fd, RDMA_VERBS_IOCTL, &cmd->hdr))
-		return errno;
+	ibv_trace(cmd_ioctl_start, context, cmd->hdr.object_id,
+		  cmd->hdr.method_id);
+	start = verbs_stats_cmd_start(vctx->priv);
+	ret = ioctl(context->cmd_fd, RDMA_VERBS_IOCTL, &cmd->hdr) ? errno : 0;
+	verbs_stats_cmd_done(vctx->priv, start);
+	ibv_trace(cmd_ioctl_done, context, cmd->hdr.object_id,
+		  cmd->hdr.method_id, ret);
+	if (ret)
+		return ret;
 
 	finalize_attrs(cmd);
 
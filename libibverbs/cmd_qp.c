@@ -386,6 +386,8 @@ int ibv_cmd_create_qp(struct ibv_pd *pd,
 	attr_ex.comp_mask |= IBV_QP_INIT_ATTR_PD;
 	attr_ex.pd = pd;
 	ret = ibv_icmd_create_qp(pd->context, NULL, qp, &attr_ex, cmdb);
+	ibv_trace(create_qp, pd->context, attr_ex.qp_type,
+		  ret ? 0 : qp->qp_num, ret);
 	if (!ret)
 		memcpy(&attr->cap, &attr_ex.cap, sizeof(attr_ex.cap));
 
@@ -402,6 +404,8 @@ int ibv_cmd_create_qp_ex(struct ibv_context *context,
 				  UVERBS_METHOD_QP_CREATE, cmd, cmd_size, resp,
 				  resp_size);
 
+	int ret;
+
 	if (!check_comp_mask(attr_ex->comp_mask,
 			     IBV_QP_INIT_ATTR_PD |
 			     IBV_QP_INIT_ATTR_XRCD |
@@ -410,7 +414,10 @@ int ibv_cmd_create_qp_ex(struct ibv_context *context,
 		return errno;
 	}
 
-	return ibv_icmd_create_qp(context, qp, NULL, attr_ex, cmdb);
+	ret = ibv_icmd_create_qp(context, qp, NULL, attr_ex, cmdb);
+	ibv_trace(create_qp, context, attr_ex->qp_type,
+		  ret ? 0 : qp->qp.qp_num, ret);
+	return ret;
 }
 
 int ibv_cmd_create_qp_ex2(struct ibv_context *context,
@@ -424,6 +431,7 @@ int ibv_cmd_create_qp_ex2(struct ibv_context *context,
 	DECLARE_CMD_BUFFER_COMPAT(cmdb, UVERBS_OBJECT_QP,
 				  UVERBS_METHOD_QP_CREATE, cmd, cmd_size, resp,
 				  resp_size);
+	int ret;
 
 	if (!check_comp_mask(attr_ex->comp_mask,
 			     IBV_QP_INIT_ATTR_PD |
@@ -437,7 +445,10 @@ int ibv_cmd_create_qp_ex2(struct ibv_context *context,
 		return errno;
 	}
 
-	return ibv_icmd_create_qp(context, qp, NULL, attr_ex, cmdb);
+	ret = ibv_icmd_create_qp(context, qp, NULL, attr_ex, cmdb);
+	ibv_trace(create_qp, context, attr_ex->qp_type,
+		  ret ? 0 : qp->qp.qp_num, ret);
+	return ret;
 }
 
 int ibv_cmd_destroy_qp(struct ibv_qp *qp)
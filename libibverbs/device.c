@@ -251,6 +251,8 @@ int verbs_init_context(struct verbs_context *context_ex,
 	}
 
 	context_ex->priv->driver_id = driver_id;
+	pthread_mutex_init(&context_ex->priv->gid_cache_lock, NULL);
+	pthread_mutex_init(&context_ex->priv->attr_cache_lock, NULL);
 	verbs_set_ops(context_ex, &verbs_dummy_ops);
 	context_ex->priv->use_ioctl_write = has_ioctl_write(context);
 
@@ -318,6 +320,9 @@ static void set_lib_ops(struct verbs_context *vctx)
 		(void (*)(void))vctx->ibv_create_flow;
 	vctx->ABI_placeholder2 =
 		(void (*)(void))vctx->ibv_destroy_flow;
+
+	verbs_attr_cache_init(vctx);
+	verbs_stats_init(vctx);
 }
 
 struct ibv_context *verbs_open_device(struct ibv_device *device, void *private_data)
@@ -431,6 +436,9 @@ out:
 
 void verbs_uninit_context(struct verbs_context *context_ex)
 {
+	verbs_gid_cache_cleanup(context_ex->priv);
+	verbs_attr_cache_cleanup(context_ex->priv);
+	verbs_stats_cleanup(context_ex->priv);
 	free(context_ex->priv);
 	if (context_ex->context.cmd_fd != -1)
 		close(context_ex->context.cmd_fd);
@@ -490,6 +498,35 @@ LATEST_SYMVER_FUNC(ibv_get_async_event, 1_1, "IBVERBS_1.1",
 		break;
 	}
 
+	switch (event->event_type) {
+	case IBV_EVENT_GID_CHANGE:
+	case IBV_EVENT_PORT_ACTIVE:
+	case IBV_EVENT_PORT_ERR:
+		verbs_gid_cache_invalidate(context, event->element.port_num);
+		break;
+	case IBV_EVENT_DEVICE_FATAL:
+		verbs_gid_cache_invalidate(context, 0);
+		break;
+	default:
+		break;
+	}
+
+	switch (event->event_type) {
+	case IBV_EVENT_PORT_ACTIVE:
+	case IBV_EVENT_PORT_ERR:
+	case IBV_EVENT_LID_CHANGE:
+	case IBV_EVENT_PKEY_CHANGE:
+	case IBV_EVENT_SM_CHANGE:
+	case IBV_EVENT_CLIENT_REREGISTER:
+		verbs_attr_cache_invalidate(context, event->element.port_num);
+		break;
+	case IBV_EVENT_DEVICE_FATAL:
+		verbs_attr_cache_invalidate(context, 0);
+		break;
+	default:
+		break;
+	}
+
 	get_ops(context)->async_event(context, event);
 
 	return 0;
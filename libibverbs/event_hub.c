@@ -0,0 +1,486 @@
+/* Licensed under the OpenIB.org BSD license (FreeBSD Variant) - See COPYING.md
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include <ccan/minmax.h>
+#include <util/util.h>
+#include "ibverbs.h"
+
+/*
+ * An event hub has one epoll set with the async_fd of each of its contexts,
+ * made non-blocking, and a timerfd.  ibv_event_hub_poll() reads up to
+ * HUB_DRAIN_BATCH events from each ready context in a pass, and hands each
+ * event to the callback of its context or stores it in the caller's array.
+ *
+ * Port events are rate limited when the hub has a coalesce_ms period: once
+ * a port event is delivered, the events of the same kind on that port during
+ * the next period are held, and the last of them is delivered at the end of
+ * the period with the number of events it stands for.  PORT_ACTIVE and
+ * PORT_ERR are one kind, so a flapping link is reported at most once a
+ * period, in its latest state.  The timerfd expires at the end of the
+ * earliest period with held events, so the hub fd becomes readable then.
+ */
+#define HUB_EPOLL_BATCH 64
+#define HUB_DRAIN_BATCH 32
+
+enum hub_port_kind {
+	HUB_PORT_LINK,
+	HUB_PORT_LID,
+	HUB_PORT_PKEY,
+	HUB_PORT_SM,
+	HUB_PORT_CLIENT_REREGISTER,
+	HUB_PORT_GID,
+	HUB_PORT_NUM_KINDS,
+};
+
+struct hub_held_event {
+	/* End of the period started by the last delivery */
+	uint64_t		until_ms;
+	/* Events held in the period, the last one was of type */
+	uint32_t		count;
+	enum ibv_event_type	type;
+};
+
+struct hub_context {
+	struct ibv_context	*context;
+	ibv_hub_event_cb	cb;
+	void			*cb_data;
+	/* Of the async_fd before it was added */
+	int			fd_flags;
+	uint32_t		num_ports;
+	/* num_ports * HUB_PORT_NUM_KINDS, NULL without coalescing */
+	struct hub_held_event	*held;
+};
+
+struct ibv_event_hub {
+	pthread_mutex_t		lock;
+	int			epoll_fd;
+	int			timer_fd;
+	uint32_t		coalesce_ms;
+	/* Indexed by async_fd */
+	struct hub_context	**contexts;
+	int			num_fds;
+	/* Held events with a count, and the time the timerfd is set to */
+	unsigned int		num_held;
+	uint64_t		timer_ms;
+};
+
+struct hub_poll {
+	struct ibv_hub_event	*events;
+	int			num_events;
+	int			num_stored;
+	/* Stored or given to a callback */
+	unsigned int		delivered;
+};
+
+static uint64_t hub_now_ms(void)
+{
+	struct timespec ts;
+
+	/* The clock of the timerfd */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static int hub_port_kind(enum ibv_event_type type)
+{
+	switch (type) {
+	case IBV_EVENT_PORT_ACTIVE:
+	case IBV_EVENT_PORT_ERR:
+		return HUB_PORT_LINK;
+	case IBV_EVENT_LID_CHANGE:
+		return HUB_PORT_LID;
+	case IBV_EVENT_PKEY_CHANGE:
+		return HUB_PORT_PKEY;
+	case IBV_EVENT_SM_CHANGE:
+		return HUB_PORT_SM;
+	case IBV_EVENT_CLIENT_REREGISTER:
+		return HUB_PORT_CLIENT_REREGISTER;
+	case IBV_EVENT_GID_CHANGE:
+		return HUB_PORT_GID;
+	default:
+		return -1;
+	}
+}
+
+/* Returns false if there is no room for the event in the caller's array */
+static bool hub_deliver(struct hub_context *hctx, struct ibv_hub_event *hev,
+			struct hub_poll *out)
+{
+	if (hctx->cb) {
+		hctx->cb(hev, hctx->cb_data);
+		ibv_ack_async_event(&hev->event);
+	} else {
+		if (out->num_stored == out->num_events)
+			return false;
+		out->events[out->num_stored++] = *hev;
+	}
+	out->delivered++;
+	return true;
+}
+
+/* Called with room for the event */
+static void hub_event(struct ibv_event_hub *hub, struct hub_context *hctx,
+		      struct ibv_async_event *event, struct hub_poll *out,
+		      uint64_t now)
+{
+	struct ibv_hub_event hev = {
+		.context = hctx->context,
+		.event = *event,
+		.count = 1,
+	};
+	struct hub_held_event *held;
+	uint32_t port = event->element.port_num;
+	int kind;
+
+	kind = hub_port_kind(event->event_type);
+	if (!hctx->held || kind < 0 || !port || port > hctx->num_ports) {
+		hub_deliver(hctx, &hev, out);
+		return;
+	}
+
+	held = &hctx->held[(port - 1) * HUB_PORT_NUM_KINDS + kind];
+	if (now < held->until_ms) {
+		if (!held->count++)
+			hub->num_held++;
+		held->type = event->event_type;
+		ibv_ack_async_event(event);
+		return;
+	}
+
+	held->until_ms = now + hub->coalesce_ms;
+	hub_deliver(hctx, &hev, out);
+}
+
+static void hub_drain(struct ibv_event_hub *hub, struct hub_context *hctx,
+		      struct hub_poll *out, uint64_t now)
+{
+	struct ibv_async_event event;
+	unsigned int i;
+
+	/* The fd stays readable for the next pass if events are left */
+	for (i = 0; i != HUB_DRAIN_BATCH; i++) {
+		if (!hctx->cb && out->num_stored == out->num_events)
+			break;
+		if (ibv_get_async_event(hctx->context, &event))
+			break;
+		hub_event(hub, hctx, &event, out, now);
+	}
+}
+
+static void hub_flush_held(struct ibv_event_hub *hub, struct hub_poll *out,
+			   uint64_t now)
+{
+	struct ibv_hub_event hev = {};
+	struct hub_held_event *held;
+	struct hub_context *hctx;
+	uint32_t i;
+	int fd;
+
+	for (fd = 0; fd != hub->num_fds && hub->num_held; fd++) {
+		hctx = hub->contexts[fd];
+		if (!hctx || !hctx->held)
+			continue;
+
+		for (i = 0; i != hctx->num_ports * HUB_PORT_NUM_KINDS; i++) {
+			held = &hctx->held[i];
+			if (!held->count || now < held->until_ms)
+				continue;
+
+			hev.context = hctx->context;
+			hev.event.event_type = held->type;
+			hev.event.element.port_num = i / HUB_PORT_NUM_KINDS + 1;
+			hev.count = held->count;
+			if (!hub_deliver(hctx, &hev, out))
+				break;
+
+			held->count = 0;
+			held->until_ms = now + hub->coalesce_ms;
+			hub->num_held--;
+		}
+	}
+}
+
+/* Expire the timerfd at the end of the earliest period with held events */
+static void hub_arm_timer(struct ibv_event_hub *hub)
+{
+	struct itimerspec its = {};
+	struct hub_context *hctx;
+	uint64_t next = 0;
+	uint32_t i;
+	int fd;
+
+	for (fd = 0; fd != hub->num_fds && hub->num_held; fd++) {
+		hctx = hub->contexts[fd];
+		if (!hctx || !hctx->held)
+			continue;
+
+		for (i = 0; i != hctx->num_ports * HUB_PORT_NUM_KINDS; i++)
+			if (hctx->held[i].count &&
+			    (!next || hctx->held[i].until_ms < next))
+				next = hctx->held[i].until_ms;
+	}
+
+	if (next == hub->timer_ms)
+		return;
+
+	/* A zero time disarms the timer */
+	its.it_value.tv_sec = next / 1000;
+	its.it_value.tv_nsec = (next % 1000) * 1000000;
+	timerfd_settime(hub->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+	hub->timer_ms = next;
+}
+
+struct ibv_event_hub *ibv_create_event_hub(struct ibv_event_hub_init_attr *attr)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct ibv_event_hub *hub;
+
+	if (attr && attr->comp_mask) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	hub = calloc(1, sizeof(*hub));
+	if (!hub) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	hub->coalesce_ms = attr ? attr->coalesce_ms : 0;
+
+	hub->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (hub->epoll_fd < 0)
+		goto err_free;
+
+	hub->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				       TFD_NONBLOCK | TFD_CLOEXEC);
+	if (hub->timer_fd < 0)
+		goto err_epoll;
+
+	ev.data.fd = hub->timer_fd;
+	if (epoll_ctl(hub->epoll_fd, EPOLL_CTL_ADD, hub->timer_fd, &ev))
+		goto err_timer;
+
+	pthread_mutex_init(&hub->lock, NULL);
+	return hub;
+
+err_timer:
+	close(hub->timer_fd);
+err_epoll:
+	close(hub->epoll_fd);
+err_free:
+	free(hub);
+	return NULL;
+}
+
+/* Called with the hub lock held, the held events are dropped */
+static void hub_remove(struct ibv_event_hub *hub, struct hub_context *hctx)
+{
+	int fd = hctx->context->async_fd;
+	uint32_t i;
+
+	epoll_ctl(hub->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	fcntl(fd, F_SETFL, hctx->fd_flags);
+
+	if (hctx->held)
+		for (i = 0; i != hctx->num_ports * HUB_PORT_NUM_KINDS; i++)
+			if (hctx->held[i].count)
+				hub->num_held--;
+
+	hub->contexts[fd] = NULL;
+	free(hctx->held);
+	free(hctx);
+}
+
+int ibv_destroy_event_hub(struct ibv_event_hub *hub)
+{
+	int fd;
+
+	pthread_mutex_lock(&hub->lock);
+	for (fd = 0; fd != hub->num_fds; fd++)
+		if (hub->contexts[fd])
+			hub_remove(hub, hub->contexts[fd]);
+	pthread_mutex_unlock(&hub->lock);
+
+	close(hub->timer_fd);
+	close(hub->epoll_fd);
+	pthread_mutex_destroy(&hub->lock);
+	free(hub->contexts);
+	free(hub);
+	return 0;
+}
+
+/* Called with the hub lock held */
+static int hub_grow(struct ibv_event_hub *hub, int fd)
+{
+	struct hub_context **contexts;
+	int num_fds;
+
+	if (fd < hub->num_fds)
+		return 0;
+
+	num_fds = max(fd + 1, 2 * hub->num_fds);
+	contexts = realloc(hub->contexts, num_fds * sizeof(*contexts));
+	if (!contexts)
+		return ENOMEM;
+
+	memset(contexts + hub->num_fds, 0,
+	       (num_fds - hub->num_fds) * sizeof(*contexts));
+	hub->contexts = contexts;
+	hub->num_fds = num_fds;
+	return 0;
+}
+
+int ibv_event_hub_add(struct ibv_event_hub *hub, struct ibv_context *context,
+		      ibv_hub_event_cb cb, void *cb_data)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct ibv_device_attr dev_attr;
+	struct hub_context *hctx;
+	int fd = context->async_fd;
+	int ret;
+
+	if (fd < 0)
+		return EINVAL;
+
+	hctx = calloc(1, sizeof(*hctx));
+	if (!hctx)
+		return ENOMEM;
+	hctx->context = context;
+	hctx->cb = cb;
+	hctx->cb_data = cb_data;
+
+	if (hub->coalesce_ms) {
+		ret = ibv_query_device(context, &dev_attr);
+		if (ret)
+			goto err_free;
+
+		hctx->num_ports = dev_attr.phys_port_cnt;
+		hctx->held = calloc(hctx->num_ports * HUB_PORT_NUM_KINDS,
+				    sizeof(*hctx->held));
+		if (!hctx->held) {
+			ret = ENOMEM;
+			goto err_free;
+		}
+	}
+
+	pthread_mutex_lock(&hub->lock);
+	ret = hub_grow(hub, fd);
+	if (ret)
+		goto err_unlock;
+	if (hub->contexts[fd]) {
+		ret = EEXIST;
+		goto err_unlock;
+	}
+
+	hctx->fd_flags = fcntl(fd, F_GETFL);
+	if (hctx->fd_flags < 0 ||
+	    fcntl(fd, F_SETFL, hctx->fd_flags | O_NONBLOCK)) {
+		ret = errno;
+		goto err_unlock;
+	}
+
+	ev.data.fd = fd;
+	if (epoll_ctl(hub->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		ret = errno;
+		fcntl(fd, F_SETFL, hctx->fd_flags);
+		goto err_unlock;
+	}
+
+	hub->contexts[fd] = hctx;
+	pthread_mutex_unlock(&hub->lock);
+	return 0;
+
+err_unlock:
+	pthread_mutex_unlock(&hub->lock);
+err_free:
+	free(hctx->held);
+	free(hctx);
+	return ret;
+}
+
+int ibv_event_hub_del(struct ibv_event_hub *hub, struct ibv_context *context)
+{
+	int fd = context->async_fd;
+	int ret = ENOENT;
+
+	pthread_mutex_lock(&hub->lock);
+	if (fd >= 0 && fd < hub->num_fds && hub->contexts[fd] &&
+	    hub->contexts[fd]->context == context) {
+		hub_remove(hub, hub->contexts[fd]);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&hub->lock);
+
+	return ret;
+}
+
+int ibv_event_hub_fd(struct ibv_event_hub *hub)
+{
+	return hub->epoll_fd;
+}
+
+int ibv_event_hub_poll(struct ibv_event_hub *hub, struct ibv_hub_event *events,
+		       int num_events, int timeout_ms)
+{
+	struct epoll_event evs[HUB_EPOLL_BATCH];
+	struct hub_poll out = {
+		.events = events,
+		.num_events = num_events,
+	};
+	uint64_t now, deadline = 0;
+	int wait_ms = timeout_ms;
+	uint64_t expired;
+	int i, nfds, fd;
+
+	if (num_events < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (timeout_ms > 0)
+		deadline = hub_now_ms() + timeout_ms;
+
+	while (true) {
+		nfds = epoll_wait(hub->epoll_fd, evs, HUB_EPOLL_BATCH, wait_ms);
+		if (nfds < 0)
+			return -1;
+
+		pthread_mutex_lock(&hub->lock);
+		now = hub_now_ms();
+		for (i = 0; i != nfds; i++) {
+			fd = evs[i].data.fd;
+			if (fd == hub->timer_fd) {
+				if (read(fd, &expired, sizeof(expired)) > 0)
+					hub->timer_ms = 0;
+			} else if (fd < hub->num_fds && hub->contexts[fd]) {
+				/* Not if it was removed after epoll_wait() */
+				hub_drain(hub, hub->contexts[fd], &out, now);
+			}
+		}
+		if (hub->num_held)
+			hub_flush_held(hub, &out, now);
+		hub_arm_timer(hub);
+		pthread_mutex_unlock(&hub->lock);
+
+		if (out.delivered || !timeout_ms)
+			break;
+		if (timeout_ms > 0) {
+			now = hub_now_ms();
+			if (now >= deadline)
+				break;
+			wait_ms = deadline - now;
+		}
+	}
+
+	return out.num_stored;
+}
@@ -33,6 +33,8 @@
 #include <config.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <endian.h>
 #include <getopt.h>
 #include <string.h>
@@ -76,6 +78,8 @@ static const char *event_name_str(enum ibv_event_type event_type)
 	}
 }
 
+#define MAX_EVENTS 64
+
 static void usage(const char *argv0)
 {
 	printf("Usage:\n");
@@ -83,16 +87,21 @@ static void usage(const char *argv0)
 	printf("\n");
 	printf("Options:\n");
 	printf("  -d, --ib-dev=<dev>     use IB device <dev> (default first device found)\n");
+	printf("  -a, --all              watch all the IB devices\n");
+	printf("  -c, --coalesce=<ms>    merge repeated port events within <ms>\n");
 	printf("  -h, --help             print a help text and exit\n");
 }
 
 int main(int argc, char *argv[])
 {
+	struct ibv_event_hub_init_attr hub_attr = {};
+	struct ibv_hub_event events[MAX_EVENTS];
 	struct ibv_device **dev_list;
-	struct ibv_context *context;
-	struct ibv_async_event event;
+	struct ibv_event_hub *hub;
 	char   *ib_devname = NULL;
+	bool all = false;
 	int i = 0;
+	int n, j;
 
 	/* Force line-buffering in case stdout is redirected */
 	setvbuf(stdout, NULL, _IOLBF, 0);
@@ -102,17 +111,25 @@ int main(int argc, char *argv[])
 		int c;
 		static struct option long_options[] = {
 			{ .name = "ib-dev",    .has_arg = 1, .val = 'd' },
+			{ .name = "all",       .has_arg = 0, .val = 'a' },
+			{ .name = "coalesce",  .has_arg = 1, .val = 'c' },
 			{ .name = "help",      .has_arg = 0, .val = 'h' },
 			{}
 		};
 
-		c = getopt_long(argc, argv, "d:h", long_options, NULL);
+		c = getopt_long(argc, argv, "d:ac:h", long_options, NULL);
 		if (c == -1)
 			break;
 		switch (c) {
 		case 'd':
 			ib_devname = strdupa(optarg);
 			break;
+		case 'a':
+			all = true;
+			break;
+		case 'c':
+			hub_attr.coalesce_ms = strtoul(optarg, NULL, 0);
+			break;
 		case 'h':
 			ret = 0;
 			SWITCH_FALLTHROUGH;
@@ -126,7 +143,7 @@ int main(int argc, char *argv[])
 		perror("Failed to get IB devices list");
 		return 1;
 	}
-	if (ib_devname) {
+	if (ib_devname && !all) {
 		for (; dev_list[i]; ++i) {
 			if (!strcmp(ibv_get_device_name(dev_list[i]), ib_devname))
 				break;
@@ -139,25 +156,50 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	context = ibv_open_device(dev_list[i]);
-	if (!context) {
-		fprintf(stderr, "Couldn't get context for %s\n",
-			ibv_get_device_name(dev_list[i]));
+	hub = ibv_create_event_hub(&hub_attr);
+	if (!hub) {
+		perror("Couldn't create event hub");
 		return 1;
 	}
 
-	printf("%s: async event FD %d\n",
-	       ibv_get_device_name(dev_list[i]), context->async_fd);
+	for (; dev_list[i]; ++i) {
+		struct ibv_context *context;
 
-	while (1) {
-		if (ibv_get_async_event(context, &event))
+		context = ibv_open_device(dev_list[i]);
+		if (!context) {
+			fprintf(stderr, "Couldn't get context for %s\n",
+				ibv_get_device_name(dev_list[i]));
 			return 1;
+		}
+		if (ibv_event_hub_add(hub, context, NULL, NULL)) {
+			fprintf(stderr, "Couldn't add %s to the event hub\n",
+				ibv_get_device_name(dev_list[i]));
+			return 1;
+		}
 
-		printf("  event_type %s (%d), port %d\n",
-		       event_name_str(event.event_type),
-		       event.event_type, event.element.port_num);
+		printf("%s: async event FD %d\n",
+		       ibv_get_device_name(dev_list[i]), context->async_fd);
+		if (!all)
+			break;
+	}
+
+	while (1) {
+		n = ibv_event_hub_poll(hub, events, MAX_EVENTS, -1);
+		if (n < 0)
+			return 1;
 
-		ibv_ack_async_event(&event);
+		for (j = 0; j < n; j++) {
+			printf("  %s: event_type %s (%d), port %d",
+			       ibv_get_device_name(events[j].context->device),
+			       event_name_str(events[j].event.event_type),
+			       events[j].event.event_type,
+			       events[j].event.element.port_num);
+			if (events[j].count > 1)
+				printf(", %u events", events[j].count);
+			printf("\n");
+
+			ibv_ack_async_event(&events[j].event);
+		}
 	}
 
 	return 0;
@@ -493,6 +493,27 @@ static void print_raw_packet_caps(uint32_t raw_packet_caps)
 		printf("\t\t\t\t\tDelay drop\n");
 }
 
+/* The cost of the queries above, when run with IBV_STATS=1 */
+static void print_stats(struct ibv_context *ctx)
+{
+	struct ibv_stats stats;
+
+	if (ibv_query_stats(ctx, &stats))
+		return;
+
+	printf("\tstats:\n");
+	printf("\t\tcmds:\t\t\t\t%" PRIu64 "\n", stats.cmds);
+	printf("\t\tcmd_ns:\t\t\t\t%" PRIu64 "\n", stats.cmd_ns);
+	printf("\t\tpost_send_calls:\t\t%" PRIu64 "\n", stats.post_send_calls);
+	printf("\t\tsend_wrs:\t\t\t%" PRIu64 "\n", stats.send_wrs);
+	printf("\t\tsend_bytes:\t\t\t%" PRIu64 "\n", stats.send_bytes);
+	printf("\t\tpost_recv_calls:\t\t%" PRIu64 "\n", stats.post_recv_calls);
+	printf("\t\trecv_wrs:\t\t\t%" PRIu64 "\n", stats.recv_wrs);
+	printf("\t\tpoll_cq_calls:\t\t\t%" PRIu64 "\n", stats.poll_cq_calls);
+	printf("\t\tcqes:\t\t\t\t%" PRIu64 "\n", stats.cqes);
+	printf("\t\tempty_polls:\t\t\t%" PRIu64 "\n", stats.empty_polls);
+}
+
 static int print_hca_cap(struct ibv_device *ib_dev, uint8_t ib_port)
 {
 	struct ibv_context *ctx;
@@ -660,6 +681,9 @@ static int print_hca_cap(struct ibv_device *ib_dev, uint8_t ib_port)
 		}
 		printf("\n");
 	}
+
+	if (verbose)
+		print_stats(ctx);
 cleanup:
 	if (ctx)
 		if (ibv_close_device(ctx)) {
@@ -0,0 +1,195 @@
+/* Licensed under the OpenIB.org BSD license (FreeBSD Variant) - See COPYING.md
+ */
+
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <infiniband/verbs.h>
+
+#include <ccan/minmax.h>
+
+/*
+ * Times ibv_get_device_list(), which every verbs process calls when it
+ * starts.  The first call of a process also loads the providers, so it is
+ * timed in freshly forked children.  The later calls of a process enumerate
+ * the devices again and match them against the devices it already has.
+ */
+
+struct call_time {
+	uint64_t		total_ns;
+	uint64_t		min_ns;
+	uint64_t		max_ns;
+	unsigned int		calls;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void call_done(struct call_time *ct, uint64_t ns)
+{
+	ct->total_ns += ns;
+	ct->min_ns = ct->calls ? min(ct->min_ns, ns) : ns;
+	ct->max_ns = max(ct->max_ns, ns);
+	ct->calls++;
+}
+
+/* Returns the number of devices, or -1 */
+static int time_device_list(uint64_t *ns)
+{
+	struct ibv_device **dev_list;
+	uint64_t start;
+	int num;
+
+	start = now_ns();
+	dev_list = ibv_get_device_list(&num);
+	*ns = now_ns() - start;
+	if (!dev_list)
+		return -1;
+	ibv_free_device_list(dev_list);
+	return num;
+}
+
+/* The first call of a new process, in a child that reports it on a pipe */
+static int time_first_call(uint64_t *ns)
+{
+	int fds[2];
+	pid_t pid;
+	int status;
+	int ret = -1;
+
+	if (pipe(fds)) {
+		perror("pipe");
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		goto out;
+	}
+	if (!pid) {
+		uint64_t child_ns;
+
+		close(fds[0]);
+		if (time_device_list(&child_ns) < 0 ||
+		    write(fds[1], &child_ns, sizeof(child_ns)) !=
+			    sizeof(child_ns))
+			_exit(1);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	fds[1] = -1;
+	if (read(fds[0], ns, sizeof(*ns)) == sizeof(*ns))
+		ret = 0;
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		ret = -1;
+out:
+	close(fds[0]);
+	if (fds[1] != -1)
+		close(fds[1]);
+	return ret;
+}
+
+static void show_time(const char *name, const struct call_time *ct)
+{
+	if (!ct->calls)
+		return;
+	printf("%-12s: %8u%11.2f%11.2f%11.2f\n", name, ct->calls,
+	       ct->total_ns / 1e3 / ct->calls, ct->min_ns / 1e3,
+	       ct->max_ns / 1e3);
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s            time ibv_get_device_list()\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -c, --cold=<num>         number of new processes timed (default 10)\n");
+	printf("  -n, --iters=<num>        number of calls timed in this process (default 100)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct call_time cold = {}, warm = {};
+	unsigned int cold_iters = 10;
+	unsigned int iters = 100;
+	unsigned int i;
+	uint64_t ns;
+	int num = 0;
+
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{ .name = "cold",  .has_arg = 1, .val = 'c' },
+			{ .name = "iters", .has_arg = 1, .val = 'n' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "c:n:", long_options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'c':
+			cold_iters = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Before this process calls into libibverbs itself */
+	for (i = 0; i < cold_iters; i++) {
+		if (time_first_call(&ns)) {
+			fprintf(stderr, "Failed to get IB devices list\n");
+			return 1;
+		}
+		call_done(&cold, ns);
+	}
+
+	/* The first call here loads the providers like the cold ones */
+	for (i = 0; i <= iters; i++) {
+		num = time_device_list(&ns);
+		if (num < 0) {
+			perror("Failed to get IB devices list");
+			return 1;
+		}
+		if (i)
+			call_done(&warm, ns);
+	}
+
+	printf("devices: %d\n", num);
+	printf("call           count    avg us     min us     max us\n");
+	show_time("first call", &cold);
+	show_time("later calls", &warm);
+	return 0;
+}
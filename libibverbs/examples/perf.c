@@ -0,0 +1,1519 @@
+/* Licensed under the OpenIB.org BSD license (FreeBSD Variant) - See COPYING.md
+ */
+
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <malloc.h>
+#include <getopt.h>
+#include <time.h>
+#include <inttypes.h>
+#include <endian.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sched.h>
+
+#include "pingpong.h"
+
+#include <ccan/minmax.h>
+
+/*
+ * RC verbs benchmark.  The client drives all the traffic, the server only
+ * answers: it takes the test parameters from the client, creates as many
+ * QPs and threads, and reposts receives for send and write with immediate.
+ */
+
+enum perf_test {
+	PERF_SEND,
+	PERF_WRITE,
+	PERF_WRITE_IMM,
+	PERF_READ,
+	PERF_FETCH_ADD,
+	PERF_CMP_SWAP,
+	PERF_NUM_TESTS,
+};
+
+static const char *const perf_test_str[PERF_NUM_TESTS] = {
+	[PERF_SEND]		= "send",
+	[PERF_WRITE]		= "write",
+	[PERF_WRITE_IMM]	= "write_imm",
+	[PERF_READ]		= "read",
+	[PERF_FETCH_ADD]	= "fetch_add",
+	[PERF_CMP_SWAP]		= "cmp_swap",
+};
+
+enum {
+	PERF_POLL_BATCH		= 16,
+	/* log2 buckets of the latency histogram, in ns */
+	PERF_HIST_BUCKETS	= 40,
+};
+
+/* Sent by the client, the server runs with the client's parameters */
+struct perf_config {
+	unsigned int		test;
+	unsigned int		latency;
+	unsigned int		size;
+	unsigned int		iters;
+	unsigned int		num_qps;
+	unsigned int		num_threads;
+	unsigned int		tx_depth;
+	unsigned int		rx_depth;
+	unsigned int		post_list;
+	unsigned int		cq_mod;
+	unsigned int		inline_size;
+	unsigned int		new_api;
+	unsigned int		thread_domain;
+};
+
+#define PERF_CONFIG_FMT "%u %u %u %u %u %u %u %u %u %u %u %u %u"
+
+struct perf_dest {
+	int			lid;
+	int			qpn;
+	int			psn;
+	uint32_t		rkey;
+	uint64_t		addr;
+	union ibv_gid		gid;
+};
+
+struct perf_qp {
+	unsigned int		index;
+	struct ibv_qp		*qp;
+	struct ibv_qp_ex	*qpx;
+	struct ibv_mr		*mr;
+	char			*buf;
+	struct ibv_sge		sge;
+	struct perf_dest	local;
+	struct perf_dest	remote;
+	/* Client side, WRs posted, completed and posted since the last
+	 * signaled one
+	 */
+	unsigned int		posted;
+	unsigned int		completed;
+	unsigned int		unsignaled;
+};
+
+struct perf_context;
+
+struct perf_thread {
+	struct perf_context	*ctx;
+	pthread_t		thread;
+	/* With thread domains, the parent domain of the thread's CQ and QPs */
+	struct ibv_td		*td;
+	struct ibv_pd		*pd;
+	union {
+		struct ibv_cq		*cq;
+		struct ibv_cq_ex	*cq_ex;
+	} cq_s;
+	struct perf_qp		**qps;
+	unsigned int		num_qps;
+	struct ibv_send_wr	*wrs;
+	unsigned int		send_flags;
+	uint64_t		*lat;
+	uint64_t		num_lat;
+	uint64_t		start_ns;
+	uint64_t		end_ns;
+	int			err;
+};
+
+struct perf_context {
+	struct ibv_context	*context;
+	struct ibv_pd		*pd;
+	struct ibv_device_attr	dev_attr;
+	struct ibv_port_attr	portinfo;
+	struct perf_config	cfg;
+	struct perf_qp		*qps;
+	struct perf_thread	*threads;
+	atomic_int		start;
+	atomic_int		stop;
+	int			server;
+};
+
+static int page_size;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool perf_is_atomic(const struct perf_config *cfg)
+{
+	return cfg->test == PERF_FETCH_ADD || cfg->test == PERF_CMP_SWAP;
+}
+
+static bool perf_needs_recv(const struct perf_config *cfg)
+{
+	return cfg->test == PERF_SEND || cfg->test == PERF_WRITE_IMM;
+}
+
+static bool perf_use_inline(const struct perf_config *cfg)
+{
+	return cfg->size <= cfg->inline_size &&
+	       (cfg->test == PERF_SEND || cfg->test == PERF_WRITE ||
+		cfg->test == PERF_WRITE_IMM);
+}
+
+static struct ibv_cq *perf_cq(struct perf_thread *th)
+{
+	return th->ctx->cfg.new_api ? ibv_cq_ex_to_cq(th->cq_s.cq_ex) :
+		th->cq_s.cq;
+}
+
+static int sock_read(int sockfd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(sockfd, p, len);
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int sock_write(int sockfd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(sockfd, p, len);
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int perf_client_connect(const char *servername, int port)
+{
+	struct addrinfo *res, *t;
+	struct addrinfo hints = {
+		.ai_family   = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM
+	};
+	char *service;
+	int sockfd = -1;
+	int n;
+
+	if (asprintf(&service, "%d", port) < 0)
+		return -1;
+
+	n = getaddrinfo(servername, service, &hints, &res);
+	if (n) {
+		fprintf(stderr, "%s for %s:%d\n", gai_strerror(n), servername,
+			port);
+		free(service);
+		return -1;
+	}
+
+	for (t = res; t; t = t->ai_next) {
+		sockfd = socket(t->ai_family, t->ai_socktype, t->ai_protocol);
+		if (sockfd >= 0) {
+			if (!connect(sockfd, t->ai_addr, t->ai_addrlen))
+				break;
+			close(sockfd);
+			sockfd = -1;
+		}
+	}
+
+	freeaddrinfo(res);
+	free(service);
+
+	if (sockfd < 0)
+		fprintf(stderr, "Couldn't connect to %s:%d\n", servername, port);
+	return sockfd;
+}
+
+static int perf_server_accept(int port)
+{
+	struct addrinfo *res, *t;
+	struct addrinfo hints = {
+		.ai_flags    = AI_PASSIVE,
+		.ai_family   = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM
+	};
+	char *service;
+	int sockfd = -1, connfd;
+	int n;
+
+	if (asprintf(&service, "%d", port) < 0)
+		return -1;
+
+	n = getaddrinfo(NULL, service, &hints, &res);
+	if (n) {
+		fprintf(stderr, "%s for port %d\n", gai_strerror(n), port);
+		free(service);
+		return -1;
+	}
+
+	for (t = res; t; t = t->ai_next) {
+		sockfd = socket(t->ai_family, t->ai_socktype, t->ai_protocol);
+		if (sockfd >= 0) {
+			n = 1;
+
+			setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &n, sizeof n);
+
+			if (!bind(sockfd, t->ai_addr, t->ai_addrlen))
+				break;
+			close(sockfd);
+			sockfd = -1;
+		}
+	}
+
+	freeaddrinfo(res);
+	free(service);
+
+	if (sockfd < 0) {
+		fprintf(stderr, "Couldn't listen to port %d\n", port);
+		return -1;
+	}
+
+	listen(sockfd, 1);
+	connfd = accept(sockfd, NULL, NULL);
+	close(sockfd);
+	if (connfd < 0)
+		fprintf(stderr, "accept() failed\n");
+	return connfd;
+}
+
+#define PERF_DEST_MSG \
+	"0000:000000:000000:00000000:0000000000000000:00000000000000000000000000000000"
+
+static int perf_send_dests(struct perf_context *ctx, int sockfd)
+{
+	char msg[sizeof PERF_DEST_MSG];
+	struct perf_dest *dest;
+	char gid[33];
+	unsigned int i;
+
+	for (i = 0; i < ctx->cfg.num_qps; i++) {
+		dest = &ctx->qps[i].local;
+		gid_to_wire_gid(&dest->gid, gid);
+		sprintf(msg, "%04x:%06x:%06x:%08x:%016" PRIx64 ":%s",
+			dest->lid, dest->qpn, dest->psn, dest->rkey,
+			dest->addr, gid);
+		if (sock_write(sockfd, msg, sizeof msg)) {
+			fprintf(stderr, "Couldn't send local address\n");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int perf_recv_dests(struct perf_context *ctx, int sockfd)
+{
+	char msg[sizeof PERF_DEST_MSG];
+	struct perf_dest *dest;
+	char gid[33];
+	unsigned int i;
+
+	for (i = 0; i < ctx->cfg.num_qps; i++) {
+		dest = &ctx->qps[i].remote;
+		if (sock_read(sockfd, msg, sizeof msg)) {
+			fprintf(stderr, "Couldn't read remote address\n");
+			return 1;
+		}
+		msg[sizeof msg - 1] = 0;
+		if (sscanf(msg, "%x:%x:%x:%x:%" SCNx64 ":%32s", &dest->lid,
+			   &dest->qpn, &dest->psn, &dest->rkey, &dest->addr,
+			   gid) != 6) {
+			fprintf(stderr, "Bad remote address\n");
+			return 1;
+		}
+		wire_gid_to_gid(gid, &dest->gid);
+	}
+	return 0;
+}
+
+static int perf_connect_qp(struct perf_context *ctx, struct perf_qp *qp,
+			   int port, enum ibv_mtu mtu, int sl, int sgid_idx)
+{
+	struct perf_dest *dest = &qp->remote;
+	struct ibv_qp_attr attr = {
+		.qp_state		= IBV_QPS_RTR,
+		.path_mtu		= mtu,
+		.dest_qp_num		= dest->qpn,
+		.rq_psn			= dest->psn,
+		.max_dest_rd_atomic	= max_t(int, ctx->dev_attr.max_qp_rd_atom, 1),
+		.min_rnr_timer		= 12,
+		.ah_attr		= {
+			.is_global	= 0,
+			.dlid		= dest->lid,
+			.sl		= sl,
+			.src_path_bits	= 0,
+			.port_num	= port
+		}
+	};
+
+	if (dest->gid.global.interface_id) {
+		attr.ah_attr.is_global = 1;
+		attr.ah_attr.grh.hop_limit = 1;
+		attr.ah_attr.grh.dgid = dest->gid;
+		attr.ah_attr.grh.sgid_index = sgid_idx;
+	}
+	if (ibv_modify_qp(qp->qp, &attr,
+			  IBV_QP_STATE              |
+			  IBV_QP_AV                 |
+			  IBV_QP_PATH_MTU           |
+			  IBV_QP_DEST_QPN           |
+			  IBV_QP_RQ_PSN             |
+			  IBV_QP_MAX_DEST_RD_ATOMIC |
+			  IBV_QP_MIN_RNR_TIMER)) {
+		fprintf(stderr, "Failed to modify QP to RTR\n");
+		return 1;
+	}
+
+	attr.qp_state	    = IBV_QPS_RTS;
+	attr.timeout	    = 14;
+	attr.retry_cnt	    = 7;
+	attr.rnr_retry	    = 7;
+	attr.sq_psn	    = qp->local.psn;
+	attr.max_rd_atomic  = max_t(int, ctx->dev_attr.max_qp_init_rd_atom, 1);
+	if (ibv_modify_qp(qp->qp, &attr,
+			  IBV_QP_STATE              |
+			  IBV_QP_TIMEOUT            |
+			  IBV_QP_RETRY_CNT          |
+			  IBV_QP_RNR_RETRY          |
+			  IBV_QP_SQ_PSN             |
+			  IBV_QP_MAX_QP_RD_ATOMIC)) {
+		fprintf(stderr, "Failed to modify QP to RTS\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int perf_alloc_thread_domain(struct perf_context *ctx,
+				    struct perf_thread *th)
+{
+	struct ibv_td_init_attr td_attr = {};
+	struct ibv_parent_domain_init_attr pd_attr = {};
+
+	th->td = ibv_alloc_td(ctx->context, &td_attr);
+	if (!th->td) {
+		fprintf(stderr, "Couldn't allocate thread domain\n");
+		return 1;
+	}
+
+	pd_attr.pd = ctx->pd;
+	pd_attr.td = th->td;
+	th->pd = ibv_alloc_parent_domain(ctx->context, &pd_attr);
+	if (!th->pd) {
+		fprintf(stderr, "Couldn't allocate parent domain\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int perf_create_cq(struct perf_context *ctx, struct perf_thread *th,
+			  int cqe)
+{
+	if (th->pd) {
+		/* Only this thread polls the CQ */
+		struct ibv_cq_init_attr_ex attr_ex = {
+			.cqe = cqe,
+			.wc_flags = 0,
+			.comp_mask = IBV_CQ_INIT_ATTR_MASK_FLAGS |
+				     IBV_CQ_INIT_ATTR_MASK_PD,
+			.flags = IBV_CREATE_CQ_ATTR_SINGLE_THREADED,
+			.parent_domain = th->pd,
+		};
+		struct ibv_cq_ex *cq_ex;
+
+		cq_ex = ibv_create_cq_ex(ctx->context, &attr_ex);
+		if (ctx->cfg.new_api)
+			th->cq_s.cq_ex = cq_ex;
+		else
+			th->cq_s.cq = cq_ex ? ibv_cq_ex_to_cq(cq_ex) : NULL;
+	} else if (ctx->cfg.new_api) {
+		struct ibv_cq_init_attr_ex attr_ex = {
+			.cqe = cqe,
+			.wc_flags = 0,
+		};
+
+		th->cq_s.cq_ex = ibv_create_cq_ex(ctx->context, &attr_ex);
+	} else {
+		th->cq_s.cq = ibv_create_cq(ctx->context, cqe, NULL, NULL, 0);
+	}
+
+	if (!th->cq_s.cq) {
+		fprintf(stderr, "Couldn't create CQ\n");
+		return 1;
+	}
+	return 0;
+}
+
+static uint64_t perf_send_ops(const struct perf_config *cfg)
+{
+	switch (cfg->test) {
+	case PERF_SEND:
+		return IBV_QP_EX_WITH_SEND;
+	case PERF_WRITE:
+		return IBV_QP_EX_WITH_RDMA_WRITE;
+	case PERF_WRITE_IMM:
+		return IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM;
+	case PERF_READ:
+		return IBV_QP_EX_WITH_RDMA_READ;
+	case PERF_FETCH_ADD:
+		return IBV_QP_EX_WITH_ATOMIC_FETCH_AND_ADD;
+	default:
+		return IBV_QP_EX_WITH_ATOMIC_CMP_AND_SWP;
+	}
+}
+
+static int perf_create_qp(struct perf_context *ctx, struct perf_thread *th,
+			  struct perf_qp *qp)
+{
+	struct perf_config *cfg = &ctx->cfg;
+	struct ibv_qp_init_attr_ex init_attr = {
+		.send_cq = perf_cq(th),
+		.recv_cq = perf_cq(th),
+		.cap = {
+			.max_send_wr  = ctx->server ? 1 : cfg->tx_depth,
+			.max_recv_wr  = ctx->server && perf_needs_recv(cfg) ?
+					cfg->rx_depth : 1,
+			.max_send_sge = 1,
+			.max_recv_sge = 1,
+			.max_inline_data = ctx->server ? 0 : cfg->inline_size,
+		},
+		.qp_type = IBV_QPT_RC,
+		.sq_sig_all = 0,
+		.comp_mask = IBV_QP_INIT_ATTR_PD,
+		.pd = th->pd ? th->pd : ctx->pd,
+	};
+	struct ibv_qp_attr attr = {
+		.qp_state        = IBV_QPS_INIT,
+		.pkey_index      = 0,
+		.qp_access_flags = IBV_ACCESS_REMOTE_WRITE |
+				   IBV_ACCESS_REMOTE_READ,
+	};
+	int access_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
+			   IBV_ACCESS_REMOTE_READ;
+	size_t len = max_t(size_t, cfg->size, sizeof(uint64_t));
+
+	if (perf_is_atomic(cfg)) {
+		access_flags |= IBV_ACCESS_REMOTE_ATOMIC;
+		attr.qp_access_flags |= IBV_ACCESS_REMOTE_ATOMIC;
+	}
+
+	qp->buf = memalign(page_size, len);
+	if (!qp->buf) {
+		fprintf(stderr, "Couldn't allocate work buf.\n");
+		return 1;
+	}
+	memset(qp->buf, 0x7b, len);
+
+	qp->mr = ibv_reg_mr(ctx->pd, qp->buf, len, access_flags);
+	if (!qp->mr) {
+		fprintf(stderr, "Couldn't register MR\n");
+		return 1;
+	}
+
+	if (cfg->new_api && !ctx->server) {
+		init_attr.comp_mask |= IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+		init_attr.send_ops_flags = perf_send_ops(cfg);
+	}
+
+	qp->qp = ibv_create_qp_ex(ctx->context, &init_attr);
+	if (!qp->qp) {
+		fprintf(stderr, "Couldn't create QP\n");
+		return 1;
+	}
+	if (init_attr.comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS)
+		qp->qpx = ibv_qp_to_qp_ex(qp->qp);
+
+	if (!ctx->server && init_attr.cap.max_inline_data < cfg->inline_size) {
+		fprintf(stderr, "Device supports only %u bytes of inline data\n",
+			init_attr.cap.max_inline_data);
+		return 1;
+	}
+
+	if (ibv_modify_qp(qp->qp, &attr,
+			  IBV_QP_STATE              |
+			  IBV_QP_PKEY_INDEX         |
+			  IBV_QP_PORT               |
+			  IBV_QP_ACCESS_FLAGS)) {
+		fprintf(stderr, "Failed to modify QP to INIT\n");
+		return 1;
+	}
+
+	qp->sge.addr = (uintptr_t)qp->buf;
+	qp->sge.length = perf_is_atomic(cfg) ? sizeof(uint64_t) : cfg->size;
+	qp->sge.lkey = qp->mr->lkey;
+
+	qp->local.qpn = qp->qp->qp_num;
+	qp->local.psn = lrand48() & 0xffffff;
+	qp->local.rkey = qp->mr->rkey;
+	qp->local.addr = (uintptr_t)qp->buf;
+	return 0;
+}
+
+static int perf_post_recv(struct perf_qp *qp, unsigned int n)
+{
+	struct ibv_recv_wr wr = {
+		.wr_id	    = qp->index,
+		.sg_list    = &qp->sge,
+		.num_sge    = 1,
+	};
+	struct ibv_recv_wr *bad_wr;
+	unsigned int i;
+
+	for (i = 0; i < n; ++i)
+		if (ibv_post_recv(qp->qp, &wr, &bad_wr))
+			return 1;
+	return 0;
+}
+
+static int perf_init_ctx(struct perf_context *ctx, struct ibv_device *ib_dev,
+			 int ib_port)
+{
+	struct perf_config *cfg = &ctx->cfg;
+	struct perf_thread *th;
+	struct perf_qp *qp;
+	unsigned int i, j;
+	int cqe;
+
+	ctx->context = ibv_open_device(ib_dev);
+	if (!ctx->context) {
+		fprintf(stderr, "Couldn't get context for %s\n",
+			ibv_get_device_name(ib_dev));
+		return 1;
+	}
+
+	if (ibv_query_device(ctx->context, &ctx->dev_attr)) {
+		fprintf(stderr, "Couldn't query device\n");
+		return 1;
+	}
+	if (perf_is_atomic(cfg) && ctx->dev_attr.atomic_cap == IBV_ATOMIC_NONE) {
+		fprintf(stderr, "The device doesn't support atomic operations\n");
+		return 1;
+	}
+
+	if (pp_get_port_info(ctx->context, ib_port, &ctx->portinfo)) {
+		fprintf(stderr, "Couldn't get port info\n");
+		return 1;
+	}
+
+	ctx->pd = ibv_alloc_pd(ctx->context);
+	if (!ctx->pd) {
+		fprintf(stderr, "Couldn't allocate PD\n");
+		return 1;
+	}
+
+	ctx->qps = calloc(cfg->num_qps, sizeof(*ctx->qps));
+	ctx->threads = calloc(cfg->num_threads, sizeof(*ctx->threads));
+	if (!ctx->qps || !ctx->threads)
+		return 1;
+
+	/* QP i belongs to thread i % num_threads */
+	for (i = 0; i < cfg->num_threads; i++) {
+		th = &ctx->threads[i];
+		th->ctx = ctx;
+		th->num_qps = (cfg->num_qps - i + cfg->num_threads - 1) /
+			      cfg->num_threads;
+		th->qps = calloc(th->num_qps, sizeof(*th->qps));
+		th->wrs = calloc(cfg->post_list, sizeof(*th->wrs));
+		if (!th->qps || !th->wrs)
+			return 1;
+
+		if (cfg->thread_domain && perf_alloc_thread_domain(ctx, th))
+			return 1;
+
+		cqe = th->num_qps * (ctx->server ? cfg->rx_depth :
+					cfg->tx_depth);
+		if (perf_create_cq(ctx, th, cqe))
+			return 1;
+
+		for (j = 0; j < th->num_qps; j++) {
+			qp = &ctx->qps[i + j * cfg->num_threads];
+			qp->index = i + j * cfg->num_threads;
+			th->qps[j] = qp;
+			if (perf_create_qp(ctx, th, qp))
+				return 1;
+			if (ctx->server && perf_needs_recv(cfg) &&
+			    perf_post_recv(qp, cfg->rx_depth)) {
+				fprintf(stderr, "Couldn't post receive\n");
+				return 1;
+			}
+		}
+
+		if (cfg->latency && !ctx->server) {
+			th->lat = calloc((uint64_t)th->num_qps * cfg->iters,
+					 sizeof(*th->lat));
+			if (!th->lat)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static void perf_close_ctx(struct perf_context *ctx)
+{
+	struct perf_thread *th;
+	struct perf_qp *qp;
+	unsigned int i;
+
+	for (i = 0; ctx->qps && i < ctx->cfg.num_qps; i++) {
+		qp = &ctx->qps[i];
+		if (qp->qp && ibv_destroy_qp(qp->qp))
+			fprintf(stderr, "Couldn't destroy QP\n");
+		if (qp->mr && ibv_dereg_mr(qp->mr))
+			fprintf(stderr, "Couldn't deregister MR\n");
+		free(qp->buf);
+	}
+
+	for (i = 0; ctx->threads && i < ctx->cfg.num_threads; i++) {
+		th = &ctx->threads[i];
+		if (th->cq_s.cq && ibv_destroy_cq(perf_cq(th)))
+			fprintf(stderr, "Couldn't destroy CQ\n");
+		if (th->pd && ibv_dealloc_pd(th->pd))
+			fprintf(stderr, "Couldn't deallocate parent domain\n");
+		if (th->td && ibv_dealloc_td(th->td))
+			fprintf(stderr, "Couldn't deallocate thread domain\n");
+		free(th->qps);
+		free(th->wrs);
+		free(th->lat);
+	}
+
+	if (ctx->pd && ibv_dealloc_pd(ctx->pd))
+		fprintf(stderr, "Couldn't deallocate PD\n");
+	if (ctx->context && ibv_close_device(ctx->context))
+		fprintf(stderr, "Couldn't release context\n");
+
+	free(ctx->qps);
+	free(ctx->threads);
+}
+
+/* Returns the number of completions and their wr_ids, or -1 */
+static int perf_poll(struct perf_thread *th, uint64_t *wr_ids, int max)
+{
+	struct ibv_wc wc[PERF_POLL_BATCH];
+	int ret, n = 0, i;
+
+	if (th->ctx->cfg.new_api) {
+		struct ibv_cq_ex *cq_ex = th->cq_s.cq_ex;
+		struct ibv_poll_cq_attr attr = {};
+
+		ret = ibv_start_poll(cq_ex, &attr);
+		if (ret == ENOENT)
+			return 0;
+		if (ret) {
+			fprintf(stderr, "poll CQ failed %d\n", ret);
+			return -1;
+		}
+		do {
+			if (cq_ex->status != IBV_WC_SUCCESS) {
+				fprintf(stderr, "Completion with error: %s\n",
+					ibv_wc_status_str(cq_ex->status));
+				ibv_end_poll(cq_ex);
+				return -1;
+			}
+			wr_ids[n++] = cq_ex->wr_id;
+			if (n == max)
+				break;
+			ret = ibv_next_poll(cq_ex);
+		} while (!ret);
+		ibv_end_poll(cq_ex);
+
+		if (ret && ret != ENOENT) {
+			fprintf(stderr, "poll CQ failed %d\n", ret);
+			return -1;
+		}
+		return n;
+	}
+
+	n = ibv_poll_cq(th->cq_s.cq, min_t(int, max, PERF_POLL_BATCH), wc);
+	if (n < 0) {
+		fprintf(stderr, "poll CQ failed %d\n", n);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (wc[i].status != IBV_WC_SUCCESS) {
+			fprintf(stderr, "Completion with error: %s\n",
+				ibv_wc_status_str(wc[i].status));
+			return -1;
+		}
+		wr_ids[i] = wc[i].wr_id;
+	}
+	return n;
+}
+
+static void perf_wr_new_api(struct perf_thread *th, struct perf_qp *qp,
+			    uint64_t wr_id, unsigned int flags)
+{
+	struct perf_config *cfg = &th->ctx->cfg;
+	struct ibv_qp_ex *qpx = qp->qpx;
+
+	qpx->wr_id = wr_id;
+	qpx->wr_flags = flags & ~IBV_SEND_INLINE;
+
+	switch (cfg->test) {
+	case PERF_SEND:
+		ibv_wr_send(qpx);
+		break;
+	case PERF_WRITE:
+		ibv_wr_rdma_write(qpx, qp->remote.rkey, qp->remote.addr);
+		break;
+	case PERF_WRITE_IMM:
+		ibv_wr_rdma_write_imm(qpx, qp->remote.rkey, qp->remote.addr,
+				      htobe32(qp->posted));
+		break;
+	case PERF_READ:
+		ibv_wr_rdma_read(qpx, qp->remote.rkey, qp->remote.addr);
+		break;
+	case PERF_FETCH_ADD:
+		ibv_wr_atomic_fetch_add(qpx, qp->remote.rkey, qp->remote.addr,
+					1);
+		break;
+	case PERF_CMP_SWAP:
+		ibv_wr_atomic_cmp_swp(qpx, qp->remote.rkey, qp->remote.addr,
+				      0, 0);
+		break;
+	}
+
+	if (flags & IBV_SEND_INLINE)
+		ibv_wr_set_inline_data(qpx, qp->buf, qp->sge.length);
+	else
+		ibv_wr_set_sge(qpx, qp->sge.lkey, qp->sge.addr,
+			       qp->sge.length);
+}
+
+static void perf_wr_legacy(struct perf_thread *th, struct perf_qp *qp,
+			   struct ibv_send_wr *wr, uint64_t wr_id,
+			   unsigned int flags)
+{
+	static const enum ibv_wr_opcode opcodes[PERF_NUM_TESTS] = {
+		[PERF_SEND]		= IBV_WR_SEND,
+		[PERF_WRITE]		= IBV_WR_RDMA_WRITE,
+		[PERF_WRITE_IMM]	= IBV_WR_RDMA_WRITE_WITH_IMM,
+		[PERF_READ]		= IBV_WR_RDMA_READ,
+		[PERF_FETCH_ADD]	= IBV_WR_ATOMIC_FETCH_AND_ADD,
+		[PERF_CMP_SWAP]		= IBV_WR_ATOMIC_CMP_AND_SWP,
+	};
+	struct perf_config *cfg = &th->ctx->cfg;
+
+	memset(wr, 0, sizeof(*wr));
+	wr->wr_id = wr_id;
+	wr->sg_list = &qp->sge;
+	wr->num_sge = 1;
+	wr->opcode = opcodes[cfg->test];
+	wr->send_flags = flags;
+
+	if (perf_is_atomic(cfg)) {
+		wr->wr.atomic.remote_addr = qp->remote.addr;
+		wr->wr.atomic.rkey = qp->remote.rkey;
+		wr->wr.atomic.compare_add = cfg->test == PERF_FETCH_ADD;
+		wr->wr.atomic.swap = 0;
+	} else if (cfg->test != PERF_SEND) {
+		wr->wr.rdma.remote_addr = qp->remote.addr;
+		wr->wr.rdma.rkey = qp->remote.rkey;
+	}
+	if (cfg->test == PERF_WRITE_IMM)
+		wr->imm_data = htobe32(qp->posted);
+}
+
+/*
+ * Post a list of n WRs.  One in cq_mod WRs and the last WR of the test are
+ * signaled, the wr_id of a signaled WR carries the QP index and the number
+ * of WRs its completion retires.
+ */
+static int perf_post_send(struct perf_thread *th, struct perf_qp *qp,
+			  unsigned int n)
+{
+	struct perf_config *cfg = &th->ctx->cfg;
+	struct ibv_send_wr *bad_wr;
+	unsigned int flags, i;
+	uint64_t wr_id;
+
+	if (cfg->new_api)
+		ibv_wr_start(qp->qpx);
+
+	for (i = 0; i < n; i++) {
+		flags = th->send_flags;
+		wr_id = 0;
+		if (++qp->unsignaled == cfg->cq_mod ||
+		    qp->posted + 1 == cfg->iters) {
+			flags |= IBV_SEND_SIGNALED;
+			wr_id = (uint64_t)qp->index << 32 | qp->unsignaled;
+			qp->unsignaled = 0;
+		}
+
+		if (cfg->new_api) {
+			perf_wr_new_api(th, qp, wr_id, flags);
+		} else {
+			perf_wr_legacy(th, qp, &th->wrs[i], wr_id, flags);
+			th->wrs[i].next = i + 1 < n ? &th->wrs[i + 1] : NULL;
+		}
+		qp->posted++;
+	}
+
+	if (cfg->new_api)
+		return ibv_wr_complete(qp->qpx);
+	return ibv_post_send(qp->qp, th->wrs, &bad_wr);
+}
+
+static void perf_complete(struct perf_context *ctx, uint64_t wr_id,
+			  uint64_t *done)
+{
+	struct perf_qp *qp = &ctx->qps[wr_id >> 32];
+	uint32_t num = wr_id;
+
+	qp->completed += num;
+	*done += num;
+}
+
+/* One WR in flight, each timed from its post to its completion */
+static int perf_run_lat(struct perf_thread *th)
+{
+	struct perf_config *cfg = &th->ctx->cfg;
+	uint64_t wr_id, done = 0, start;
+	unsigned int i, j;
+	int n;
+
+	for (i = 0; i < cfg->iters; i++) {
+		for (j = 0; j < th->num_qps; j++) {
+			start = now_ns();
+			if (perf_post_send(th, th->qps[j], 1)) {
+				fprintf(stderr, "Couldn't post send\n");
+				return 1;
+			}
+			do {
+				n = perf_poll(th, &wr_id, 1);
+			} while (!n);
+			if (n < 0)
+				return 1;
+			th->lat[th->num_lat++] = now_ns() - start;
+			perf_complete(th->ctx, wr_id, &done);
+		}
+	}
+	return 0;
+}
+
+/* Keep up to tx_depth WRs in flight on each QP of the thread */
+static int perf_run_bw(struct perf_thread *th)
+{
+	struct perf_config *cfg = &th->ctx->cfg;
+	uint64_t total = (uint64_t)th->num_qps * cfg->iters;
+	uint64_t wr_ids[PERF_POLL_BATCH];
+	uint64_t done = 0;
+	struct perf_qp *qp;
+	unsigned int i, num;
+	int n;
+
+	while (done < total) {
+		for (i = 0; i < th->num_qps; i++) {
+			qp = th->qps[i];
+			while (qp->posted < cfg->iters) {
+				num = min(cfg->post_list,
+					  cfg->iters - qp->posted);
+				if (qp->posted - qp->completed + num >
+				    cfg->tx_depth)
+					break;
+				if (perf_post_send(th, qp, num)) {
+					fprintf(stderr, "Couldn't post send\n");
+					return 1;
+				}
+			}
+		}
+
+		n = perf_poll(th, wr_ids, PERF_POLL_BATCH);
+		if (n < 0)
+			return 1;
+		for (i = 0; i < n; i++)
+			perf_complete(th->ctx, wr_ids[i], &done);
+	}
+	return 0;
+}
+
+static void *perf_client_thread(void *arg)
+{
+	struct perf_thread *th = arg;
+	struct perf_config *cfg = &th->ctx->cfg;
+
+	if (perf_use_inline(cfg))
+		th->send_flags = IBV_SEND_INLINE;
+
+	/* Start together, once all the threads exist */
+	while (!atomic_load(&th->ctx->start))
+		sched_yield();
+	if (atomic_load(&th->ctx->stop))
+		return NULL;
+
+	th->start_ns = now_ns();
+	th->err = cfg->latency ? perf_run_lat(th) : perf_run_bw(th);
+	th->end_ns = now_ns();
+	return NULL;
+}
+
+/* Repost the receives consumed by send or write with immediate */
+static void *perf_server_thread(void *arg)
+{
+	struct perf_thread *th = arg;
+	struct perf_context *ctx = th->ctx;
+	uint64_t wr_ids[PERF_POLL_BATCH];
+	int i, n;
+
+	while (!atomic_load_explicit(&ctx->stop, memory_order_relaxed)) {
+		n = perf_poll(th, wr_ids, PERF_POLL_BATCH);
+		if (n < 0) {
+			th->err = 1;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (perf_post_recv(&ctx->qps[wr_ids[i]], 1)) {
+				fprintf(stderr, "Couldn't post receive\n");
+				th->err = 1;
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *lat, uint64_t num, double p)
+{
+	uint64_t i = p * num / 100;
+
+	return lat[min(i, num - 1)] / 1000.;
+}
+
+static void perf_print_latency(struct perf_context *ctx)
+{
+	uint64_t hist[PERF_HIST_BUCKETS] = {};
+	uint64_t num = 0, sum = 0, i;
+	struct perf_thread *th;
+	unsigned int t, b;
+	uint64_t *lat;
+	bool first = true;
+
+	for (t = 0; t < ctx->cfg.num_threads; t++)
+		num += ctx->threads[t].num_lat;
+	if (!num)
+		return;
+
+	lat = malloc(num * sizeof(*lat));
+	if (!lat)
+		return;
+	for (num = 0, t = 0; t < ctx->cfg.num_threads; t++) {
+		th = &ctx->threads[t];
+		memcpy(lat + num, th->lat, th->num_lat * sizeof(*lat));
+		num += th->num_lat;
+	}
+	qsort(lat, num, sizeof(*lat), cmp_u64);
+
+	for (i = 0; i < num; i++) {
+		sum += lat[i];
+		b = lat[i] ? 63 - __builtin_clzll(lat[i]) : 0;
+		hist[min_t(unsigned int, b, PERF_HIST_BUCKETS - 1)]++;
+	}
+
+	printf(",\n  \"latency_us\": {\n");
+	printf("    \"min\": %.3f,\n", lat[0] / 1000.);
+	printf("    \"avg\": %.3f,\n", sum / 1000. / num);
+	printf("    \"p50\": %.3f,\n", percentile_us(lat, num, 50));
+	printf("    \"p99\": %.3f,\n", percentile_us(lat, num, 99));
+	printf("    \"p99.9\": %.3f,\n", percentile_us(lat, num, 99.9));
+	printf("    \"max\": %.3f\n", lat[num - 1] / 1000.);
+	printf("  },\n  \"latency_histogram\": [");
+	for (b = 0; b < PERF_HIST_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		printf("%s\n    { \"ge_ns\": %" PRIu64 ", \"count\": %" PRIu64
+		       " }", first ? "" : ",", b ? (uint64_t)1 << b : 0, hist[b]);
+		first = false;
+	}
+	printf("\n  ]");
+	free(lat);
+}
+
+static void perf_print(struct perf_context *ctx, const char *devname)
+{
+	struct perf_config *cfg = &ctx->cfg;
+	uint64_t start = UINT64_MAX, end = 0, ops;
+	struct perf_thread *th;
+	double sec;
+	unsigned int i;
+
+	for (i = 0; i < cfg->num_threads; i++) {
+		th = &ctx->threads[i];
+		start = min(start, th->start_ns);
+		end = max(end, th->end_ns);
+	}
+	sec = (end - start) / 1e9;
+	ops = (uint64_t)cfg->num_qps * cfg->iters;
+
+	printf("{\n");
+	printf("  \"device\": \"%s\",\n", devname);
+	printf("  \"test\": \"%s\",\n", perf_test_str[cfg->test]);
+	printf("  \"mode\": \"%s\",\n", cfg->latency ? "latency" : "bw");
+	printf("  \"api\": \"%s\",\n", cfg->new_api ? "ex" : "legacy");
+	printf("  \"thread_domain\": %s,\n",
+	       cfg->thread_domain ? "true" : "false");
+	printf("  \"size\": %u,\n", cfg->size);
+	printf("  \"iters\": %u,\n", cfg->iters);
+	printf("  \"qps\": %u,\n", cfg->num_qps);
+	printf("  \"threads\": %u,\n", cfg->num_threads);
+	printf("  \"tx_depth\": %u,\n", cfg->tx_depth);
+	printf("  \"post_list\": %u,\n", cfg->post_list);
+	printf("  \"cq_mod\": %u,\n", cfg->cq_mod);
+	printf("  \"inline\": %s,\n", perf_use_inline(cfg) ? "true" : "false");
+	printf("  \"ops\": %" PRIu64 ",\n", ops);
+	printf("  \"seconds\": %.6f,\n", sec);
+	printf("  \"msg_rate_mops\": %.4f,\n", sec ? ops / sec / 1e6 : 0);
+	printf("  \"bw_mb_per_sec\": %.2f,\n",
+	       sec ? ops * (double)cfg->size / sec / 1e6 : 0);
+	printf("  \"per_thread_mops\": [");
+	for (i = 0; i < cfg->num_threads; i++) {
+		th = &ctx->threads[i];
+		sec = (th->end_ns - th->start_ns) / 1e9;
+		printf("%s%.4f", i ? ", " : "",
+		       sec ? (double)th->num_qps * cfg->iters / sec / 1e6 : 0);
+	}
+	printf("]");
+	if (cfg->latency)
+		perf_print_latency(ctx);
+	printf("\n}\n");
+}
+
+static int perf_run_threads(struct perf_context *ctx,
+			    void *(*fn)(void *))
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < ctx->cfg.num_threads; i++) {
+		ret = pthread_create(&ctx->threads[i].thread, NULL, fn,
+				     &ctx->threads[i]);
+		if (ret) {
+			fprintf(stderr, "Couldn't create thread: %s\n",
+				strerror(ret));
+			atomic_store(&ctx->stop, 1);
+			atomic_store(&ctx->start, 1);
+			while (i--)
+				pthread_join(ctx->threads[i].thread, NULL);
+			return 1;
+		}
+	}
+	atomic_store(&ctx->start, 1);
+	return 0;
+}
+
+static int perf_join_threads(struct perf_context *ctx)
+{
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < ctx->cfg.num_threads; i++) {
+		pthread_join(ctx->threads[i].thread, NULL);
+		err |= ctx->threads[i].err;
+	}
+	return err;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s            start a server and wait for connection\n", argv0);
+	printf("  %s <host>     connect to server at <host> and run the test\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -p, --port=<port>        listen on/connect to port <port> (default 18515)\n");
+	printf("  -d, --ib-dev=<dev>       use IB device <dev> (default first device found)\n");
+	printf("  -i, --ib-port=<port>     use port <port> of IB device (default 1)\n");
+	printf("  -g, --gid-idx=<gid index> local port gid index\n");
+	printf("  -m, --mtu=<size>         path MTU (default 1024)\n");
+	printf("  -S, --sl=<sl>            service level value\n");
+	printf("\n");
+	printf("Client options, the server takes them from the client:\n");
+	printf("  -t, --test=<test>        send, write, write_imm, read, fetch_add or cmp_swap\n");
+	printf("                           (default send)\n");
+	printf("  -L, --latency            measure the latency of single operations\n");
+	printf("                           (default message rate and bandwidth)\n");
+	printf("  -s, --size=<size>        message size (default 64, 8 for atomics)\n");
+	printf("  -n, --iters=<iters>      operations per QP (default 100000)\n");
+	printf("  -q, --qps=<num>          number of QPs (default 1)\n");
+	printf("  -T, --threads=<num>      number of threads, each with its own CQ (default 1)\n");
+	printf("  -D, --tx-depth=<dep>     send WRs in flight per QP (default 128)\n");
+	printf("  -r, --rx-depth=<dep>     receives posted per QP on the server (default 512)\n");
+	printf("  -b, --post-list=<num>    WRs per post call (default 1)\n");
+	printf("  -c, --cq-mod=<num>       signal one in <num> WRs (default 64)\n");
+	printf("  -I, --inline=<size>      send messages up to <size> bytes inline (default 0)\n");
+	printf("  -N, --new_send           use the ibv_qp_ex and ibv_cq_ex API\n");
+	printf("  -P, --thread-domain      create each thread's CQ and QPs under a thread\n");
+	printf("                           domain, so the provider can skip their locks\n");
+}
+
+static int perf_parse_test(const char *name)
+{
+	int i;
+
+	for (i = 0; i < PERF_NUM_TESTS; i++)
+		if (!strcmp(name, perf_test_str[i]))
+			return i;
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ibv_device      **dev_list;
+	struct ibv_device	*ib_dev;
+	struct perf_context	 ctx = {};
+	struct perf_config	*cfg = &ctx.cfg;
+	char                    *ib_devname = NULL;
+	char                    *servername = NULL;
+	unsigned int             port = 18515;
+	int                      ib_port = 1;
+	enum ibv_mtu		 mtu = IBV_MTU_1024;
+	int                      sl = 0;
+	int			 gidx = -1;
+	int			 size = -1;
+	int			 test;
+	int			 sockfd = -1;
+	int			 ret = 1;
+	char			 msg[128];
+	unsigned int		 i;
+	void *(*thread_fn)(void *);
+
+	srand48(getpid() * time(NULL));
+
+	*cfg = (struct perf_config) {
+		.test		= PERF_SEND,
+		.iters		= 100000,
+		.num_qps	= 1,
+		.num_threads	= 1,
+		.tx_depth	= 128,
+		.rx_depth	= 512,
+		.post_list	= 1,
+		.cq_mod		= 64,
+	};
+
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{ .name = "port",      .has_arg = 1, .val = 'p' },
+			{ .name = "ib-dev",    .has_arg = 1, .val = 'd' },
+			{ .name = "ib-port",   .has_arg = 1, .val = 'i' },
+			{ .name = "gid-idx",   .has_arg = 1, .val = 'g' },
+			{ .name = "mtu",       .has_arg = 1, .val = 'm' },
+			{ .name = "sl",        .has_arg = 1, .val = 'S' },
+			{ .name = "test",      .has_arg = 1, .val = 't' },
+			{ .name = "latency",   .has_arg = 0, .val = 'L' },
+			{ .name = "size",      .has_arg = 1, .val = 's' },
+			{ .name = "iters",     .has_arg = 1, .val = 'n' },
+			{ .name = "qps",       .has_arg = 1, .val = 'q' },
+			{ .name = "threads",   .has_arg = 1, .val = 'T' },
+			{ .name = "tx-depth",  .has_arg = 1, .val = 'D' },
+			{ .name = "rx-depth",  .has_arg = 1, .val = 'r' },
+			{ .name = "post-list", .has_arg = 1, .val = 'b' },
+			{ .name = "cq-mod",    .has_arg = 1, .val = 'c' },
+			{ .name = "inline",    .has_arg = 1, .val = 'I' },
+			{ .name = "new_send",  .has_arg = 0, .val = 'N' },
+			{ .name = "thread-domain", .has_arg = 0, .val = 'P' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "p:d:i:g:m:S:t:Ls:n:q:T:D:r:b:c:I:NP",
+				long_options, NULL);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'p':
+			port = strtoul(optarg, NULL, 0);
+			if (port > 65535) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		case 'd':
+			ib_devname = strdupa(optarg);
+			break;
+
+		case 'i':
+			ib_port = strtol(optarg, NULL, 0);
+			if (ib_port < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		case 'g':
+			gidx = strtol(optarg, NULL, 0);
+			break;
+
+		case 'm':
+			mtu = pp_mtu_to_enum(strtol(optarg, NULL, 0));
+			if (mtu == 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		case 'S':
+			sl = strtol(optarg, NULL, 0);
+			break;
+
+		case 't':
+			test = perf_parse_test(optarg);
+			if (test < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			cfg->test = test;
+			break;
+
+		case 'L':
+			cfg->latency = 1;
+			break;
+
+		case 's':
+			size = strtol(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			cfg->iters = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'q':
+			cfg->num_qps = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'T':
+			cfg->num_threads = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'D':
+			cfg->tx_depth = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'r':
+			cfg->rx_depth = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'b':
+			cfg->post_list = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'c':
+			cfg->cq_mod = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'I':
+			cfg->inline_size = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'N':
+			cfg->new_api = 1;
+			break;
+
+		case 'P':
+			cfg->thread_domain = 1;
+			break;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc - 1)
+		servername = strdupa(argv[optind]);
+	else if (optind < argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	if (servername) {
+		if (perf_is_atomic(cfg)) {
+			if (size >= 0 && size != sizeof(uint64_t)) {
+				fprintf(stderr, "Atomic operations are 8 bytes\n");
+				return 1;
+			}
+			size = sizeof(uint64_t);
+		}
+		cfg->size = size < 0 ? 64 : size;
+
+		if (cfg->latency) {
+			cfg->tx_depth = 1;
+			cfg->post_list = 1;
+			cfg->cq_mod = 1;
+		}
+
+		if (!cfg->iters || !cfg->num_qps || !cfg->num_threads ||
+		    !cfg->tx_depth || !cfg->rx_depth || !cfg->post_list ||
+		    !cfg->cq_mod) {
+			fprintf(stderr, "Counts and depths must not be 0\n");
+			return 1;
+		}
+		if (cfg->num_threads > cfg->num_qps) {
+			fprintf(stderr, "Each thread needs a QP\n");
+			return 1;
+		}
+		/*
+		 * A full send queue must hold a signaled WR, or the
+		 * next post list waits for a completion that never comes.
+		 */
+		if (cfg->cq_mod - 1 + cfg->post_list > cfg->tx_depth) {
+			fprintf(stderr, "cq-mod + post-list - 1 must not exceed tx-depth\n");
+			return 1;
+		}
+	}
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("Failed to get IB devices list");
+		return 1;
+	}
+
+	if (!ib_devname) {
+		ib_dev = *dev_list;
+		if (!ib_dev) {
+			fprintf(stderr, "No IB devices found\n");
+			goto out_free_list;
+		}
+	} else {
+		for (i = 0; dev_list[i]; ++i)
+			if (!strcmp(ibv_get_device_name(dev_list[i]), ib_devname))
+				break;
+		ib_dev = dev_list[i];
+		if (!ib_dev) {
+			fprintf(stderr, "IB device %s not found\n", ib_devname);
+			goto out_free_list;
+		}
+	}
+
+	if (servername) {
+		sockfd = perf_client_connect(servername, port);
+		if (sockfd < 0)
+			goto out_free_list;
+		memset(msg, 0, sizeof(msg));
+		snprintf(msg, sizeof(msg), PERF_CONFIG_FMT, cfg->test,
+			 cfg->latency, cfg->size, cfg->iters, cfg->num_qps,
+			 cfg->num_threads, cfg->tx_depth, cfg->rx_depth,
+			 cfg->post_list, cfg->cq_mod, cfg->inline_size,
+			 cfg->new_api, cfg->thread_domain);
+		if (sock_write(sockfd, msg, sizeof(msg))) {
+			fprintf(stderr, "Couldn't send the test parameters\n");
+			goto out;
+		}
+	} else {
+		ctx.server = 1;
+		sockfd = perf_server_accept(port);
+		if (sockfd < 0)
+			goto out_free_list;
+		if (sock_read(sockfd, msg, sizeof(msg))) {
+			fprintf(stderr, "Couldn't read the test parameters\n");
+			goto out;
+		}
+		msg[sizeof(msg) - 1] = 0;
+		if (sscanf(msg, PERF_CONFIG_FMT, &cfg->test, &cfg->latency,
+			   &cfg->size, &cfg->iters, &cfg->num_qps,
+			   &cfg->num_threads, &cfg->tx_depth, &cfg->rx_depth,
+			   &cfg->post_list, &cfg->cq_mod, &cfg->inline_size,
+			   &cfg->new_api, &cfg->thread_domain) != 13 ||
+		    cfg->test >= PERF_NUM_TESTS || !cfg->num_threads ||
+		    cfg->num_threads > cfg->num_qps || !cfg->rx_depth) {
+			fprintf(stderr, "Bad test parameters\n");
+			goto out;
+		}
+	}
+
+	if (perf_init_ctx(&ctx, ib_dev, ib_port))
+		goto out;
+
+	if (ctx.portinfo.link_layer != IBV_LINK_LAYER_ETHERNET &&
+	    !ctx.portinfo.lid) {
+		fprintf(stderr, "Couldn't get local LID\n");
+		goto out;
+	}
+
+	for (i = 0; i < cfg->num_qps; i++) {
+		ctx.qps[i].local.lid = ctx.portinfo.lid;
+		if (gidx >= 0) {
+			if (ibv_query_gid(ctx.context, ib_port, gidx,
+					  &ctx.qps[i].local.gid)) {
+				fprintf(stderr, "can't read sgid of index %d\n",
+					gidx);
+				goto out;
+			}
+		}
+	}
+
+	/* The client's QPs go first, the server connects before answering */
+	if (servername) {
+		if (perf_send_dests(&ctx, sockfd) ||
+		    perf_recv_dests(&ctx, sockfd))
+			goto out;
+	} else {
+		if (perf_recv_dests(&ctx, sockfd))
+			goto out;
+	}
+
+	for (i = 0; i < cfg->num_qps; i++)
+		if (perf_connect_qp(&ctx, &ctx.qps[i], ib_port, mtu, sl, gidx))
+			goto out;
+
+	if (!servername && perf_send_dests(&ctx, sockfd))
+		goto out;
+
+	if (servername) {
+		ret = perf_run_threads(&ctx, perf_client_thread);
+		if (!ret)
+			ret = perf_join_threads(&ctx);
+
+		if (!ret)
+			perf_print(&ctx, ibv_get_device_name(ib_dev));
+		else
+			fprintf(stderr, "The test failed\n");
+
+		if (sock_write(sockfd, "done", sizeof "done"))
+			fprintf(stderr, "Couldn't tell the server to stop\n");
+	} else {
+		thread_fn = perf_needs_recv(cfg) ? perf_server_thread : NULL;
+		if (thread_fn && perf_run_threads(&ctx, thread_fn))
+			goto out;
+
+		/* Until the client is done, or gone */
+		if (sock_read(sockfd, msg, sizeof "done"))
+			fprintf(stderr, "The client went away\n");
+
+		atomic_store(&ctx.stop, 1);
+		ret = thread_fn ? perf_join_threads(&ctx) : 0;
+	}
+
+out:
+	close(sockfd);
+	perf_close_ctx(&ctx);
+out_free_list:
+	ibv_free_device_list(dev_list);
+	return ret;
+}
@@ -0,0 +1,376 @@
+/* Licensed under the OpenIB.org BSD license (FreeBSD Variant) - See COPYING.md
+ */
+
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <infiniband/verbs.h>
+
+#include <ccan/minmax.h>
+
+/*
+ * Times the verbs calls that connection managers and middleware make to set
+ * up each RC connection: the device, port and GID queries, then the QP
+ * creation and its transitions up to RTS.  The QPs are connected to
+ * themselves, so no peer is needed.
+ */
+
+enum setup_step {
+	STEP_QUERY_DEVICE,
+	STEP_QUERY_PORT,
+	STEP_QUERY_GID,
+	STEP_CREATE_QP,
+	STEP_INIT,
+	STEP_RTR,
+	STEP_RTS,
+	STEP_DESTROY_QP,
+	STEP_CNT,
+};
+
+static const char *const step_str[STEP_CNT] = {
+	[STEP_QUERY_DEVICE]	= "query device",
+	[STEP_QUERY_PORT]	= "query port",
+	[STEP_QUERY_GID]	= "query gid",
+	[STEP_CREATE_QP]	= "create qp",
+	[STEP_INIT]		= "modify init",
+	[STEP_RTR]		= "modify rtr",
+	[STEP_RTS]		= "modify rts",
+	[STEP_DESTROY_QP]	= "destroy qp",
+};
+
+struct step_time {
+	uint64_t		total_ns;
+	uint64_t		min_ns;
+	uint64_t		max_ns;
+};
+
+struct setup_context {
+	struct ibv_context	*context;
+	struct ibv_pd		*pd;
+	struct ibv_cq		*cq;
+	int			ib_port;
+	int			gidx;
+	struct step_time	steps[STEP_CNT];
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void step_done(struct setup_context *ctx, enum setup_step step,
+		      uint64_t *start)
+{
+	struct step_time *st = &ctx->steps[step];
+	uint64_t end = now_ns();
+	uint64_t ns = end - *start;
+
+	st->total_ns += ns;
+	st->min_ns = st->min_ns ? min(st->min_ns, ns) : ns;
+	st->max_ns = max(st->max_ns, ns);
+	*start = end;
+}
+
+static int setup_one(struct setup_context *ctx)
+{
+	struct ibv_qp_init_attr init_attr = {
+		.send_cq = ctx->cq,
+		.recv_cq = ctx->cq,
+		.cap = {
+			.max_send_wr  = 16,
+			.max_recv_wr  = 16,
+			.max_send_sge = 1,
+			.max_recv_sge = 1,
+		},
+		.qp_type = IBV_QPT_RC,
+	};
+	struct ibv_qp_attr attr = {};
+	struct ibv_device_attr_ex dev_attr;
+	struct ibv_port_attr port_attr;
+	union ibv_gid gid = {};
+	struct ibv_qp *qp;
+	uint64_t start;
+	int ret = 1;
+
+	start = now_ns();
+	if (ibv_query_device_ex(ctx->context, NULL, &dev_attr)) {
+		fprintf(stderr, "Couldn't query device\n");
+		return 1;
+	}
+	step_done(ctx, STEP_QUERY_DEVICE, &start);
+
+	if (ibv_query_port(ctx->context, ctx->ib_port, &port_attr)) {
+		fprintf(stderr, "Couldn't query port %d\n", ctx->ib_port);
+		return 1;
+	}
+	step_done(ctx, STEP_QUERY_PORT, &start);
+
+	if (ctx->gidx >= 0 &&
+	    ibv_query_gid(ctx->context, ctx->ib_port, ctx->gidx, &gid)) {
+		fprintf(stderr, "Couldn't query gid %d\n", ctx->gidx);
+		return 1;
+	}
+	step_done(ctx, STEP_QUERY_GID, &start);
+
+	qp = ibv_create_qp(ctx->pd, &init_attr);
+	if (!qp) {
+		fprintf(stderr, "Couldn't create QP\n");
+		return 1;
+	}
+	step_done(ctx, STEP_CREATE_QP, &start);
+
+	attr.qp_state = IBV_QPS_INIT;
+	attr.pkey_index = 0;
+	attr.port_num = ctx->ib_port;
+	attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE |
+			       IBV_ACCESS_REMOTE_READ;
+	if (ibv_modify_qp(qp, &attr,
+			  IBV_QP_STATE              |
+			  IBV_QP_PKEY_INDEX         |
+			  IBV_QP_PORT               |
+			  IBV_QP_ACCESS_FLAGS)) {
+		fprintf(stderr, "Failed to modify QP to INIT\n");
+		goto out;
+	}
+	step_done(ctx, STEP_INIT, &start);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.qp_state = IBV_QPS_RTR;
+	attr.path_mtu = port_attr.active_mtu;
+	attr.dest_qp_num = qp->qp_num;
+	attr.rq_psn = 0;
+	attr.max_dest_rd_atomic = max_t(int, dev_attr.orig_attr.max_qp_rd_atom,
+					1);
+	attr.min_rnr_timer = 12;
+	attr.ah_attr.dlid = port_attr.lid;
+	attr.ah_attr.port_num = ctx->ib_port;
+	if (gid.global.interface_id) {
+		attr.ah_attr.is_global = 1;
+		attr.ah_attr.grh.hop_limit = 1;
+		attr.ah_attr.grh.dgid = gid;
+		attr.ah_attr.grh.sgid_index = ctx->gidx;
+	}
+	if (ibv_modify_qp(qp, &attr,
+			  IBV_QP_STATE              |
+			  IBV_QP_AV                 |
+			  IBV_QP_PATH_MTU           |
+			  IBV_QP_DEST_QPN           |
+			  IBV_QP_RQ_PSN             |
+			  IBV_QP_MAX_DEST_RD_ATOMIC |
+			  IBV_QP_MIN_RNR_TIMER)) {
+		fprintf(stderr, "Failed to modify QP to RTR\n");
+		goto out;
+	}
+	step_done(ctx, STEP_RTR, &start);
+
+	attr.qp_state = IBV_QPS_RTS;
+	attr.timeout = 14;
+	attr.retry_cnt = 7;
+	attr.rnr_retry = 7;
+	attr.sq_psn = 0;
+	attr.max_rd_atomic =
+		max_t(int, dev_attr.orig_attr.max_qp_init_rd_atom, 1);
+	if (ibv_modify_qp(qp, &attr,
+			  IBV_QP_STATE              |
+			  IBV_QP_TIMEOUT            |
+			  IBV_QP_RETRY_CNT          |
+			  IBV_QP_RNR_RETRY          |
+			  IBV_QP_SQ_PSN             |
+			  IBV_QP_MAX_QP_RD_ATOMIC)) {
+		fprintf(stderr, "Failed to modify QP to RTS\n");
+		goto out;
+	}
+	step_done(ctx, STEP_RTS, &start);
+	ret = 0;
+
+out:
+	if (ibv_destroy_qp(qp)) {
+		fprintf(stderr, "Couldn't destroy QP\n");
+		return 1;
+	}
+	step_done(ctx, STEP_DESTROY_QP, &start);
+
+	return ret;
+}
+
+static void show_perf(struct setup_context *ctx, unsigned int conns,
+		      uint64_t total_ns, const struct ibv_stats *stats)
+{
+	struct step_time *st;
+	int i;
+
+	printf("step              total ms     max us     min us  us / conn\n");
+	for (i = 0; i < STEP_CNT; i++) {
+		st = &ctx->steps[i];
+		printf("%-13s: %11.2f%11.2f%11.2f%11.2f\n", step_str[i],
+		       st->total_ns / 1e6, st->max_ns / 1e3, st->min_ns / 1e3,
+		       st->total_ns / 1e3 / conns);
+	}
+	printf("set up %u connections in %.2f ms: %.0f connections / sec\n",
+	       conns, total_ns / 1e6,
+	       total_ns ? conns / (total_ns / 1e9) : 0);
+	if (stats)
+		printf("kernel commands / conn: %.2f\n",
+		       (double)stats->cmds / conns);
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s            time the verbs calls of RC connection setup\n",
+	       argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -d, --ib-dev=<dev>       use IB device <dev> (default first device found)\n");
+	printf("  -i, --ib-port=<port>     use port <port> of IB device (default 1)\n");
+	printf("  -g, --gid-idx=<gid index> local port gid index (default none)\n");
+	printf("  -n, --conns=<num>        number of connections (default 1000)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct ibv_device **dev_list;
+	struct ibv_device *ib_dev;
+	struct setup_context ctx = { .ib_port = 1, .gidx = -1 };
+	struct ibv_stats stats;
+	char *ib_devname = NULL;
+	unsigned int conns = 1000;
+	uint64_t start, total_ns, cmds;
+	bool has_stats;
+	unsigned int i;
+	int ret = 1;
+
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{ .name = "ib-dev",  .has_arg = 1, .val = 'd' },
+			{ .name = "ib-port", .has_arg = 1, .val = 'i' },
+			{ .name = "gid-idx", .has_arg = 1, .val = 'g' },
+			{ .name = "conns",   .has_arg = 1, .val = 'n' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "d:i:g:n:", long_options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'd':
+			ib_devname = strdupa(optarg);
+			break;
+
+		case 'i':
+			ctx.ib_port = strtol(optarg, NULL, 0);
+			if (ctx.ib_port < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		case 'g':
+			ctx.gidx = strtol(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			conns = strtoul(optarg, NULL, 0);
+			if (!conns) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("Failed to get IB devices list");
+		return 1;
+	}
+
+	if (!ib_devname) {
+		ib_dev = *dev_list;
+		if (!ib_dev) {
+			fprintf(stderr, "No IB devices found\n");
+			goto out_free_list;
+		}
+	} else {
+		for (i = 0; dev_list[i]; ++i)
+			if (!strcmp(ibv_get_device_name(dev_list[i]),
+				    ib_devname))
+				break;
+		ib_dev = dev_list[i];
+		if (!ib_dev) {
+			fprintf(stderr, "IB device %s not found\n", ib_devname);
+			goto out_free_list;
+		}
+	}
+
+	ctx.context = ibv_open_device(ib_dev);
+	if (!ctx.context) {
+		fprintf(stderr, "Couldn't get context for %s\n",
+			ibv_get_device_name(ib_dev));
+		goto out_free_list;
+	}
+
+	ctx.pd = ibv_alloc_pd(ctx.context);
+	if (!ctx.pd) {
+		fprintf(stderr, "Couldn't allocate PD\n");
+		goto out_close;
+	}
+
+	ctx.cq = ibv_create_cq(ctx.context, 16, NULL, NULL, 0);
+	if (!ctx.cq) {
+		fprintf(stderr, "Couldn't create CQ\n");
+		goto out_pd;
+	}
+
+	/* ibv_query_stats() only counts when IBV_STATS is set */
+	memset(&stats, 0, sizeof(stats));
+	has_stats = !ibv_query_stats(ctx.context, &stats);
+	cmds = stats.cmds;
+
+	start = now_ns();
+	for (i = 0; i < conns; i++)
+		if (setup_one(&ctx))
+			goto out_cq;
+	total_ns = now_ns() - start;
+
+	if (has_stats && !ibv_query_stats(ctx.context, &stats)) {
+		stats.cmds -= cmds;
+		show_perf(&ctx, conns, total_ns, &stats);
+	} else {
+		show_perf(&ctx, conns, total_ns, NULL);
+	}
+	ret = 0;
+
+out_cq:
+	ibv_destroy_cq(ctx.cq);
+out_pd:
+	ibv_dealloc_pd(ctx.pd);
+out_close:
+	ibv_close_device(ctx.context);
+out_free_list:
+	ibv_free_device_list(dev_list);
+	return ret;
+}
@@ -0,0 +1,354 @@
+/* Licensed under the OpenIB.org BSD license (FreeBSD Variant) - See COPYING.md
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <util/util.h>
+#include "ibverbs.h"
+
+/*
+ * ibv_query_gid(), ibv_query_gid_type(), ibv_query_gid_ex() and the GID
+ * lookups of ibv_init_ah_from_wc() are served from a copy of the GID tables
+ * of the context's ports, read with a single ibv_query_gid_table() call
+ * instead of one or two queries (or sysfs reads) per GID index.
+ *
+ * The copy of a port is dropped when ibv_get_async_event() returns a GID
+ * change or port event for it, and everything is dropped on a fatal event.
+ * An application that does not read async events never sees those, so the
+ * copy of a port is also read again GID_CACHE_TTL_MS after it was read,
+ * when that port is next queried.  A lookup by GID that misses is checked
+ * against the kernel's table once, without reading the copy again.
+ */
+#define GID_CACHE_TTL_MS 1000
+
+struct gid_cache_port {
+	/* 0 when the copy must be read again */
+	uint64_t		expires_ms;
+	bool			valid;
+	uint32_t		tbl_len;
+	/* By GID index, the entries of empty GIDs are zero */
+	struct ibv_gid_entry	*entries;
+	uint32_t		hash_mask;
+	/* GID index + 1 of (gid, sysfs GID type), 0 for a free slot */
+	uint32_t		*hash;
+};
+
+struct verbs_gid_cache {
+	/* The port table sizes; a failed read is retried after the TTL */
+	uint64_t		expires_ms;
+	bool			valid;
+	uint32_t		num_ports;
+	/* Room for the GID table of every port, as the kernel returns it */
+	size_t			table_len;
+	struct ibv_gid_entry	*table;
+	struct gid_cache_port	ports[];
+};
+
+static uint64_t gid_cache_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static enum ibv_gid_type_sysfs gid_sysfs_type(uint32_t gid_type)
+{
+	return gid_type == IBV_GID_TYPE_ROCE_V2 ? IBV_GID_TYPE_SYSFS_ROCE_V2 :
+						  IBV_GID_TYPE_SYSFS_IB_ROCE_V1;
+}
+
+static uint32_t gid_hash(const union ibv_gid *gid,
+			 enum ibv_gid_type_sysfs type)
+{
+	uint64_t w[2];
+	uint64_t h;
+
+	memcpy(w, gid->raw, sizeof(w));
+	h = (w[0] * 0x9e3779b97f4a7c15ULL) ^ w[1] ^ type;
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h >> 32;
+}
+
+static uint32_t *gid_hash_slot(struct gid_cache_port *port,
+			       const union ibv_gid *gid,
+			       enum ibv_gid_type_sysfs type)
+{
+	uint32_t i = gid_hash(gid, type) & port->hash_mask;
+	struct ibv_gid_entry *entry;
+
+	for (;; i = (i + 1) & port->hash_mask) {
+		if (!port->hash[i])
+			return &port->hash[i];
+
+		entry = &port->entries[port->hash[i] - 1];
+		if (!memcmp(&entry->gid, gid, sizeof(*gid)) &&
+		    gid_sysfs_type(entry->gid_type) == type)
+			return &port->hash[i];
+	}
+}
+
+static void gid_cache_free(struct verbs_gid_cache *cache)
+{
+	uint32_t i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < cache->num_ports; i++) {
+		free(cache->ports[i].entries);
+		free(cache->ports[i].hash);
+	}
+	free(cache->table);
+	free(cache);
+}
+
+static int gid_cache_alloc_ports(struct ibv_context *context,
+				 struct verbs_gid_cache *cache)
+{
+	struct ibv_port_attr port_attr;
+	struct gid_cache_port *port;
+	uint32_t p;
+
+	for (p = 0; p < cache->num_ports; p++) {
+		port = &cache->ports[p];
+		if (ibv_query_port(context, p + 1, &port_attr))
+			return -1;
+
+		port->tbl_len = port_attr.gid_tbl_len;
+		port->hash_mask = roundup_pow_of_two(2 * port->tbl_len + 1) - 1;
+		port->entries = calloc(port->tbl_len, sizeof(*port->entries));
+		port->hash = calloc(port->hash_mask + 1, sizeof(*port->hash));
+		if ((port->tbl_len && !port->entries) || !port->hash)
+			return -1;
+		cache->table_len += port->tbl_len;
+	}
+
+	cache->table = calloc(cache->table_len, sizeof(*cache->table));
+	return cache->table ? 0 : -1;
+}
+
+static struct verbs_gid_cache *gid_cache_load(struct ibv_context *context)
+{
+	struct ibv_device_attr dev_attr;
+	struct verbs_gid_cache *cache;
+
+	if (ibv_query_device(context, &dev_attr))
+		dev_attr.phys_port_cnt = 0;
+
+	cache = calloc(1, sizeof(*cache) +
+			  dev_attr.phys_port_cnt * sizeof(cache->ports[0]));
+	if (!cache)
+		return NULL;
+
+	cache->num_ports = dev_attr.phys_port_cnt;
+	cache->valid = cache->num_ports && !gid_cache_alloc_ports(context, cache);
+	cache->expires_ms = gid_cache_now_ms() + GID_CACHE_TTL_MS;
+	return cache;
+}
+
+/*
+ * Called with gid_cache_lock held.  Returns the cache with the table sizes
+ * of the ports read, the GIDs of each port are read by gid_cache_get_port().
+ */
+static struct verbs_gid_cache *gid_cache_get(struct ibv_context *context)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+	struct verbs_gid_cache *cache = priv->gid_cache;
+
+	if (!cache || (!cache->valid &&
+		       gid_cache_now_ms() >= cache->expires_ms)) {
+		gid_cache_free(cache);
+		cache = priv->gid_cache = gid_cache_load(context);
+	}
+	return cache && cache->valid ? cache : NULL;
+}
+
+/* Reads the kernel's GID table, of all the ports, into cache->table */
+static ssize_t gid_cache_read_table(struct ibv_context *context,
+				    struct verbs_gid_cache *cache)
+{
+	return _ibv_query_gid_table(context, cache->table, cache->table_len, 0,
+				    sizeof(*cache->table));
+}
+
+/*
+ * Called with gid_cache_lock held.  Returns the port's copy, read again
+ * if it has expired, or NULL if it can't be read.
+ */
+static struct gid_cache_port *gid_cache_get_port(struct ibv_context *context,
+						 struct verbs_gid_cache *cache,
+						 uint32_t port_num)
+{
+	struct gid_cache_port *port = &cache->ports[port_num - 1];
+	struct ibv_gid_entry *entry;
+	uint64_t now;
+	ssize_t num, i;
+	uint32_t *slot;
+
+	now = gid_cache_now_ms();
+	if (now < port->expires_ms)
+		return port->valid ? port : NULL;
+
+	/* A failed read is not retried before the TTL either */
+	port->expires_ms = now + GID_CACHE_TTL_MS;
+	num = gid_cache_read_table(context, cache);
+	port->valid = num >= 0;
+	if (!port->valid)
+		return NULL;
+
+	memset(port->entries, 0, port->tbl_len * sizeof(*port->entries));
+	memset(port->hash, 0, (port->hash_mask + 1) * sizeof(*port->hash));
+	for (i = 0; i < num; i++) {
+		entry = &cache->table[i];
+		if (entry->port_num != port_num ||
+		    entry->gid_index >= port->tbl_len)
+			continue;
+
+		port->entries[entry->gid_index] = *entry;
+		/* The lowest index wins, as with a scan of the table */
+		slot = gid_hash_slot(port, &entry->gid,
+				     gid_sysfs_type(entry->gid_type));
+		if (!*slot || *slot > entry->gid_index + 1)
+			*slot = entry->gid_index + 1;
+	}
+	return port;
+}
+
+/*
+ * Returns false if the cache can't be used, otherwise *ret is 0, ENODATA for
+ * an empty GID or EINVAL for a bad port or index, as from the kernel.
+ */
+bool verbs_gid_cache_query(struct ibv_context *context, uint32_t port_num,
+			   uint32_t gid_index, struct ibv_gid_entry *entry,
+			   int *ret)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+	struct verbs_gid_cache *cache;
+	struct gid_cache_port *port;
+	bool usable = false;
+
+	pthread_mutex_lock(&priv->gid_cache_lock);
+	cache = gid_cache_get(context);
+	if (!cache)
+		goto out;
+
+	if (!port_num || port_num > cache->num_ports) {
+		*ret = EINVAL;
+		usable = true;
+		goto out;
+	}
+
+	port = gid_cache_get_port(context, cache, port_num);
+	if (!port)
+		goto out;
+
+	if (gid_index >= port->tbl_len) {
+		*ret = EINVAL;
+	} else if (port->entries[gid_index].port_num) {
+		*entry = port->entries[gid_index];
+		*ret = 0;
+	} else {
+		*ret = ENODATA;
+	}
+	usable = true;
+out:
+	pthread_mutex_unlock(&priv->gid_cache_lock);
+	return usable;
+}
+
+/*
+ * Called with gid_cache_lock held.  Looks (gid, type) up in the kernel's
+ * table, for a GID added since the port's copy was read.  The copy is left
+ * as it is, the GID change event of the new GID drops it.
+ */
+static bool gid_cache_find_direct(struct ibv_context *context,
+				  struct verbs_gid_cache *cache,
+				  uint32_t port_num, const union ibv_gid *gid,
+				  enum ibv_gid_type_sysfs type, int *index)
+{
+	struct ibv_gid_entry *entry;
+	ssize_t num, i;
+
+	num = gid_cache_read_table(context, cache);
+	if (num < 0)
+		return false;
+
+	*index = -1;
+	for (i = 0; i < num; i++) {
+		entry = &cache->table[i];
+		if (entry->port_num == port_num &&
+		    !memcmp(&entry->gid, gid, sizeof(*gid)) &&
+		    gid_sysfs_type(entry->gid_type) == type &&
+		    (*index < 0 || entry->gid_index < *index))
+			*index = entry->gid_index;
+	}
+	return true;
+}
+
+/*
+ * Returns false if the cache can't be used, otherwise *index is the lowest
+ * GID index of (gid, type) on the port, or -1.
+ */
+bool verbs_gid_cache_find(struct ibv_context *context, uint32_t port_num,
+			  const union ibv_gid *gid,
+			  enum ibv_gid_type_sysfs type, int *index)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+	struct verbs_gid_cache *cache;
+	struct gid_cache_port *port;
+	bool usable = false;
+
+	pthread_mutex_lock(&priv->gid_cache_lock);
+	cache = gid_cache_get(context);
+	if (!cache)
+		goto out;
+
+	*index = -1;
+	if (!port_num || port_num > cache->num_ports) {
+		usable = true;
+		goto out;
+	}
+
+	port = gid_cache_get_port(context, cache, port_num);
+	if (!port)
+		goto out;
+
+	*index = (int)*gid_hash_slot(port, gid, type) - 1;
+	usable = *index >= 0 ||
+		 gid_cache_find_direct(context, cache, port_num, gid, type,
+				       index);
+out:
+	pthread_mutex_unlock(&priv->gid_cache_lock);
+	return usable;
+}
+
+/* port_num 0 drops the copies of all the ports and their table sizes */
+void verbs_gid_cache_invalidate(struct ibv_context *context,
+				uint32_t port_num)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+	struct verbs_gid_cache *cache;
+
+	pthread_mutex_lock(&priv->gid_cache_lock);
+	cache = priv->gid_cache;
+	if (cache && !port_num) {
+		gid_cache_free(cache);
+		priv->gid_cache = NULL;
+	} else if (cache && port_num <= cache->num_ports) {
+		cache->ports[port_num - 1].expires_ms = 0;
+	}
+	pthread_mutex_unlock(&priv->gid_cache_lock);
+}
+
+void verbs_gid_cache_cleanup(struct verbs_ex_private *priv)
+{
+	gid_cache_free(priv->gid_cache);
+	priv->gid_cache = NULL;
+	pthread_mutex_destroy(&priv->gid_cache_lock);
+}
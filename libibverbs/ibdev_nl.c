@@ -125,15 +125,102 @@ static int find_uverbs_nl_cb(struct nl_msg *msg, void *data)
 	return 0;
 }
 
-/* Ask the kernel for the uverbs char device information */
-static int find_uverbs_nl(struct nl_sock *nl, struct verbs_sysfs_dev *sysfs_dev)
+/*
+ * GET_CHARDEV requests sent before their replies are read. The kernel drops
+ * replies that don't fit in the socket receive buffer, so each batch must be
+ * small enough for its replies to be queued there.
+ */
+#define UVERBS_NL_BATCH 16
+
+struct uverbs_nl_batch {
+	struct verbs_sysfs_dev	*devs[UVERBS_NL_BATCH];
+	uint32_t		seqs[UVERBS_NL_BATCH];
+	unsigned int		num;
+	unsigned int		replies;
+};
+
+static struct verbs_sysfs_dev *uverbs_nl_batch_dev(struct uverbs_nl_batch *batch,
+						   uint32_t seq)
+{
+	unsigned int i;
+
+	for (i = 0; i != batch->num; i++)
+		if (batch->seqs[i] == seq)
+			return batch->devs[i];
+	return NULL;
+}
+
+static int uverbs_nl_batch_cb(struct nl_msg *msg, void *data)
+{
+	struct uverbs_nl_batch *batch = data;
+	struct verbs_sysfs_dev *sysfs_dev;
+
+	sysfs_dev = uverbs_nl_batch_dev(batch, nlmsg_hdr(msg)->nlmsg_seq);
+	if (!sysfs_dev)
+		return NL_SKIP;
+
+	batch->replies++;
+	/* A device without a sysfs_name falls back to sysfs */
+	if (find_uverbs_nl_cb(msg, sysfs_dev))
+		sysfs_dev->sysfs_name[0] = 0;
+	return NL_OK;
+}
+
+static int uverbs_nl_batch_err_cb(struct sockaddr_nl *nla,
+				  struct nlmsgerr *nlerr, void *data)
 {
-	if (rdmanl_get_chardev(nl, sysfs_dev->ibdev_idx, "uverbs",
-				  find_uverbs_nl_cb, sysfs_dev))
+	struct uverbs_nl_batch *batch = data;
+
+	if (uverbs_nl_batch_dev(batch, nlerr->msg.nlmsg_seq))
+		batch->replies++;
+	return NL_SKIP;
+}
+
+static int uverbs_nl_batch_recv(struct nl_sock *nl,
+				struct uverbs_nl_batch *batch)
+{
+	int ret = 0;
+
+	if (nl_socket_modify_err_cb(nl, NL_CB_CUSTOM, uverbs_nl_batch_err_cb,
+				    batch))
 		return -1;
-	if (!sysfs_dev->sysfs_name[0])
+	if (nl_socket_modify_cb(nl, NL_CB_VALID, NL_CB_CUSTOM,
+				uverbs_nl_batch_cb, batch))
 		return -1;
-	return 0;
+	while (batch->replies != batch->num) {
+		ret = nl_recvmsgs_default(nl);
+		if (ret < 0)
+			break;
+	}
+	nl_socket_modify_err_cb(nl, NL_CB_CUSTOM, NULL, NULL);
+
+	batch->num = 0;
+	batch->replies = 0;
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Ask the kernel for the uverbs char device information of every device,
+ * with UVERBS_NL_BATCH requests in flight instead of one round trip per
+ * device. The devices the kernel didn't answer for are left without a
+ * sysfs_name.
+ */
+static void find_uverbs_nl(struct nl_sock *nl, struct list_head *sysfs_list)
+{
+	struct uverbs_nl_batch batch = {};
+	struct verbs_sysfs_dev *sysfs_dev;
+
+	list_for_each (sysfs_list, sysfs_dev, entry) {
+		if (rdmanl_send_get_chardev(nl, sysfs_dev->ibdev_idx, "uverbs",
+					    &batch.seqs[batch.num]))
+			break;
+		batch.devs[batch.num++] = sysfs_dev;
+		if (batch.num == UVERBS_NL_BATCH &&
+		    uverbs_nl_batch_recv(nl, &batch))
+			return;
+	}
+	if (batch.num)
+		uverbs_nl_batch_recv(nl, &batch);
 }
 
 static int find_sysfs_devs_nl_cb(struct nl_msg *msg, void *data)
@@ -200,8 +287,10 @@ int find_sysfs_devs_nl(struct list_head *tmp_sysfs_dev_list)
 	if (rdmanl_get_devices(nl, find_sysfs_devs_nl_cb, tmp_sysfs_dev_list))
 		goto err;
 
+	find_uverbs_nl(nl, tmp_sysfs_dev_list);
+
 	list_for_each_safe (tmp_sysfs_dev_list, dev, dev_tmp, entry) {
-		if ((find_uverbs_nl(nl, dev) && find_uverbs_sysfs(dev)) ||
+		if ((!dev->sysfs_name[0] && find_uverbs_sysfs(dev)) ||
 		    try_access_device(dev)) {
 			list_del(&dev->entry);
 			free(dev);
@@ -35,6 +35,8 @@
 #define IB_VERBS_H
 
 #include <pthread.h>
+#include <time.h>
+#include <sys/sdt.h>
 
 #include <infiniband/driver.h>
 #include <ccan/bitmap.h>
@@ -69,12 +71,44 @@ static inline void load_drivers(void)
 void load_drivers(void);
 #endif
 
+/*
+ * A USDT probe of the libibverbs provider, a nop until a tracer attaches,
+ * eg usdt:/usr/lib/libibverbs.so.1:libibverbs:cmd_ioctl_done in bpftrace.
+ */
+#define ibv_trace(name, ...) STAP_PROBEV(libibverbs, name, ##__VA_ARGS__)
+
+/* The counters of ibv_query_stats(), only allocated when IBV_STATS is set */
+struct verbs_stats {
+	_Atomic(uint64_t)	cmds;
+	_Atomic(uint64_t)	cmd_ns;
+	_Atomic(uint64_t)	post_send_calls;
+	_Atomic(uint64_t)	send_wrs;
+	_Atomic(uint64_t)	send_bytes;
+	_Atomic(uint64_t)	post_recv_calls;
+	_Atomic(uint64_t)	recv_wrs;
+	_Atomic(uint64_t)	poll_cq_calls;
+	_Atomic(uint64_t)	cqes;
+	_Atomic(uint64_t)	empty_polls;
+
+	/* The provider's data path, called by the counting wrappers */
+	int (*post_send)(struct ibv_qp *qp, struct ibv_send_wr *wr,
+			 struct ibv_send_wr **bad_wr);
+	int (*post_recv)(struct ibv_qp *qp, struct ibv_recv_wr *wr,
+			 struct ibv_recv_wr **bad_wr);
+	int (*poll_cq)(struct ibv_cq *cq, int num_entries, struct ibv_wc *wc);
+};
+
 struct verbs_ex_private {
 	BITMAP_DECLARE(unsupported_ioctls, VERBS_OPS_NUM);
 	uint32_t driver_id;
 	bool use_ioctl_write;
 	struct verbs_context_ops ops;
 	bool imported;
+	pthread_mutex_t gid_cache_lock;
+	struct verbs_gid_cache *gid_cache;
+	pthread_mutex_t attr_cache_lock;
+	struct verbs_attr_cache *attr_cache;
+	struct verbs_stats *stats;
 };
 
 static inline struct verbs_ex_private *get_priv(struct ibv_context *ctx)
@@ -87,6 +121,55 @@ static inline const struct verbs_context_ops *get_ops(struct ibv_context *ctx)
 	return &get_priv(ctx)->ops;
 }
 
+bool verbs_gid_cache_query(struct ibv_context *context, uint32_t port_num,
+			   uint32_t gid_index, struct ibv_gid_entry *entry,
+			   int *ret);
+bool verbs_gid_cache_find(struct ibv_context *context, uint32_t port_num,
+			  const union ibv_gid *gid,
+			  enum ibv_gid_type_sysfs type, int *index);
+void verbs_gid_cache_invalidate(struct ibv_context *context,
+				uint32_t port_num);
+void verbs_gid_cache_cleanup(struct verbs_ex_private *priv);
+
+void verbs_attr_cache_init(struct verbs_context *vctx);
+bool verbs_attr_cache_query_port(struct ibv_context *context,
+				 uint8_t port_num,
+				 struct ibv_port_attr *port_attr,
+				 size_t port_attr_len, int *ret);
+void verbs_attr_cache_invalidate(struct ibv_context *context,
+				 uint8_t port_num);
+void verbs_attr_cache_cleanup(struct verbs_ex_private *priv);
+
+void verbs_stats_init(struct verbs_context *vctx);
+void verbs_stats_cleanup(struct verbs_ex_private *priv);
+
+static inline uint64_t verbs_stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Time spent in a kernel command, start is 0 without stats */
+static inline uint64_t verbs_stats_cmd_start(struct verbs_ex_private *priv)
+{
+	return priv->stats ? verbs_stats_now_ns() : 0;
+}
+
+static inline void verbs_stats_cmd_done(struct verbs_ex_private *priv,
+					uint64_t start)
+{
+	if (!priv->stats)
+		return;
+
+	atomic_fetch_add_explicit(&priv->stats->cmds, 1,
+				  memory_order_relaxed);
+	atomic_fetch_add_explicit(&priv->stats->cmd_ns,
+				  verbs_stats_now_ns() - start,
+				  memory_order_relaxed);
+}
+
 enum ibv_node_type decode_knode_type(unsigned int knode_type);
 
 int find_sysfs_devs_nl(struct list_head *tmp_sysfs_dev_list);
@@ -511,6 +511,9 @@ static void check_memlock_limit(void)
 static int same_sysfs_dev(struct verbs_sysfs_dev *sysfs1,
 			  struct verbs_sysfs_dev *sysfs2)
 {
+	if (strcmp(sysfs1->ibdev_name, sysfs2->ibdev_name) != 0)
+		return 0;
+
 	if (strcmp(sysfs1->sysfs_name, sysfs2->sysfs_name) != 0)
 		return 0;
 
@@ -525,6 +528,69 @@ static int same_sysfs_dev(struct verbs_sysfs_dev *sysfs1,
 	return 1;
 }
 
+/*
+ * The devices found by an enumeration, hashed by IB device name so that each
+ * device already in the device_list is looked up instead of searched for.
+ */
+struct sysfs_dev_hash {
+	uint32_t		mask;
+	struct verbs_sysfs_dev	**slots;
+};
+
+static uint32_t ibdev_name_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *name; name++)
+		h = (h ^ (uint8_t)*name) * 16777619U;
+	return h;
+}
+
+static void sysfs_dev_hash_init(struct sysfs_dev_hash *hash,
+				struct list_head *sysfs_list)
+{
+	struct verbs_sysfs_dev *sysfs_dev;
+	uint32_t num = 0;
+	uint32_t i;
+
+	list_for_each(sysfs_list, sysfs_dev, entry)
+		num++;
+
+	hash->mask = roundup_pow_of_two(2 * num + 1) - 1;
+	hash->slots = calloc(hash->mask + 1, sizeof(*hash->slots));
+	/* Without the table sysfs_dev_hash_find() searches the list */
+	if (!hash->slots)
+		return;
+
+	list_for_each(sysfs_list, sysfs_dev, entry) {
+		i = ibdev_name_hash(sysfs_dev->ibdev_name) & hash->mask;
+		while (hash->slots[i])
+			i = (i + 1) & hash->mask;
+		hash->slots[i] = sysfs_dev;
+	}
+}
+
+static struct verbs_sysfs_dev *sysfs_dev_hash_find(struct sysfs_dev_hash *hash,
+						   struct list_head *sysfs_list,
+						   struct verbs_sysfs_dev *old)
+{
+	struct verbs_sysfs_dev *sysfs_dev;
+	uint32_t i;
+
+	if (!hash->slots) {
+		list_for_each(sysfs_list, sysfs_dev, entry)
+			if (same_sysfs_dev(old, sysfs_dev))
+				return sysfs_dev;
+		return NULL;
+	}
+
+	i = ibdev_name_hash(old->ibdev_name) & hash->mask;
+	for (; hash->slots[i]; i = (i + 1) & hash->mask)
+		if (same_sysfs_dev(old, hash->slots[i]))
+			return hash->slots[i];
+	return NULL;
+}
+
 /* Match every ibv_sysfs_dev in the sysfs_list to a driver and add a new entry
  * to device_list. Once matched to a driver the entry in sysfs_list is
  * removed.
@@ -551,7 +617,9 @@ static void try_all_drivers(struct list_head *sysfs_list,
 int ibverbs_get_device_list(struct list_head *device_list)
 {
 	LIST_HEAD(sysfs_list);
+	LIST_HEAD(found_list);
 	struct verbs_sysfs_dev *sysfs_dev, *next_dev;
+	struct sysfs_dev_hash hash;
 	struct verbs_device *vdev, *tmp;
 	static int drivers_loaded;
 	unsigned int num_devices = 0;
@@ -572,27 +640,26 @@ int ibverbs_get_device_list(struct list_head *device_list)
 
 	/* Remove entries from the sysfs_list that are already preset in the
 	 * device_list, and remove entries from the device_list that are not
-	 * present in the sysfs_list.
+	 * present in the sysfs_list. The entries found stay in the hash until
+	 * the end, on the found_list.
 	 */
+	sysfs_dev_hash_init(&hash, &sysfs_list);
 	list_for_each_safe(device_list, vdev, tmp, entry) {
-		struct verbs_sysfs_dev *old_sysfs = NULL;
-
-		list_for_each(&sysfs_list, sysfs_dev, entry) {
-			if (same_sysfs_dev(vdev->sysfs, sysfs_dev)) {
-				old_sysfs = sysfs_dev;
-				break;
-			}
-		}
+		struct verbs_sysfs_dev *old_sysfs;
 
+		old_sysfs = sysfs_dev_hash_find(&hash, &sysfs_list, vdev->sysfs);
 		if (old_sysfs) {
 			list_del(&old_sysfs->entry);
-			free(old_sysfs);
+			list_add(&found_list, &old_sysfs->entry);
 			num_devices++;
 		} else {
 			list_del(&vdev->entry);
 			ibverbs_device_put(&vdev->device);
 		}
 	}
+	free(hash.slots);
+	list_for_each_safe(&found_list, sysfs_dev, next_dev, entry)
+		free(sysfs_dev);
 
 	try_all_drivers(&sysfs_list, device_list, &num_devices);
 
@@ -0,0 +1,140 @@
+/* Licensed under the OpenIB.org BSD license (FreeBSD Variant) - See COPYING.md
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ccan/minmax.h>
+#include <util/util.h>
+#include "ibverbs.h"
+
+/*
+ * ibv_post_send(), ibv_post_recv() and ibv_poll_cq() are inline and call
+ * the provider through the context ops, so when IBV_STATS is set in the
+ * environment the context ops are pointed at these wrappers, which count
+ * and fire the post_send, post_recv and poll_cq probes.  Without IBV_STATS
+ * the data path is untouched.
+ */
+
+#define STATS_ADD(stats, field, val)                                          \
+	atomic_fetch_add_explicit(&(stats)->field, val, memory_order_relaxed)
+
+static int stats_post_send(struct ibv_qp *qp, struct ibv_send_wr *wr,
+			   struct ibv_send_wr **bad_wr)
+{
+	struct verbs_stats *stats = get_priv(qp->context)->stats;
+	uint64_t num_wr = 0, bytes = 0;
+	struct ibv_send_wr *cur;
+	int ret, i;
+
+	ret = stats->post_send(qp, wr, bad_wr);
+
+	for (cur = wr; cur && !(ret && cur == *bad_wr); cur = cur->next) {
+		num_wr++;
+		for (i = 0; i < cur->num_sge; i++)
+			bytes += cur->sg_list[i].length;
+	}
+	STATS_ADD(stats, post_send_calls, 1);
+	STATS_ADD(stats, send_wrs, num_wr);
+	STATS_ADD(stats, send_bytes, bytes);
+	ibv_trace(post_send, qp->context, qp->qp_num, num_wr, bytes, ret);
+
+	return ret;
+}
+
+static int stats_post_recv(struct ibv_qp *qp, struct ibv_recv_wr *wr,
+			   struct ibv_recv_wr **bad_wr)
+{
+	struct verbs_stats *stats = get_priv(qp->context)->stats;
+	struct ibv_recv_wr *cur;
+	uint64_t num_wr = 0;
+	int ret;
+
+	ret = stats->post_recv(qp, wr, bad_wr);
+
+	for (cur = wr; cur && !(ret && cur == *bad_wr); cur = cur->next)
+		num_wr++;
+	STATS_ADD(stats, post_recv_calls, 1);
+	STATS_ADD(stats, recv_wrs, num_wr);
+	ibv_trace(post_recv, qp->context, qp->qp_num, num_wr, ret);
+
+	return ret;
+}
+
+static int stats_poll_cq(struct ibv_cq *cq, int num_entries, struct ibv_wc *wc)
+{
+	struct verbs_stats *stats = get_priv(cq->context)->stats;
+	int ret;
+
+	ret = stats->poll_cq(cq, num_entries, wc);
+
+	STATS_ADD(stats, poll_cq_calls, 1);
+	if (ret > 0)
+		STATS_ADD(stats, cqes, ret);
+	else if (!ret)
+		STATS_ADD(stats, empty_polls, 1);
+	ibv_trace(poll_cq, cq->context, cq, num_entries, ret);
+
+	return ret;
+}
+
+/* Called once the provider has set up the context ops */
+void verbs_stats_init(struct verbs_context *vctx)
+{
+	struct ibv_context *ctx = &vctx->context;
+	struct verbs_stats *stats;
+	const char *env;
+
+	env = getenv("IBV_STATS");
+	if (!env || !strcmp(env, "0"))
+		return;
+
+	stats = calloc(1, sizeof(*stats));
+	if (!stats)
+		return;
+
+	stats->post_send = ctx->ops.post_send;
+	stats->post_recv = ctx->ops.post_recv;
+	stats->poll_cq = ctx->ops.poll_cq;
+	ctx->ops.post_send = stats_post_send;
+	ctx->ops.post_recv = stats_post_recv;
+	ctx->ops.poll_cq = stats_poll_cq;
+	vctx->priv->stats = stats;
+}
+
+void verbs_stats_cleanup(struct verbs_ex_private *priv)
+{
+	free(priv->stats);
+	priv->stats = NULL;
+}
+
+int _ibv_query_stats(struct ibv_context *context, struct ibv_stats *stats,
+		     size_t stats_size)
+{
+	struct verbs_stats *vstats = get_priv(context)->stats;
+	struct ibv_stats out = {};
+
+	if (!vstats)
+		return EOPNOTSUPP;
+	if (stats_size < offsetofend(struct ibv_stats, comp_mask))
+		return EINVAL;
+
+	out.cmds = atomic_load(&vstats->cmds);
+	out.cmd_ns = atomic_load(&vstats->cmd_ns);
+	out.post_send_calls = atomic_load(&vstats->post_send_calls);
+	out.send_wrs = atomic_load(&vstats->send_wrs);
+	out.send_bytes = atomic_load(&vstats->send_bytes);
+	out.post_recv_calls = atomic_load(&vstats->post_recv_calls);
+	out.recv_wrs = atomic_load(&vstats->recv_wrs);
+	out.poll_cq_calls = atomic_load(&vstats->poll_cq_calls);
+	out.cqes = atomic_load(&vstats->cqes);
+	out.empty_polls = atomic_load(&vstats->empty_polls);
+
+	/* Older callers get the counters that they know about */
+	memset(stats, 0, stats_size);
+	memcpy(stats, &out, min(stats_size, sizeof(out)));
+	return 0;
+}
@@ -157,7 +157,8 @@ LATEST_SYMVER_FUNC(ibv_query_device, 1_1, "IBVERBS_1.1",
 		   struct ibv_context *context,
 		   struct ibv_device_attr *device_attr)
 {
-	return get_ops(context)->query_device_ex(
+	/* The context op, which may be the attribute cache */
+	return verbs_get_ctx(context)->query_device_ex(
 		context, NULL,
 		container_of(device_attr, struct ibv_device_attr_ex, orig_attr),
 		sizeof(*device_attr));
@@ -166,6 +167,12 @@ LATEST_SYMVER_FUNC(ibv_query_device, 1_1, "IBVERBS_1.1",
 int __lib_query_port(struct ibv_context *context, uint8_t port_num,
 		     struct ibv_port_attr *port_attr, size_t port_attr_len)
 {
+	int ret;
+
+	if (verbs_attr_cache_query_port(context, port_num, port_attr,
+					port_attr_len, &ret))
+		return ret;
+
 	/* Don't expose this mess to the provider, provide a large enough
 	 * temporary buffer if the user buffer is too small.
 	 */
@@ -313,6 +320,7 @@ struct ibv_mr *ibv_reg_mr_iova2(struct ibv_pd *pd, void *addr, size_t length,
 		return NULL;
 
 	mr = get_ops(pd->context)->reg_mr(pd, addr, length, iova, access);
+	ibv_trace(reg_mr, pd->context, addr, length, access, mr ? 0 : errno);
 	if (mr) {
 		mr->context = pd->context;
 		mr->pd      = pd;
@@ -705,6 +713,8 @@ LATEST_SYMVER_FUNC(ibv_modify_qp, 1_1, "IBVERBS_1.1",
 	int ret;
 
 	ret = get_ops(qp->context)->modify_qp(qp, attr, attr_mask);
+	ibv_trace(modify_qp, qp->context, qp->qp_num, attr_mask,
+		  attr_mask & IBV_QP_STATE ? attr->qp_state : -1, ret);
 	if (ret)
 		return ret;
 
@@ -768,6 +778,9 @@ static int ibv_find_gid_index(struct ibv_context *context, uint8_t port_num,
 	union ibv_gid sgid;
 	int i = 0, ret;
 
+	if (verbs_gid_cache_find(context, port_num, gid, gid_type, &i))
+		return i;
+
 	do {
 		ret = ibv_query_gid(context, port_num, i, &sgid);
 		if (!ret) {
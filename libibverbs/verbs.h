@@ -2330,6 +2330,63 @@ int ibv_get_async_event(struct ibv_context *context,
  */
 void ibv_ack_async_event(struct ibv_async_event *event);
 
+/* Multiplexes the async events of many contexts, see ibv_create_event_hub(3) */
+struct ibv_event_hub;
+
+struct ibv_event_hub_init_attr {
+	uint32_t		comp_mask;
+	/* Repeated port events are merged within this period, 0 for none */
+	uint32_t		coalesce_ms;
+};
+
+struct ibv_hub_event {
+	struct ibv_context	*context;
+	struct ibv_async_event	event;
+	/* The number of events merged into this one */
+	uint32_t		count;
+};
+
+typedef void (*ibv_hub_event_cb)(struct ibv_hub_event *event, void *cb_data);
+
+/**
+ * ibv_create_event_hub - Create an async event hub
+ */
+struct ibv_event_hub *ibv_create_event_hub(struct ibv_event_hub_init_attr *attr);
+
+/**
+ * ibv_destroy_event_hub - Destroy an async event hub and remove its contexts
+ */
+int ibv_destroy_event_hub(struct ibv_event_hub *hub);
+
+/**
+ * ibv_event_hub_add - Deliver the async events of a context through a hub
+ * @cb: Called for each event of the context, or NULL to return the events
+ *      from ibv_event_hub_poll()
+ */
+int ibv_event_hub_add(struct ibv_event_hub *hub, struct ibv_context *context,
+		      ibv_hub_event_cb cb, void *cb_data);
+
+/**
+ * ibv_event_hub_del - Stop delivering the async events of a context
+ */
+int ibv_event_hub_del(struct ibv_event_hub *hub, struct ibv_context *context);
+
+/**
+ * ibv_event_hub_fd - Get the fd that is readable when the hub has events
+ */
+int ibv_event_hub_fd(struct ibv_event_hub *hub);
+
+/**
+ * ibv_event_hub_poll - Read the async events of all the contexts of a hub
+ * @events: Array for the events of contexts added without a callback
+ * @timeout_ms: As for epoll_wait()
+ *
+ * Returns the number of events stored in @events, or -1.  The events
+ * stored in @events must be acknowledged with ibv_ack_async_event().
+ */
+int ibv_event_hub_poll(struct ibv_event_hub *hub, struct ibv_hub_event *events,
+		       int num_events, int timeout_ms);
+
 /**
  * ibv_query_device - Get device properties
  */
@@ -2365,6 +2422,22 @@ static inline int ___ibv_query_port(struct ibv_context *context,
 #define ibv_query_port(context, port_num, port_attr) \
 	___ibv_query_port(context, port_num, port_attr)
 
+int _ibv_query_port_fresh(struct ibv_context *context, uint8_t port_num,
+			  struct ibv_port_attr *port_attr,
+			  size_t port_attr_size);
+
+/*
+ * ibv_query_port_fresh - Get port properties from the device, never from
+ * the copy that ibv_query_port() may return
+ */
+static inline int ibv_query_port_fresh(struct ibv_context *context,
+				       uint8_t port_num,
+				       struct ibv_port_attr *port_attr)
+{
+	return _ibv_query_port_fresh(context, port_num, port_attr,
+				     sizeof(*port_attr));
+}
+
 /**
  * ibv_query_gid - Get a GID table entry
  */
@@ -2401,6 +2474,33 @@ static inline ssize_t ibv_query_gid_table(struct ibv_context *context,
 				    sizeof(*entries));
 }
 
+/* Counters of a device context, see ibv_query_stats(3) */
+struct ibv_stats {
+	uint64_t		comp_mask;
+	uint64_t		cmds;
+	uint64_t		cmd_ns;
+	uint64_t		post_send_calls;
+	uint64_t		send_wrs;
+	uint64_t		send_bytes;
+	uint64_t		post_recv_calls;
+	uint64_t		recv_wrs;
+	uint64_t		poll_cq_calls;
+	uint64_t		cqes;
+	uint64_t		empty_polls;
+};
+
+int _ibv_query_stats(struct ibv_context *context, struct ibv_stats *stats,
+		     size_t stats_size);
+
+/*
+ * ibv_query_stats - Read the counters of a context opened with IBV_STATS set
+ */
+static inline int ibv_query_stats(struct ibv_context *context,
+				  struct ibv_stats *stats)
+{
+	return _ibv_query_stats(context, stats, sizeof(*stats));
+}
+
 /**
  * ibv_query_pkey - Get a P_Key table entry
  */
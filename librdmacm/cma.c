@@ -92,10 +92,53 @@ struct cma_device {
 	int		    port_cnt;
 	int		    refcnt;
 	int		    max_qpsize;
+	int		    max_cqe;
+	int		    max_srq_wr;
+	struct list_head    shared_cqs;
+	struct list_head    shared_srqs;
 	uint8_t		    max_initiator_depth;
 	uint8_t		    max_responder_resources;
 	int		    ibv_idx;
 	uint8_t		    is_device_dead : 1;
+	uint8_t		    srq_resize : 1;
+};
+
+/*
+ * CQs and SRQs pooled for ids with RDMA_OPTION_LIB_SHARED_CQ/SRQ set.  Each
+ * thread creating QPs on a device gets its own, so a thread polls only the
+ * completions of the connections it set up.  Both are protected by mut.
+ */
+struct cma_shared_cq {
+	struct list_node	entry;
+	pthread_t		owner;
+	struct ibv_comp_channel	*channel;
+	struct ibv_cq		*cq;
+	int			refcnt;
+	int			used;
+	bool			fixed;
+	struct list_head	srqs;
+};
+
+/*
+ * The receive completions of QPs on a shared SRQ are bounded by the SRQ size,
+ * not by the QP count, so a shared CQ reserves entries for each shared SRQ
+ * once, for as long as a QP on it uses that SRQ.
+ */
+struct cma_shared_cq_srq {
+	struct list_node	entry;
+	struct cma_shared_srq	*ssrq;
+	int			refcnt;
+	uint32_t		cqe;
+};
+
+struct cma_shared_srq {
+	struct list_node	entry;
+	pthread_t		owner;
+	struct ibv_pd		*pd;
+	struct ibv_srq		*srq;
+	int			refcnt;
+	uint32_t		max_wr;
+	uint32_t		max_sge;
 };
 
 struct cma_id_private {
@@ -115,6 +158,12 @@ struct cma_id_private {
 	uint8_t			responder_resources;
 	struct ibv_ece		local_ece;
 	struct ibv_ece		remote_ece;
+	bool			share_cq;
+	bool			share_srq;
+	struct cma_shared_cq	*shared_cq;
+	int			shared_cqe;
+	struct cma_shared_cq_srq *shared_cq_srq;
+	struct cma_shared_srq	*shared_srq;
 };
 
 struct cma_multicast {
@@ -130,11 +179,28 @@ struct cma_multicast {
 	struct sockaddr_storage addr;
 };
 
+struct cma_event_channel;
+
 struct cma_event {
 	struct rdma_cm_event	event;
-	uint8_t			private_data[RDMA_MAX_PRIVATE_DATA];
 	struct cma_id_private	*id_priv;
 	struct cma_multicast	*mc;
+	struct cma_event_channel *chan;
+	struct cma_event	*next;
+	uint8_t			private_data[RDMA_MAX_PRIVATE_DATA];
+};
+
+/* Up to CMA_EVENT_CACHE acked events are kept by a channel for reuse */
+#define CMA_EVENT_CACHE 64
+
+struct cma_event_channel {
+	struct rdma_event_channel channel;
+	fastlock_t		lock;
+	struct cma_event	*free_events;
+	int			free_cnt;
+	/* events handed out and not yet acked */
+	int			events;
+	bool			destroyed;
 };
 
 static LIST_HEAD(cma_dev_list);
@@ -273,6 +339,8 @@ static struct cma_device *insert_cma_dev(struct ibv_device *dev)
 	cma_dev->guid = ibv_get_device_guid(dev);
 	cma_dev->ibv_idx = ibv_get_device_index(dev);
 	cma_dev->dev = dev;
+	list_head_init(&cma_dev->shared_cqs);
+	list_head_init(&cma_dev->shared_srqs);
 
 	/* reverse iteration, optimized to ibv_idx which is growing */
 	list_for_each_rev(&cma_dev_list, p, entry) {
@@ -459,6 +527,9 @@ static int ucma_init_device(struct cma_device *cma_dev)
 
 	cma_dev->port_cnt = attr.phys_port_cnt;
 	cma_dev->max_qpsize = attr.max_qp_wr;
+	cma_dev->max_cqe = attr.max_cqe;
+	cma_dev->max_srq_wr = attr.max_srq_wr;
+	cma_dev->srq_resize = !!(attr.device_cap_flags & IBV_DEVICE_SRQ_RESIZE);
 	cma_dev->max_initiator_depth = (uint8_t) attr.max_qp_init_rd_atom;
 	cma_dev->max_responder_resources = (uint8_t) attr.max_qp_rd_atom;
 	return 0;
@@ -564,29 +635,104 @@ void rdma_free_devices(struct ibv_context **list)
 
 struct rdma_event_channel *rdma_create_event_channel(void)
 {
-	struct rdma_event_channel *channel;
+	struct cma_event_channel *chan;
 
 	if (ucma_init())
 		return NULL;
 
-	channel = malloc(sizeof(*channel));
-	if (!channel)
+	chan = calloc(1, sizeof(*chan));
+	if (!chan)
 		return NULL;
 
-	channel->fd = open_cdev(dev_name, dev_cdev);
-	if (channel->fd < 0) {
+	chan->channel.fd = open_cdev(dev_name, dev_cdev);
+	if (chan->channel.fd < 0) {
 		goto err;
 	}
-	return channel;
+	fastlock_init(&chan->lock);
+	return &chan->channel;
 err:
-	free(channel);
+	free(chan);
 	return NULL;
 }
 
+static void ucma_free_channel(struct cma_event_channel *chan)
+{
+	struct cma_event *evt;
+
+	while ((evt = chan->free_events)) {
+		chan->free_events = evt->next;
+		free(evt);
+	}
+	fastlock_destroy(&chan->lock);
+	free(chan);
+}
+
+/*
+ * The channel memory lives on until its last event is acked, as a migrated
+ * id may ack events after their channel is gone.
+ */
 void rdma_destroy_event_channel(struct rdma_event_channel *channel)
 {
+	struct cma_event_channel *chan;
+	bool last;
+
+	chan = container_of(channel, struct cma_event_channel, channel);
 	close(channel->fd);
-	free(channel);
+
+	fastlock_acquire(&chan->lock);
+	chan->destroyed = true;
+	last = !chan->events;
+	fastlock_release(&chan->lock);
+	if (last)
+		ucma_free_channel(chan);
+}
+
+static struct cma_event *ucma_alloc_event(struct rdma_event_channel *channel)
+{
+	struct cma_event_channel *chan;
+	struct cma_event *evt;
+
+	chan = container_of(channel, struct cma_event_channel, channel);
+	fastlock_acquire(&chan->lock);
+	evt = chan->free_events;
+	if (evt) {
+		chan->free_events = evt->next;
+		chan->free_cnt--;
+	}
+	chan->events++;
+	fastlock_release(&chan->lock);
+
+	if (!evt) {
+		evt = malloc(sizeof(*evt));
+		if (!evt) {
+			fastlock_acquire(&chan->lock);
+			chan->events--;
+			fastlock_release(&chan->lock);
+			return NULL;
+		}
+	}
+	evt->chan = chan;
+	return evt;
+}
+
+static void ucma_free_event(struct cma_event *evt)
+{
+	struct cma_event_channel *chan = evt->chan;
+	bool last;
+
+	fastlock_acquire(&chan->lock);
+	if (chan->free_cnt < CMA_EVENT_CACHE && !chan->destroyed) {
+		evt->next = chan->free_events;
+		chan->free_events = evt;
+		chan->free_cnt++;
+		evt = NULL;
+	}
+	last = !--chan->events && chan->destroyed;
+	fastlock_release(&chan->lock);
+
+	free(evt);
+	if (last)
+		ucma_free_channel(chan);
 }
 
 static struct cma_device *ucma_get_cma_device(__be64 guid, uint32_t idx)
@@ -1437,8 +1583,294 @@ static int ucma_init_ud_qp(struct cma_id_private *id_priv, struct ibv_qp *qp)
 	return rdma_seterrno(ret);
 }
 
+#define CMA_SHARED_CQ_MIN	256
+
+static struct cma_shared_cq_srq *ucma_find_cq_srq(struct cma_shared_cq *scq,
+						  struct cma_shared_srq *ssrq)
+{
+	struct cma_shared_cq_srq *cq_srq;
+
+	list_for_each(&scq->srqs, cq_srq, entry) {
+		if (cq_srq->ssrq == ssrq)
+			return cq_srq;
+	}
+	return NULL;
+}
+
+/* Entries to reserve on scq for cqe more and the receives of ssrq, if any */
+static int ucma_shared_cq_need(struct cma_shared_cq *scq, int cqe,
+			       struct cma_shared_srq *ssrq)
+{
+	struct cma_shared_cq_srq *cq_srq;
+
+	if (!ssrq)
+		return cqe;
+
+	cq_srq = scq ? ucma_find_cq_srq(scq, ssrq) : NULL;
+	return cqe + ssrq->max_wr - (cq_srq ? cq_srq->cqe : 0);
+}
+
+static void ucma_drop_shared_srq(struct cma_shared_srq *ssrq);
+
+/*
+ * Reserve cqe entries on a shared CQ of the calling thread, plus the size of
+ * ssrq where the CQ has not reserved it yet.  A full CQ is grown, doubling
+ * its size up to the device limit; once it can grow no more another CQ is
+ * started for the thread.  Call with ssrq held.
+ */
+static struct cma_shared_cq *ucma_get_shared_cq(struct cma_device *cma_dev,
+						int cqe,
+						struct cma_shared_srq *ssrq,
+						struct cma_shared_cq_srq **cq_srq)
+{
+	struct cma_shared_cq_srq *new_cq_srq = NULL;
+	struct cma_shared_cq *scq;
+	pthread_t self = pthread_self();
+	int need, size;
+
+	if (ssrq) {
+		new_cq_srq = calloc(1, sizeof(*new_cq_srq));
+		if (!new_cq_srq)
+			return NULL;
+	}
+
+	pthread_mutex_lock(&mut);
+	if (ucma_shared_cq_need(NULL, cqe, ssrq) > cma_dev->max_cqe) {
+		errno = EINVAL;
+		goto err1;
+	}
+
+	list_for_each(&cma_dev->shared_cqs, scq, entry) {
+		if (!pthread_equal(scq->owner, self))
+			continue;
+		need = ucma_shared_cq_need(scq, cqe, ssrq);
+		if (scq->used + need <= scq->cq->cqe)
+			goto found;
+		if (scq->fixed || scq->used + need > cma_dev->max_cqe)
+			continue;
+
+		size = max(2 * scq->cq->cqe, scq->used + need);
+		size = min(size, cma_dev->max_cqe);
+		if (!ibv_resize_cq(scq->cq, size))
+			goto found;
+		scq->fixed = true;
+	}
+
+	need = ucma_shared_cq_need(NULL, cqe, ssrq);
+	scq = calloc(1, sizeof(*scq));
+	if (!scq)
+		goto err1;
+	list_head_init(&scq->srqs);
+
+	scq->channel = ibv_create_comp_channel(cma_dev->verbs);
+	if (!scq->channel)
+		goto err2;
+
+	size = max(need, CMA_SHARED_CQ_MIN);
+	size = min(size, cma_dev->max_cqe);
+	scq->cq = ibv_create_cq(cma_dev->verbs, size, NULL, scq->channel, 0);
+	if (!scq->cq)
+		goto err3;
+
+	scq->owner = self;
+	list_add_tail(&cma_dev->shared_cqs, &scq->entry);
+found:
+	scq->used += need;
+	scq->refcnt++;
+	*cq_srq = NULL;
+	if (ssrq) {
+		*cq_srq = ucma_find_cq_srq(scq, ssrq);
+		if (!*cq_srq) {
+			*cq_srq = new_cq_srq;
+			new_cq_srq = NULL;
+			(*cq_srq)->ssrq = ssrq;
+			ssrq->refcnt++;
+			list_add_tail(&scq->srqs, &(*cq_srq)->entry);
+		}
+		(*cq_srq)->cqe = ssrq->max_wr;
+		(*cq_srq)->refcnt++;
+	}
+	pthread_mutex_unlock(&mut);
+	free(new_cq_srq);
+	return scq;
+
+err3:
+	ibv_destroy_comp_channel(scq->channel);
+err2:
+	free(scq);
+err1:
+	pthread_mutex_unlock(&mut);
+	free(new_cq_srq);
+	return NULL;
+}
+
+static void ucma_put_shared_cq(struct cma_shared_cq *scq, int cqe,
+			       struct cma_shared_cq_srq *cq_srq)
+{
+	pthread_mutex_lock(&mut);
+	scq->used -= cqe;
+	if (cq_srq && !--cq_srq->refcnt) {
+		scq->used -= cq_srq->cqe;
+		list_del(&cq_srq->entry);
+		ucma_drop_shared_srq(cq_srq->ssrq);
+		free(cq_srq);
+	}
+	if (!--scq->refcnt) {
+		list_del(&scq->entry);
+		ibv_destroy_cq(scq->cq);
+		ibv_destroy_comp_channel(scq->channel);
+		free(scq);
+	}
+	pthread_mutex_unlock(&mut);
+}
+
+/*
+ * SRQs are matched by PD and SGE count and sized to the largest receive
+ * queue asked for, where the device can resize them.
+ */
+static struct cma_shared_srq *ucma_get_shared_srq(struct cma_device *cma_dev,
+						  struct ibv_pd *pd,
+						  struct ibv_qp_cap *cap)
+{
+	struct ibv_srq_init_attr attr = {};
+	struct cma_shared_srq *ssrq;
+	struct ibv_srq_attr srq_attr;
+	pthread_t self = pthread_self();
+	uint32_t max_wr;
+
+	max_wr = max_t(uint32_t, cap->max_recv_wr, 1);
+	max_wr = min_t(uint32_t, max_wr, cma_dev->max_srq_wr);
+
+	pthread_mutex_lock(&mut);
+	list_for_each(&cma_dev->shared_srqs, ssrq, entry) {
+		if (!pthread_equal(ssrq->owner, self) || ssrq->pd != pd ||
+		    ssrq->max_sge < cap->max_recv_sge)
+			continue;
+
+		if (max_wr > ssrq->max_wr && cma_dev->srq_resize) {
+			srq_attr.max_wr = max_wr;
+			if (!ibv_modify_srq(ssrq->srq, &srq_attr, IBV_SRQ_MAX_WR))
+				ssrq->max_wr = max_wr;
+		}
+		goto found;
+	}
+
+	ssrq = calloc(1, sizeof(*ssrq));
+	if (!ssrq)
+		goto err;
+
+	attr.attr.max_wr = max_wr;
+	attr.attr.max_sge = max_t(uint32_t, cap->max_recv_sge, 1);
+	ssrq->srq = ibv_create_srq(pd, &attr);
+	if (!ssrq->srq) {
+		free(ssrq);
+		goto err;
+	}
+
+	ssrq->owner = self;
+	ssrq->pd = pd;
+	ssrq->max_wr = attr.attr.max_wr;
+	ssrq->max_sge = attr.attr.max_sge;
+	list_add_tail(&cma_dev->shared_srqs, &ssrq->entry);
+found:
+	ssrq->refcnt++;
+	pthread_mutex_unlock(&mut);
+	return ssrq;
+
+err:
+	pthread_mutex_unlock(&mut);
+	return NULL;
+}
+
+/* Call with mut held */
+static void ucma_drop_shared_srq(struct cma_shared_srq *ssrq)
+{
+	if (!--ssrq->refcnt) {
+		list_del(&ssrq->entry);
+		ibv_destroy_srq(ssrq->srq);
+		free(ssrq);
+	}
+}
+
+static void ucma_put_shared_srq(struct cma_shared_srq *ssrq)
+{
+	pthread_mutex_lock(&mut);
+	ucma_drop_shared_srq(ssrq);
+	pthread_mutex_unlock(&mut);
+}
+
+static int ucma_create_shared_cqs(struct rdma_cm_id *id, uint32_t send_size,
+				  uint32_t recv_size)
+{
+	struct cma_shared_srq *ssrq = NULL;
+	struct cma_id_private *id_priv;
+	struct cma_shared_cq *scq;
+	int cqe = send_size + recv_size;
+
+	id_priv = container_of(id, struct cma_id_private, id);
+	/* Receives on the pooled SRQ are reserved for the SRQ as a whole */
+	if (recv_size && id_priv->shared_srq &&
+	    id->srq == id_priv->shared_srq->srq) {
+		ssrq = id_priv->shared_srq;
+		cqe = send_size;
+	}
+
+	scq = ucma_get_shared_cq(id_priv->cma_dev, cqe, ssrq,
+				 &id_priv->shared_cq_srq);
+	if (!scq)
+		return -1;
+
+	id_priv->shared_cq = scq;
+	id_priv->shared_cqe = cqe;
+	if (send_size) {
+		id->send_cq_channel = scq->channel;
+		id->send_cq = scq->cq;
+	}
+	if (recv_size) {
+		id->recv_cq_channel = scq->channel;
+		id->recv_cq = scq->cq;
+	}
+	return 0;
+}
+
+static void ucma_destroy_shared_cqs(struct cma_id_private *id_priv)
+{
+	struct rdma_cm_id *id = &id_priv->id;
+
+	if (id->send_cq == id_priv->shared_cq->cq) {
+		id->send_cq = NULL;
+		id->send_cq_channel = NULL;
+	}
+	if (id->recv_cq == id_priv->shared_cq->cq) {
+		id->recv_cq = NULL;
+		id->recv_cq_channel = NULL;
+	}
+	ucma_put_shared_cq(id_priv->shared_cq, id_priv->shared_cqe,
+			   id_priv->shared_cq_srq);
+	id_priv->shared_cq = NULL;
+	id_priv->shared_cq_srq = NULL;
+}
+
+static void ucma_release_shared_srq(struct cma_id_private *id_priv)
+{
+	if (!id_priv->shared_srq)
+		return;
+
+	id_priv->id.srq = NULL;
+	ucma_put_shared_srq(id_priv->shared_srq);
+	id_priv->shared_srq = NULL;
+}
+
 static void ucma_destroy_cqs(struct rdma_cm_id *id)
 {
+	struct cma_id_private *id_priv;
+
+	id_priv = container_of(id, struct cma_id_private, id);
+	if (id_priv->shared_cq) {
+		ucma_destroy_shared_cqs(id_priv);
+		return;
+	}
+
 	if (id->qp_type == IBV_QPT_XRC_RECV && id->srq)
 		return;
 
@@ -1557,6 +1989,14 @@ int rdma_create_srq(struct rdma_cm_id *id, struct ibv_pd *pd,
 
 void rdma_destroy_srq(struct rdma_cm_id *id)
 {
+	struct cma_id_private *id_priv;
+
+	id_priv = container_of(id, struct cma_id_private, id);
+	if (id_priv->shared_srq) {
+		ucma_release_shared_srq(id_priv);
+		return;
+	}
+
 	ibv_destroy_srq(id->srq);
 	id->srq = NULL;
 	ucma_destroy_cqs(id);
@@ -1617,10 +2057,35 @@ static int set_local_ece(struct rdma_cm_id *id, struct ibv_qp *qp)
 	return 0;
 }
 
+static int ucma_setup_qp(struct cma_id_private *id_priv, struct ibv_qp *qp)
+{
+	struct rdma_cm_id *id = &id_priv->id;
+	int ret;
+
+	ret = init_ece(id, qp);
+	if (ret)
+		return ret;
+
+	if (ucma_is_ud_qp(id->qp_type))
+		ret = ucma_init_ud_qp(id_priv, qp);
+	else
+		ret = ucma_init_conn_qp(id_priv, qp);
+	if (ret)
+		return ret;
+	ret = set_local_ece(id, qp);
+	if (ret)
+		return ret;
+
+	id->pd = qp->pd;
+	id->qp = qp;
+	return 0;
+}
+
 int rdma_create_qp_ex(struct rdma_cm_id *id,
 		      struct ibv_qp_init_attr_ex *attr)
 {
 	struct cma_id_private *id_priv;
+	uint32_t send_size, recv_size;
 	struct ibv_qp *qp;
 	int ret;
 
@@ -1647,10 +2112,25 @@ int rdma_create_qp_ex(struct rdma_cm_id *id,
 		}
 	}
 
-	ret = ucma_create_cqs(id, attr->send_cq || id->send_cq ? 0 : attr->cap.max_send_wr,
-				  attr->recv_cq || id->recv_cq ? 0 : attr->cap.max_recv_wr);
+	if (id_priv->share_srq && !id->srq && !attr->srq &&
+	    (id->qp_type == IBV_QPT_RC || id->qp_type == IBV_QPT_UC ||
+	     id->qp_type == IBV_QPT_UD)) {
+		id_priv->shared_srq = ucma_get_shared_srq(id_priv->cma_dev,
+							  attr->pd, &attr->cap);
+		if (!id_priv->shared_srq)
+			return -1;
+		id->srq = id_priv->shared_srq->srq;
+	}
+
+	send_size = attr->send_cq || id->send_cq ? 0 : attr->cap.max_send_wr;
+	recv_size = attr->recv_cq || id->recv_cq ? 0 : attr->cap.max_recv_wr;
+	if (id_priv->share_cq && (send_size || recv_size) &&
+	    id->qp_type != IBV_QPT_XRC_RECV)
+		ret = ucma_create_shared_cqs(id, send_size, recv_size);
+	else
+		ret = ucma_create_cqs(id, send_size, recv_size);
 	if (ret)
-		return ret;
+		goto err0;
 
 	if (!attr->send_cq)
 		attr->send_cq = id->send_cq;
@@ -1664,27 +2144,16 @@ int rdma_create_qp_ex(struct rdma_cm_id *id,
 		goto err1;
 	}
 
-	ret = init_ece(id, qp);
-	if (ret)
-		goto err2;
-
-	if (ucma_is_ud_qp(id->qp_type))
-		ret = ucma_init_ud_qp(id_priv, qp);
-	else
-		ret = ucma_init_conn_qp(id_priv, qp);
+	ret = ucma_setup_qp(id_priv, qp);
 	if (ret)
 		goto err2;
-	ret = set_local_ece(id, qp);
-	if (ret)
-		goto err2;
-
-	id->pd = qp->pd;
-	id->qp = qp;
 	return 0;
 err2:
 	ibv_destroy_qp(qp);
 err1:
 	ucma_destroy_cqs(id);
+err0:
+	ucma_release_shared_srq(id_priv);
 	return ret;
 }
 
@@ -1707,6 +2176,51 @@ void rdma_destroy_qp(struct rdma_cm_id *id)
 	ibv_destroy_qp(id->qp);
 	id->qp = NULL;
 	ucma_destroy_cqs(id);
+	ucma_release_shared_srq(container_of(id, struct cma_id_private, id));
+}
+
+/*
+ * Give an id a QP in the RESET state that was created on the id's PD, e.g.
+ * the QP of an earlier connection.  The QP is moved to INIT as if it had
+ * been created by rdma_create_qp(); the caller sets up the id's CQ fields.
+ */
+int ucma_attach_qp(struct rdma_cm_id *id, struct ibv_qp *qp)
+{
+	if (id->qp || qp->pd != id->pd)
+		return ERR(EINVAL);
+
+	return ucma_setup_qp(container_of(id, struct cma_id_private, id), qp);
+}
+
+/*
+ * Take a reference on the id's device, which keeps its PD, and everything
+ * registered with it, alive after the id is destroyed.
+ */
+struct cma_device *ucma_hold_device(struct rdma_cm_id *id)
+{
+	struct cma_id_private *id_priv;
+
+	id_priv = container_of(id, struct cma_id_private, id);
+	pthread_mutex_lock(&mut);
+	id_priv->cma_dev->refcnt++;
+	pthread_mutex_unlock(&mut);
+	return id_priv->cma_dev;
+}
+
+void ucma_release_device(struct cma_device *cma_dev)
+{
+	ucma_put_device(cma_dev);
+}
+
+/* True once the device has been hot-unplugged; its held references remain */
+bool ucma_device_removed(struct cma_device *cma_dev)
+{
+	bool removed;
+
+	pthread_mutex_lock(&mut);
+	removed = cma_dev->is_device_dead;
+	pthread_mutex_unlock(&mut);
+	return removed;
 }
 
 static int ucma_valid_param(struct cma_id_private *id_priv,
@@ -2238,10 +2752,20 @@ int rdma_ack_cm_event(struct rdma_cm_event *event)
 		ucma_complete_mc_event(evt->mc);
 	else
 		ucma_complete_event(evt->id_priv);
-	free(evt);
+	ucma_free_event(evt);
 	return 0;
 }
 
+int rdma_ack_cm_events(struct rdma_cm_event **events, int num)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < num; i++)
+		if (rdma_ack_cm_event(events[i]))
+			ret = -1;
+	return ret;
+}
+
 static void ucma_process_addr_resolved(struct cma_event *evt)
 {
 	if (af_ib_support) {
@@ -2271,11 +2795,19 @@ static void ucma_process_route_resolved(struct cma_event *evt)
 		evt->event.event = RDMA_CM_EVENT_ROUTE_ERROR;
 }
 
-static int ucma_query_req_info(struct rdma_cm_id *id)
+/*
+ * QUERY_ROUTE returns the addresses, device, GIDs, pkey and the primary and
+ * alternate paths of a request in one command.  Only requests received on
+ * an AF_IB listener need the separate queries, as their addresses do not fit
+ * in its response.
+ */
+static int ucma_query_req_info(struct rdma_cm_id *id,
+			       struct rdma_cm_id *listen_id)
 {
 	int ret;
 
-	if (!af_ib_support)
+	if (!af_ib_support ||
+	    listen_id->route.addr.src_addr.sa_family != AF_IB)
 		return ucma_query_route(id);
 
 	ret = ucma_query_addr(id);
@@ -2316,6 +2848,8 @@ static int ucma_process_conn_req(struct cma_event *evt, uint32_t handle,
 	id_priv->responder_resources = evt->event.param.conn.responder_resources;
 	id_priv->remote_ece.vendor_id = ece->vendor_id;
 	id_priv->remote_ece.options = ece->attr_mod;
+	id_priv->share_cq = evt->id_priv->share_cq;
+	id_priv->share_srq = evt->id_priv->share_srq;
 
 	if (evt->id_priv->sync) {
 		ret = rdma_migrate_id(&id_priv->id, NULL);
@@ -2323,7 +2857,7 @@ static int ucma_process_conn_req(struct cma_event *evt, uint32_t handle,
 			goto err2;
 	}
 
-	ret = ucma_query_req_info(&id_priv->id);
+	ret = ucma_query_req_info(&id_priv->id, &evt->id_priv->id);
 	if (ret)
 		goto err2;
 
@@ -2474,33 +3008,22 @@ int rdma_establish(struct rdma_cm_id *id)
 						   id));
 }
 
-int rdma_get_cm_event(struct rdma_event_channel *channel,
-		      struct rdma_cm_event **event)
+static int ucma_get_event(struct rdma_event_channel *channel,
+			  struct cma_event *evt)
 {
 	struct ucma_abi_event_resp resp = {};
 	struct ucma_abi_get_event cmd;
-	struct cma_event *evt;
 	int ret;
 
-	ret = ucma_init();
-	if (ret)
-		return ret;
-
-	if (!event)
-		return ERR(EINVAL);
-
-	evt = malloc(sizeof(*evt));
-	if (!evt)
-		return ERR(ENOMEM);
-
 retry:
-	memset(evt, 0, sizeof(*evt));
+	/* private_data is only read up to the reported length */
+	memset(&evt->event, 0, sizeof(evt->event));
+	evt->id_priv = NULL;
+	evt->mc = NULL;
 	CMA_INIT_CMD_RESP(&cmd, sizeof cmd, GET_EVENT, &resp, sizeof resp);
 	ret = write(channel->fd, &cmd, sizeof cmd);
-	if (ret != sizeof cmd) {
-		free(evt);
+	if (ret != sizeof cmd)
 		return (ret >= 0) ? ERR(ENODATA) : -1;
-	}
 
 	VALGRIND_MAKE_MEM_DEFINED(&resp, sizeof resp);
 
@@ -2615,10 +3138,81 @@ retry:
 		break;
 	}
 
+	return 0;
+}
+
+int rdma_get_cm_event(struct rdma_event_channel *channel,
+		      struct rdma_cm_event **event)
+{
+	struct cma_event *evt;
+	int ret;
+
+	ret = ucma_init();
+	if (ret)
+		return ret;
+
+	if (!event)
+		return ERR(EINVAL);
+
+	evt = ucma_alloc_event(channel);
+	if (!evt)
+		return ERR(ENOMEM);
+
+	ret = ucma_get_event(channel, evt);
+	if (ret) {
+		ucma_free_event(evt);
+		return ret;
+	}
+
 	*event = &evt->event;
 	return 0;
 }
 
+int rdma_get_cm_events(struct rdma_event_channel *channel,
+		       struct rdma_cm_event **events, int max)
+{
+	struct pollfd fds = { .fd = channel->fd, .events = POLLIN };
+	struct cma_event *evt;
+	int cnt, flags, ret;
+
+	ret = ucma_init();
+	if (ret)
+		return ret;
+
+	if (!events || max <= 0)
+		return ERR(EINVAL);
+
+	flags = fcntl(channel->fd, F_GETFL);
+	if (flags < 0)
+		return -1;
+
+	for (cnt = 0; cnt < max; cnt++) {
+		/*
+		 * Only the first read may block.  A non-blocking channel is
+		 * drained until the kernel reports EAGAIN.
+		 */
+		if (cnt && !(flags & O_NONBLOCK) && poll(&fds, 1, 0) != 1)
+			break;
+
+		evt = ucma_alloc_event(channel);
+		if (!evt) {
+			if (!cnt)
+				return ERR(ENOMEM);
+			break;
+		}
+
+		ret = ucma_get_event(channel, evt);
+		if (ret) {
+			ucma_free_event(evt);
+			if (!cnt)
+				return ret;
+			break;
+		}
+		events[cnt] = &evt->event;
+	}
+	return cnt;
+}
+
 const char *rdma_event_str(enum rdma_cm_event_type event)
 {
 	switch (event) {
@@ -2659,6 +3253,25 @@ const char *rdma_event_str(enum rdma_cm_event_type event)
 	}
 }
 
+static int ucma_set_lib_option(struct cma_id_private *id_priv, int optname,
+			       void *optval, size_t optlen)
+{
+	if (optlen != sizeof(int))
+		return ERR(EINVAL);
+
+	switch (optname) {
+	case RDMA_OPTION_LIB_SHARED_CQ:
+		id_priv->share_cq = !!*(int *) optval;
+		break;
+	case RDMA_OPTION_LIB_SHARED_SRQ:
+		id_priv->share_srq = !!*(int *) optval;
+		break;
+	default:
+		return ERR(ENOPROTOOPT);
+	}
+	return 0;
+}
+
 int rdma_set_option(struct rdma_cm_id *id, int level, int optname,
 		    void *optval, size_t optlen)
 {
@@ -2666,8 +3279,11 @@ int rdma_set_option(struct rdma_cm_id *id, int level, int optname,
 	struct cma_id_private *id_priv;
 	int ret;
 
-	CMA_INIT_CMD(&cmd, sizeof cmd, SET_OPTION);
 	id_priv = container_of(id, struct cma_id_private, id);
+	if (level == RDMA_OPTION_LIB)
+		return ucma_set_lib_option(id_priv, optname, optval, optlen);
+
+	CMA_INIT_CMD(&cmd, sizeof cmd, SET_OPTION);
 	cmd.id = id_priv->handle;
 	cmd.optval = (uintptr_t) optval;
 	cmd.level = level;
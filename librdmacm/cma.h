@@ -37,6 +37,7 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <endian.h>
 #include <semaphore.h>
@@ -85,6 +86,12 @@ void ucma_set_sid(enum rdma_port_space ps, struct sockaddr *addr,
 int ucma_max_qpsize(struct rdma_cm_id *id);
 int ucma_complete(struct rdma_cm_id *id);
 int ucma_shutdown(struct rdma_cm_id *id);
+int ucma_attach_qp(struct rdma_cm_id *id, struct ibv_qp *qp);
+
+struct cma_device;
+struct cma_device *ucma_hold_device(struct rdma_cm_id *id);
+void ucma_release_device(struct cma_device *cma_dev);
+bool ucma_device_removed(struct cma_device *cma_dev);
 
 static inline int ERR(int err)
 {
@@ -41,6 +41,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 
 #include <rdma/rdma_cma.h>
 #include "common.h"
@@ -52,6 +53,7 @@ static char *dst_addr;
 static char *src_addr;
 static int timeout = 2000;
 static int retries = 2;
+static int batch;
 
 enum step {
 	STEP_CREATE_ID,
@@ -107,6 +109,12 @@ static volatile int completed[STEP_CNT];
 static struct ibv_qp_init_attr init_qp_attr;
 static struct rdma_conn_param conn_param;
 
+/* server side accept rate */
+static struct timeval accept_start;
+static int accept_reqs;
+static int accepted;
+static float req_event_us;
+
 #define start_perf(n, s)	gettimeofday(&((n)->times[s][0]), NULL)
 #define end_perf(n, s)		gettimeofday(&((n)->times[s][1]), NULL)
 #define start_time(s)		gettimeofday(&times[s][0], NULL)
@@ -208,6 +216,30 @@ static void conn_handler(struct node *n)
 	completed[STEP_CONNECT]++;
 }
 
+/*
+ * The server reports how fast it accepted each group of 'connections'
+ * requests, counted from the first request to the last established event,
+ * and the time spent in rdma_get_cm_event() returning the requests.
+ */
+static void accept_handler(void)
+{
+	struct timeval now;
+	float us;
+
+	if (++accepted < connections)
+		return;
+
+	gettimeofday(&now, NULL);
+	us = diff_us(&now, &accept_start);
+	printf("accepted %d connections in %.2f ms: %.0f accepts / sec, "
+	       "%.2f us / request in %s\n", accepted,
+	       us / 1000., accepted * 1000000. / us, req_event_us / accept_reqs,
+	       batch ? "rdma_get_cm_events" : "rdma_get_cm_event");
+	accepted = 0;
+	accept_reqs = 0;
+	req_event_us = 0;
+}
+
 static void disc_handler(struct node *n)
 {
 	end_perf(n, STEP_DISCONNECT);
@@ -298,6 +330,8 @@ static void cma_handler(struct rdma_cm_id *id, struct rdma_cm_event *event)
 	case RDMA_CM_EVENT_ESTABLISHED:
 		if (n)
 			conn_handler(n);
+		else
+			accept_handler();
 		break;
 	case RDMA_CM_EVENT_ADDR_ERROR:
 		if (n->retries--) {
@@ -348,7 +382,6 @@ static void cma_handler(struct rdma_cm_id *id, struct rdma_cm_event *event)
 	default:
 		break;
 	}
-	rdma_ack_cm_event(event);
 }
 
 static int alloc_nodes(void)
@@ -398,17 +431,46 @@ static void cleanup_nodes(void)
 
 static void *process_events(void *arg)
 {
-	struct rdma_cm_event *event;
-	int ret = 0;
-
-	while (!ret) {
-		ret = rdma_get_cm_event(channel, &event);
-		if (!ret) {
-			cma_handler(event->id, event);
+	struct pollfd fds = { .fd = channel->fd, .events = POLLIN };
+	struct rdma_cm_event *events[batch ? batch : 1];
+	struct timeval start, end;
+	float us;
+	int i, n;
+
+	while (1) {
+		/* wait outside of the timed call */
+		if (poll(&fds, 1, -1) < 0 && errno != EINTR) {
+			perror("failure polling event channel");
+			break;
+		}
+		gettimeofday(&start, NULL);
+		if (batch) {
+			n = rdma_get_cm_events(channel, events, batch);
 		} else {
+			n = rdma_get_cm_event(channel, &events[0]);
+			if (!n)
+				n = 1;
+		}
+		if (n < 0) {
 			perror("failure in rdma_get_cm_event in process_server_events");
-			ret = errno;
+			break;
 		}
+		gettimeofday(&end, NULL);
+
+		us = diff_us(&end, &start) / n;
+		for (i = 0; i < n; i++) {
+			if (events[i]->event == RDMA_CM_EVENT_CONNECT_REQUEST) {
+				if (!accept_reqs++)
+					accept_start = start;
+				req_event_us += us;
+			}
+			cma_handler(events[i]->id, events[i]);
+		}
+
+		if (batch)
+			rdma_ack_cm_events(events, n);
+		else
+			rdma_ack_cm_event(events[0]);
 	}
 	return NULL;
 }
@@ -618,7 +680,7 @@ int main(int argc, char **argv)
 
 	hints.ai_port_space = RDMA_PS_TCP;
 	hints.ai_qp_type = IBV_QPT_RC;
-	while ((op = getopt(argc, argv, "s:b:c:p:r:t:")) != -1) {
+	while ((op = getopt(argc, argv, "s:b:c:p:r:t:E:")) != -1) {
 		switch (op) {
 		case 's':
 			dst_addr = optarg;
@@ -638,6 +700,9 @@ int main(int argc, char **argv)
 		case 't':
 			timeout = atoi(optarg);
 			break;
+		case 'E':
+			batch = atoi(optarg);
+			break;
 		default:
 			printf("usage: %s\n", argv[0]);
 			printf("\t[-s server_address]\n");
@@ -646,6 +711,7 @@ int main(int argc, char **argv)
 			printf("\t[-p port_number]\n");
 			printf("\t[-r retries]\n");
 			printf("\t[-t timeout_ms]\n");
+			printf("\t[-E max_events]\n");
 			exit(1);
 		}
 	}
@@ -0,0 +1,243 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Creates many rdma_cm_ids with QPs, once with private CQs and once with
+ * RDMA_OPTION_LIB_SHARED_CQ, and reports the memory, file descriptors and
+ * time needed to poll every CQ once.  Each mode runs in its own process so
+ * that the memory figures do not include the other run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <rdma/rdma_cma.h>
+#include <infiniband/verbs.h>
+#include "common.h"
+
+static char *src_addr;
+static int connections = 10000;
+static int qp_depth = 16;
+static int iterations = 100;
+
+static double now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static long rss_kb(void)
+{
+	long size, resident;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int open_fds(void)
+{
+	struct dirent *d;
+	DIR *dir;
+	int cnt = 0;
+
+	dir = opendir("/proc/self/fd");
+	if (!dir)
+		return 0;
+	while ((d = readdir(dir)))
+		if (d->d_name[0] != '.')
+			cnt++;
+	closedir(dir);
+	return cnt;
+}
+
+static int run(int shared)
+{
+	struct rdma_addrinfo hints, *rai = NULL;
+	struct rdma_event_channel *channel;
+	struct ibv_qp_init_attr attr;
+	struct rdma_cm_id **ids;
+	struct ibv_cq **cqs;
+	struct ibv_wc wc[16];
+	double start, t_create, t_poll, t_destroy;
+	long rss;
+	int i, j, fds, ncq = 0, ret = 0;
+
+	ids = calloc(connections, sizeof(*ids));
+	cqs = calloc(connections * 2, sizeof(*cqs));
+	if (!ids || !cqs) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	channel = create_first_event_channel();
+	if (!channel) {
+		ret = -errno;
+		goto free;
+	}
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_flags = RAI_PASSIVE;
+	hints.ai_port_space = RDMA_PS_TCP;
+	ret = rdma_getaddrinfo(src_addr, NULL, &hints, &rai);
+	if (ret) {
+		printf("rdma_getaddrinfo: %s\n", gai_strerror(ret));
+		goto close;
+	}
+
+	rss = rss_kb();
+	fds = open_fds();
+	memset(&attr, 0, sizeof attr);
+	attr.qp_type = IBV_QPT_RC;
+	attr.cap.max_send_wr = qp_depth;
+	attr.cap.max_recv_wr = qp_depth;
+	attr.cap.max_send_sge = 1;
+	attr.cap.max_recv_sge = 1;
+
+	start = now_usec();
+	for (i = 0; i < connections; i++) {
+		ret = rdma_create_id(channel, &ids[i], NULL, RDMA_PS_TCP);
+		if (ret) {
+			perror("rdma_create_id");
+			goto out;
+		}
+
+		ret = rdma_bind_addr(ids[i], rai->ai_src_addr);
+		if (ret) {
+			perror("rdma_bind_addr");
+			goto out;
+		}
+
+		if (shared) {
+			ret = rdma_set_option(ids[i], RDMA_OPTION_LIB,
+					      RDMA_OPTION_LIB_SHARED_CQ,
+					      &shared, sizeof shared);
+			if (ret) {
+				perror("rdma_set_option");
+				goto out;
+			}
+		}
+
+		ret = rdma_create_qp(ids[i], NULL, &attr);
+		if (ret) {
+			perror("rdma_create_qp");
+			goto out;
+		}
+
+		if (!ncq || cqs[ncq - 1] != ids[i]->send_cq)
+			cqs[ncq++] = ids[i]->send_cq;
+		if (ids[i]->recv_cq != ids[i]->send_cq)
+			cqs[ncq++] = ids[i]->recv_cq;
+	}
+	t_create = now_usec() - start;
+	rss = rss_kb() - rss;
+	fds = open_fds() - fds;
+
+	start = now_usec();
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < ncq; j++)
+			ibv_poll_cq(cqs[j], 16, wc);
+	}
+	t_poll = (now_usec() - start) / iterations;
+
+	printf("%-8s %10d %8d %10ld %8d %12.2f %12.2f",
+	       shared ? "shared" : "private", connections, ncq, rss, fds,
+	       t_create / connections, t_poll);
+out:
+	start = now_usec();
+	for (i = 0; i < connections && ids[i]; i++) {
+		if (ids[i]->qp)
+			rdma_destroy_qp(ids[i]);
+		rdma_destroy_id(ids[i]);
+	}
+	t_destroy = now_usec() - start;
+	if (!ret)
+		printf(" %12.2f\n", t_destroy / connections);
+
+	rdma_freeaddrinfo(rai);
+close:
+	rdma_destroy_event_channel(channel);
+free:
+	free(cqs);
+	free(ids);
+	return ret;
+}
+
+static int run_child(int shared)
+{
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -errno;
+	}
+	if (!pid)
+		_exit(run(shared) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		return -1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "b:c:q:i:")) != -1) {
+		switch (op) {
+		case 'b':
+			src_addr = optarg;
+			break;
+		case 'c':
+			connections = atoi(optarg);
+			break;
+		case 'q':
+			qp_depth = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			printf("usage: %s\n", argv[0]);
+			printf("\t -b bind_address\n");
+			printf("\t[-c connections]\n");
+			printf("\t[-q qp_depth]\n");
+			printf("\t[-i poll_iterations]\n");
+			exit(1);
+		}
+	}
+
+	if (!src_addr) {
+		fprintf(stderr, "%s: a bind address is required\n", argv[0]);
+		exit(1);
+	}
+	if (connections <= 0 || qp_depth <= 0 || iterations <= 0) {
+		fprintf(stderr, "%s: counts must be positive\n", argv[0]);
+		exit(1);
+	}
+
+	printf("%-8s %10s %8s %10s %8s %12s %12s %12s\n", "cq", "qps", "cqs",
+	       "rss(KB)", "fds", "create(us)", "poll(us)", "destroy(us)");
+	ret = run_child(0);
+	if (!ret)
+		ret = run_child(1);
+
+	return ret ? 1 : 0;
+}
@@ -82,6 +82,7 @@ static int flags = MSG_DONTWAIT;
 static int poll_timeout = 0;
 static int custom;
 static int use_fork;
+static int conn_test;
 static pid_t fork_pid;
 static enum rs_optimization optimization;
 static int size_option;
@@ -123,6 +124,22 @@ static void show_perf(void)
 		(usec / iterations) / (transfer_count * 2));
 }
 
+static void show_conn_perf(void)
+{
+	char str[32];
+	float usec;
+
+	usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+
+	/* name conns seconds conns/sec usec/conn */
+	printf("%-10s", "connect");
+	cnt_str(str, sizeof str, iterations);
+	printf("%-8s", str);
+	printf("%8.2fs%11.2f%11.2f\n",
+		usec / 1000000., iterations * 1000000. / usec,
+		usec / iterations);
+}
+
 static void init_latency_test(int size)
 {
 	char sstr[5];
@@ -498,6 +515,52 @@ free:
 	return ret;
 }
 
+/*
+ * Connection setup rate: each iteration connects, exchanges one small
+ * message each way to show the connection works, then shuts down and
+ * closes it.
+ */
+static int run_conn_test(void)
+{
+	int i, ret = 0;
+
+	buf = malloc(16);
+	if (!buf) {
+		perror("malloc");
+		return -1;
+	}
+
+	if (!dst_addr) {
+		ret = server_listen();
+		if (ret)
+			goto free;
+	}
+
+	printf("%-10s%-8s%8s %10s%11s\n",
+	       "name", "conns", "time", "conns/sec", "usec/conn");
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		ret = dst_addr ? client_connect() : server_connect();
+		if (ret)
+			break;
+
+		ret = sync_test();
+		rs_shutdown(rs, SHUT_RDWR);
+		rs_close(rs);
+		if (ret)
+			break;
+	}
+	gettimeofday(&end, NULL);
+	if (!ret)
+		show_conn_perf();
+
+	if (!dst_addr)
+		rs_close(lrs);
+free:
+	free(buf);
+	return ret;
+}
+
 static int run(void)
 {
 	int i, ret = 0;
@@ -579,6 +642,9 @@ static int set_test_opt(const char *arg)
 		case 'b':
 			flags = (flags & ~MSG_DONTWAIT) | MSG_WAITALL;
 			break;
+		case 'c':
+			conn_test = 1;
+			break;
 		case 'f':
 			use_fork = 1;
 			use_rs = 0;
@@ -600,6 +666,8 @@ static int set_test_opt(const char *arg)
 			use_rs = 0;
 		} else if (!strncasecmp("async", arg, 5)) {
 			use_async = 1;
+		} else if (!strncasecmp("connect", arg, 7)) {
+			conn_test = 1;
 		} else if (!strncasecmp("block", arg, 5)) {
 			flags = (flags & ~MSG_DONTWAIT) | MSG_WAITALL;
 		} else if (!strncasecmp("nonblock", arg, 8)) {
@@ -693,6 +761,7 @@ int main(int argc, char **argv)
 			printf("\t    s|sockets - use standard tcp/ip sockets\n");
 			printf("\t    a|async - asynchronous operation (use poll)\n");
 			printf("\t    b|blocking - use blocking calls\n");
+			printf("\t    c|connect - measure connection setup rate\n");
 			printf("\t    f|fork - fork server processing\n");
 			printf("\t    n|nonblocking - use nonblocking calls\n");
 			printf("\t    r|resolve - use rdma cm to resolve address\n");
@@ -704,6 +773,16 @@ int main(int argc, char **argv)
 	if (!(flags & MSG_DONTWAIT))
 		poll_timeout = -1;
 
+	if (conn_test) {
+		if (use_fork) {
+			fprintf(stderr, "connect test does not support fork\n");
+			exit(1);
+		}
+		if (!custom)
+			iterations = 1000;
+		return run_conn_test();
+	}
+
 	ret = run();
 	return ret;
 }
@@ -658,6 +658,35 @@ int rdma_get_cm_event(struct rdma_event_channel *channel,
  */
 int rdma_ack_cm_event(struct rdma_cm_event *event);
 
+/**
+ * rdma_get_cm_events - Retrieves the pending communication events.
+ * @channel: Event channel to check for events.
+ * @events: Array receiving up to max events.
+ * @max: Size of the events array.
+ * Description:
+ *   Retrieves up to max communication events.  The call waits for the first
+ *   event as rdma_get_cm_event does, then returns the events already pending
+ *   without blocking again.  Returns the number of events retrieved.
+ * Notes:
+ *   Every event must be acknowledged, either one at a time with
+ *   rdma_ack_cm_event or with rdma_ack_cm_events.
+ * See also:
+ *   rdma_get_cm_event, rdma_ack_cm_events
+ */
+int rdma_get_cm_events(struct rdma_event_channel *channel,
+		       struct rdma_cm_event **events, int max);
+
+/**
+ * rdma_ack_cm_events - Free communication events.
+ * @events: Events to be released.
+ * @num: Number of events.
+ * Description:
+ *   Acknowledges num events, as rdma_ack_cm_event does for each of them.
+ * See also:
+ *   rdma_get_cm_events, rdma_ack_cm_event
+ */
+int rdma_ack_cm_events(struct rdma_cm_event **events, int num);
+
 __be16 rdma_get_src_port(struct rdma_cm_id *id);
 __be16 rdma_get_dst_port(struct rdma_cm_id *id);
 
@@ -709,7 +738,8 @@ const char *rdma_event_str(enum rdma_cm_event_type event);
 /* Option levels */
 enum {
 	RDMA_OPTION_ID		= 0,
-	RDMA_OPTION_IB		= 1
+	RDMA_OPTION_IB		= 1,
+	RDMA_OPTION_LIB		= 0x100	/* handled by librdmacm */
 };
 
 /* Option details */
@@ -724,6 +754,11 @@ enum {
 	RDMA_OPTION_IB_PATH	 = 1	/* struct ibv_path_data[] */
 };
 
+enum {
+	RDMA_OPTION_LIB_SHARED_CQ  = 0,	/* int: QPs use pooled CQs */
+	RDMA_OPTION_LIB_SHARED_SRQ = 1	/* int: QPs use pooled SRQs */
+};
+
 /**
  * rdma_set_option - Set options for an rdma_cm_id.
  * @id: Communication identifier to set option for.
@@ -731,6 +766,11 @@ enum {
  * @optname: Name of the option to set.
  * @optval: Reference to the option data.
  * @optlen: The size of the %optval buffer.
+ * Description:
+ *   Options at level RDMA_OPTION_LIB are kept by the library.  With
+ *   RDMA_OPTION_LIB_SHARED_CQ or RDMA_OPTION_LIB_SHARED_SRQ set, QPs created
+ *   later on the id, or on ids of connection requests it reports, take their
+ *   CQs or SRQ from a per device, per thread pool instead of private ones.
  */
 int rdma_set_option(struct rdma_cm_id *id, int level, int optname,
 		    void *optval, size_t optlen);
@@ -68,9 +68,12 @@
 #define RS_QP_CTRL_SIZE 4	/* must be power of 2 */
 #define RS_CONN_RETRIES 6
 #define RS_SGL_SIZE 2
+#define RS_EP_REUSE_US 50000
 static struct index_map idm;
 static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t svc_mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t ep_mut = PTHREAD_MUTEX_INITIALIZER;
+static dlist_entry ep_pool = { &ep_pool, &ep_pool };
 
 struct rsocket;
 
@@ -136,6 +139,7 @@ static uint32_t def_mem = (1 << 17);
 static uint32_t def_wmem = (1 << 17);
 static uint32_t polling_time = 10;
 static int wake_up_interval = 5000;
+static uint32_t ep_pool_size = 16;
 
 /*
  * Immediate data format is determined by the upper bits
@@ -408,6 +412,38 @@ struct rsocket {
 	int		  unack_cqe;
 };
 
+/*
+ * The QP, CQ and buffers of a closed stream rsocket, kept in ep_pool for a
+ * new connection on the same PD that asks for the same sizes.  The QP is in
+ * the RESET state and the CQ is empty.  The buffers the peer writes to are
+ * not registered while pooled, so that a new connection gets new rkeys, and
+ * the QP is not reused before the old peer could have stopped sending to it.
+ */
+struct rs_ep {
+	dlist_entry		entry;
+	struct cma_device	*cma_dev;
+	struct ibv_comp_channel	*channel;
+	struct ibv_cq		*cq;
+	struct ibv_qp		*qp;
+	uint64_t		reuse_us;
+
+	uint32_t		sbuf_size;
+	uint32_t		rbuf_size;
+	uint16_t		sq_size;
+	uint16_t		rq_size;
+	uint16_t		sq_inline;
+	int			target_iomap_size;
+	int			opts;
+
+	struct rs_msg		*rmsg;
+	uint8_t			*sbuf;
+	struct ibv_mr		*smr;
+	void			*target_buffer_list;
+	size_t			target_len;
+	uint8_t			*rbuf;
+	size_t			rbuf_len;
+};
+
 #define DS_UDP_TAG 0x55555555
 
 struct ds_udp_header {
@@ -603,6 +639,11 @@ static void rs_configure(void)
 		def_iomap_size = (uint8_t) rs_value_to_scale(
 			(uint16_t) rs_scale_to_value(def_iomap_size, 8), 8);
 	}
+
+	if ((f = fopen(RS_CONF_DIR "/ep_pool_size", "r"))) {
+		failable_fscanf(f, "%u", &ep_pool_size);
+		fclose(f);
+	}
 	init = 1;
 out:
 	pthread_mutex_unlock(&mut);
@@ -737,6 +778,8 @@ static void ds_set_qp_size(struct rsocket *rs)
 		rs->sbuf_size = rs->sq_size * RS_SNDLOWAT;
 }
 
+static void rs_reset_bufs(struct rsocket *rs);
+
 static int rs_init_bufs(struct rsocket *rs)
 {
 	uint32_t total_rbuf_size, total_sbuf_size;
@@ -767,11 +810,6 @@ static int rs_init_bufs(struct rsocket *rs)
 	if (!rs->target_mr)
 		return -1;
 
-	memset(rs->target_buffer_list, 0, len);
-	rs->target_sgl = rs->target_buffer_list;
-	if (rs->target_iomap_size)
-		rs->target_iomap = (struct rs_iomap *) (rs->target_sgl + RS_SGL_SIZE);
-
 	total_rbuf_size = rs->rbuf_size;
 	if (rs->opts & RS_OPT_MSG_SEND)
 		total_rbuf_size += rs->rq_size * RS_MSG_SIZE;
@@ -783,6 +821,19 @@ static int rs_init_bufs(struct rsocket *rs)
 	if (!rs->rmr)
 		return -1;
 
+	rs_reset_bufs(rs);
+	return 0;
+}
+
+static void rs_reset_bufs(struct rsocket *rs)
+{
+	memset(rs->target_buffer_list, 0,
+	       sizeof(*rs->target_sgl) * RS_SGL_SIZE +
+	       sizeof(*rs->target_iomap) * rs->target_iomap_size);
+	rs->target_sgl = rs->target_buffer_list;
+	if (rs->target_iomap_size)
+		rs->target_iomap = (struct rs_iomap *) (rs->target_sgl + RS_SGL_SIZE);
+
 	rs->ssgl[0].addr = rs->ssgl[1].addr = (uintptr_t) rs->sbuf;
 	rs->sbuf_bytes_avail = rs->sbuf_size;
 	rs->ssgl[0].lkey = rs->ssgl[1].lkey = rs->smr->lkey;
@@ -791,7 +842,6 @@ static int rs_init_bufs(struct rsocket *rs)
 	rs->rbuf_bytes_avail = rs->rbuf_size >> 1;
 	rs->sqe_avail = rs->sq_size - rs->ctrl_max_seqno;
 	rs->rseq_comp = rs->rq_size >> 1;
-	return 0;
 }
 
 static int ds_init_bufs(struct ds_qp *qp)
@@ -893,14 +943,265 @@ static inline int ds_post_recv(struct rsocket *rs, struct ds_qp *qp, uint32_t of
 	return rdma_seterrno(ibv_post_recv(qp->cm_id->qp, &wr, &bad));
 }
 
-static int rs_create_ep(struct rsocket *rs)
+static void rs_free_ep(struct rs_ep *ep)
+{
+	free(ep->rbuf);
+	free(ep->target_buffer_list);
+	rdma_dereg_mr(ep->smr);
+	free(ep->sbuf);
+	free(ep->rmsg);
+	ibv_destroy_qp(ep->qp);
+	ibv_destroy_cq(ep->cq);
+	ibv_destroy_comp_channel(ep->channel);
+	ucma_release_device(ep->cma_dev);
+	free(ep);
+}
+
+static bool rs_ep_match(struct rsocket *rs, struct rs_ep *ep)
+{
+	return ep->qp->pd == rs->cm_id->pd &&
+	       ep->sq_size == rs->sq_size && ep->rq_size == rs->rq_size &&
+	       ep->sq_inline >= rs->sq_inline &&
+	       ep->sbuf_size == rs->sbuf_size &&
+	       ep->rbuf_size == rs->rbuf_size &&
+	       ep->target_iomap_size == rs->target_iomap_size &&
+	       (ep->opts & RS_OPT_MSG_SEND) == (rs->opts & RS_OPT_MSG_SEND);
+}
+
+/* Call with ep_mut held.  Frees the pooled entries of removed devices. */
+static void rs_drop_dead_eps(void)
+{
+	dlist_entry *entry, *next;
+	struct rs_ep *ep;
+
+	for (entry = ep_pool.next; entry != &ep_pool; entry = next) {
+		next = entry->next;
+		ep = container_of(entry, struct rs_ep, entry);
+		if (ucma_device_removed(ep->cma_dev)) {
+			dlist_remove(entry);
+			rs_free_ep(ep);
+		}
+	}
+}
+
+/*
+ * Call with ep_mut held.  Counts the pooled entries of a PD that are ready
+ * for reuse and those still waiting out the retry time of their old
+ * connection, and frees the ready entries past ep_pool_size, which were
+ * kept while waiting.
+ */
+static void rs_count_eps(struct ibv_pd *pd, uint64_t now,
+			 uint32_t *ready, uint32_t *waiting)
+{
+	dlist_entry *entry, *next;
+	struct rs_ep *ep;
+
+	*ready = *waiting = 0;
+	for (entry = ep_pool.next; entry != &ep_pool; entry = next) {
+		next = entry->next;
+		ep = container_of(entry, struct rs_ep, entry);
+		if (ep->qp->pd != pd)
+			continue;
+
+		if (ep->reuse_us > now) {
+			(*waiting)++;
+		} else if (*ready >= ep_pool_size) {
+			dlist_remove(entry);
+			rs_free_ep(ep);
+		} else {
+			(*ready)++;
+		}
+	}
+}
+
+/* Releases the devices held by the pool when the library is unloaded */
+static void __attribute__((destructor)) rs_ep_pool_fini(void)
+{
+	struct rs_ep *ep;
+
+	pthread_mutex_lock(&ep_mut);
+	while (ep_pool.next != &ep_pool) {
+		ep = container_of(ep_pool.next, struct rs_ep, entry);
+		dlist_remove(&ep->entry);
+		rs_free_ep(ep);
+	}
+	pthread_mutex_unlock(&ep_mut);
+}
+
+/*
+ * Take the QP, CQ and buffers of a closed rsocket from the pool instead of
+ * creating and registering new ones.  Returns false if there is no match.
+ */
+static bool rs_get_ep(struct rsocket *rs)
+{
+	struct rdma_cm_id *cm_id = rs->cm_id;
+	struct rs_ep *ep = NULL, *cur;
+	dlist_entry *entry;
+	uint64_t now;
+
+	now = rs_time_us();
+	pthread_mutex_lock(&ep_mut);
+	rs_drop_dead_eps();
+	for (entry = ep_pool.next; entry != &ep_pool; entry = entry->next) {
+		cur = container_of(entry, struct rs_ep, entry);
+		if (cur->reuse_us <= now && rs_ep_match(rs, cur)) {
+			ep = cur;
+			dlist_remove(entry);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ep_mut);
+	if (!ep)
+		return false;
+
+	/* New rkeys, so that nothing the old peer still writes is accepted */
+	rs->target_mr = rdma_reg_write(cm_id, ep->target_buffer_list,
+				       ep->target_len);
+	if (!rs->target_mr)
+		goto err;
+	rs->rmr = rdma_reg_write(cm_id, ep->rbuf, ep->rbuf_len);
+	if (!rs->rmr)
+		goto err;
+
+	ep->cq->cq_context = cm_id;
+	ep->qp->qp_context = rs;
+	if (set_fd_nonblock(ep->channel->fd, rs->fd_flags & O_NONBLOCK) ||
+	    ucma_attach_qp(cm_id, ep->qp))
+		goto err;
+
+	ibv_req_notify_cq(ep->cq, 0);
+	cm_id->recv_cq_channel = cm_id->send_cq_channel = ep->channel;
+	cm_id->recv_cq = cm_id->send_cq = ep->cq;
+
+	rs->sq_inline = ep->sq_inline;
+	rs->rmsg = ep->rmsg;
+	rs->sbuf = ep->sbuf;
+	rs->smr = ep->smr;
+	rs->target_buffer_list = ep->target_buffer_list;
+	rs->rbuf = ep->rbuf;
+	rs_reset_bufs(rs);
+
+	ucma_release_device(ep->cma_dev);
+	free(ep);
+	return true;
+
+err:
+	if (rs->rmr)
+		rdma_dereg_mr(rs->rmr);
+	if (rs->target_mr)
+		rdma_dereg_mr(rs->target_mr);
+	rs->rmr = rs->target_mr = NULL;
+	rs_free_ep(ep);
+	return false;
+}
+
+/*
+ * Keep the QP, CQ and buffers of a stream rsocket being freed for a later
+ * connection, up to ep_pool_size ready for reuse per device.  QP and CQ
+ * creation and memory registration are most of the cost of setting up a
+ * connection.
+ *
+ * A QP is only ready once its retry time has passed, about half a second
+ * with the usual ack timeout, so a pool of ep_pool_size would allow only
+ * ep_pool_size reuses per retry time.  Entries still waiting are therefore
+ * not counted against ep_pool_size but against enough further entries to
+ * keep ep_pool_size ready every RS_EP_REUSE_US.
+ */
+static bool rs_put_ep(struct rsocket *rs)
+{
+	struct rdma_cm_id *cm_id = rs->cm_id;
+	struct ibv_qp_init_attr init_attr;
+	struct ibv_qp_attr attr;
+	struct ibv_wc wc;
+	struct ibv_cq *cq;
+	struct rs_ep *ep;
+	uint32_t ready, waiting;
+	uint64_t now, timewait_us;
+	void *context;
+
+	if (!ep_pool_size || !cm_id || !cm_id->qp || !rs->rmr)
+		return false;
+
+	/*
+	 * The QPN is reused as well, so wait out the time the old peer may
+	 * keep retrying sends to it, as the kernel CM does for timewait.
+	 */
+	if (ibv_query_qp(cm_id->qp, &attr, IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT,
+			 &init_attr) || !attr.timeout || attr.timeout > 31)
+		return false;
+	timewait_us = (attr.retry_cnt + 1) * ((4096ULL << attr.timeout) / 1000);
+
+	attr.qp_state = IBV_QPS_RESET;
+	if (ibv_modify_qp(cm_id->qp, &attr, IBV_QP_STATE))
+		return false;
+
+	/* Completions and CQ events left over belong to the old connection */
+	while (ibv_poll_cq(cm_id->recv_cq, 1, &wc) > 0)
+		;
+	if (set_fd_nonblock(cm_id->recv_cq_channel->fd, true))
+		return false;
+	while (!ibv_get_cq_event(cm_id->recv_cq_channel, &cq, &context))
+		rs->unack_cqe++;
+	ibv_ack_cq_events(cm_id->recv_cq, rs->unack_cqe);
+	rs->unack_cqe = 0;
+
+	ep = calloc(1, sizeof(*ep));
+	if (!ep)
+		return false;
+
+	now = rs_time_us();
+	pthread_mutex_lock(&ep_mut);
+	rs_drop_dead_eps();
+	rs_count_eps(cm_id->pd, now, &ready, &waiting);
+	if (ready >= ep_pool_size ||
+	    waiting >= ep_pool_size * (timewait_us / RS_EP_REUSE_US + 1)) {
+		pthread_mutex_unlock(&ep_mut);
+		free(ep);
+		return false;
+	}
+
+	ep->cma_dev = ucma_hold_device(cm_id);
+	ep->channel = cm_id->recv_cq_channel;
+	ep->cq = cm_id->recv_cq;
+	ep->qp = cm_id->qp;
+	ep->reuse_us = now + timewait_us;
+	ep->sbuf_size = rs->sbuf_size;
+	ep->rbuf_size = rs->rbuf_size;
+	ep->sq_size = rs->sq_size;
+	ep->rq_size = rs->rq_size;
+	ep->sq_inline = rs->sq_inline;
+	ep->target_iomap_size = rs->target_iomap_size;
+	ep->opts = rs->opts;
+	ep->rmsg = rs->rmsg;
+	ep->sbuf = rs->sbuf;
+	ep->smr = rs->smr;
+	ep->target_buffer_list = rs->target_buffer_list;
+	ep->target_len = rs->target_mr->length;
+	ep->rbuf = rs->rbuf;
+	ep->rbuf_len = rs->rmr->length;
+	rdma_dereg_mr(rs->target_mr);
+	rdma_dereg_mr(rs->rmr);
+	dlist_insert_tail(&ep->entry, &ep_pool);
+	pthread_mutex_unlock(&ep_mut);
+
+	cm_id->qp = NULL;
+	cm_id->recv_cq = cm_id->send_cq = NULL;
+	cm_id->recv_cq_channel = cm_id->send_cq_channel = NULL;
+	rs->rmsg = NULL;
+	rs->sbuf = NULL;
+	rs->smr = NULL;
+	rs->target_buffer_list = NULL;
+	rs->target_mr = NULL;
+	rs->rbuf = NULL;
+	rs->rmr = NULL;
+	return true;
+}
+
+static int rs_new_ep(struct rsocket *rs)
 {
 	struct ibv_qp_init_attr qp_attr;
-	int i, ret;
+	int ret;
 
-	rs_set_qp_size(rs);
-	if (rs->cm_id->verbs->device->transport_type == IBV_TRANSPORT_IWARP)
-		rs->opts |= RS_OPT_MSG_SEND;
 	ret = rs_create_cq(rs, rs->cm_id);
 	if (ret)
 		return ret;
@@ -925,9 +1226,21 @@ static int rs_create_ep(struct rsocket *rs)
 	if ((rs->opts & RS_OPT_MSG_SEND) && (rs->sq_inline < RS_MSG_SIZE))
 		return ERR(ENOTSUP);
 
-	ret = rs_init_bufs(rs);
-	if (ret)
-		return ret;
+	return rs_init_bufs(rs);
+}
+
+static int rs_create_ep(struct rsocket *rs)
+{
+	int i, ret;
+
+	rs_set_qp_size(rs);
+	if (rs->cm_id->verbs->device->transport_type == IBV_TRANSPORT_IWARP)
+		rs->opts |= RS_OPT_MSG_SEND;
+	if (!rs_get_ep(rs)) {
+		ret = rs_new_ep(rs);
+		if (ret)
+			return ret;
+	}
 
 	for (i = 0; i < rs->rq_size; i++) {
 		ret = rs_post_recv(rs);
@@ -1030,6 +1343,7 @@ static void rs_free(struct rsocket *rs)
 		return;
 	}
 
+	rs_put_ep(rs);
 	if (rs->rmsg)
 		free(rs->rmsg);
 
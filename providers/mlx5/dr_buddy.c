@@ -60,8 +60,6 @@ int dr_buddy_init(struct dr_icm_buddy_mem *buddy, uint32_t max_order)
 	buddy->max_order = max_order;
 
 	list_node_init(&buddy->list_node);
-	list_head_init(&buddy->used_list);
-	list_head_init(&buddy->hot_list);
 
 	buddy->bits = calloc(buddy->max_order + 1, sizeof(long *));
 	if (!buddy->bits) {
@@ -56,10 +56,26 @@
 #include <string.h>
 #include "mlx5dv_dr.h"
 
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
 #define DR_STE_CRC_POLY		0xEDB88320L
 
 static uint32_t dr_ste_crc_tab32[8][256];
 
+static uint32_t dr_crc32_swab(uint32_t crc)
+{
+	return ((crc>>24) & 0xff) | ((crc<<8) & 0xff0000) |
+		((crc>>8) & 0xff00) | ((crc<<24) & 0xff000000);
+}
+
+static void dr_crc32_select_calc(void);
+
 static void dr_crc32_calc_lookup_entry(uint32_t (*tbl)[256], uint8_t i,
 				       uint8_t j)
 {
@@ -91,6 +107,8 @@ void dr_crc32_init_table(void)
 		dr_crc32_calc_lookup_entry(dr_ste_crc_tab32, 6, i);
 		dr_crc32_calc_lookup_entry(dr_ste_crc_tab32, 7, i);
 	}
+
+	dr_crc32_select_calc();
 }
 
 /* Compute CRC32 (Slicing-by-8 algorithm) */
@@ -126,6 +144,177 @@ uint32_t dr_crc32_slice8_calc(const void *input_data, size_t length)
 		crc = (crc >> 8) ^ dr_ste_crc_tab32[0][(crc & 0xff)
 			^ *current_char++];
 
-	return ((crc>>24) & 0xff) | ((crc<<8) & 0xff0000) |
-		((crc>>8) & 0xff00) | ((crc<<24) & 0xff000000);
+	return dr_crc32_swab(crc);
+}
+
+static void dr_crc32_slice8_calc_batch(const void *input_data, size_t length,
+				       size_t stride, uint32_t *crc,
+				       uint32_t num)
+{
+	const uint8_t *p = input_data;
+	uint32_t i;
+
+	for (i = 0; i < num; i++, p += stride)
+		crc[i] = dr_crc32_slice8_calc(p, length);
+}
+
+#if defined(__x86_64__)
+static bool dr_crc32_have_clmul(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return ecx & bit_PCLMUL;
+}
+
+/*
+ * Fold the 16B blocks with carry-less multiplications then reduce the last
+ * one with Barrett, see Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction".  The constants are those of the
+ * bit reflected DR_STE_CRC_POLY.  Other lengths go to the tables.
+ */
+__attribute__((target("pclmul"))) static inline uint32_t
+dr_crc32_clmul_calc_one(const void *input_data, size_t length)
+{
+	const __m128i r4r3 = _mm_set_epi64x(0xccaa009eULL, 0x1751997d0ULL);
+	const __m128i r5 = _mm_set_epi64x(0, 0x163cd6124ULL);
+	const __m128i upoly = _mm_set_epi64x(0x1f7011641ULL, 0x1db710641ULL);
+	const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+	const __m128i *p = input_data;
+	__m128i x, t;
+
+	if (!input_data || !length || length % sizeof(*p))
+		return dr_crc32_slice8_calc(input_data, length);
+
+	x = _mm_loadu_si128(p++);
+	for (length -= sizeof(*p); length; length -= sizeof(*p)) {
+		t = _mm_clmulepi64_si128(x, r4r3, 0x11);
+		x = _mm_clmulepi64_si128(x, r4r3, 0x00);
+		x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_loadu_si128(p++));
+	}
+
+	/* 128 to 64 bits, this also appends the 32 zero bits of the CRC */
+	t = _mm_clmulepi64_si128(r4r3, x, 0x01);
+	x = _mm_xor_si128(_mm_srli_si128(x, 8), t);
+
+	/* 64 to 32 bits */
+	t = _mm_srli_si128(x, 4);
+	x = _mm_clmulepi64_si128(_mm_and_si128(x, mask32), r5, 0x00);
+	x = _mm_xor_si128(x, t);
+
+	t = x;
+	x = _mm_clmulepi64_si128(_mm_and_si128(x, mask32), upoly, 0x10);
+	x = _mm_clmulepi64_si128(_mm_and_si128(x, mask32), upoly, 0x00);
+	x = _mm_xor_si128(x, t);
+
+	return dr_crc32_swab(_mm_cvtsi128_si32(_mm_srli_si128(x, 4)));
+}
+
+__attribute__((target("pclmul")))
+static uint32_t dr_crc32_clmul_calc(const void *input_data, size_t length)
+{
+	return dr_crc32_clmul_calc_one(input_data, length);
+}
+
+__attribute__((target("pclmul")))
+static void dr_crc32_clmul_calc_batch(const void *input_data, size_t length,
+				      size_t stride, uint32_t *crc,
+				      uint32_t num)
+{
+	const uint8_t *p = input_data;
+	uint32_t i;
+
+	for (i = 0; i < num; i++, p += stride)
+		crc[i] = dr_crc32_clmul_calc_one(p, length);
+}
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+
+static bool dr_crc32_have_crc32(void)
+{
+	return getauxval(AT_HWCAP) & HWCAP_CRC32;
+}
+
+/* The CRC32 instructions use the same polynomial, not CRC32C */
+__attribute__((target("+crc"))) static inline uint32_t
+dr_crc32_arm_calc_one(const void *input_data, size_t length)
+{
+	const uint8_t *p = input_data;
+	uint32_t crc = 0;
+	uint64_t val;
+
+	if (!input_data)
+		return 0;
+
+	for (; length >= sizeof(val); length -= sizeof(val)) {
+		memcpy(&val, p, sizeof(val));
+		crc = __crc32d(crc, val);
+		p += sizeof(val);
+	}
+
+	while (length--)
+		crc = __crc32b(crc, *p++);
+
+	return dr_crc32_swab(crc);
+}
+
+__attribute__((target("+crc")))
+static uint32_t dr_crc32_arm_calc(const void *input_data, size_t length)
+{
+	return dr_crc32_arm_calc_one(input_data, length);
+}
+
+__attribute__((target("+crc")))
+static void dr_crc32_arm_calc_batch(const void *input_data, size_t length,
+				    size_t stride, uint32_t *crc, uint32_t num)
+{
+	const uint8_t *p = input_data;
+	uint32_t i;
+
+	for (i = 0; i < num; i++, p += stride)
+		crc[i] = dr_crc32_arm_calc_one(p, length);
+}
+#endif
+
+typedef uint32_t (*dr_crc32_calc_fn_t)(const void *, size_t);
+typedef void (*dr_crc32_calc_batch_fn_t)(const void *, size_t, size_t,
+					 uint32_t *, uint32_t);
+
+static dr_crc32_calc_fn_t dr_crc32_calc_fn = dr_crc32_slice8_calc;
+static dr_crc32_calc_batch_fn_t dr_crc32_calc_batch_fn =
+	dr_crc32_slice8_calc_batch;
+
+static void dr_crc32_select_calc(void)
+{
+#if defined(__x86_64__)
+	if (dr_crc32_have_clmul()) {
+		dr_crc32_calc_fn = dr_crc32_clmul_calc;
+		dr_crc32_calc_batch_fn = dr_crc32_clmul_calc_batch;
+	}
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (dr_crc32_have_crc32()) {
+		dr_crc32_calc_fn = dr_crc32_arm_calc;
+		dr_crc32_calc_batch_fn = dr_crc32_arm_calc_batch;
+	}
+#endif
+}
+
+/*
+ * Same result as dr_crc32_slice8_calc(), with the CPU CRC instructions when
+ * there are.  Valid once dr_crc32_init_table() was called.
+ */
+uint32_t dr_crc32_calc(const void *input_data, size_t length)
+{
+	return dr_crc32_calc_fn(input_data, length);
+}
+
+/* The CRC of num buffers of length bytes, stride bytes apart */
+void dr_crc32_calc_batch(const void *input_data, size_t length, size_t stride,
+			 uint32_t *crc, uint32_t num)
+{
+	dr_crc32_calc_batch_fn(input_data, length, stride, crc, num);
 }
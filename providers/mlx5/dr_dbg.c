@@ -33,56 +33,10 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include "mlx5dv_dr.h"
+#include "dr_dump.h"
 
 #define BUFF_SIZE	1024
 
-enum dr_dump_rec_type {
-	DR_DUMP_REC_TYPE_DOMAIN = 3000,
-	DR_DUMP_REC_TYPE_DOMAIN_INFO_FLEX_PARSER = 3001,
-	DR_DUMP_REC_TYPE_DOMAIN_INFO_DEV_ATTR = 3002,
-	DR_DUMP_REC_TYPE_DOMAIN_INFO_VPORT = 3003,
-	DR_DUMP_REC_TYPE_DOMAIN_INFO_CAPS = 3004,
-	DR_DUMP_REC_TYPE_DOMAIN_SEND_RING = 3005,
-
-	DR_DUMP_REC_TYPE_TABLE = 3100,
-	DR_DUMP_REC_TYPE_TABLE_RX = 3101,
-	DR_DUMP_REC_TYPE_TABLE_TX = 3102,
-
-	DR_DUMP_REC_TYPE_MATCHER = 3200,
-	DR_DUMP_REC_TYPE_MATCHER_MASK = 3201,
-	DR_DUMP_REC_TYPE_MATCHER_RX = 3202,
-	DR_DUMP_REC_TYPE_MATCHER_TX = 3203,
-	DR_DUMP_REC_TYPE_MATCHER_BUILDER = 3204,
-
-	DR_DUMP_REC_TYPE_RULE = 3300,
-	DR_DUMP_REC_TYPE_RULE_RX_ENTRY_V0 = 3301,
-	DR_DUMP_REC_TYPE_RULE_TX_ENTRY_V0 = 3302,
-	DR_DUMP_REC_TYPE_RULE_RX_ENTRY_V1 = 3303,
-	DR_DUMP_REC_TYPE_RULE_TX_ENTRY_V1 = 3304,
-
-	DR_DUMP_REC_TYPE_ACTION_ENCAP_L2 = 3400,
-	DR_DUMP_REC_TYPE_ACTION_ENCAP_L3 = 3401,
-	DR_DUMP_REC_TYPE_ACTION_MODIFY_HDR = 3402,
-	DR_DUMP_REC_TYPE_ACTION_DROP = 3403,
-	DR_DUMP_REC_TYPE_ACTION_QP = 3404,
-	DR_DUMP_REC_TYPE_ACTION_FT = 3405,
-	DR_DUMP_REC_TYPE_ACTION_CTR = 3406,
-	DR_DUMP_REC_TYPE_ACTION_TAG = 3407,
-	DR_DUMP_REC_TYPE_ACTION_VPORT = 3408,
-	DR_DUMP_REC_TYPE_ACTION_DECAP_L2 = 3409,
-	DR_DUMP_REC_TYPE_ACTION_DECAP_L3 = 3410,
-	DR_DUMP_REC_TYPE_ACTION_DEVX_TIR = 3411,
-	DR_DUMP_REC_TYPE_ACTION_PUSH_VLAN = 3412,
-	DR_DUMP_REC_TYPE_ACTION_POP_VLAN = 3413,
-	DR_DUMP_REC_TYPE_ACTION_METER = 3414,
-	DR_DUMP_REC_TYPE_ACTION_SAMPLER = 3415,
-	DR_DUMP_REC_TYPE_ACTION_DEST_ARRAY = 3416,
-	DR_DUMP_REC_TYPE_ACTION_ASO_FIRST_HIT = 3417,
-	DR_DUMP_REC_TYPE_ACTION_ASO_FLOW_METER = 3418,
-	DR_DUMP_REC_TYPE_ACTION_ASO_CT = 3419,
-	DR_DUMP_REC_TYPE_ACTION_MISS = 3423,
-};
-
 static uint64_t dr_dump_icm_to_idx(uint64_t icm_addr)
 {
 	return (icm_addr >> 6) & 0xffffffff;
@@ -769,6 +723,598 @@ static int dr_dump_domain_all(FILE *fout, struct mlx5dv_dr_domain *dmn)
 	return 0;
 }
 
+/*
+ * Binary dump: the records of dr_dump.h are copied into a buffer while the
+ * locks are held and written out once they are dropped, a table at a time.
+ * The buffer grows up to DR_DUMP_BUF_MAX_SIZE, a bigger table is written
+ * out in chunks of that size with the locks held.
+ */
+#define DR_DUMP_BUF_SIZE	(1 << 20)
+#define DR_DUMP_BUF_MAX_SIZE	(64 << 20)
+
+struct dr_dump_buf {
+	FILE		*f;
+	uint8_t		*data;
+	size_t		size;
+	size_t		len;
+	int		err;
+};
+
+static int dr_dump_buf_flush(struct dr_dump_buf *buf)
+{
+	if (buf->len && !buf->err &&
+	    fwrite(buf->data, 1, buf->len, buf->f) != buf->len)
+		buf->err = errno ? errno : EIO;
+
+	buf->len = 0;
+	return buf->err;
+}
+
+static void *dr_dump_buf_get(struct dr_dump_buf *buf, size_t len)
+{
+	size_t size = buf->size;
+	uint8_t *data;
+	void *ptr;
+
+	if (buf->err)
+		return NULL;
+
+	if (buf->len + len > buf->size) {
+		while (size < buf->len + len && size < DR_DUMP_BUF_MAX_SIZE)
+			size *= 2;
+
+		data = size > buf->size ? realloc(buf->data, size) : NULL;
+		if (data) {
+			buf->data = data;
+			buf->size = size;
+		}
+
+		if (buf->len + len > buf->size && dr_dump_buf_flush(buf))
+			return NULL;
+	}
+
+	ptr = buf->data + buf->len;
+	buf->len += len;
+	return ptr;
+}
+
+static void dr_dump_bin_rec(struct dr_dump_buf *buf, uint16_t type,
+			    const void *rec, size_t rec_len,
+			    const void *data, size_t data_len)
+{
+	struct dr_dump_bin_rec hdr = {
+		.type = type,
+		.len = rec_len + data_len,
+	};
+	uint8_t *ptr;
+
+	ptr = dr_dump_buf_get(buf, sizeof(hdr) + hdr.len);
+	if (!ptr)
+		return;
+
+	memcpy(ptr, &hdr, sizeof(hdr));
+	memcpy(ptr + sizeof(hdr), rec, rec_len);
+	if (data_len)
+		memcpy(ptr + sizeof(hdr) + rec_len, data, data_len);
+}
+
+static void dr_dump_bin_rule_action(struct dr_dump_buf *buf,
+				    const uint64_t rule_id,
+				    struct mlx5dv_dr_action *action)
+{
+	uint64_t arg[DR_DUMP_BIN_ACTION_MAX_ARGS];
+	struct dr_dump_bin_action rec = {
+		.action_id = (uint64_t)(uintptr_t)action,
+		.rule_id = rule_id,
+	};
+	enum dr_dump_rec_type type;
+	int num_args = 0;
+
+	switch (action->action_type) {
+	case DR_ACTION_TYP_DROP:
+		type = DR_DUMP_REC_TYPE_ACTION_DROP;
+		break;
+	case DR_ACTION_TYP_FT:
+		type = DR_DUMP_REC_TYPE_ACTION_FT;
+		arg[num_args++] = action->dest_tbl->devx_obj->object_id;
+		arg[num_args++] = (uint64_t)(uintptr_t)action->dest_tbl;
+		break;
+	case DR_ACTION_TYP_QP:
+		if (action->dest_qp.is_qp) {
+			type = DR_DUMP_REC_TYPE_ACTION_QP;
+			arg[num_args++] = action->dest_qp.qp->qp_num;
+		} else {
+			type = DR_DUMP_REC_TYPE_ACTION_DEVX_TIR;
+			arg[num_args++] = action->dest_qp.devx_tir->rx_icm_addr;
+		}
+		break;
+	case DR_ACTION_TYP_CTR:
+		type = DR_DUMP_REC_TYPE_ACTION_CTR;
+		arg[num_args++] = action->ctr.devx_obj->object_id +
+				  action->ctr.offset;
+		break;
+	case DR_ACTION_TYP_TAG:
+		type = DR_DUMP_REC_TYPE_ACTION_TAG;
+		arg[num_args++] = action->flow_tag;
+		break;
+	case DR_ACTION_TYP_MODIFY_HDR:
+		type = DR_DUMP_REC_TYPE_ACTION_MODIFY_HDR;
+		arg[num_args++] = action->rewrite.index;
+		break;
+	case DR_ACTION_TYP_VPORT:
+		type = DR_DUMP_REC_TYPE_ACTION_VPORT;
+		arg[num_args++] = action->vport.caps->num;
+		break;
+	case DR_ACTION_TYP_TNL_L2_TO_L2:
+		type = DR_DUMP_REC_TYPE_ACTION_DECAP_L2;
+		break;
+	case DR_ACTION_TYP_TNL_L3_TO_L2:
+		type = DR_DUMP_REC_TYPE_ACTION_DECAP_L3;
+		arg[num_args++] = action->rewrite.index;
+		break;
+	case DR_ACTION_TYP_L2_TO_TNL_L2:
+		type = DR_DUMP_REC_TYPE_ACTION_ENCAP_L2;
+		arg[num_args++] = action->reformat.dvo->object_id;
+		break;
+	case DR_ACTION_TYP_L2_TO_TNL_L3:
+		type = DR_DUMP_REC_TYPE_ACTION_ENCAP_L3;
+		arg[num_args++] = action->reformat.dvo->object_id;
+		break;
+	case DR_ACTION_TYP_METER:
+		type = DR_DUMP_REC_TYPE_ACTION_METER;
+		arg[num_args++] = (uint64_t)(uintptr_t)action->meter.next_ft;
+		arg[num_args++] = action->meter.devx_obj->object_id;
+		arg[num_args++] = action->meter.rx_icm_addr;
+		arg[num_args++] = action->meter.tx_icm_addr;
+		break;
+	case DR_ACTION_TYP_SAMPLER:
+		type = DR_DUMP_REC_TYPE_ACTION_SAMPLER;
+		arg[num_args++] = (uint64_t)(uintptr_t)action->sampler.sampler_default->next_ft;
+		arg[num_args++] = action->sampler.term_tbl->devx_tbl->ft_dvo->object_id;
+		arg[num_args++] = action->sampler.sampler_default->devx_obj->object_id;
+		arg[num_args++] = action->sampler.sampler_default->rx_icm_addr;
+		arg[num_args++] = action->sampler.sampler_restore ?
+				  action->sampler.sampler_restore->tx_icm_addr :
+				  action->sampler.sampler_default->tx_icm_addr;
+		break;
+	case DR_ACTION_TYP_DEST_ARRAY:
+		type = DR_DUMP_REC_TYPE_ACTION_DEST_ARRAY;
+		arg[num_args++] = action->dest_array.devx_tbl->ft_dvo->object_id;
+		arg[num_args++] = action->dest_array.rx_icm_addr;
+		arg[num_args++] = action->dest_array.tx_icm_addr;
+		break;
+	case DR_ACTION_TYP_POP_VLAN:
+		type = DR_DUMP_REC_TYPE_ACTION_POP_VLAN;
+		break;
+	case DR_ACTION_TYP_PUSH_VLAN:
+		type = DR_DUMP_REC_TYPE_ACTION_PUSH_VLAN;
+		arg[num_args++] = action->push_vlan.vlan_hdr;
+		break;
+	case DR_ACTION_TYP_ASO_FIRST_HIT:
+		type = DR_DUMP_REC_TYPE_ACTION_ASO_FIRST_HIT;
+		arg[num_args++] = action->aso.devx_obj->object_id;
+		break;
+	case DR_ACTION_TYP_ASO_FLOW_METER:
+		type = DR_DUMP_REC_TYPE_ACTION_ASO_FLOW_METER;
+		arg[num_args++] = action->aso.devx_obj->object_id;
+		break;
+	case DR_ACTION_TYP_ASO_CT:
+		type = DR_DUMP_REC_TYPE_ACTION_ASO_CT;
+		arg[num_args++] = action->aso.devx_obj->object_id;
+		break;
+	case DR_ACTION_TYP_MISS:
+		type = DR_DUMP_REC_TYPE_ACTION_MISS;
+		break;
+	default:
+		return;
+	}
+
+	dr_dump_bin_rec(buf, type, &rec, sizeof(rec), arg,
+			num_args * sizeof(arg[0]));
+}
+
+static void dr_dump_bin_rule_rx_tx(struct dr_dump_buf *buf,
+				   struct dr_rule_rx_tx *nic_rule,
+				   bool is_rx, const uint64_t rule_id,
+				   enum mlx5_ifc_steering_format_version format_ver)
+{
+	struct dr_ste *ste_arr[DR_RULE_MAX_STES + DR_ACTION_MAX_STES];
+	struct dr_dump_bin_rule_mem rec = {
+		.rule_id = rule_id,
+	};
+	enum dr_dump_rec_type mem_rec_type;
+	int i;
+
+	if (format_ver == MLX5_HW_CONNECTX_5) {
+		mem_rec_type = is_rx ? DR_DUMP_REC_TYPE_RULE_RX_ENTRY_V0 :
+				       DR_DUMP_REC_TYPE_RULE_TX_ENTRY_V0;
+	} else {
+		mem_rec_type = is_rx ? DR_DUMP_REC_TYPE_RULE_RX_ENTRY_V1 :
+				       DR_DUMP_REC_TYPE_RULE_TX_ENTRY_V1;
+	}
+
+	dr_rule_get_reverse_rule_members(ste_arr, nic_rule->last_rule_ste, &i);
+
+	while (i--) {
+		rec.icm_idx = dr_dump_icm_to_idx(dr_ste_get_icm_addr(ste_arr[i]));
+		dr_dump_bin_rec(buf, mem_rec_type, &rec, sizeof(rec),
+				ste_arr[i]->hw_ste, ste_arr[i]->size);
+	}
+}
+
+static void dr_dump_bin_rule(struct dr_dump_buf *buf,
+			     struct mlx5dv_dr_rule *rule)
+{
+	struct dr_dump_bin_rule rec = {
+		.rule_id = (uint64_t)(uintptr_t)rule,
+		.matcher_id = (uint64_t)(uintptr_t)rule->matcher,
+	};
+	enum mlx5_ifc_steering_format_version format_ver;
+	int i;
+
+	format_ver = rule->matcher->tbl->dmn->info.caps.sw_format_ver;
+
+	dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_RULE, &rec, sizeof(rec), NULL, 0);
+
+	if (!dr_is_root_table(rule->matcher->tbl)) {
+		if (rule->rx.nic_matcher)
+			dr_dump_bin_rule_rx_tx(buf, &rule->rx, true,
+					       rec.rule_id, format_ver);
+		if (rule->tx.nic_matcher)
+			dr_dump_bin_rule_rx_tx(buf, &rule->tx, false,
+					       rec.rule_id, format_ver);
+	}
+
+	for (i = 0; i < rule->num_actions; i++)
+		dr_dump_bin_rule_action(buf, rec.rule_id, rule->actions[i]);
+}
+
+static void dr_dump_bin_matcher_mask(struct dr_dump_buf *buf,
+				     struct dr_match_param *mask,
+				     uint8_t criteria,
+				     const uint64_t matcher_id)
+{
+	static const struct {
+		uint8_t criteria;
+		size_t offset;
+		size_t size;
+	} parts[DR_DUMP_MASK_PARTS] = {
+		[DR_DUMP_MASK_OUTER] = {
+			DR_MATCHER_CRITERIA_OUTER,
+			offsetof(struct dr_match_param, outer),
+			sizeof(mask->outer),
+		},
+		[DR_DUMP_MASK_INNER] = {
+			DR_MATCHER_CRITERIA_INNER,
+			offsetof(struct dr_match_param, inner),
+			sizeof(mask->inner),
+		},
+		[DR_DUMP_MASK_MISC] = {
+			DR_MATCHER_CRITERIA_MISC,
+			offsetof(struct dr_match_param, misc),
+			sizeof(mask->misc),
+		},
+		[DR_DUMP_MASK_MISC2] = {
+			DR_MATCHER_CRITERIA_MISC2,
+			offsetof(struct dr_match_param, misc2),
+			sizeof(mask->misc2),
+		},
+		[DR_DUMP_MASK_MISC3] = {
+			DR_MATCHER_CRITERIA_MISC3,
+			offsetof(struct dr_match_param, misc3),
+			sizeof(mask->misc3),
+		},
+		[DR_DUMP_MASK_MISC4] = {
+			DR_MATCHER_CRITERIA_MISC4,
+			offsetof(struct dr_match_param, misc4),
+			sizeof(mask->misc4),
+		},
+		[DR_DUMP_MASK_MISC5] = {
+			DR_MATCHER_CRITERIA_MISC5,
+			offsetof(struct dr_match_param, misc5),
+			sizeof(mask->misc5),
+		},
+	};
+	struct dr_dump_bin_matcher_mask rec = {
+		.matcher_id = matcher_id,
+	};
+	uint8_t data[sizeof(*mask)];
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < DR_DUMP_MASK_PARTS; i++) {
+		if (!(criteria & parts[i].criteria))
+			continue;
+
+		memcpy(data + len, (uint8_t *)mask + parts[i].offset,
+		       parts[i].size);
+		rec.part_len[i] = parts[i].size;
+		len += parts[i].size;
+	}
+
+	dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_MATCHER_MASK, &rec, sizeof(rec),
+			data, len);
+}
+
+static void dr_dump_bin_matcher_rx_tx(struct dr_dump_buf *buf, bool is_rx,
+				      struct dr_matcher_rx_tx *matcher_rx_tx,
+				      const uint64_t matcher_id)
+{
+	struct dr_dump_bin_matcher_rx_tx rec = {
+		.matcher_rx_tx_id = (uint64_t)(uintptr_t)matcher_rx_tx,
+		.matcher_id = matcher_id,
+		.s_htbl_idx = dr_dump_icm_to_idx(matcher_rx_tx->s_htbl->chunk->icm_addr),
+		.e_anchor_idx = dr_dump_icm_to_idx(matcher_rx_tx->e_anchor->chunk->icm_addr),
+		.num_of_builders = matcher_rx_tx->num_of_builders,
+	};
+	struct dr_dump_bin_matcher_builder builder = {
+		.matcher_id = matcher_id,
+		.is_rx = is_rx,
+	};
+	struct dr_ste_build *sb;
+	int i;
+
+	dr_dump_bin_rec(buf, is_rx ? DR_DUMP_REC_TYPE_MATCHER_RX :
+				     DR_DUMP_REC_TYPE_MATCHER_TX,
+			&rec, sizeof(rec), NULL, 0);
+
+	for (i = 0; i < matcher_rx_tx->num_of_builders; i++) {
+		sb = &matcher_rx_tx->ste_builder[i];
+		builder.index = i;
+		builder.lu_type = sb->lu_type;
+		builder.format_id = sb->htbl_type == DR_STE_HTBL_TYPE_MATCH ?
+				    sb->format_id : -1;
+		dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_MATCHER_BUILDER,
+				&builder, sizeof(builder), NULL, 0);
+	}
+}
+
+static void dr_dump_bin_matcher(struct dr_dump_buf *buf,
+				struct mlx5dv_dr_matcher *matcher)
+{
+	struct dr_dump_bin_matcher rec = {
+		.matcher_id = (uint64_t)(uintptr_t)matcher,
+		.table_id = (uint64_t)(uintptr_t)matcher->tbl,
+		.prio = matcher->prio,
+	};
+
+	dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_MATCHER, &rec, sizeof(rec),
+			NULL, 0);
+
+	if (dr_is_root_table(matcher->tbl))
+		return;
+
+	dr_dump_bin_matcher_mask(buf, &matcher->mask, matcher->match_criteria,
+				 rec.matcher_id);
+	if (matcher->rx.nic_tbl)
+		dr_dump_bin_matcher_rx_tx(buf, true, &matcher->rx,
+					  rec.matcher_id);
+	if (matcher->tx.nic_tbl)
+		dr_dump_bin_matcher_rx_tx(buf, false, &matcher->tx,
+					  rec.matcher_id);
+}
+
+static void dr_dump_bin_table_all(struct dr_dump_buf *buf,
+				  struct mlx5dv_dr_table *tbl)
+{
+	struct dr_dump_bin_table rec = {
+		.table_id = (uint64_t)(uintptr_t)tbl,
+		.domain_id = dr_domain_id_calc(tbl->dmn->type),
+		.table_type = tbl->table_type,
+		.level = tbl->level,
+	};
+	struct dr_dump_bin_table_rx_tx nic_rec = {
+		.table_id = rec.table_id,
+	};
+	struct mlx5dv_dr_matcher *matcher;
+	struct mlx5dv_dr_rule *rule;
+
+	dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_TABLE, &rec, sizeof(rec),
+			NULL, 0);
+
+	if (dr_is_root_table(tbl))
+		return;
+
+	if (tbl->rx.nic_dmn) {
+		nic_rec.s_anchor_idx = dr_dump_icm_to_idx(tbl->rx.s_anchor->chunk->icm_addr);
+		dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_TABLE_RX, &nic_rec,
+				sizeof(nic_rec), NULL, 0);
+	}
+
+	if (tbl->tx.nic_dmn) {
+		nic_rec.s_anchor_idx = dr_dump_icm_to_idx(tbl->tx.s_anchor->chunk->icm_addr);
+		dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_TABLE_TX, &nic_rec,
+				sizeof(nic_rec), NULL, 0);
+	}
+
+	list_for_each(&tbl->matcher_list, matcher, matcher_list) {
+		dr_dump_bin_matcher(buf, matcher);
+		list_for_each(&matcher->rule_list, rule, rule_list)
+			dr_dump_bin_rule(buf, rule);
+	}
+}
+
+static void dr_dump_bin_flex_parser(struct dr_dump_buf *buf, const char *name,
+				    const uint8_t value,
+				    const uint64_t domain_id)
+{
+	struct dr_dump_bin_flex_parser rec = {
+		.domain_id = domain_id,
+		.value = value,
+	};
+
+	dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_DOMAIN_INFO_FLEX_PARSER,
+			&rec, sizeof(rec), name, strlen(name));
+}
+
+static void dr_dump_bin_domain_info(struct dr_dump_buf *buf,
+				    struct dr_domain_info *info,
+				    const uint64_t domain_id)
+{
+	struct dr_dump_bin_dev_attr dev_attr = {
+		.domain_id = domain_id,
+		.num_ports = info->caps.vports.num_ports,
+	};
+	struct dr_dump_bin_caps caps = {
+		.domain_id = domain_id,
+		.nic_rx_drop_address = info->caps.nic_rx_drop_address,
+		.nic_tx_drop_address = info->caps.nic_tx_drop_address,
+		.gvmi = info->caps.gvmi,
+		.flex_protocols = info->caps.flex_protocols,
+		.num_ports = info->caps.vports.num_ports,
+		.eswitch_manager = info->caps.eswitch_manager,
+	};
+	struct dr_dump_bin_vport vport = {
+		.domain_id = domain_id,
+	};
+	struct dr_vports_table *vports_tbl = info->caps.vports.vports;
+	struct dr_devx_vport_cap *vport_cap;
+	const char *fw_ver = info->attr.orig_attr.fw_ver;
+	int i;
+
+	dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_DOMAIN_INFO_DEV_ATTR,
+			&dev_attr, sizeof(dev_attr),
+			fw_ver, strnlen(fw_ver, sizeof(info->attr.orig_attr.fw_ver)));
+
+	dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_DOMAIN_INFO_CAPS, &caps,
+			sizeof(caps), NULL, 0);
+
+	for (i = 0; vports_tbl && i < DR_VPORTS_BUCKETS; i++) {
+		for (vport_cap = vports_tbl->buckets[i]; vport_cap;
+		     vport_cap = vport_cap->next) {
+			vport.num = vport_cap->num;
+			vport.vport_gvmi = vport_cap->vport_gvmi;
+			vport.icm_address_rx = vport_cap->icm_address_rx;
+			vport.icm_address_tx = vport_cap->icm_address_tx;
+			dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_DOMAIN_INFO_VPORT,
+					&vport, sizeof(vport), NULL, 0);
+		}
+	}
+
+	dr_dump_bin_flex_parser(buf, "icmp_dw0",
+				info->caps.flex_parser_id_icmp_dw0, domain_id);
+	dr_dump_bin_flex_parser(buf, "icmp_dw1",
+				info->caps.flex_parser_id_icmp_dw1, domain_id);
+	dr_dump_bin_flex_parser(buf, "icmpv6_dw0",
+				info->caps.flex_parser_id_icmpv6_dw0, domain_id);
+	dr_dump_bin_flex_parser(buf, "icmpv6_dw1",
+				info->caps.flex_parser_id_icmpv6_dw1, domain_id);
+}
+
+static void dr_dump_bin_domain(struct dr_dump_buf *buf,
+			       struct mlx5dv_dr_domain *dmn)
+{
+	const char *dev_name = dmn->ctx->device->dev_name;
+	struct dr_dump_bin_domain rec = {
+		.domain_id = dr_domain_id_calc(dmn->type),
+		.type = dmn->type,
+		.gvmi = dmn->info.caps.gvmi,
+		.supp_sw_steering = dmn->info.supp_sw_steering,
+	};
+	struct dr_dump_bin_send_ring ring = {
+		.domain_id = rec.domain_id,
+	};
+	char names[sizeof(PACKAGE_VERSION) + IBV_SYSFS_NAME_MAX];
+	size_t len;
+	int i;
+
+	memcpy(names, PACKAGE_VERSION, sizeof(PACKAGE_VERSION));
+	len = strnlen(dev_name, IBV_SYSFS_NAME_MAX);
+	memcpy(names + sizeof(PACKAGE_VERSION), dev_name, len);
+
+	dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_DOMAIN, &rec, sizeof(rec),
+			names, sizeof(PACKAGE_VERSION) + len);
+
+	dr_dump_bin_domain_info(buf, &dmn->info, rec.domain_id);
+
+	if (!dmn->info.supp_sw_steering)
+		return;
+
+	for (i = 0; i < DR_MAX_SEND_RINGS; i++) {
+		ring.ring_id = (uint64_t)(uintptr_t)dmn->send_ring[i];
+		ring.cqn = dmn->send_ring[i]->cq.cqn;
+		ring.qpn = dmn->send_ring[i]->qp->obj->object_id;
+		dr_dump_bin_rec(buf, DR_DUMP_REC_TYPE_DOMAIN_SEND_RING, &ring,
+				sizeof(ring), NULL, 0);
+	}
+}
+
+static bool dr_dump_domain_has_table(struct mlx5dv_dr_domain *dmn,
+				     struct mlx5dv_dr_table *tbl)
+{
+	struct mlx5dv_dr_table *tmp;
+
+	list_for_each(&dmn->tbl_list, tmp, tbl_list)
+		if (tmp == tbl)
+			return true;
+
+	return false;
+}
+
+/*
+ * The table list is copied first and each table is then dumped under its
+ * own hold of the locks, if it still exists.  Tables created meanwhile are
+ * not dumped.
+ */
+static int dr_dump_domain_bin(FILE *fout, struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_dump_buf buf = {
+		.f = fout,
+		.size = DR_DUMP_BUF_SIZE,
+	};
+	struct mlx5dv_dr_table **tbls = NULL;
+	struct dr_dump_bin_hdr *hdr;
+	struct mlx5dv_dr_table *tbl;
+	size_t num_tbls = 0, i;
+
+	buf.data = malloc(buf.size);
+	if (!buf.data)
+		return -ENOMEM;
+
+	hdr = dr_dump_buf_get(&buf, sizeof(*hdr));
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, DR_DUMP_BIN_MAGIC, sizeof(hdr->magic));
+	hdr->version = DR_DUMP_BIN_VERSION;
+
+	pthread_spin_lock(&dmn->debug_lock);
+	dr_domain_lock(dmn);
+
+	dr_dump_bin_domain(&buf, dmn);
+
+	list_for_each(&dmn->tbl_list, tbl, tbl_list)
+		num_tbls++;
+
+	if (num_tbls) {
+		tbls = malloc(num_tbls * sizeof(*tbls));
+		if (tbls) {
+			i = 0;
+			list_for_each(&dmn->tbl_list, tbl, tbl_list)
+				tbls[i++] = tbl;
+		} else {
+			buf.err = ENOMEM;
+		}
+	}
+
+	dr_domain_unlock(dmn);
+	pthread_spin_unlock(&dmn->debug_lock);
+
+	for (i = 0; i < num_tbls && !dr_dump_buf_flush(&buf); i++) {
+		pthread_spin_lock(&dmn->debug_lock);
+		dr_domain_lock(dmn);
+
+		if (dr_dump_domain_has_table(dmn, tbls[i]))
+			dr_dump_bin_table_all(&buf, tbls[i]);
+
+		dr_domain_unlock(dmn);
+		pthread_spin_unlock(&dmn->debug_lock);
+	}
+
+	dr_dump_buf_flush(&buf);
+	free(tbls);
+	free(buf.data);
+	return -buf.err;
+}
+
 int mlx5dv_dump_dr_domain(FILE *fout, struct mlx5dv_dr_domain *dmn)
 {
 	int ret;
@@ -787,6 +1333,18 @@ int mlx5dv_dump_dr_domain(FILE *fout, struct mlx5dv_dr_domain *dmn)
 	return ret;
 }
 
+int mlx5dv_dump_dr_domain_ex(FILE *fout, struct mlx5dv_dr_domain *dmn,
+			     uint32_t flags)
+{
+	if (!fout || !dmn || flags & ~MLX5DV_DUMP_DR_FLAGS_BINARY)
+		return -EINVAL;
+
+	if (flags & MLX5DV_DUMP_DR_FLAGS_BINARY)
+		return dr_dump_domain_bin(fout, dmn);
+
+	return mlx5dv_dump_dr_domain(fout, dmn);
+}
+
 int mlx5dv_dump_dr_table(FILE *fout, struct mlx5dv_dr_table *tbl)
 {
 	int ret;
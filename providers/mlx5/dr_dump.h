@@ -0,0 +1,200 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#ifndef _DR_DUMP_H_
+#define _DR_DUMP_H_
+
+#include <stdint.h>
+
+/*
+ * Steering dump records.  The CSV dump writes one line per record, starting
+ * with its type.  The binary dump of mlx5dv_dump_dr_domain_ex() writes the
+ * same records as a struct dr_dump_bin_hdr, then per record a struct
+ * dr_dump_bin_rec followed by the record payload below, in host byte order.
+ * Strings at the end of a payload are not NUL terminated.
+ * mlx5_dr_dump2csv turns a binary dump back into the CSV lines.
+ */
+enum dr_dump_rec_type {
+	DR_DUMP_REC_TYPE_DOMAIN = 3000,
+	DR_DUMP_REC_TYPE_DOMAIN_INFO_FLEX_PARSER = 3001,
+	DR_DUMP_REC_TYPE_DOMAIN_INFO_DEV_ATTR = 3002,
+	DR_DUMP_REC_TYPE_DOMAIN_INFO_VPORT = 3003,
+	DR_DUMP_REC_TYPE_DOMAIN_INFO_CAPS = 3004,
+	DR_DUMP_REC_TYPE_DOMAIN_SEND_RING = 3005,
+
+	DR_DUMP_REC_TYPE_TABLE = 3100,
+	DR_DUMP_REC_TYPE_TABLE_RX = 3101,
+	DR_DUMP_REC_TYPE_TABLE_TX = 3102,
+
+	DR_DUMP_REC_TYPE_MATCHER = 3200,
+	DR_DUMP_REC_TYPE_MATCHER_MASK = 3201,
+	DR_DUMP_REC_TYPE_MATCHER_RX = 3202,
+	DR_DUMP_REC_TYPE_MATCHER_TX = 3203,
+	DR_DUMP_REC_TYPE_MATCHER_BUILDER = 3204,
+
+	DR_DUMP_REC_TYPE_RULE = 3300,
+	DR_DUMP_REC_TYPE_RULE_RX_ENTRY_V0 = 3301,
+	DR_DUMP_REC_TYPE_RULE_TX_ENTRY_V0 = 3302,
+	DR_DUMP_REC_TYPE_RULE_RX_ENTRY_V1 = 3303,
+	DR_DUMP_REC_TYPE_RULE_TX_ENTRY_V1 = 3304,
+
+	DR_DUMP_REC_TYPE_ACTION_ENCAP_L2 = 3400,
+	DR_DUMP_REC_TYPE_ACTION_ENCAP_L3 = 3401,
+	DR_DUMP_REC_TYPE_ACTION_MODIFY_HDR = 3402,
+	DR_DUMP_REC_TYPE_ACTION_DROP = 3403,
+	DR_DUMP_REC_TYPE_ACTION_QP = 3404,
+	DR_DUMP_REC_TYPE_ACTION_FT = 3405,
+	DR_DUMP_REC_TYPE_ACTION_CTR = 3406,
+	DR_DUMP_REC_TYPE_ACTION_TAG = 3407,
+	DR_DUMP_REC_TYPE_ACTION_VPORT = 3408,
+	DR_DUMP_REC_TYPE_ACTION_DECAP_L2 = 3409,
+	DR_DUMP_REC_TYPE_ACTION_DECAP_L3 = 3410,
+	DR_DUMP_REC_TYPE_ACTION_DEVX_TIR = 3411,
+	DR_DUMP_REC_TYPE_ACTION_PUSH_VLAN = 3412,
+	DR_DUMP_REC_TYPE_ACTION_POP_VLAN = 3413,
+	DR_DUMP_REC_TYPE_ACTION_METER = 3414,
+	DR_DUMP_REC_TYPE_ACTION_SAMPLER = 3415,
+	DR_DUMP_REC_TYPE_ACTION_DEST_ARRAY = 3416,
+	DR_DUMP_REC_TYPE_ACTION_ASO_FIRST_HIT = 3417,
+	DR_DUMP_REC_TYPE_ACTION_ASO_FLOW_METER = 3418,
+	DR_DUMP_REC_TYPE_ACTION_ASO_CT = 3419,
+	DR_DUMP_REC_TYPE_ACTION_MISS = 3423,
+};
+
+#define DR_DUMP_BIN_MAGIC	"MLX5DRDB"
+#define DR_DUMP_BIN_VERSION	1
+
+struct dr_dump_bin_hdr {
+	char		magic[8];
+	/* Also tells a dump of a host with the other byte order */
+	uint32_t	version;
+	uint32_t	reserved;
+};
+
+struct dr_dump_bin_rec {
+	uint16_t	type;
+	/* Payload bytes that follow */
+	uint16_t	len;
+};
+
+/* Followed by the package version, a NUL and the device name */
+struct dr_dump_bin_domain {
+	uint64_t	domain_id;
+	uint32_t	type;
+	uint32_t	gvmi;
+	uint32_t	supp_sw_steering;
+	uint32_t	reserved;
+};
+
+/* Followed by the parser name */
+struct dr_dump_bin_flex_parser {
+	uint64_t	domain_id;
+	uint32_t	value;
+	uint32_t	reserved;
+};
+
+/* Followed by the FW version */
+struct dr_dump_bin_dev_attr {
+	uint64_t	domain_id;
+	uint32_t	num_ports;
+	uint32_t	reserved;
+};
+
+struct dr_dump_bin_vport {
+	uint64_t	domain_id;
+	uint64_t	icm_address_rx;
+	uint64_t	icm_address_tx;
+	int32_t		num;
+	uint32_t	vport_gvmi;
+};
+
+struct dr_dump_bin_caps {
+	uint64_t	domain_id;
+	uint64_t	nic_rx_drop_address;
+	uint64_t	nic_tx_drop_address;
+	uint32_t	gvmi;
+	uint32_t	flex_protocols;
+	int32_t		num_ports;
+	int32_t		eswitch_manager;
+};
+
+struct dr_dump_bin_send_ring {
+	uint64_t	ring_id;
+	uint64_t	domain_id;
+	uint32_t	cqn;
+	uint32_t	qpn;
+};
+
+struct dr_dump_bin_table {
+	uint64_t	table_id;
+	uint64_t	domain_id;
+	int32_t		table_type;
+	int32_t		level;
+};
+
+struct dr_dump_bin_table_rx_tx {
+	uint64_t	table_id;
+	uint64_t	s_anchor_idx;
+};
+
+struct dr_dump_bin_matcher {
+	uint64_t	matcher_id;
+	uint64_t	table_id;
+	int32_t		prio;
+	uint32_t	reserved;
+};
+
+/* Mask parts in CSV column order, an absent part has no bytes */
+enum {
+	DR_DUMP_MASK_OUTER,
+	DR_DUMP_MASK_INNER,
+	DR_DUMP_MASK_MISC,
+	DR_DUMP_MASK_MISC2,
+	DR_DUMP_MASK_MISC3,
+	DR_DUMP_MASK_MISC4,
+	DR_DUMP_MASK_MISC5,
+	DR_DUMP_MASK_PARTS,
+};
+
+/* Followed by the bytes of each part present */
+struct dr_dump_bin_matcher_mask {
+	uint64_t	matcher_id;
+	uint16_t	part_len[DR_DUMP_MASK_PARTS];
+	uint16_t	reserved;
+};
+
+struct dr_dump_bin_matcher_rx_tx {
+	uint64_t	matcher_rx_tx_id;
+	uint64_t	matcher_id;
+	uint64_t	s_htbl_idx;
+	uint64_t	e_anchor_idx;
+	int32_t		num_of_builders;
+	uint32_t	reserved;
+};
+
+struct dr_dump_bin_matcher_builder {
+	uint64_t	matcher_id;
+	int32_t		index;
+	int32_t		is_rx;
+	uint32_t	lu_type;
+	int32_t		format_id;
+};
+
+struct dr_dump_bin_rule {
+	uint64_t	rule_id;
+	uint64_t	matcher_id;
+};
+
+/* Followed by the HW STE */
+struct dr_dump_bin_rule_mem {
+	uint64_t	icm_idx;
+	uint64_t	rule_id;
+};
+
+/* Followed by the action arguments, each a uint64_t printed in hex */
+struct dr_dump_bin_action {
+	uint64_t	action_id;
+	uint64_t	rule_id;
+};
+
+#define DR_DUMP_BIN_ACTION_MAX_ARGS	5
+
+#endif /* _DR_DUMP_H_ */
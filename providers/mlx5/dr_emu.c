@@ -0,0 +1,1299 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Device side of SW steering in host memory.  The DR code reaches the device
+ * through a handful of verbs, devx commands, device memory (ICM) and an RC QP
+ * whose RDMA writes land in ICM; this file implements those entry points so
+ * test programs linked with the dr_*.c sources (built with MLX5_DR_EMU) can
+ * create domains, tables, matchers and rules without a ConnectX device.
+ *
+ * ICM addresses are kept below 4G, the STE miss address getters only return
+ * 32 bits.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dr_emu.h"
+#include "mlx5dv_dr.h"
+#include "dr_ste.h"
+
+#define DR_EMU_DEV_NAME			"mlx5_emu0"
+#define DR_EMU_VHCA_ID			1
+#define DR_EMU_DEF_LOG_ICM_SIZE		30
+#define DR_EMU_MAX_LOG_ICM_SIZE		31
+#define DR_EMU_LOG_HDR_ICM_SIZE		23
+#define DR_EMU_STE_ICM_BASE		(1ULL << 31)
+#define DR_EMU_HDR_ICM_BASE		(1ULL << 28)
+/* Device owned objects: drop/allow anchors and non SW owned tables */
+#define DR_EMU_FW_ICM_BASE		(1ULL << 20)
+#define DR_EMU_MAX_COLLISIONS		64
+
+enum {
+	DR_EMU_QP_RST,
+	DR_EMU_QP_INIT,
+	DR_EMU_QP_RTR,
+	DR_EMU_QP_RTS,
+	DR_EMU_QP_ERR,
+};
+
+struct dr_emu_pd {
+	struct ibv_pd		pd;
+	uint32_t		pdn;
+};
+
+struct dr_emu_cq {
+	struct ibv_cq		cq;
+	struct list_node	entry;
+	struct mlx5_cqe64	*buf;
+	__be32			dbrec[2];
+	uint32_t		cqn;
+	uint32_t		ncqe;
+	uint32_t		pi;
+};
+
+struct dr_emu_mr {
+	struct ibv_mr		mr;
+	/* Host address backing iova mr.addr */
+	void			*host;
+};
+
+struct dr_emu_dm {
+	struct mlx5_dm		mdm;
+	struct list_node	entry;
+	void			*host;
+};
+
+struct dr_emu_umem {
+	struct mlx5_devx_umem	umem;
+	struct list_node	entry;
+};
+
+struct dr_emu_obj {
+	struct mlx5dv_devx_obj	obj;
+	struct list_node	entry;
+	uint16_t		opcode;
+	union {
+		struct {
+			void			*sq_buf;
+			uint32_t		sq_wqe_cnt;
+			uint16_t		sq_ci;
+			uint8_t			state;
+			__be32			*db;
+			struct dr_emu_cq	*cq;
+		} qp;
+		struct {
+			uint64_t		icm_root_0;
+			uint64_t		icm_root_1;
+		} ft;
+	};
+};
+
+struct dr_emu {
+	struct mlx5_context	mctx;
+	struct verbs_device	vdev;
+	struct dr_emu_attr	attr;
+	pthread_mutex_t		mutex;
+	uint32_t		next_id;
+	uint64_t		fw_icm_next;
+	uint64_t		rx_drop_addr;
+	uint64_t		tx_drop_addr;
+	uint64_t		tx_allow_addr;
+	struct list_head	objs;
+	struct list_head	umems;
+	struct list_head	cqs;
+	/* Sorted by remote_va */
+	struct list_head	dms;
+	struct dr_emu_mr	**mrs;
+	uint32_t		max_mrs;
+	struct dr_emu_stats	stats;
+};
+
+#ifdef MLX5_DEBUG
+uint32_t mlx5_debug_mask;
+#endif
+
+static struct dr_emu *to_emu(struct ibv_context *ctx)
+{
+	return container_of(to_mctx(ctx), struct dr_emu, mctx);
+}
+
+static uint64_t dr_emu_fw_icm_alloc(struct dr_emu *emu)
+{
+	uint64_t addr = emu->fw_icm_next;
+
+	emu->fw_icm_next += DR_STE_SIZE;
+	return addr;
+}
+
+static struct dr_emu_obj *dr_emu_find_obj(struct dr_emu *emu, uint16_t opcode,
+					  uint32_t id)
+{
+	struct dr_emu_obj *eobj;
+
+	list_for_each(&emu->objs, eobj, entry)
+		if (eobj->opcode == opcode && eobj->obj.object_id == id)
+			return eobj;
+
+	return NULL;
+}
+
+static struct dr_emu_umem *dr_emu_find_umem(struct dr_emu *emu, uint32_t id)
+{
+	struct dr_emu_umem *eumem;
+
+	list_for_each(&emu->umems, eumem, entry)
+		if (eumem->umem.dv_devx_umem.umem_id == id)
+			return eumem;
+
+	return NULL;
+}
+
+static struct dr_emu_cq *dr_emu_find_cq(struct dr_emu *emu, uint32_t cqn)
+{
+	struct dr_emu_cq *ecq;
+
+	list_for_each(&emu->cqs, ecq, entry)
+		if (ecq->cqn == cqn)
+			return ecq;
+
+	return NULL;
+}
+
+static void *dr_emu_icm_ptr(struct dr_emu *emu, uint64_t addr, size_t len)
+{
+	struct dr_emu_dm *dm;
+	void *ptr = NULL;
+
+	pthread_mutex_lock(&emu->mutex);
+	list_for_each(&emu->dms, dm, entry) {
+		if (addr < dm->mdm.remote_va)
+			break;
+		if (addr + len <= dm->mdm.remote_va + dm->mdm.length) {
+			ptr = dm->host + (addr - dm->mdm.remote_va);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&emu->mutex);
+
+	return ptr;
+}
+
+/* Must be called with the mutex held */
+static void *dr_emu_mr_ptr(struct dr_emu *emu, uint32_t key, uint64_t iova,
+			   size_t len)
+{
+	struct dr_emu_mr *emr;
+	uint64_t start;
+
+	if (!key || key > emu->max_mrs || !emu->mrs[key - 1])
+		return NULL;
+
+	emr = emu->mrs[key - 1];
+	start = (uintptr_t)emr->mr.addr;
+	if (iova < start || iova + len > start + emr->mr.length)
+		return NULL;
+
+	return emr->host + (iova - start);
+}
+
+static int dr_emu_add_mr(struct dr_emu *emu, struct dr_emu_mr *emr)
+{
+	struct dr_emu_mr **mrs;
+	uint32_t i;
+
+	pthread_mutex_lock(&emu->mutex);
+	for (i = 0; i < emu->max_mrs; i++)
+		if (!emu->mrs[i])
+			goto found;
+
+	mrs = realloc(emu->mrs, (emu->max_mrs * 2 + 16) * sizeof(*mrs));
+	if (!mrs) {
+		pthread_mutex_unlock(&emu->mutex);
+		errno = ENOMEM;
+		return errno;
+	}
+	memset(mrs + emu->max_mrs, 0, (emu->max_mrs + 16) * sizeof(*mrs));
+	emu->mrs = mrs;
+	emu->max_mrs = emu->max_mrs * 2 + 16;
+
+found:
+	emu->mrs[i] = emr;
+	/* Key 0 is the inline data marker of the send ring */
+	emr->mr.lkey = i + 1;
+	emr->mr.rkey = i + 1;
+	pthread_mutex_unlock(&emu->mutex);
+	return 0;
+}
+
+/* Verbs */
+
+const char *ibv_get_device_name(struct ibv_device *device)
+{
+	return device->name;
+}
+
+static void dr_emu_fill_device_attr(struct dr_emu *emu,
+				    struct ibv_device_attr *attr)
+{
+	snprintf(attr->fw_ver, sizeof(attr->fw_ver), "emu");
+	attr->vendor_id = 0x02c9;
+	attr->vendor_part_id =
+		emu->attr.sw_format_ver == MLX5_HW_CONNECTX_5 ? 4119 : 4125;
+	attr->max_qp = 1 << 16;
+	attr->max_qp_wr = 1 << 15;
+	attr->max_sge = 1;
+	attr->max_cq = 1 << 16;
+	attr->max_cqe = 1 << 22;
+	attr->max_mr = 1 << 16;
+	attr->max_pd = 1 << 16;
+	attr->phys_port_cnt = 1;
+}
+
+int ibv_query_device(struct ibv_context *context,
+		     struct ibv_device_attr *device_attr)
+{
+	memset(device_attr, 0, sizeof(*device_attr));
+	dr_emu_fill_device_attr(to_emu(context), device_attr);
+	return 0;
+}
+
+static int dr_emu_query_device_ex(struct ibv_context *context,
+				  const struct ibv_query_device_ex_input *input,
+				  struct ibv_device_attr_ex *attr,
+				  size_t attr_size)
+{
+	memset(attr, 0, attr_size);
+	dr_emu_fill_device_attr(to_emu(context), &attr->orig_attr);
+	attr->phys_port_cnt_ex = 1;
+	return 0;
+}
+
+static int dr_emu_query_port(struct ibv_context *context, uint8_t port_num,
+			     struct ibv_port_attr *port_attr,
+			     size_t port_attr_len)
+{
+	if (port_num != 1) {
+		errno = EINVAL;
+		return errno;
+	}
+
+	memset(port_attr, 0, port_attr_len);
+	port_attr->state = IBV_PORT_ACTIVE;
+	port_attr->max_mtu = IBV_MTU_4096;
+	port_attr->active_mtu = IBV_MTU_1024;
+	port_attr->gid_tbl_len = 1;
+	port_attr->pkey_tbl_len = 1;
+	port_attr->link_layer = IBV_LINK_LAYER_ETHERNET;
+	return 0;
+}
+
+#undef ibv_query_port
+int ibv_query_port(struct ibv_context *context, uint8_t port_num,
+		   struct _compat_ibv_port_attr *port_attr)
+{
+	struct ibv_port_attr attr;
+	int ret;
+
+	ret = dr_emu_query_port(context, port_num, &attr, sizeof(attr));
+	/* The 1.1 layout ends before port_cap_flags2 */
+	if (!ret)
+		memcpy(port_attr, &attr,
+		       offsetof(struct ibv_port_attr, port_cap_flags2));
+	return ret;
+}
+
+struct ibv_pd *ibv_alloc_pd(struct ibv_context *context)
+{
+	struct dr_emu *emu = to_emu(context);
+	struct dr_emu_pd *epd;
+
+	epd = calloc(1, sizeof(*epd));
+	if (!epd) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	epd->pd.context = context;
+	pthread_mutex_lock(&emu->mutex);
+	epd->pdn = emu->next_id++;
+	pthread_mutex_unlock(&emu->mutex);
+	return &epd->pd;
+}
+
+int ibv_dealloc_pd(struct ibv_pd *pd)
+{
+	free(container_of(pd, struct dr_emu_pd, pd));
+	return 0;
+}
+
+#undef ibv_reg_mr
+struct ibv_mr *ibv_reg_mr(struct ibv_pd *pd, void *addr, size_t length,
+			  int access)
+{
+	struct dr_emu_mr *emr;
+
+	emr = calloc(1, sizeof(*emr));
+	if (!emr) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	emr->mr.context = pd->context;
+	emr->mr.pd = pd;
+	emr->mr.addr = addr;
+	emr->mr.length = length;
+	emr->host = addr;
+	if (dr_emu_add_mr(to_emu(pd->context), emr)) {
+		free(emr);
+		return NULL;
+	}
+
+	return &emr->mr;
+}
+
+/* Zero based: iova X of the MR is byte X of the DM */
+static struct ibv_mr *dr_emu_reg_dm_mr(struct ibv_pd *pd, struct ibv_dm *ibdm,
+				       uint64_t dm_offset, size_t length,
+				       unsigned int access)
+{
+	struct dr_emu_dm *dm = container_of(to_mdm(ibdm), struct dr_emu_dm, mdm);
+	struct dr_emu_mr *emr;
+
+	if (!(access & IBV_ACCESS_ZERO_BASED) ||
+	    dm_offset + length > dm->mdm.length) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	emr = calloc(1, sizeof(*emr));
+	if (!emr) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	emr->mr.context = pd->context;
+	emr->mr.pd = pd;
+	emr->mr.addr = (void *)(uintptr_t)dm_offset;
+	emr->mr.length = length;
+	emr->host = dm->host + dm_offset;
+	if (dr_emu_add_mr(to_emu(pd->context), emr)) {
+		free(emr);
+		return NULL;
+	}
+
+	return &emr->mr;
+}
+
+int ibv_dereg_mr(struct ibv_mr *mr)
+{
+	struct dr_emu *emu = to_emu(mr->context);
+
+	pthread_mutex_lock(&emu->mutex);
+	emu->mrs[mr->lkey - 1] = NULL;
+	pthread_mutex_unlock(&emu->mutex);
+	free(container_of(mr, struct dr_emu_mr, mr));
+	return 0;
+}
+
+struct ibv_cq *ibv_create_cq(struct ibv_context *context, int cqe,
+			     void *cq_context, struct ibv_comp_channel *channel,
+			     int comp_vector)
+{
+	struct dr_emu *emu = to_emu(context);
+	struct dr_emu_cq *ecq;
+	uint32_t i;
+
+	ecq = calloc(1, sizeof(*ecq));
+	if (!ecq) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ecq->ncqe = roundup_pow_of_two(cqe);
+	ecq->buf = calloc(ecq->ncqe, sizeof(*ecq->buf));
+	if (!ecq->buf) {
+		free(ecq);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (i = 0; i < ecq->ncqe; i++)
+		ecq->buf[i].op_own = MLX5_CQE_INVALID << 4;
+
+	ecq->cq.context = context;
+	ecq->cq.cq_context = cq_context;
+	ecq->cq.channel = channel;
+	ecq->cq.cqe = ecq->ncqe - 1;
+
+	pthread_mutex_lock(&emu->mutex);
+	ecq->cqn = emu->next_id++;
+	list_add_tail(&emu->cqs, &ecq->entry);
+	pthread_mutex_unlock(&emu->mutex);
+
+	return &ecq->cq;
+}
+
+int ibv_destroy_cq(struct ibv_cq *cq)
+{
+	struct dr_emu_cq *ecq = container_of(cq, struct dr_emu_cq, cq);
+	struct dr_emu *emu = to_emu(cq->context);
+
+	pthread_mutex_lock(&emu->mutex);
+	list_del(&ecq->entry);
+	pthread_mutex_unlock(&emu->mutex);
+	free(ecq->buf);
+	free(ecq);
+	return 0;
+}
+
+/* mlx5dv objects */
+
+int mlx5dv_init_obj(struct mlx5dv_obj *obj, uint64_t obj_type)
+{
+	if (obj_type & ~(MLX5DV_OBJ_CQ | MLX5DV_OBJ_PD))
+		return EOPNOTSUPP;
+
+	if (obj_type & MLX5DV_OBJ_CQ) {
+		struct dr_emu_cq *ecq = container_of(obj->cq.in,
+						     struct dr_emu_cq, cq);
+
+		memset(obj->cq.out, 0, sizeof(*obj->cq.out));
+		obj->cq.out->buf = ecq->buf;
+		obj->cq.out->dbrec = ecq->dbrec;
+		obj->cq.out->cqe_cnt = ecq->ncqe;
+		obj->cq.out->cqe_size = sizeof(*ecq->buf);
+		obj->cq.out->cqn = ecq->cqn;
+	}
+
+	if (obj_type & MLX5DV_OBJ_PD) {
+		obj->pd.out->pdn = container_of(obj->pd.in, struct dr_emu_pd,
+						pd)->pdn;
+		obj->pd.out->comp_mask = 0;
+	}
+
+	return 0;
+}
+
+/* First fit of a size aligned range in [base, base + space) */
+static int dr_emu_icm_alloc(struct dr_emu *emu, struct dr_emu_dm *new_dm,
+			    uint64_t base, uint64_t space)
+{
+	uint64_t align_sz = roundup_pow_of_two(new_dm->mdm.length);
+	uint64_t addr = base;
+	struct dr_emu_dm *dm;
+
+	list_for_each(&emu->dms, dm, entry) {
+		if (dm->mdm.remote_va + dm->mdm.length <= addr)
+			continue;
+		if (dm->mdm.remote_va >= addr + new_dm->mdm.length)
+			break;
+		addr = align(dm->mdm.remote_va + dm->mdm.length, align_sz);
+	}
+
+	if (addr + new_dm->mdm.length > base + space)
+		return ENOMEM;
+
+	new_dm->mdm.remote_va = addr;
+	if (&dm->entry == &emu->dms.n)
+		list_add_tail(&emu->dms, &new_dm->entry);
+	else
+		list_add_before(&emu->dms, &dm->entry, &new_dm->entry);
+
+	return 0;
+}
+
+struct ibv_dm *mlx5dv_alloc_dm(struct ibv_context *context,
+			       struct ibv_alloc_dm_attr *dm_attr,
+			       struct mlx5dv_alloc_dm_attr *mlx5_dm_attr)
+{
+	struct dr_emu *emu = to_emu(context);
+	uint64_t base, space;
+	struct dr_emu_dm *dm;
+	int ret;
+
+	switch (mlx5_dm_attr->type) {
+	case MLX5_IB_UAPI_DM_TYPE_STEERING_SW_ICM:
+		base = DR_EMU_STE_ICM_BASE;
+		space = 1ULL << emu->attr.log_icm_size;
+		break;
+	case MLX5_IB_UAPI_DM_TYPE_HEADER_MODIFY_SW_ICM:
+		base = DR_EMU_HDR_ICM_BASE;
+		space = 1ULL << DR_EMU_LOG_HDR_ICM_SIZE;
+		break;
+	default:
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	dm = calloc(1, sizeof(*dm));
+	if (!dm) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	dm->host = calloc(1, dm_attr->length);
+	if (!dm->host) {
+		errno = ENOMEM;
+		goto err_free;
+	}
+
+	dm->mdm.verbs_dm.dm.context = context;
+	dm->mdm.length = dm_attr->length;
+
+	pthread_mutex_lock(&emu->mutex);
+	ret = dr_emu_icm_alloc(emu, dm, base, space);
+	if (!ret)
+		emu->stats.icm_bytes += dm->mdm.length;
+	pthread_mutex_unlock(&emu->mutex);
+	if (ret) {
+		errno = ret;
+		goto err_free_host;
+	}
+
+	return &dm->mdm.verbs_dm.dm;
+
+err_free_host:
+	free(dm->host);
+err_free:
+	free(dm);
+	return NULL;
+}
+
+int mlx5_free_dm(struct ibv_dm *ibdm)
+{
+	struct dr_emu_dm *dm = container_of(to_mdm(ibdm), struct dr_emu_dm, mdm);
+	struct dr_emu *emu = to_emu(ibdm->context);
+
+	pthread_mutex_lock(&emu->mutex);
+	list_del(&dm->entry);
+	emu->stats.icm_bytes -= dm->mdm.length;
+	pthread_mutex_unlock(&emu->mutex);
+	free(dm->host);
+	free(dm);
+	return 0;
+}
+
+struct mlx5dv_devx_uar *mlx5dv_devx_alloc_uar(struct ibv_context *context,
+					      uint32_t flags)
+{
+	struct mlx5_bf *bf;
+
+	bf = calloc(1, sizeof(*bf));
+	if (!bf) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	bf->devx_uar.context = context;
+	bf->devx_uar.dv_devx_uar.page_id = 1;
+	bf->nc_mode = flags == MLX5_IB_UAPI_UAR_ALLOC_TYPE_NC;
+	return &bf->devx_uar.dv_devx_uar;
+}
+
+void mlx5dv_devx_free_uar(struct mlx5dv_devx_uar *devx_uar)
+{
+	free(container_of(devx_uar, struct mlx5_bf, devx_uar.dv_devx_uar));
+}
+
+struct mlx5dv_devx_umem *mlx5dv_devx_umem_reg(struct ibv_context *context,
+					      void *addr, size_t size,
+					      uint32_t access)
+{
+	struct dr_emu *emu = to_emu(context);
+	struct dr_emu_umem *eumem;
+
+	eumem = calloc(1, sizeof(*eumem));
+	if (!eumem) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	eumem->umem.context = context;
+	eumem->umem.addr = addr;
+	eumem->umem.size = size;
+
+	pthread_mutex_lock(&emu->mutex);
+	eumem->umem.dv_devx_umem.umem_id = emu->next_id++;
+	list_add_tail(&emu->umems, &eumem->entry);
+	pthread_mutex_unlock(&emu->mutex);
+
+	return &eumem->umem.dv_devx_umem;
+}
+
+int mlx5dv_devx_umem_dereg(struct mlx5dv_devx_umem *dv_devx_umem)
+{
+	struct dr_emu_umem *eumem =
+		container_of(dv_devx_umem, struct dr_emu_umem, umem.dv_devx_umem);
+	struct dr_emu *emu = to_emu(eumem->umem.context);
+
+	pthread_mutex_lock(&emu->mutex);
+	list_del(&eumem->entry);
+	pthread_mutex_unlock(&emu->mutex);
+	free(eumem);
+	return 0;
+}
+
+/* Root tables are steered by the kernel, there is none here */
+
+struct mlx5dv_flow_matcher *
+mlx5dv_create_flow_matcher(struct ibv_context *context,
+			   struct mlx5dv_flow_matcher_attr *matcher_attr)
+{
+	errno = EOPNOTSUPP;
+	return NULL;
+}
+
+int mlx5dv_destroy_flow_matcher(struct mlx5dv_flow_matcher *matcher)
+{
+	return EOPNOTSUPP;
+}
+
+struct ibv_flow *
+_mlx5dv_create_flow(struct mlx5dv_flow_matcher *flow_matcher,
+		    struct mlx5dv_flow_match_parameters *match_value,
+		    size_t num_actions,
+		    struct mlx5dv_flow_action_attr actions_attr[],
+		    struct mlx5_flow_action_attr_aux actions_attr_aux[])
+{
+	errno = EOPNOTSUPP;
+	return NULL;
+}
+
+struct ibv_flow_action *
+mlx5dv_create_flow_action_modify_header(struct ibv_context *ctx,
+					size_t actions_sz,
+					uint64_t actions[],
+					enum mlx5dv_flow_table_type ft_type)
+{
+	errno = EOPNOTSUPP;
+	return NULL;
+}
+
+struct ibv_flow_action *
+mlx5dv_create_flow_action_packet_reformat(struct ibv_context *ctx,
+					  size_t data_sz,
+					  void *data,
+					  enum mlx5dv_flow_action_packet_reformat_type reformat_type,
+					  enum mlx5dv_flow_table_type ft_type)
+{
+	errno = EOPNOTSUPP;
+	return NULL;
+}
+
+int mlx5_destroy_flow_action(struct ibv_flow_action *action)
+{
+	return EOPNOTSUPP;
+}
+
+int _mlx5dv_query_port(struct ibv_context *context, uint32_t port_num,
+		       struct mlx5dv_port *info, size_t info_len)
+{
+	return EOPNOTSUPP;
+}
+
+/* Devx commands */
+
+static int dr_emu_query_hca_cap(struct dr_emu *emu, const void *in,
+				void *out, size_t outlen)
+{
+	uint16_t op_mod = DEVX_GET(query_hca_cap_in, in, op_mod);
+	bool v0 = emu->attr.sw_format_ver == MLX5_HW_CONNECTX_5;
+
+	if (outlen < DEVX_ST_SZ_BYTES(query_hca_cap_out))
+		return EINVAL;
+
+	memset(out, 0, outlen);
+	switch (op_mod & ~HCA_CAP_OPMOD_GET_CUR) {
+	case MLX5_SET_HCA_CAP_OP_MOD_GENERAL_DEVICE:
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.cmd_hca_cap.vhca_id, DR_EMU_VHCA_ID);
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.cmd_hca_cap.roce, 1);
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.cmd_hca_cap.steering_format_version,
+			 emu->attr.sw_format_ver);
+		break;
+	case MLX5_SET_HCA_CAP_OP_MOD_NIC_FLOW_TABLE:
+		DEVX_SET64(query_hca_cap_out, out,
+			   capability.flow_table_nic_cap.
+			   sw_steering_nic_rx_action_drop_icm_address,
+			   emu->rx_drop_addr);
+		DEVX_SET64(query_hca_cap_out, out,
+			   capability.flow_table_nic_cap.
+			   sw_steering_nic_tx_action_drop_icm_address,
+			   emu->tx_drop_addr);
+		DEVX_SET64(query_hca_cap_out, out,
+			   capability.flow_table_nic_cap.
+			   sw_steering_nic_tx_action_allow_icm_address,
+			   emu->tx_allow_addr);
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.flow_table_nic_cap.
+			 flow_table_properties_nic_receive.sw_owner, v0);
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.flow_table_nic_cap.
+			 flow_table_properties_nic_transmit.sw_owner, v0);
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.flow_table_nic_cap.
+			 flow_table_properties_nic_receive.sw_owner_v2, !v0);
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.flow_table_nic_cap.
+			 flow_table_properties_nic_transmit.sw_owner_v2, !v0);
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.flow_table_nic_cap.
+			 flow_table_properties_nic_receive.max_ft_level, 63);
+		break;
+	case MLX5_SET_HCA_CAP_OP_MOD_DEVICE_MEMORY:
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.device_mem_cap.log_steering_sw_icm_size,
+			 emu->attr.log_icm_size);
+		DEVX_SET64(query_hca_cap_out, out,
+			   capability.device_mem_cap.
+			   header_modify_sw_icm_start_address,
+			   DR_EMU_HDR_ICM_BASE);
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.device_mem_cap.log_header_modify_sw_icm_size,
+			 DR_EMU_LOG_HDR_ICM_SIZE);
+		break;
+	case MLX5_SET_HCA_CAP_OP_MOD_ROCE:
+		DEVX_SET(query_hca_cap_out, out,
+			 capability.roce_caps.fl_rc_qp_when_roce_enabled, 1);
+		break;
+	default:
+		return EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
+int mlx5dv_devx_general_cmd(struct ibv_context *context, const void *in,
+			    size_t inlen, void *out, size_t outlen)
+{
+	struct dr_emu *emu = to_emu(context);
+	int ret = 0;
+
+	pthread_mutex_lock(&emu->mutex);
+	emu->stats.cmds++;
+	switch (DEVX_GET(general_obj_in_cmd_hdr, in, opcode)) {
+	case MLX5_CMD_OP_QUERY_HCA_CAP:
+		ret = dr_emu_query_hca_cap(emu, in, out, outlen);
+		break;
+	case MLX5_CMD_OP_QUERY_NIC_VPORT_CONTEXT:
+		memset(out, 0, outlen);
+		DEVX_SET(query_nic_vport_context_out, out,
+			 nic_vport_context.roce_en, 1);
+		break;
+	case MLX5_CMD_OP_SYNC_STEERING:
+		break;
+	default:
+		ret = EOPNOTSUPP;
+		break;
+	}
+	pthread_mutex_unlock(&emu->mutex);
+
+	if (ret)
+		errno = ret;
+	return ret;
+}
+
+static int dr_emu_create_ft(struct dr_emu *emu, struct dr_emu_obj *eobj,
+			    const void *in)
+{
+	const void *ft_ctx = DEVX_ADDR_OF(create_flow_table_in, in,
+					  flow_table_context);
+
+	if (DEVX_GET(flow_table_context, ft_ctx, sw_owner)) {
+		eobj->ft.icm_root_0 = DEVX_GET64(flow_table_context, ft_ctx,
+						 sw_owner_icm_root_0);
+		eobj->ft.icm_root_1 = DEVX_GET64(flow_table_context, ft_ctx,
+						 sw_owner_icm_root_1);
+	} else {
+		eobj->ft.icm_root_0 = dr_emu_fw_icm_alloc(emu);
+		eobj->ft.icm_root_1 = dr_emu_fw_icm_alloc(emu);
+	}
+
+	return 0;
+}
+
+static int dr_emu_create_qp(struct dr_emu *emu, struct dr_emu_obj *eobj,
+			    const void *in)
+{
+	const void *qpc = DEVX_ADDR_OF(create_qp_in, in, qpc);
+	struct dr_emu_umem *wq_umem, *db_umem;
+	size_t rq_size, sq_size;
+
+	wq_umem = dr_emu_find_umem(emu, DEVX_GET(create_qp_in, in, wq_umem_id));
+	db_umem = dr_emu_find_umem(emu, DEVX_GET(qpc, qpc, dbr_umem_id));
+	eobj->qp.cq = dr_emu_find_cq(emu, DEVX_GET(qpc, qpc, cqn_snd));
+	if (!wq_umem || !db_umem || !eobj->qp.cq)
+		return EINVAL;
+
+	rq_size = (size_t)1 << (DEVX_GET(qpc, qpc, log_rq_size) +
+				DEVX_GET(qpc, qpc, log_rq_stride) + 4);
+	eobj->qp.sq_wqe_cnt = 1 << DEVX_GET(qpc, qpc, log_sq_size);
+	sq_size = (size_t)eobj->qp.sq_wqe_cnt << MLX5_SEND_WQE_SHIFT;
+	if (rq_size + sq_size > wq_umem->umem.size ||
+	    db_umem->umem.size < 2 * sizeof(__be32))
+		return EINVAL;
+
+	/* The RQ comes first in the WQ buffer */
+	eobj->qp.sq_buf = wq_umem->umem.addr + rq_size;
+	eobj->qp.db = db_umem->umem.addr;
+	eobj->qp.state = DR_EMU_QP_RST;
+	return 0;
+}
+
+struct mlx5dv_devx_obj *mlx5dv_devx_obj_create(struct ibv_context *context,
+					       const void *in, size_t inlen,
+					       void *out, size_t outlen)
+{
+	uint16_t opcode = DEVX_GET(general_obj_in_cmd_hdr, in, opcode);
+	struct dr_emu *emu = to_emu(context);
+	struct dr_emu_obj *eobj;
+	int ret = 0;
+
+	eobj = calloc(1, sizeof(*eobj));
+	if (!eobj) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&emu->mutex);
+	emu->stats.cmds++;
+	switch (opcode) {
+	case MLX5_CMD_OP_CREATE_FLOW_TABLE:
+		ret = dr_emu_create_ft(emu, eobj, in);
+		break;
+	case MLX5_CMD_OP_CREATE_QP:
+		ret = dr_emu_create_qp(emu, eobj, in);
+		break;
+	case MLX5_CMD_OP_CREATE_FLOW_GROUP:
+	case MLX5_CMD_OP_SET_FLOW_TABLE_ENTRY:
+	case MLX5_CMD_OP_ALLOC_PACKET_REFORMAT_CONTEXT:
+		break;
+	default:
+		ret = EOPNOTSUPP;
+		break;
+	}
+
+	if (ret) {
+		pthread_mutex_unlock(&emu->mutex);
+		free(eobj);
+		errno = ret;
+		return NULL;
+	}
+
+	eobj->opcode = opcode;
+	eobj->obj.context = context;
+	eobj->obj.object_id = emu->next_id++;
+	list_add_tail(&emu->objs, &eobj->entry);
+	pthread_mutex_unlock(&emu->mutex);
+
+	memset(out, 0, outlen);
+	return &eobj->obj;
+}
+
+int mlx5dv_devx_obj_query(struct mlx5dv_devx_obj *obj, const void *in,
+			  size_t inlen, void *out, size_t outlen)
+{
+	struct dr_emu_obj *eobj = container_of(obj, struct dr_emu_obj, obj);
+	struct dr_emu *emu = to_emu(obj->context);
+	int ret = 0;
+
+	pthread_mutex_lock(&emu->mutex);
+	emu->stats.cmds++;
+	if (DEVX_GET(general_obj_in_cmd_hdr, in, opcode) ==
+		    MLX5_CMD_OP_QUERY_FLOW_TABLE &&
+	    eobj->opcode == MLX5_CMD_OP_CREATE_FLOW_TABLE) {
+		memset(out, 0, outlen);
+		DEVX_SET64(query_flow_table_out, out,
+			   flow_table_context.sw_owner_icm_root_0,
+			   eobj->ft.icm_root_0);
+		DEVX_SET64(query_flow_table_out, out,
+			   flow_table_context.sw_owner_icm_root_1,
+			   eobj->ft.icm_root_1);
+	} else {
+		ret = EOPNOTSUPP;
+	}
+	pthread_mutex_unlock(&emu->mutex);
+
+	if (ret)
+		errno = ret;
+	return ret;
+}
+
+int mlx5dv_devx_obj_modify(struct mlx5dv_devx_obj *obj, const void *in,
+			   size_t inlen, void *out, size_t outlen)
+{
+	struct dr_emu_obj *eobj = container_of(obj, struct dr_emu_obj, obj);
+	struct dr_emu *emu = to_emu(obj->context);
+	uint8_t from, to;
+	int ret = 0;
+
+	switch (DEVX_GET(general_obj_in_cmd_hdr, in, opcode)) {
+	case MLX5_CMD_OP_RST2INIT_QP:
+		from = DR_EMU_QP_RST;
+		to = DR_EMU_QP_INIT;
+		break;
+	case MLX5_CMD_OP_INIT2RTR_QP:
+		from = DR_EMU_QP_INIT;
+		to = DR_EMU_QP_RTR;
+		break;
+	case MLX5_CMD_OP_RTR2RTS_QP:
+		from = DR_EMU_QP_RTR;
+		to = DR_EMU_QP_RTS;
+		break;
+	default:
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	pthread_mutex_lock(&emu->mutex);
+	emu->stats.cmds++;
+	if (eobj->opcode != MLX5_CMD_OP_CREATE_QP || eobj->qp.state != from)
+		ret = EINVAL;
+	else
+		eobj->qp.state = to;
+	pthread_mutex_unlock(&emu->mutex);
+
+	if (ret)
+		errno = ret;
+	else
+		memset(out, 0, outlen);
+	return ret;
+}
+
+int mlx5dv_devx_obj_destroy(struct mlx5dv_devx_obj *obj)
+{
+	struct dr_emu_obj *eobj = container_of(obj, struct dr_emu_obj, obj);
+	struct dr_emu *emu = to_emu(obj->context);
+
+	pthread_mutex_lock(&emu->mutex);
+	emu->stats.cmds++;
+	list_del(&eobj->entry);
+	pthread_mutex_unlock(&emu->mutex);
+	free(eobj);
+	return 0;
+}
+
+/* Send queue */
+
+static void *dr_emu_sq_wrap(struct dr_emu_obj *qp, void *p)
+{
+	size_t sq_size = (size_t)qp->qp.sq_wqe_cnt << MLX5_SEND_WQE_SHIFT;
+
+	if (p >= qp->qp.sq_buf + sq_size)
+		p -= sq_size;
+	return p;
+}
+
+/* Inline data may wrap around the end of the SQ */
+static void dr_emu_sq_copy(struct dr_emu_obj *qp, void *dst, void *src,
+			   size_t len)
+{
+	void *qend = qp->qp.sq_buf +
+		((size_t)qp->qp.sq_wqe_cnt << MLX5_SEND_WQE_SHIFT);
+	size_t copy;
+
+	src = dr_emu_sq_wrap(qp, src);
+	if (src + len > qend) {
+		copy = qend - src;
+		memcpy(dst, src, copy);
+		dst += copy;
+		len -= copy;
+		src = qp->qp.sq_buf;
+	}
+	memcpy(dst, src, len);
+}
+
+static int dr_emu_exec_wqe(struct dr_emu *emu, struct dr_emu_obj *qp,
+			   struct mlx5_wqe_ctrl_seg *ctrl)
+{
+	uint8_t opcode = be32toh(ctrl->opmod_idx_opcode) & 0xff;
+	struct mlx5_wqe_raddr_seg *rseg = (void *)(ctrl + 1);
+	uint64_t raddr = be64toh(rseg->raddr);
+	uint32_t rkey = be32toh(rseg->rkey);
+	struct mlx5_wqe_data_seg *dseg;
+	uint32_t byte_count;
+	void *remote, *local;
+	void *seg;
+
+	if (opcode != MLX5_OPCODE_RDMA_WRITE && opcode != MLX5_OPCODE_RDMA_READ)
+		return EINVAL;
+
+	seg = dr_emu_sq_wrap(qp, rseg + 1);
+	byte_count = be32toh(*(__be32 *)seg);
+
+	if (byte_count & MLX5_INLINE_SEG) {
+		byte_count &= ~MLX5_INLINE_SEG;
+		remote = dr_emu_mr_ptr(emu, rkey, raddr, byte_count);
+		if (opcode != MLX5_OPCODE_RDMA_WRITE || !remote)
+			return EINVAL;
+		dr_emu_sq_copy(qp, remote, seg + sizeof(__be32), byte_count);
+	} else {
+		dseg = seg;
+		local = dr_emu_mr_ptr(emu, be32toh(dseg->lkey),
+				      be64toh(dseg->addr), byte_count);
+		remote = dr_emu_mr_ptr(emu, rkey, raddr, byte_count);
+		if (!local || !remote)
+			return EINVAL;
+		if (opcode == MLX5_OPCODE_RDMA_WRITE)
+			memcpy(remote, local, byte_count);
+		else
+			memcpy(local, remote, byte_count);
+	}
+
+	if (opcode == MLX5_OPCODE_RDMA_WRITE)
+		emu->stats.bytes_written += byte_count;
+	return 0;
+}
+
+static void dr_emu_write_cqe(struct dr_emu_obj *qp, uint16_t wqe_counter,
+			     bool error)
+{
+	struct dr_emu_cq *cq = qp->qp.cq;
+	uint32_t ci = be32toh(cq->dbrec[MLX5_CQ_SET_CI]) & 0xffffff;
+	struct mlx5_cqe64 *cqe;
+
+	if (((cq->pi - ci) & 0xffffff) >= cq->ncqe) {
+		fprintf(stderr, "dr_emu: CQ %u overrun\n", cq->cqn);
+		qp->qp.state = DR_EMU_QP_ERR;
+		return;
+	}
+
+	cqe = &cq->buf[cq->pi & (cq->ncqe - 1)];
+	cqe->wqe_counter = htobe16(wqe_counter);
+	cqe->sop_drop_qpn = htobe32(qp->obj.object_id & 0xffffff);
+	cqe->op_own = (error ? MLX5_CQE_REQ_ERR : MLX5_CQE_REQ) << 4 |
+		      !!(cq->pi & cq->ncqe);
+	cq->pi++;
+}
+
+static void dr_emu_process_sq(struct dr_emu *emu, struct dr_emu_obj *qp)
+{
+	uint16_t pi = be32toh(qp->qp.db[MLX5_SND_DBR]) & 0xffff;
+	struct mlx5_wqe_ctrl_seg *ctrl;
+	unsigned int idx, ds;
+	int err;
+
+	while (qp->qp.state == DR_EMU_QP_RTS && qp->qp.sq_ci != pi) {
+		idx = qp->qp.sq_ci & (qp->qp.sq_wqe_cnt - 1);
+		ctrl = qp->qp.sq_buf + (idx << MLX5_SEND_WQE_SHIFT);
+		ds = be32toh(ctrl->qpn_ds) & 0x3f;
+
+		err = dr_emu_exec_wqe(emu, qp, ctrl);
+		if (err) {
+			fprintf(stderr, "dr_emu: QP %u bad WQE %u\n",
+				qp->obj.object_id, qp->qp.sq_ci);
+			qp->qp.state = DR_EMU_QP_ERR;
+		}
+		if (err || ctrl->fm_ce_se & MLX5_WQE_CTRL_CQ_UPDATE)
+			dr_emu_write_cqe(qp,
+					 be32toh(ctrl->opmod_idx_opcode) >> 8,
+					 err);
+
+		qp->qp.sq_ci += DIV_ROUND_UP(ds * 16, MLX5_SEND_WQE_BB);
+		emu->stats.wqes++;
+	}
+}
+
+void dr_emu_ring_db(struct mlx5dv_devx_uar *uar, __be64 db)
+{
+	struct mlx5_devx_uar *devx_uar =
+		container_of(uar, struct mlx5_devx_uar, dv_devx_uar);
+	struct dr_emu *emu = to_emu(devx_uar->context);
+	uint32_t qpn = (be64toh(db) & 0xffffffff) >> 8;
+	struct dr_emu_obj *qp;
+
+	pthread_mutex_lock(&emu->mutex);
+	emu->stats.doorbells++;
+	qp = dr_emu_find_obj(emu, MLX5_CMD_OP_CREATE_QP, qpn);
+	if (qp)
+		dr_emu_process_sq(emu, qp);
+	pthread_mutex_unlock(&emu->mutex);
+}
+
+/* Lookup model */
+
+static uint32_t dr_emu_hash_index(uint8_t *hw_ste, uint32_t num_of_entries,
+				  uint16_t byte_mask)
+{
+	struct dr_icm_chunk chunk = { .num_of_entries = num_of_entries };
+	struct dr_ste_htbl htbl = {
+		.type = DR_STE_HTBL_TYPE_LEGACY,
+		.byte_mask = byte_mask,
+		.chunk = &chunk,
+	};
+
+	return dr_ste_calc_hash_index(hw_ste, &htbl);
+}
+
+int dr_emu_lookup(struct mlx5dv_dr_matcher *matcher,
+		  struct mlx5dv_flow_match_parameters *value,
+		  uint64_t *icm_addr)
+{
+	uint8_t ste_arr[DR_RULE_MAX_STES * DR_STE_SIZE] = {};
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	uint8_t *mask_p = (uint8_t *)&matcher->mask;
+	struct dr_ste_ctx *ste_ctx = dmn->ste_ctx;
+	struct dr_emu *emu = to_emu(dmn->ctx);
+	struct dr_matcher_rx_tx *nic_matcher;
+	struct dr_match_param param = {};
+	uint8_t *param_p = (uint8_t *)&param;
+	uint8_t expected[DR_STE_SIZE];
+	uint64_t addr, miss_addr;
+	uint32_t num_of_entries;
+	uint8_t *icm_ste = NULL;
+	uint16_t byte_mask;
+	int i, hops, ret;
+	size_t j;
+
+	if (dr_is_root_table(matcher->tbl))
+		return EOPNOTSUPP;
+
+	nic_matcher = dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_TX ?
+		&matcher->tx : &matcher->rx;
+	if (nic_matcher->s_htbl->type != DR_STE_HTBL_TYPE_LEGACY)
+		return EOPNOTSUPP;
+
+	if (value->match_sz > DEVX_ST_SZ_BYTES(dr_match_param) ||
+	    value->match_sz % sizeof(uint32_t))
+		return EINVAL;
+
+	/* The device compares the masked packet fields */
+	dr_ste_copy_param(matcher->match_criteria, &param, value);
+	for (j = 0; j < sizeof(param); j++)
+		param_p[j] &= mask_p[j];
+
+	ret = dr_ste_build_ste_arr(matcher, nic_matcher, &param, ste_arr);
+	if (ret)
+		return ret;
+
+	miss_addr = nic_matcher->e_anchor->chunk->icm_addr;
+	addr = nic_matcher->s_htbl->chunk->icm_addr;
+	num_of_entries = nic_matcher->s_htbl->chunk->num_of_entries;
+	byte_mask = nic_matcher->s_htbl->byte_mask;
+
+	for (i = 0; i < nic_matcher->num_of_builders; i++) {
+		uint8_t *hw_ste = ste_arr + i * DR_STE_SIZE;
+
+		addr += (uint64_t)dr_emu_hash_index(hw_ste, num_of_entries,
+						    byte_mask) * DR_STE_SIZE;
+
+		memcpy(expected, hw_ste, DR_STE_SIZE);
+		dr_ste_prepare_for_postsend(ste_ctx, expected, DR_STE_SIZE);
+
+		/* Head of the hash bucket, then its collision list */
+		for (hops = 0; ; hops++) {
+			if (addr == miss_addr || hops > DR_EMU_MAX_COLLISIONS)
+				return ENOENT;
+
+			icm_ste = dr_emu_icm_ptr(emu, addr, DR_STE_SIZE);
+			if (!icm_ste)
+				return ENOENT;
+
+			if (!memcmp(icm_ste + DR_STE_SIZE_CTRL,
+				    expected + DR_STE_SIZE_CTRL,
+				    DR_STE_SIZE_TAG + DR_STE_SIZE_MASK))
+				break;
+
+			addr = ste_ctx->get_miss_addr(icm_ste);
+		}
+
+		if (i == nic_matcher->num_of_builders - 1)
+			break;
+
+		byte_mask = ste_ctx->get_byte_mask(icm_ste);
+		addr = ste_ctx->get_hit_addr(icm_ste, &num_of_entries);
+	}
+
+	*icm_addr = addr;
+	return 0;
+}
+
+/* Context */
+
+struct ibv_context *dr_emu_open(const struct dr_emu_attr *attr)
+{
+	struct verbs_context *vctx;
+	struct dr_emu *emu;
+
+	if (attr->sw_format_ver != MLX5_HW_CONNECTX_5 &&
+	    attr->sw_format_ver != MLX5_HW_CONNECTX_6DX) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	if (attr->log_icm_size &&
+	    (attr->log_icm_size < DR_CHUNK_SIZE_1024K + DR_STE_LOG_SIZE ||
+	     attr->log_icm_size > DR_EMU_MAX_LOG_ICM_SIZE)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	emu = calloc(1, sizeof(*emu));
+	if (!emu) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	emu->attr = *attr;
+	if (!emu->attr.log_icm_size)
+		emu->attr.log_icm_size = DR_EMU_DEF_LOG_ICM_SIZE;
+
+	pthread_mutex_init(&emu->mutex, NULL);
+	list_head_init(&emu->objs);
+	list_head_init(&emu->umems);
+	list_head_init(&emu->cqs);
+	list_head_init(&emu->dms);
+	emu->next_id = 1;
+	emu->fw_icm_next = DR_EMU_FW_ICM_BASE;
+	emu->rx_drop_addr = dr_emu_fw_icm_alloc(emu);
+	emu->tx_drop_addr = dr_emu_fw_icm_alloc(emu);
+	emu->tx_allow_addr = dr_emu_fw_icm_alloc(emu);
+
+	snprintf(emu->vdev.device.name, sizeof(emu->vdev.device.name), "%s",
+		 DR_EMU_DEV_NAME);
+	emu->vdev.device.transport_type = IBV_TRANSPORT_IB;
+	emu->vdev.device.node_type = IBV_NODE_CA;
+
+	vctx = &emu->mctx.ibv_ctx;
+	vctx->sz = sizeof(*vctx);
+	vctx->query_device_ex = dr_emu_query_device_ex;
+	vctx->query_port = dr_emu_query_port;
+	vctx->reg_dm_mr = dr_emu_reg_dm_mr;
+	vctx->context.device = &emu->vdev.device;
+	vctx->context.abi_compat = __VERBS_ABI_IS_EXTENDED;
+	vctx->context.num_comp_vectors = 1;
+	emu->mctx.dbg_fp = stderr;
+
+	return &vctx->context;
+}
+
+int dr_emu_close(struct ibv_context *ctx)
+{
+	struct dr_emu *emu = to_emu(ctx);
+
+	if (!list_empty(&emu->objs) || !list_empty(&emu->umems) ||
+	    !list_empty(&emu->cqs) || !list_empty(&emu->dms)) {
+		errno = EBUSY;
+		return errno;
+	}
+
+	pthread_mutex_destroy(&emu->mutex);
+	free(emu->mrs);
+	free(emu);
+	return 0;
+}
+
+void dr_emu_get_stats(struct ibv_context *ctx, struct dr_emu_stats *stats)
+{
+	struct dr_emu *emu = to_emu(ctx);
+
+	pthread_mutex_lock(&emu->mutex);
+	*stats = emu->stats;
+	pthread_mutex_unlock(&emu->mutex);
+}
@@ -0,0 +1,48 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#ifndef _DR_EMU_H_
+#define _DR_EMU_H_
+
+#include <stdint.h>
+#include "mlx5dv_dr.h"
+
+/*
+ * In-memory model of the device side of SW steering.  When the dr_*.c
+ * sources are built with MLX5_DR_EMU and linked with dr_emu.c, devx
+ * commands, device memory (ICM) and the send ring QP are served from host
+ * memory, so mlx5dv_dr_* runs without a ConnectX device.  libmlx5 itself is
+ * never built this way.
+ */
+
+struct dr_emu_attr {
+	/* MLX5_HW_CONNECTX_5 (STE v0) or MLX5_HW_CONNECTX_6DX (STE v1) */
+	uint8_t sw_format_ver;
+	/* log2 of the STE ICM size, 0 selects the default of 1GB */
+	uint8_t log_icm_size;
+};
+
+struct dr_emu_stats {
+	uint64_t cmds;		/* devx commands */
+	uint64_t doorbells;	/* send ring doorbells rung */
+	uint64_t wqes;		/* send ring WQEs executed */
+	uint64_t bytes_written;	/* RDMA write bytes into ICM */
+	uint64_t icm_bytes;	/* ICM currently allocated */
+};
+
+struct ibv_context *dr_emu_open(const struct dr_emu_attr *attr);
+int dr_emu_close(struct ibv_context *ctx);
+void dr_emu_get_stats(struct ibv_context *ctx, struct dr_emu_stats *stats);
+
+/*
+ * Walk the matcher the way the device would for a packet with the given
+ * field values: hash into each STE table, follow the collision list on a
+ * tag mismatch and the hit address on a match.  Returns 0 and the ICM
+ * address of the last matching STE, ENOENT on a miss, or an errno.
+ */
+int dr_emu_lookup(struct mlx5dv_dr_matcher *matcher,
+		  struct mlx5dv_flow_match_parameters *value,
+		  uint64_t *icm_addr);
+
+/* Send ring doorbell, called by dr_send.c in place of the UAR write */
+void dr_emu_ring_db(struct mlx5dv_devx_uar *uar, __be64 db);
+
+#endif /* _DR_EMU_H_ */
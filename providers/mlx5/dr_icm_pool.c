@@ -35,17 +35,48 @@
 #define DR_ICM_MODIFY_HDR_ALIGN_BASE	64
 #define DR_ICM_SYNC_THRESHOLD_POOL (64 * 1024 * 1024)
 
+/*
+ * Each thread allocates through one of the pool caches, picked round robin
+ * when it first allocates.  A cache keeps the synced chunks of the small
+ * sizes for reuse and takes DR_ICM_CACHE_REFILL of them from the buddies at
+ * once, so the common allocations take only the cache lock, which other
+ * threads rarely touch.
+ */
+#define DR_ICM_POOL_CACHES		16
+#define DR_ICM_CACHE_MAX_LOG_SZ		DR_CHUNK_SIZE_64
+/* Chunks of order 0 a cache keeps, half as many for each order above */
+#define DR_ICM_CACHE_DEPTH		1024
+#define DR_ICM_CACHE_REFILL		8
+
+struct dr_icm_cache {
+	pthread_spinlock_t	lock;
+	/* Chunks allocated from this cache. HW may be accessing this memory */
+	struct list_head	used_list;
+	/* hardware may be accessing this memory but at some future,
+	 * undetermined time, it might cease to do so.
+	 * sync_ste command sets them free.
+	 */
+	struct list_head	hot_list;
+	/* Synced chunks ready for reuse, by chunk size, reset as new */
+	struct list_head	free_list[DR_ICM_CACHE_MAX_LOG_SZ + 1];
+	uint32_t		num_free[DR_ICM_CACHE_MAX_LOG_SZ + 1];
+};
+
 struct dr_icm_pool {
 	enum dr_icm_type	icm_type;
 	struct mlx5dv_dr_domain	*dmn;
 	enum dr_icm_chunk_size	max_log_chunk_sz;
-	/* memory management */
+	/* memory management, the buddies and syncing */
 	pthread_spinlock_t	lock;
 	struct list_head	buddy_mem_list;
-	uint64_t		hot_memory_size;
+	atomic_size_t		hot_memory_size;
 	bool			syncing;
+	struct dr_icm_cache	caches[DR_ICM_POOL_CACHES];
 };
 
+static atomic_uint dr_icm_next_cache;
+static __thread int dr_icm_thread_cache = -1;
+
 struct dr_icm_mr {
 	struct ibv_mr		*mr;
 	struct ibv_dm		*dm;
@@ -170,43 +201,37 @@ get_chunk_icm_type(struct dr_icm_chunk *chunk)
 	return chunk->buddy_mem->pool->icm_type;
 }
 
+/* The STE arrays share one allocation, ste_arr first */
 static int
 dr_icm_chunk_ste_init(struct dr_icm_chunk *chunk)
 {
 	struct dr_icm_buddy_mem *buddy = chunk->buddy_mem;
+	size_t num = chunk->num_of_entries;
 
-	chunk->ste_arr = calloc(chunk->num_of_entries, sizeof(struct dr_ste));
+	chunk->ste_arr = calloc(1, num * (sizeof(struct dr_ste) +
+					  sizeof(struct list_head) +
+					  buddy->hw_ste_sz));
 	if (!chunk->ste_arr) {
 		errno = ENOMEM;
 		return errno;
 	}
 
-	chunk->hw_ste_arr = calloc(chunk->num_of_entries, buddy->hw_ste_sz);
-	if (!chunk->hw_ste_arr) {
-		errno = ENOMEM;
-		goto out_free_ste_arr;
-	}
-
-	chunk->miss_list = malloc(chunk->num_of_entries *
-				  sizeof(struct list_head));
-	if (!chunk->miss_list) {
-		errno = ENOMEM;
-		goto out_free_hw_ste_arr;
-	}
+	chunk->miss_list = (struct list_head *)(chunk->ste_arr + num);
+	chunk->hw_ste_arr = (uint8_t *)(chunk->miss_list + num);
 
 	return 0;
+}
 
-out_free_hw_ste_arr:
-	free(chunk->hw_ste_arr);
-out_free_ste_arr:
-	free(chunk->ste_arr);
-	return errno;
+/* A chunk taken from a cache must look like a new one */
+static void dr_icm_chunk_ste_reset(struct dr_icm_chunk *chunk)
+{
+	memset(chunk->ste_arr, 0, chunk->num_of_entries * sizeof(struct dr_ste));
+	memset(chunk->hw_ste_arr, 0,
+	       chunk->num_of_entries * chunk->buddy_mem->hw_ste_sz);
 }
 
 static void dr_icm_chunk_ste_cleanup(struct dr_icm_chunk *chunk)
 {
-	free(chunk->miss_list);
-	free(chunk->hw_ste_arr);
 	free(chunk->ste_arr);
 }
 
@@ -263,14 +288,6 @@ free_mr:
 
 static void dr_icm_buddy_destroy(struct dr_icm_buddy_mem *buddy)
 {
-	struct dr_icm_chunk *chunk, *next;
-
-	list_for_each_safe(&buddy->hot_list, chunk, next, chunk_list)
-		dr_icm_chunk_destroy(chunk);
-
-	list_for_each_safe(&buddy->used_list, chunk, next, chunk_list)
-		dr_icm_chunk_destroy(chunk);
-
 	dr_icm_pool_mr_destroy(buddy->icm_mr);
 
 	dr_buddy_cleanup(buddy);
@@ -309,12 +326,8 @@ dr_icm_chunk_create(struct dr_icm_pool *pool,
 		goto out_free_chunk;
 	}
 
-	buddy_mem_pool->used_memory += chunk->byte_size;
 	list_node_init(&chunk->chunk_list);
 
-	/* chunk now is part of the used_list */
-	list_add_tail(&buddy_mem_pool->used_list, &chunk->chunk_list);
-
 	return chunk;
 
 out_free_chunk:
@@ -324,12 +337,45 @@ out_free_chunk:
 
 static bool dr_icm_pool_is_sync_required(struct dr_icm_pool *pool)
 {
-	if (pool->hot_memory_size > DR_ICM_SYNC_THRESHOLD_POOL)
+	if (atomic_load(&pool->hot_memory_size) > DR_ICM_SYNC_THRESHOLD_POOL)
 		return true;
 
 	return false;
 }
 
+static struct dr_icm_cache *dr_icm_pool_get_cache(struct dr_icm_pool *pool)
+{
+	if (dr_icm_thread_cache < 0)
+		dr_icm_thread_cache = atomic_fetch_add(&dr_icm_next_cache, 1) %
+				      DR_ICM_POOL_CACHES;
+
+	return &pool->caches[dr_icm_thread_cache];
+}
+
+/* Keep a synced chunk in its cache, returns false if there is no room */
+static bool dr_icm_cache_put(struct dr_icm_chunk *chunk)
+{
+	struct dr_icm_cache *cache = chunk->cache;
+	uint32_t order = ilog32(chunk->num_of_entries - 1);
+	bool put = false;
+
+	if (order > DR_ICM_CACHE_MAX_LOG_SZ)
+		return false;
+
+	pthread_spin_lock(&cache->lock);
+	if (cache->num_free[order] < DR_ICM_CACHE_DEPTH >> order) {
+		if (get_chunk_icm_type(chunk) == DR_ICM_TYPE_STE)
+			dr_icm_chunk_ste_reset(chunk);
+		list_del(&chunk->chunk_list);
+		list_add_tail(&cache->free_list[order], &chunk->chunk_list);
+		cache->num_free[order]++;
+		put = true;
+	}
+	pthread_spin_unlock(&cache->lock);
+
+	return put;
+}
+
 /* In order to gain performance FW command is done out of the lock */
 static int dr_icm_pool_sync_pool_buddies(struct dr_icm_pool *pool)
 {
@@ -337,12 +383,18 @@ static int dr_icm_pool_sync_pool_buddies(struct dr_icm_pool *pool)
 	struct dr_icm_chunk *chunk, *tmp_chunk;
 	struct list_head sync_list;
 	bool need_reclaim = false;
-	int err;
+	struct dr_icm_cache *cache;
+	size_t synced = 0;
+	int err, i, o;
 
 	list_head_init(&sync_list);
 
-	list_for_each_safe(&pool->buddy_mem_list, buddy, tmp_buddy, list_node)
-		list_append_list(&sync_list, &buddy->hot_list);
+	for (i = 0; i < DR_ICM_POOL_CACHES; i++) {
+		cache = &pool->caches[i];
+		pthread_spin_lock(&cache->lock);
+		list_append_list(&sync_list, &cache->hot_list);
+		pthread_spin_unlock(&cache->lock);
+	}
 
 	pool->syncing = true;
 
@@ -358,13 +410,33 @@ static int dr_icm_pool_sync_pool_buddies(struct dr_icm_pool *pool)
 	if (err) /* Unexpected state, add debug note and continue */
 		dr_dbg(pool->dmn, "Failed devx sync hw\n");
 
+	list_for_each_safe(&sync_list, chunk, tmp_chunk, chunk_list) {
+		synced += chunk->byte_size;
+		if (!need_reclaim)
+			dr_icm_cache_put(chunk);
+	}
+	atomic_fetch_sub(&pool->hot_memory_size, synced);
+
+	/* Cached memory would keep the buddies from being reclaimed */
+	if (need_reclaim) {
+		for (i = 0; i < DR_ICM_POOL_CACHES; i++) {
+			cache = &pool->caches[i];
+			pthread_spin_lock(&cache->lock);
+			for (o = 0; o <= DR_ICM_CACHE_MAX_LOG_SZ; o++) {
+				list_append_list(&sync_list,
+						 &cache->free_list[o]);
+				cache->num_free[o] = 0;
+			}
+			pthread_spin_unlock(&cache->lock);
+		}
+	}
+
 	pthread_spin_lock(&pool->lock);
 	list_for_each_safe(&sync_list, chunk, tmp_chunk, chunk_list) {
 		buddy = chunk->buddy_mem;
 		dr_buddy_free_mem(buddy, chunk->seg,
 				  ilog32(chunk->num_of_entries - 1));
 		buddy->used_memory -= chunk->byte_size;
-		pool->hot_memory_size -= chunk->byte_size;
 		dr_icm_chunk_destroy(chunk);
 	}
 
@@ -428,61 +500,151 @@ static int dr_icm_handle_buddies_get_mem(struct dr_icm_pool *pool,
 
 found:
 	*buddy = buddy_mem_pool;
+	buddy_mem_pool->used_memory +=
+		dr_icm_pool_chunk_size_to_byte(chunk_size, pool->icm_type);
 out:
 	return err;
 }
 
+/* Like dr_icm_handle_buddies_get_mem() but never creates a buddy */
+static int dr_icm_buddies_try_get_mem(struct dr_icm_pool *pool,
+				      enum dr_icm_chunk_size chunk_size,
+				      struct dr_icm_buddy_mem **buddy)
+{
+	struct dr_icm_buddy_mem *buddy_mem_pool;
+	int seg;
+
+	list_for_each(&pool->buddy_mem_list, buddy_mem_pool, list_node) {
+		seg = dr_buddy_alloc_mem(buddy_mem_pool, chunk_size);
+		if (seg != -1) {
+			*buddy = buddy_mem_pool;
+			buddy_mem_pool->used_memory +=
+				dr_icm_pool_chunk_size_to_byte(chunk_size,
+							       pool->icm_type);
+			return seg;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Take up to num chunks from the buddies, the first is returned in use and
+ * the rest go to the cache.  Only the buddy search is done under the pool
+ * lock.
+ */
+static struct dr_icm_chunk *
+dr_icm_cache_refill(struct dr_icm_pool *pool, struct dr_icm_cache *cache,
+		    enum dr_icm_chunk_size chunk_size, uint32_t num)
+{
+	struct dr_icm_buddy_mem *buddy[DR_ICM_CACHE_REFILL];
+	struct dr_icm_chunk *chunk[DR_ICM_CACHE_REFILL];
+	int seg[DR_ICM_CACHE_REFILL];
+	uint32_t i, got;
+
+	pthread_spin_lock(&pool->lock);
+	got = !dr_icm_handle_buddies_get_mem(pool, chunk_size, &buddy[0],
+					     &seg[0]);
+	/* The rest only if there is room, a new buddy is not worth it */
+	while (got && got < num) {
+		seg[got] = dr_icm_buddies_try_get_mem(pool, chunk_size,
+						      &buddy[got]);
+		if (seg[got] == -1)
+			break;
+		got++;
+	}
+	pthread_spin_unlock(&pool->lock);
+
+	for (i = 0; i < got; i++) {
+		chunk[i] = dr_icm_chunk_create(pool, chunk_size, buddy[i],
+					       seg[i]);
+		if (!chunk[i])
+			break;
+		chunk[i]->cache = cache;
+	}
+
+	if (i < got) {
+		pthread_spin_lock(&pool->lock);
+		for (; got > i; got--) {
+			dr_buddy_free_mem(buddy[got - 1], seg[got - 1],
+					  chunk_size);
+			buddy[got - 1]->used_memory -=
+				dr_icm_pool_chunk_size_to_byte(chunk_size,
+							       pool->icm_type);
+		}
+		pthread_spin_unlock(&pool->lock);
+	}
+
+	if (!got)
+		return NULL;
+
+	pthread_spin_lock(&cache->lock);
+	/* chunk now is part of the used_list */
+	list_add_tail(&cache->used_list, &chunk[0]->chunk_list);
+	for (i = 1; i < got; i++) {
+		list_add_tail(&cache->free_list[chunk_size],
+			      &chunk[i]->chunk_list);
+		cache->num_free[chunk_size]++;
+	}
+	pthread_spin_unlock(&cache->lock);
+
+	return chunk[0];
+}
+
 /* Allocate an ICM chunk, each chunk holds a piece of ICM memory and
  * also memory used for HW STE management for optimisations.
  */
 struct dr_icm_chunk *dr_icm_alloc_chunk(struct dr_icm_pool *pool,
 					enum dr_icm_chunk_size chunk_size)
 {
-	struct dr_icm_buddy_mem *buddy;
-	struct dr_icm_chunk *chunk = NULL;
-	int ret;
-	int seg;
-
-	pthread_spin_lock(&pool->lock);
+	struct dr_icm_cache *cache = dr_icm_pool_get_cache(pool);
+	struct dr_icm_chunk *chunk;
+	uint32_t num = 1;
 
 	if (chunk_size > pool->max_log_chunk_sz) {
 		errno = EINVAL;
-		goto out;
+		return NULL;
 	}
 
-	/* find mem, get back the relevant buddy pool and seg in that mem */
-	ret = dr_icm_handle_buddies_get_mem(pool, chunk_size, &buddy, &seg);
-	if (ret)
-		goto out;
+	if (chunk_size <= DR_ICM_CACHE_MAX_LOG_SZ) {
+		pthread_spin_lock(&cache->lock);
+		chunk = list_pop(&cache->free_list[chunk_size],
+				 struct dr_icm_chunk, chunk_list);
+		if (chunk) {
+			cache->num_free[chunk_size]--;
+			list_add_tail(&cache->used_list, &chunk->chunk_list);
+		}
+		pthread_spin_unlock(&cache->lock);
 
-	chunk = dr_icm_chunk_create(pool, chunk_size, buddy, seg);
-	if (!chunk)
-		goto out_err;
+		if (chunk)
+			return chunk;
 
-	goto out;
+		if (!(pool->dmn->flags & DR_DOMAIN_FLAG_MEMORY_RECLAIM))
+			num = DR_ICM_CACHE_REFILL;
+	}
 
-out_err:
-	dr_buddy_free_mem(buddy, seg, chunk_size);
-out:
-	pthread_spin_unlock(&pool->lock);
-	return chunk;
+	return dr_icm_cache_refill(pool, cache, chunk_size, num);
 }
 
 void dr_icm_free_chunk(struct dr_icm_chunk *chunk)
 {
-	struct dr_icm_buddy_mem *buddy = chunk->buddy_mem;
-	struct dr_icm_pool *pool = buddy->pool;
+	struct dr_icm_pool *pool = chunk->buddy_mem->pool;
+	struct dr_icm_cache *cache = chunk->cache;
 
 	/* move the memory to the waiting list AKA "hot" */
-	pthread_spin_lock(&pool->lock);
+	pthread_spin_lock(&cache->lock);
 	list_del_init(&chunk->chunk_list);
-	list_add_tail(&buddy->hot_list, &chunk->chunk_list);
-	buddy->pool->hot_memory_size += chunk->byte_size;
+	list_add_tail(&cache->hot_list, &chunk->chunk_list);
+	pthread_spin_unlock(&cache->lock);
+	atomic_fetch_add(&pool->hot_memory_size, chunk->byte_size);
 
 	/* Check if we have chunks that are waiting for sync-ste */
-	if (dr_icm_pool_is_sync_required(pool) && !pool->syncing)
-		dr_icm_pool_sync_pool_buddies(buddy->pool);
+	if (!dr_icm_pool_is_sync_required(pool))
+		return;
 
+	pthread_spin_lock(&pool->lock);
+	if (dr_icm_pool_is_sync_required(pool) && !pool->syncing)
+		dr_icm_pool_sync_pool_buddies(pool);
 	pthread_spin_unlock(&pool->lock);
 }
 
@@ -498,8 +660,9 @@ struct dr_icm_pool *dr_icm_pool_create(struct mlx5dv_dr_domain *dmn,
 				       enum dr_icm_type icm_type)
 {
 	enum dr_icm_chunk_size max_log_chunk_sz;
+	struct dr_icm_cache *cache;
 	struct dr_icm_pool *pool;
-	int ret;
+	int ret, i, o;
 
 	if (icm_type == DR_ICM_TYPE_STE)
 		max_log_chunk_sz = dmn->info.max_log_sw_icm_sz;
@@ -524,16 +687,57 @@ struct dr_icm_pool *dr_icm_pool_create(struct mlx5dv_dr_domain *dmn,
 		goto free_pool;
 	}
 
+	for (i = 0; i < DR_ICM_POOL_CACHES; i++) {
+		cache = &pool->caches[i];
+		ret = pthread_spin_init(&cache->lock, PTHREAD_PROCESS_PRIVATE);
+		if (ret) {
+			errno = ret;
+			goto destroy_locks;
+		}
+
+		list_head_init(&cache->used_list);
+		list_head_init(&cache->hot_list);
+		for (o = 0; o <= DR_ICM_CACHE_MAX_LOG_SZ; o++)
+			list_head_init(&cache->free_list[o]);
+	}
+
 	return pool;
 
+destroy_locks:
+	while (i--)
+		pthread_spin_destroy(&pool->caches[i].lock);
+	pthread_spin_destroy(&pool->lock);
 free_pool:
 	free(pool);
 	return NULL;
 }
 
+static void dr_icm_cache_cleanup(struct dr_icm_cache *cache)
+{
+	struct dr_icm_chunk *chunk, *next;
+	int o;
+
+	list_for_each_safe(&cache->hot_list, chunk, next, chunk_list)
+		dr_icm_chunk_destroy(chunk);
+
+	list_for_each_safe(&cache->used_list, chunk, next, chunk_list)
+		dr_icm_chunk_destroy(chunk);
+
+	for (o = 0; o <= DR_ICM_CACHE_MAX_LOG_SZ; o++)
+		list_for_each_safe(&cache->free_list[o], chunk, next,
+				   chunk_list)
+			dr_icm_chunk_destroy(chunk);
+
+	pthread_spin_destroy(&cache->lock);
+}
+
 void dr_icm_pool_destroy(struct dr_icm_pool *pool)
 {
 	struct dr_icm_buddy_mem *buddy, *tmp_buddy;
+	int i;
+
+	for (i = 0; i < DR_ICM_POOL_CACHES; i++)
+		dr_icm_cache_cleanup(&pool->caches[i]);
 
 	list_for_each_safe(&pool->buddy_mem_list, buddy, tmp_buddy, list_node)
 		dr_icm_buddy_destroy(buddy);
@@ -1054,6 +1054,7 @@ static int dr_matcher_add_to_tbl(struct mlx5dv_dr_matcher *matcher)
 
 static void dr_matcher_uninit_nic(struct dr_matcher_rx_tx *nic_matcher)
 {
+	dr_rule_rehash_abort_all(nic_matcher);
 	dr_matcher_clear_ste_builders(nic_matcher);
 	dr_htbl_put(nic_matcher->s_htbl);
 	dr_htbl_put(nic_matcher->e_anchor);
@@ -1124,6 +1125,7 @@ static int dr_matcher_init_nic(struct mlx5dv_dr_matcher *matcher,
 	/* make sure the tables exist while empty */
 	dr_htbl_get(nic_matcher->s_htbl);
 	dr_htbl_get(nic_matcher->e_anchor);
+	list_head_init(&nic_matcher->rehash_list);
 
 	return 0;
 
@@ -1256,6 +1258,9 @@ dr_matcher_set_nic_matcher_layout(struct mlx5dv_dr_matcher *matcher,
 
 	dr_domain_lock(dmn);
 
+	/* Rehashes in progress assume a resizable matcher and its s_htbl */
+	dr_rule_rehash_abort_all(nic_matcher);
+
 	if (matcher_layout->flags & MLX5DV_DR_MATCHER_LAYOUT_NUM_RULE) {
 		/* if needed set dmn->info.max_log_sw_icm_sz and pool max_log_chunk_sz */
 		dr_domain_set_max_ste_icm_size(dmn, matcher_layout->log_num_of_rules_hint);
@@ -36,6 +36,17 @@
 
 #define DR_RULE_MAX_STE_CHAIN (DR_RULE_MAX_STES + DR_ACTION_MAX_STES)
 
+/* State of mlx5dv_dr_rule_create_bulk() and mlx5dv_dr_rule_destroy_bulk() */
+struct dr_rule_bulk {
+	struct mlx5dv_dr_domain	*dmn;
+	/* HW writes of the rules created so far */
+	struct list_head	send_list[DR_MAX_SEND_RINGS];
+	/* Rules created so far, moved to the matcher at the end */
+	struct list_head	rule_list;
+	/* Hash locks held, RX then TX as taken by dr_domain_lock() */
+	uint32_t		locked;
+};
+
 static int dr_rule_append_to_miss_list(struct dr_ste_ctx *ste_ctx,
 				       struct dr_ste *new_last_ste,
 				       struct list_head *miss_list,
@@ -130,14 +141,8 @@ free_tbl:
 	return NULL;
 }
 
-static int dr_rule_handle_one_ste_in_update_list(struct dr_ste_send_info *ste_info,
-						 struct mlx5dv_dr_domain *dmn,
-						 uint8_t send_ring_idx)
+static void dr_rule_update_sw_ste(struct dr_ste_send_info *ste_info)
 {
-	int ret;
-
-	list_del(&ste_info->send_list);
-
 	/* Copy data to ste, only reduced size or control, the last 16B (mask)
 	 * is already written to the hw.
 	 */
@@ -145,6 +150,17 @@ static int dr_rule_handle_one_ste_in_update_list(struct dr_ste_send_info *ste_in
 		memcpy(ste_info->ste->hw_ste, ste_info->data, DR_STE_SIZE_CTRL);
 	else
 		memcpy(ste_info->ste->hw_ste, ste_info->data, ste_info->ste->size);
+}
+
+static int dr_rule_handle_one_ste_in_update_list(struct dr_ste_send_info *ste_info,
+						 struct mlx5dv_dr_domain *dmn,
+						 uint8_t send_ring_idx)
+{
+	int ret;
+
+	list_del(&ste_info->send_list);
+
+	dr_rule_update_sw_ste(ste_info);
 
 	ret = dr_send_postsend_ste(dmn, ste_info->ste, ste_info->data,
 				   ste_info->size, ste_info->offset,
@@ -188,6 +204,140 @@ static int dr_rule_send_update_list(struct list_head *send_ste_list,
 	return 0;
 }
 
+/*
+ * Like dr_rule_send_update_list() in reverse order, but the HW writes are
+ * only queued on the bulk.  The STEs are updated right away so the next
+ * rules of the bulk see them.
+ */
+static void dr_rule_bulk_queue_update_list(struct dr_rule_bulk *bulk,
+					   struct list_head *send_ste_list,
+					   uint8_t send_ring_idx)
+{
+	struct list_head *bulk_list =
+		&bulk->send_list[send_ring_idx % DR_MAX_SEND_RINGS];
+	struct dr_ste_send_info *ste_info, *tmp_ste_info;
+
+	list_for_each_rev_safe(send_ste_list, ste_info, tmp_ste_info,
+			       send_list) {
+		list_del(&ste_info->send_list);
+		dr_rule_update_sw_ste(ste_info);
+
+		/* The data may be the rule's STE array, on the stack */
+		if (ste_info->data != ste_info->data_cont) {
+			memcpy(ste_info->data_cont, ste_info->data,
+			       ste_info->size);
+			ste_info->data = ste_info->data_cont;
+		}
+
+		list_add_tail(bulk_list, &ste_info->send_list);
+	}
+}
+
+/*
+ * Write the queued STEs, one send ring lock and few doorbells per ring.
+ * Must be done before anything else writes STEs the bulk may update or
+ * frees ICM, that is before a rehash or a rule cleanup.
+ */
+static int dr_rule_bulk_flush(struct mlx5dv_dr_domain *dmn,
+			      struct dr_rule_bulk *bulk)
+{
+	int i, ret, err = 0;
+
+	for (i = 0; i < DR_MAX_SEND_RINGS; i++) {
+		if (list_empty(&bulk->send_list[i]))
+			continue;
+
+		ret = dr_send_postsend_ste_list(dmn, &bulk->send_list[i], i);
+		if (ret && !err) {
+			dr_dbg(dmn, "Failed sending bulk STEs\n");
+			err = EIO;
+		}
+	}
+
+	if (err)
+		errno = err;
+	return err;
+}
+
+static void dr_rule_bulk_init(struct dr_rule_bulk *bulk,
+			      struct mlx5dv_dr_domain *dmn)
+{
+	int i;
+
+	bulk->dmn = dmn;
+	for (i = 0; i < DR_MAX_SEND_RINGS; i++)
+		list_head_init(&bulk->send_list[i]);
+	list_head_init(&bulk->rule_list);
+	bulk->locked = 0;
+}
+
+static pthread_spinlock_t *dr_rule_bulk_lock_ptr(struct dr_rule_bulk *bulk,
+						 int bit)
+{
+	struct dr_domain_info *info = &bulk->dmn->info;
+
+	if (bit < NUM_OF_LOCKS)
+		return &info->rx.locks[bit];
+	return &info->tx.locks[bit - NUM_OF_LOCKS];
+}
+
+/*
+ * Flush the queued writes and release the hash locks, so that the STEs the
+ * bulk touched are written before anyone else may update them.
+ */
+static int dr_rule_bulk_unlock(struct dr_rule_bulk *bulk)
+{
+	int ret, bit;
+
+	ret = dr_rule_bulk_flush(bulk->dmn, bulk);
+
+	for (bit = 2 * NUM_OF_LOCKS - 1; bit >= 0; bit--)
+		if (bulk->locked & (1U << bit))
+			pthread_spin_unlock(dr_rule_bulk_lock_ptr(bulk, bit));
+	bulk->locked = 0;
+
+	return ret;
+}
+
+/*
+ * Take the hash lock of a rule, as dr_rule_lock() does, and keep it for the
+ * rest of the bulk.  The locks are taken in dr_domain_lock() order; one that
+ * would be out of order is waited for only after releasing the others.
+ * The lock is always taken, the return is that of a flush on the way.
+ */
+static int dr_rule_bulk_lock(struct dr_rule_bulk *bulk,
+			     struct dr_rule_rx_tx *nic_rule, uint8_t *hw_ste)
+{
+	struct dr_matcher_rx_tx *nic_matcher = nic_rule->nic_matcher;
+	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
+	pthread_spinlock_t *lock;
+	uint32_t mask;
+	int bit = 0;
+	int ret = 0;
+
+	if (nic_matcher->fixed_size) {
+		dr_rule_set_lock_index(nic_rule, hw_ste);
+		bit = nic_rule->lock_index;
+	}
+	if (nic_dmn->type == DR_DOMAIN_NIC_TYPE_TX)
+		bit += NUM_OF_LOCKS;
+
+	mask = 1U << bit;
+	if (bulk->locked & mask)
+		return 0;
+
+	lock = dr_rule_bulk_lock_ptr(bulk, bit);
+	if (bulk->locked > mask && pthread_spin_trylock(lock)) {
+		ret = dr_rule_bulk_unlock(bulk);
+		pthread_spin_lock(lock);
+	} else if (bulk->locked < mask) {
+		pthread_spin_lock(lock);
+	}
+	bulk->locked |= mask;
+
+	return ret;
+}
+
 static struct dr_ste *dr_rule_find_ste_in_miss_list(struct list_head *miss_list,
 						    uint8_t *hw_ste,
 						    uint8_t tag_size)
@@ -322,8 +472,6 @@ static struct dr_ste *dr_rule_rehash_copy_ste(struct mlx5dv_dr_matcher *matcher,
 						      update_list, true);
 	}
 
-	dr_rule_rehash_copy_ste_ctrl(matcher, nic_matcher, cur_ste, new_ste);
-
 	return new_ste;
 }
 
@@ -344,6 +492,8 @@ static int dr_rule_rehash_copy_miss_list(struct mlx5dv_dr_matcher *matcher,
 		if (!new_ste)
 			goto err_insert;
 
+		dr_rule_rehash_copy_ste_ctrl(matcher, nic_matcher, cur_ste,
+					     new_ste);
 		list_del(&cur_ste->miss_list_node);
 		dr_htbl_put(cur_ste->htbl);
 	}
@@ -386,6 +536,16 @@ clean_copy:
 	return err;
 }
 
+/* The pointing STE's hit address changed, its table may be rehashed too */
+static void dr_rule_rehash_pointing_ste_update(struct dr_ste *pointing_ste)
+{
+	struct dr_ste *first_ste = dr_ste_get_miss_list_top(pointing_ste);
+	struct dr_ste_htbl *htbl = first_ste->htbl;
+
+	if (htbl->rehash)
+		dr_rule_rehash_update(htbl, first_ste - htbl->ste_arr);
+}
+
 static struct dr_ste_htbl *dr_rule_rehash_htbl_common(struct mlx5dv_dr_matcher *matcher,
 						      struct dr_matcher_rx_tx *nic_matcher,
 						      struct dr_ste_htbl *cur_htbl,
@@ -487,6 +647,7 @@ static struct dr_ste_htbl *dr_rule_rehash_htbl_common(struct mlx5dv_dr_matcher *
 						 cur_htbl->pointing_ste->hw_ste,
 						 new_htbl);
 		ste_to_update = cur_htbl->pointing_ste;
+		dr_rule_rehash_pointing_ste_update(ste_to_update);
 	}
 
 	dr_send_fill_and_append_ste_send_info(ste_to_update, DR_STE_SIZE_CTRL,
@@ -564,6 +725,478 @@ err_out:
 	return ENOTSUP;
 }
 
+/*
+ * Tables bigger than DR_RULE_REHASH_STEP entries are rehashed incrementally:
+ * the bigger table is built aside, DR_RULE_REHASH_STEP buckets of the
+ * current one after each rule insertion, while the rules keep going to the
+ * current table and the device keeps looking up there.  A bucket that
+ * changes after it was copied is dropped from the new table and copied
+ * again.  Once every bucket is copied the pointing STE is switched to the new
+ * table with a single control write and the STEs move over, so the device
+ * sees either table whole.  The STEs of the current table are then released
+ * over the next insertions as well.
+ */
+#define DR_RULE_REHASH_STEP 64
+
+enum dr_rule_rehash_bucket_state {
+	DR_RULE_REHASH_BUCKET_PENDING,
+	DR_RULE_REHASH_BUCKET_COPIED,
+	DR_RULE_REHASH_BUCKET_DIRTY,
+};
+
+struct dr_rule_rehash_pair {
+	struct dr_ste *cur_ste;
+	struct dr_ste *new_ste;
+};
+
+struct dr_rule_rehash_bucket {
+	uint32_t first_pair;
+	uint32_t num_pairs;
+	enum dr_rule_rehash_bucket_state state;
+};
+
+struct dr_rule_rehash {
+	struct mlx5dv_dr_matcher *matcher;
+	struct dr_matcher_rx_tx *nic_matcher;
+	struct dr_ste_htbl *cur_htbl;
+	struct dr_ste_htbl *new_htbl;
+	/* Attached to nic_matcher->rehash_list */
+	struct list_node list;
+	uint8_t ste_location;
+	uint8_t formated_ste[DR_STE_SIZE];
+	/* Only the current table's STEs are left to release */
+	bool switched;
+	/* The buckets of cur_htbl, copied then released in order */
+	struct dr_rule_rehash_bucket *buckets;
+	uint32_t num_buckets;
+	uint32_t next_bucket;
+	/* Buckets changed after they were copied */
+	uint32_t *dirty;
+	uint32_t num_dirty;
+	/* The STEs of the copied buckets and their copy in new_htbl */
+	struct dr_rule_rehash_pair *pairs;
+	uint32_t num_pairs;
+	uint32_t max_pairs;
+};
+
+static bool dr_rule_rehash_is_incremental(struct dr_ste_htbl *htbl)
+{
+	return htbl->chunk->num_of_entries > DR_RULE_REHASH_STEP;
+}
+
+static void dr_rule_rehash_drop_bucket(struct dr_rule_rehash *rehash,
+				       struct dr_rule_rehash_bucket *bucket)
+{
+	struct dr_ste_htbl *new_htbl = rehash->new_htbl;
+	struct dr_ste *new_ste;
+	uint32_t i;
+
+	/* The new table's buckets hold only copies of this bucket */
+	for (i = 0; i < bucket->num_pairs; i++) {
+		new_ste = rehash->pairs[bucket->first_pair + i].new_ste;
+
+		list_del_init(&new_ste->miss_list_node);
+		atomic_init(&new_ste->refcount, 0);
+		if (new_ste->htbl != new_htbl)
+			new_htbl->ctrl.num_of_collisions--;
+		new_htbl->ctrl.num_of_valid_entries--;
+		dr_htbl_put(new_ste->htbl);
+	}
+
+	bucket->num_pairs = 0;
+}
+
+static void dr_rule_rehash_destroy(struct dr_rule_rehash *rehash)
+{
+	list_del(&rehash->list);
+	rehash->cur_htbl->rehash = NULL;
+	dr_htbl_put(rehash->new_htbl);
+	dr_htbl_put(rehash->cur_htbl);
+	free(rehash->pairs);
+	free(rehash->dirty);
+	free(rehash->buckets);
+	free(rehash);
+}
+
+/* Keep the current table, the device never looked at the new one */
+static void dr_rule_rehash_abort(struct dr_rule_rehash *rehash)
+{
+	uint32_t i;
+
+	for (i = 0; i < rehash->next_bucket; i++)
+		dr_rule_rehash_drop_bucket(rehash, &rehash->buckets[i]);
+
+	dr_rule_rehash_destroy(rehash);
+}
+
+/* The device is done with the current table, its STEs can go */
+static void dr_rule_rehash_release(struct dr_rule_rehash *rehash,
+				   uint32_t budget)
+{
+	struct dr_rule_rehash_bucket *bucket;
+	struct dr_ste *cur_ste;
+	uint32_t i;
+
+	while (budget-- && rehash->next_bucket < rehash->num_buckets) {
+		bucket = &rehash->buckets[rehash->next_bucket++];
+		for (i = 0; i < bucket->num_pairs; i++) {
+			cur_ste = rehash->pairs[bucket->first_pair + i].cur_ste;
+			list_del(&cur_ste->miss_list_node);
+			dr_htbl_put(cur_ste->htbl);
+		}
+	}
+
+	if (rehash->next_bucket == rehash->num_buckets)
+		dr_rule_rehash_destroy(rehash);
+}
+
+void dr_rule_rehash_abort_all(struct dr_matcher_rx_tx *nic_matcher)
+{
+	struct dr_rule_rehash *rehash, *tmp;
+
+	list_for_each_safe(&nic_matcher->rehash_list, rehash, tmp, list) {
+		if (rehash->switched)
+			dr_rule_rehash_release(rehash, UINT32_MAX);
+		else
+			dr_rule_rehash_abort(rehash);
+	}
+}
+
+/* Called before or after the miss list of bucket index in htbl changes */
+void dr_rule_rehash_update(struct dr_ste_htbl *htbl, uint32_t index)
+{
+	struct dr_rule_rehash *rehash = htbl->rehash;
+	struct dr_rule_rehash_bucket *bucket = &rehash->buckets[index];
+
+	/* The last STE is gone, so is the table */
+	if (!htbl->ctrl.num_of_valid_entries) {
+		dr_rule_rehash_abort(rehash);
+		return;
+	}
+
+	if (bucket->state != DR_RULE_REHASH_BUCKET_COPIED)
+		return;
+
+	dr_rule_rehash_drop_bucket(rehash, bucket);
+	bucket->state = DR_RULE_REHASH_BUCKET_DIRTY;
+	rehash->dirty[rehash->num_dirty++] = index;
+}
+
+static int dr_rule_rehash_start(struct dr_rule_rx_tx *nic_rule,
+				struct mlx5dv_dr_matcher *matcher,
+				struct dr_ste_htbl *cur_htbl,
+				uint8_t ste_location)
+{
+	struct dr_matcher_rx_tx *nic_matcher = nic_rule->nic_matcher;
+	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct dr_htbl_connect_info info;
+	enum dr_icm_chunk_size new_size;
+	struct dr_rule_rehash *rehash;
+
+	new_size = dr_icm_next_higher_chunk(cur_htbl->chunk_size);
+	new_size = min_t(uint32_t, new_size, dmn->info.max_log_sw_icm_sz);
+
+	if (new_size == cur_htbl->chunk_size)
+		return 0; /* Skip rehash, we already at the max size */
+
+	rehash = calloc(1, sizeof(*rehash));
+	if (!rehash) {
+		errno = ENOMEM;
+		return errno;
+	}
+
+	rehash->num_buckets = cur_htbl->chunk->num_of_entries;
+	rehash->max_pairs = rehash->num_buckets;
+	rehash->buckets = calloc(rehash->num_buckets, sizeof(*rehash->buckets));
+	rehash->dirty = calloc(rehash->num_buckets, sizeof(*rehash->dirty));
+	rehash->pairs = calloc(rehash->max_pairs, sizeof(*rehash->pairs));
+	if (!rehash->buckets || !rehash->dirty || !rehash->pairs) {
+		errno = ENOMEM;
+		goto free_rehash;
+	}
+
+	/* The entries are set up as the buckets get copied */
+	rehash->new_htbl = dr_ste_htbl_alloc_lazy(dmn->ste_icm_pool,
+						  new_size,
+						  cur_htbl->type,
+						  cur_htbl->lu_type,
+						  cur_htbl->byte_mask);
+	if (!rehash->new_htbl) {
+		dr_dbg(dmn, "Failed to allocate new hash table\n");
+		goto free_rehash;
+	}
+
+	info.type = CONNECT_MISS;
+	info.miss_icm_addr = nic_matcher->e_anchor->chunk->icm_addr;
+	dr_ste_set_formated_ste(dmn->ste_ctx,
+				dmn->info.caps.gvmi,
+				nic_dmn->type,
+				rehash->new_htbl,
+				rehash->formated_ste,
+				&info);
+
+	rehash->matcher = matcher;
+	rehash->nic_matcher = nic_matcher;
+	rehash->cur_htbl = cur_htbl;
+	rehash->ste_location = ste_location;
+
+	/* Both tables are held till the switch */
+	dr_htbl_get(rehash->new_htbl);
+	dr_htbl_get(cur_htbl);
+	cur_htbl->rehash = rehash;
+	list_add_tail(&nic_matcher->rehash_list, &rehash->list);
+
+	return 0;
+
+free_rehash:
+	free(rehash->pairs);
+	free(rehash->dirty);
+	free(rehash->buckets);
+	free(rehash);
+	return errno;
+}
+
+static int dr_rule_rehash_copy_bucket(struct dr_rule_rehash *rehash,
+				      uint32_t index,
+				      struct list_head *update_list)
+{
+	struct dr_rule_rehash_bucket *bucket = &rehash->buckets[index];
+	struct dr_ste *head_ste = &rehash->cur_htbl->ste_arr[index];
+	struct dr_rule_rehash_pair *pairs;
+	struct dr_ste *cur_ste, *new_ste;
+
+	bucket->state = DR_RULE_REHASH_BUCKET_COPIED;
+	bucket->first_pair = rehash->num_pairs;
+	bucket->num_pairs = 0;
+
+	if (dr_ste_is_not_used(head_ste))
+		return 0;
+
+	list_for_each(dr_ste_get_miss_list(head_ste), cur_ste, miss_list_node) {
+		if (rehash->num_pairs == rehash->max_pairs) {
+			pairs = realloc(rehash->pairs, 2 * rehash->max_pairs *
+					sizeof(*pairs));
+			if (!pairs) {
+				errno = ENOMEM;
+				return errno;
+			}
+			rehash->pairs = pairs;
+			rehash->max_pairs *= 2;
+		}
+
+		new_ste = dr_rule_rehash_copy_ste(rehash->matcher,
+						  rehash->nic_matcher,
+						  cur_ste,
+						  rehash->new_htbl,
+						  update_list);
+		if (!new_ste)
+			return errno;
+
+		/* In use, the control is copied on the switch */
+		atomic_init(&new_ste->refcount, 1);
+
+		rehash->pairs[rehash->num_pairs].cur_ste = cur_ste;
+		rehash->pairs[rehash->num_pairs].new_ste = new_ste;
+		rehash->num_pairs++;
+		bucket->num_pairs++;
+	}
+
+	return 0;
+}
+
+/*
+ * The copies of buckets first..first + num - 1 land in the same range of
+ * each cur_htbl sized part of the new table, the hash index is modulo the
+ * number of entries.
+ */
+static int dr_rule_rehash_write(struct dr_rule_rehash *rehash,
+				uint32_t first, uint32_t num,
+				uint8_t send_ring_idx)
+{
+	struct mlx5dv_dr_domain *dmn = rehash->matcher->tbl->dmn;
+	struct dr_ste_htbl *new_htbl = rehash->new_htbl;
+	uint8_t *mask = NULL;
+	uint32_t i;
+	int ret;
+
+	if (new_htbl->type == DR_STE_HTBL_TYPE_LEGACY)
+		mask = rehash->nic_matcher->ste_builder[rehash->ste_location - 1].bit_mask;
+
+	for (i = first; i < new_htbl->chunk->num_of_entries;
+	     i += rehash->num_buckets) {
+		ret = dr_send_postsend_htbl_range(dmn, new_htbl,
+						  rehash->formated_ste, mask,
+						  i, num, send_ring_idx);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int dr_rule_rehash_switch(struct dr_rule_rehash *rehash,
+				 uint8_t send_ring_idx,
+				 struct dr_rule_bulk *bulk)
+{
+	struct dr_matcher_rx_tx *nic_matcher = rehash->nic_matcher;
+	struct mlx5dv_dr_matcher *matcher = rehash->matcher;
+	struct dr_ste_htbl *cur_htbl = rehash->cur_htbl;
+	struct dr_ste_htbl *new_htbl = rehash->new_htbl;
+	struct dr_ste *pointing_ste = cur_htbl->pointing_ste;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct dr_rule_rehash_bucket *bucket;
+	struct dr_ste_send_info *ste_info;
+	struct dr_rule_rehash_pair *pair;
+	struct dr_ste *ste_to_update;
+	LIST_HEAD(send_ste_list);
+	uint32_t i, j;
+
+	/* The bulk may have queued writes to the current table */
+	if (bulk && dr_rule_bulk_flush(dmn, bulk))
+		return errno;
+
+	ste_info = calloc(1, sizeof(*ste_info));
+	if (!ste_info) {
+		errno = ENOMEM;
+		return errno;
+	}
+
+	/* The pairs of dropped copies are stale, go by the buckets */
+	for (i = 0; i < rehash->num_buckets; i++) {
+		bucket = &rehash->buckets[i];
+		for (j = 0; j < bucket->num_pairs; j++) {
+			pair = &rehash->pairs[bucket->first_pair + j];
+			dr_rule_rehash_copy_ste_ctrl(matcher, nic_matcher,
+						     pair->cur_ste,
+						     pair->new_ste);
+		}
+	}
+
+	new_htbl->pointing_ste = pointing_ste;
+	pointing_ste->next_htbl = new_htbl;
+
+	if (rehash->ste_location == 1) {
+		/* The previous table is an anchor, anchors size is always one STE */
+		struct dr_ste_htbl *prev_htbl = pointing_ste->htbl;
+
+		/* On matcher s_anchor we keep an extra refcount */
+		dr_htbl_get(new_htbl);
+		dr_htbl_put(cur_htbl);
+
+		nic_matcher->s_htbl = new_htbl;
+
+		dr_ste_set_hit_addr(dmn->ste_ctx,
+				    prev_htbl->ste_arr[0].hw_ste,
+				    new_htbl->chunk->icm_addr,
+				    new_htbl->chunk->num_of_entries);
+
+		ste_to_update = &prev_htbl->ste_arr[0];
+	} else {
+		dr_ste_set_hit_addr_by_next_htbl(dmn->ste_ctx,
+						 pointing_ste->hw_ste,
+						 new_htbl);
+		ste_to_update = pointing_ste;
+		dr_rule_rehash_pointing_ste_update(ste_to_update);
+	}
+
+	dr_send_fill_and_append_ste_send_info(ste_to_update, DR_STE_SIZE_CTRL,
+					      0, ste_to_update->hw_ste, ste_info,
+					      &send_ste_list, false);
+	if (dr_rule_send_update_list(&send_ste_list, dmn, false,
+				     send_ring_idx))
+		dr_dbg(dmn, "Failed updating the pointing STE\n");
+
+	/* The current table is released by the next steps */
+	rehash->switched = true;
+	rehash->next_bucket = 0;
+	return 0;
+}
+
+/*
+ * Copy the next buckets of the first table being rehashed and switch it to
+ * its new table once all are copied, or release the next buckets of the
+ * table it replaced.  On failure the rehash is dropped and the current table
+ * stays.
+ */
+static void dr_rule_rehash_step(struct dr_matcher_rx_tx *nic_matcher,
+				uint8_t send_ring_idx,
+				struct dr_rule_bulk *bulk)
+{
+	struct dr_ste_send_info *ste_info, *tmp_ste_info;
+	uint32_t budget = DR_RULE_REHASH_STEP;
+	struct dr_rule_rehash *rehash;
+	struct mlx5dv_dr_domain *dmn;
+	LIST_HEAD(update_list);
+	uint32_t index, first, num;
+	int ret = 0;
+
+	rehash = list_top(&nic_matcher->rehash_list, struct dr_rule_rehash,
+			  list);
+	if (!rehash)
+		return;
+
+	if (rehash->switched) {
+		dr_rule_rehash_release(rehash, budget);
+		return;
+	}
+
+	dmn = rehash->matcher->tbl->dmn;
+
+	while (budget && rehash->num_dirty) {
+		index = rehash->dirty[--rehash->num_dirty];
+		ret = dr_rule_rehash_copy_bucket(rehash, index, &update_list);
+		if (!ret)
+			ret = dr_rule_rehash_write(rehash, index, 1,
+						   send_ring_idx);
+		if (ret)
+			goto out;
+		budget--;
+	}
+
+	first = rehash->next_bucket;
+	num = min_t(uint32_t, budget, rehash->num_buckets - first);
+	for (index = first; index < rehash->new_htbl->chunk->num_of_entries;
+	     index += rehash->num_buckets)
+		dr_ste_htbl_init_entries(rehash->new_htbl, index, num);
+
+	for (index = first; index < first + num; index++) {
+		/* Counted before the copy, an abort drops what it made */
+		rehash->next_bucket = index + 1;
+		ret = dr_rule_rehash_copy_bucket(rehash, index, &update_list);
+		if (ret)
+			goto out;
+	}
+
+	if (num)
+		ret = dr_rule_rehash_write(rehash, first, num, send_ring_idx);
+	if (ret)
+		goto out;
+
+	/*
+	 * Collision entries and the miss addresses pointing to them, written
+	 * after their buckets as on a full rehash.
+	 */
+	ret = dr_rule_send_update_list(&update_list, dmn, false,
+				       send_ring_idx);
+	if (ret)
+		goto out;
+
+	if (rehash->next_bucket == rehash->num_buckets && !rehash->num_dirty)
+		ret = dr_rule_rehash_switch(rehash, send_ring_idx, bulk);
+
+out:
+	if (ret) {
+		dr_dbg(dmn, "Failed rehash step, keeping the current table\n");
+		list_for_each_safe(&update_list, ste_info, tmp_ste_info,
+				   send_list) {
+			list_del(&ste_info->send_list);
+			free(ste_info);
+		}
+		dr_rule_rehash_abort(rehash);
+	}
+}
+
 static struct dr_ste_htbl *dr_rule_rehash(struct mlx5dv_dr_rule *rule,
 					  struct dr_rule_rx_tx *nic_rule,
 					  struct dr_ste_htbl *cur_htbl,
@@ -895,7 +1528,8 @@ static struct dr_ste *dr_rule_handle_ste_branch(struct mlx5dv_dr_rule *rule,
 						struct dr_ste_htbl *cur_htbl,
 						uint8_t *hw_ste,
 						uint8_t ste_location,
-						struct dr_ste_htbl **put_htbl)
+						struct dr_ste_htbl **put_htbl,
+						struct dr_rule_bulk *bulk)
 {
 	struct dr_matcher_rx_tx *nic_matcher = nic_rule->nic_matcher;
 	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
@@ -904,7 +1538,7 @@ static struct dr_ste *dr_rule_handle_ste_branch(struct mlx5dv_dr_rule *rule,
 	struct dr_ste_htbl *new_htbl;
 	struct list_head *miss_list;
 	struct dr_ste *matched_ste;
-	bool skip_rehash = nic_matcher->fixed_size;
+	bool skip_rehash = nic_matcher->fixed_size || cur_htbl->rehash;
 	struct dr_ste *ste;
 	int index;
 
@@ -914,6 +1548,9 @@ again:
 	ste = &cur_htbl->ste_arr[index];
 
 	if (dr_ste_is_not_used(ste)) {
+		if (cur_htbl->rehash)
+			dr_rule_rehash_update(cur_htbl, index);
+
 		if (dr_rule_handle_empty_entry(matcher, nic_rule, cur_htbl,
 					       ste, ste_location,
 					       hw_ste, miss_list,
@@ -944,6 +1581,15 @@ again:
 			/* Hash table index in use, try to resize of the hash */
 			skip_rehash = true;
 
+			/* Big tables grow over the next insertions */
+			if (dr_rule_rehash_is_incremental(cur_htbl)) {
+				if (dr_rule_rehash_start(nic_rule, matcher,
+							 cur_htbl, ste_location))
+					dr_dbg(dmn, "Failed starting rehash, htbl-log_size: %d\n",
+					       cur_htbl->chunk_size);
+				goto again;
+			}
+
 			/*
 			 * Hold the table till we update.
 			 * Release in dr_rule_create_rule_nr()
@@ -951,6 +1597,12 @@ again:
 			*put_htbl = cur_htbl;
 			dr_htbl_get(cur_htbl);
 
+			/* The rehash copies and frees the current table */
+			if (bulk && dr_rule_bulk_flush(dmn, bulk)) {
+				dr_htbl_put(cur_htbl);
+				return NULL;
+			}
+
 			new_htbl = dr_rule_rehash(rule, nic_rule, cur_htbl,
 						  ste_location, send_ste_list);
 			if (!new_htbl) {
@@ -963,6 +1615,9 @@ again:
 			goto again;
 		} else {
 			/* Hash table index in use, add another collision (miss) */
+			if (cur_htbl->rehash)
+				dr_rule_rehash_update(cur_htbl, index);
+
 			ste = dr_rule_handle_collision(matcher,
 						       nic_rule,
 						       ste,
@@ -1088,39 +1743,43 @@ static bool dr_rule_verify(struct mlx5dv_dr_matcher *matcher,
 	return true;
 }
 
+/* A bulk keeps the hash lock until it is done */
 static int dr_rule_destroy_rule_nic(struct mlx5dv_dr_rule *rule,
-				    struct dr_rule_rx_tx *nic_rule)
+				    struct dr_rule_rx_tx *nic_rule,
+				    struct dr_rule_bulk *bulk)
 {
-	dr_rule_lock(nic_rule, NULL);
+	if (bulk)
+		dr_rule_bulk_lock(bulk, nic_rule, NULL);
+	else
+		dr_rule_lock(nic_rule, NULL);
 	dr_rule_clean_rule_members(rule, nic_rule);
-	dr_rule_unlock(nic_rule);
+	if (!bulk)
+		dr_rule_unlock(nic_rule);
 	return 0;
 }
 
-static int dr_rule_destroy_rule_fdb(struct mlx5dv_dr_rule *rule)
+static int dr_rule_destroy_rule_fdb(struct mlx5dv_dr_rule *rule,
+				    struct dr_rule_bulk *bulk)
 {
-	dr_rule_destroy_rule_nic(rule, &rule->rx);
-	dr_rule_destroy_rule_nic(rule, &rule->tx);
+	dr_rule_destroy_rule_nic(rule, &rule->rx, bulk);
+	dr_rule_destroy_rule_nic(rule, &rule->tx, bulk);
 	return 0;
 }
 
-static int dr_rule_destroy_rule(struct mlx5dv_dr_rule *rule)
+static int dr_rule_destroy_rule_members(struct mlx5dv_dr_rule *rule,
+					struct dr_rule_bulk *bulk)
 {
 	struct mlx5dv_dr_domain *dmn = rule->matcher->tbl->dmn;
 
-	pthread_spin_lock(&dmn->debug_lock);
-	list_del(&rule->rule_list);
-	pthread_spin_unlock(&dmn->debug_lock);
-
 	switch (dmn->type) {
 	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
-		dr_rule_destroy_rule_nic(rule, &rule->rx);
+		dr_rule_destroy_rule_nic(rule, &rule->rx, bulk);
 		break;
 	case MLX5DV_DR_DOMAIN_TYPE_NIC_TX:
-		dr_rule_destroy_rule_nic(rule, &rule->tx);
+		dr_rule_destroy_rule_nic(rule, &rule->tx, bulk);
 		break;
 	case MLX5DV_DR_DOMAIN_TYPE_FDB:
-		dr_rule_destroy_rule_fdb(rule);
+		dr_rule_destroy_rule_fdb(rule, bulk);
 		break;
 	default:
 		assert(false);
@@ -1134,6 +1793,17 @@ static int dr_rule_destroy_rule(struct mlx5dv_dr_rule *rule)
 	return 0;
 }
 
+static int dr_rule_destroy_rule(struct mlx5dv_dr_rule *rule)
+{
+	struct mlx5dv_dr_domain *dmn = rule->matcher->tbl->dmn;
+
+	pthread_spin_lock(&dmn->debug_lock);
+	list_del(&rule->rule_list);
+	pthread_spin_unlock(&dmn->debug_lock);
+
+	return dr_rule_destroy_rule_members(rule, NULL);
+}
+
 static int dr_rule_destroy_rule_root(struct mlx5dv_dr_rule *rule)
 {
 	int ret;
@@ -1196,7 +1866,8 @@ dr_rule_create_rule_nic(struct mlx5dv_dr_rule *rule,
 			struct dr_rule_rx_tx *nic_rule,
 			struct dr_match_param *param,
 			size_t num_actions,
-			struct mlx5dv_dr_action *actions[])
+			struct mlx5dv_dr_action *actions[],
+			struct dr_rule_bulk *bulk)
 {
 	uint8_t hw_ste_arr[DR_RULE_MAX_STE_CHAIN * DR_STE_SIZE] = {};
 	struct dr_matcher_rx_tx *nic_matcher = nic_rule->nic_matcher;
@@ -1226,7 +1897,13 @@ dr_rule_create_rule_nic(struct mlx5dv_dr_rule *rule,
 	if (ret)
 		return ret;
 
-	dr_rule_lock(nic_rule, hw_ste_arr);
+	if (bulk) {
+		ret = dr_rule_bulk_lock(bulk, nic_rule, hw_ste_arr);
+		if (ret)
+			return ret;
+	} else {
+		dr_rule_lock(nic_rule, hw_ste_arr);
+	}
 
 	cur_htbl = nic_matcher->s_htbl;
 
@@ -1245,7 +1922,8 @@ dr_rule_create_rule_nic(struct mlx5dv_dr_rule *rule,
 						cur_htbl,
 						cur_hw_ste_ent,
 						i + 1,
-						&htbl);
+						&htbl,
+						bulk);
 		if (!ste) {
 			dr_dbg(dmn, "Failed creating next branch\n");
 			ret = errno;
@@ -1264,18 +1942,29 @@ dr_rule_create_rule_nic(struct mlx5dv_dr_rule *rule,
 		dr_dbg(dmn, "Failed apply actions\n");
 		goto free_rule;
 	}
-	ret = dr_rule_send_update_list(&send_ste_list, dmn, true, nic_rule->lock_index);
-	if (ret) {
-		dr_dbg(dmn, "Failed sending ste!\n");
-		goto free_rule;
+	if (bulk) {
+		dr_rule_bulk_queue_update_list(bulk, &send_ste_list,
+					       nic_rule->lock_index);
+	} else {
+		ret = dr_rule_send_update_list(&send_ste_list, dmn, true,
+					       nic_rule->lock_index);
+		if (ret) {
+			dr_dbg(dmn, "Failed sending ste!\n");
+			goto free_rule;
+		}
 	}
 
 	if (htbl)
 		dr_htbl_put(htbl);
 
+	dr_rule_rehash_step(nic_matcher, nic_rule->lock_index, bulk);
+
 	goto out_unlock;
 
 free_rule:
+	/* The cleanup writes neighbour STEs the bulk may have queued */
+	if (bulk)
+		dr_rule_bulk_flush(dmn, bulk);
 	dr_rule_clean_rule_members(rule, nic_rule);
 	/* Clean all ste_info's */
 	list_for_each_safe(&send_ste_list, ste_info, tmp_ste_info, send_list) {
@@ -1283,7 +1972,8 @@ free_rule:
 		free(ste_info);
 	}
 out_unlock:
-	dr_rule_unlock(nic_rule);
+	if (!bulk)
+		dr_rule_unlock(nic_rule);
 	return ret;
 }
 
@@ -1291,7 +1981,8 @@ static int
 dr_rule_create_rule_fdb(struct mlx5dv_dr_rule *rule,
 			struct dr_match_param *param,
 			size_t num_actions,
-			struct mlx5dv_dr_action *actions[])
+			struct mlx5dv_dr_action *actions[],
+			struct dr_rule_bulk *bulk)
 {
 	struct dr_match_param copy_param = {};
 	int ret;
@@ -1303,19 +1994,21 @@ dr_rule_create_rule_fdb(struct mlx5dv_dr_rule *rule,
 	memcpy(&copy_param, param, sizeof(struct dr_match_param));
 
 	ret = dr_rule_create_rule_nic(rule, &rule->rx, param,
-				      num_actions, actions);
+				      num_actions, actions, bulk);
 	if (ret)
 		return ret;
 
 	ret = dr_rule_create_rule_nic(rule, &rule->tx, &copy_param,
-				      num_actions, actions);
+				      num_actions, actions, bulk);
 	if (ret)
 		goto destroy_rule_nic_rx;
 
 	return 0;
 
 destroy_rule_nic_rx:
-	dr_rule_destroy_rule_nic(rule, &rule->rx);
+	if (bulk)
+		dr_rule_bulk_flush(rule->matcher->tbl->dmn, bulk);
+	dr_rule_destroy_rule_nic(rule, &rule->rx, bulk);
 	return ret;
 }
 
@@ -1323,7 +2016,8 @@ static struct mlx5dv_dr_rule *
 dr_rule_create_rule(struct mlx5dv_dr_matcher *matcher,
 		    struct mlx5dv_flow_match_parameters *value,
 		    size_t num_actions,
-		    struct mlx5dv_dr_action *actions[])
+		    struct mlx5dv_dr_action *actions[],
+		    struct dr_rule_bulk *bulk)
 {
 	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
 	struct dr_match_param param = {};
@@ -1351,18 +2045,18 @@ dr_rule_create_rule(struct mlx5dv_dr_matcher *matcher,
 	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
 		rule->rx.nic_matcher = &matcher->rx;
 		ret = dr_rule_create_rule_nic(rule, &rule->rx, &param,
-					      num_actions, actions);
+					      num_actions, actions, bulk);
 		break;
 	case MLX5DV_DR_DOMAIN_TYPE_NIC_TX:
 		rule->tx.nic_matcher = &matcher->tx;
 		ret = dr_rule_create_rule_nic(rule, &rule->tx, &param,
-					      num_actions, actions);
+					      num_actions, actions, bulk);
 		break;
 	case MLX5DV_DR_DOMAIN_TYPE_FDB:
 		rule->rx.nic_matcher = &matcher->rx;
 		rule->tx.nic_matcher = &matcher->tx;
 		ret = dr_rule_create_rule_fdb(rule, &param,
-					      num_actions, actions);
+					      num_actions, actions, bulk);
 		break;
 	default:
 		ret = EINVAL;
@@ -1373,9 +2067,14 @@ dr_rule_create_rule(struct mlx5dv_dr_matcher *matcher,
 	if (ret)
 		goto remove_action_members;
 
-	pthread_spin_lock(&dmn->debug_lock);
-	list_add_tail(&matcher->rule_list, &rule->rule_list);
-	pthread_spin_unlock(&dmn->debug_lock);
+	/* A bulk moves its rules to the matcher at the end */
+	if (bulk) {
+		list_add_tail(&bulk->rule_list, &rule->rule_list);
+	} else {
+		pthread_spin_lock(&dmn->debug_lock);
+		list_add_tail(&matcher->rule_list, &rule->rule_list);
+		pthread_spin_unlock(&dmn->debug_lock);
+	}
 
 	return rule;
 
@@ -1462,7 +2161,8 @@ struct mlx5dv_dr_rule *mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 	if (dr_is_root_table(matcher->tbl))
 		rule = dr_rule_create_rule_root(matcher, value, num_actions, actions);
 	else
-		rule = dr_rule_create_rule(matcher, value, num_actions, actions);
+		rule = dr_rule_create_rule(matcher, value, num_actions, actions,
+					   NULL);
 
 	if (!rule)
 		atomic_fetch_sub(&matcher->refcount, 1);
@@ -1485,3 +2185,148 @@ int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule)
 		atomic_fetch_sub(&matcher->refcount, 1);
 	return ret;
 }
+
+/* Bound the time other rule updates wait for a bulk */
+#define DR_RULE_BULK_CHUNK	512
+
+static int dr_rule_create_bulk_chunk(struct mlx5dv_dr_matcher *matcher,
+				     struct mlx5dv_dr_rule_bulk_entry *entries,
+				     size_t num_entries)
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct dr_rule_bulk bulk;
+	int ret = 0;
+	size_t i;
+
+	dr_rule_bulk_init(&bulk, dmn);
+
+	for (i = 0; i < num_entries; i++) {
+		atomic_fetch_add(&matcher->refcount, 1);
+		entries[i].rule = dr_rule_create_rule(matcher, entries[i].value,
+						      entries[i].num_actions,
+						      entries[i].actions,
+						      &bulk);
+		if (!entries[i].rule) {
+			atomic_fetch_sub(&matcher->refcount, 1);
+			ret = errno;
+			break;
+		}
+	}
+
+	if (dr_rule_bulk_unlock(&bulk) && !ret)
+		ret = errno;
+
+	pthread_spin_lock(&dmn->debug_lock);
+	list_append_list(&matcher->rule_list, &bulk.rule_list);
+	pthread_spin_unlock(&dmn->debug_lock);
+
+	return ret;
+}
+
+int mlx5dv_dr_rule_create_bulk(struct mlx5dv_dr_matcher *matcher,
+			       struct mlx5dv_dr_rule_bulk_entry *entries,
+			       size_t num_entries)
+{
+	size_t i, num;
+	int ret;
+
+	for (i = 0; i < num_entries; i++)
+		entries[i].rule = NULL;
+
+	if (dr_is_root_table(matcher->tbl)) {
+		for (i = 0; i < num_entries; i++) {
+			entries[i].rule =
+				mlx5dv_dr_rule_create(matcher, entries[i].value,
+						      entries[i].num_actions,
+						      entries[i].actions);
+			if (!entries[i].rule)
+				return errno;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < num_entries; i += num) {
+		num = min_t(size_t, num_entries - i, DR_RULE_BULK_CHUNK);
+		ret = dr_rule_create_bulk_chunk(matcher, entries + i, num);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Destroy the rules of one domain, as mlx5dv_dr_rule_destroy() does.  On
+ * failure the failing rule is left out of its matcher like a single
+ * destroy leaves it, and the rules after it are put back.
+ */
+static int dr_rule_destroy_bulk_chunk(struct mlx5dv_dr_rule *rules[],
+				      size_t num_rules)
+{
+	struct mlx5dv_dr_domain *dmn = rules[0]->matcher->tbl->dmn;
+	struct mlx5dv_dr_matcher *matcher;
+	struct dr_rule_bulk bulk;
+	int ret = 0;
+	size_t i, j;
+
+	dr_rule_bulk_init(&bulk, dmn);
+
+	pthread_spin_lock(&dmn->debug_lock);
+	for (i = 0; i < num_rules; i++)
+		list_del(&rules[i]->rule_list);
+	pthread_spin_unlock(&dmn->debug_lock);
+
+	for (i = 0; i < num_rules; i++) {
+		matcher = rules[i]->matcher;
+		ret = dr_rule_destroy_rule_members(rules[i], &bulk);
+		if (ret)
+			break;
+		atomic_fetch_sub(&matcher->refcount, 1);
+	}
+
+	dr_rule_bulk_unlock(&bulk);
+
+	if (ret && i + 1 < num_rules) {
+		pthread_spin_lock(&dmn->debug_lock);
+		for (j = i + 1; j < num_rules; j++)
+			list_add_tail(&rules[j]->matcher->rule_list,
+				      &rules[j]->rule_list);
+		pthread_spin_unlock(&dmn->debug_lock);
+	}
+
+	return ret;
+}
+
+int mlx5dv_dr_rule_destroy_bulk(struct mlx5dv_dr_rule *rules[],
+				size_t num_rules)
+{
+	struct mlx5dv_dr_table *tbl;
+	struct mlx5dv_dr_domain *dmn;
+	size_t i, j;
+	int ret;
+
+	for (i = 0; i < num_rules; i = j) {
+		dmn = rules[i]->matcher->tbl->dmn;
+		j = i + 1;
+
+		if (dr_is_root_table(rules[i]->matcher->tbl)) {
+			ret = mlx5dv_dr_rule_destroy(rules[i]);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		while (j < num_rules && j - i < DR_RULE_BULK_CHUNK) {
+			tbl = rules[j]->matcher->tbl;
+			if (tbl->dmn != dmn || dr_is_root_table(tbl))
+				break;
+			j++;
+		}
+
+		ret = dr_rule_destroy_bulk_chunk(rules + i, j - i);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
@@ -36,6 +36,9 @@
 #include <util/mmio.h>
 #include "mlx5dv_dr.h"
 #include "wqe.h"
+#ifdef MLX5_DR_EMU
+#include "dr_emu.h"
+#endif
 
 #define QUEUE_SIZE		128
 #define SIGNAL_PER_DIV_QUEUE	16
@@ -387,14 +390,16 @@ static void dr_set_raddr_seg(struct mlx5_wqe_raddr_seg *rseg,
 
 static void dr_post_send_db(struct dr_qp *dr_qp, int size, void *ctrl)
 {
-	dr_qp->sq.head += 2; /* RDMA_WRITE + RDMA_READ */
-
 	/*
 	 * Make sure that descriptors are written before
 	 * updating doorbell record and ringing the doorbell
 	 */
 	udma_to_device_barrier();
 	dr_qp->db[MLX5_SND_DBR] = htobe32(dr_qp->sq.cur_post & 0xffff);
+#ifdef MLX5_DR_EMU
+	dr_emu_ring_db(dr_qp->uar, *(__be64 *)ctrl);
+	return;
+#endif
 	if (dr_qp->nc_uar) {
 		udma_to_device_barrier();
 		mmio_write64_be((uint8_t *)dr_qp->uar->reg_addr, *(__be64 *)ctrl);
@@ -465,7 +470,7 @@ static void dr_set_ctrl_seg(struct mlx5_wqe_ctrl_seg *ctrl,
 
 static void dr_rdma_segments(struct dr_qp *dr_qp, uint64_t remote_addr,
 			     uint32_t rkey, struct dr_data_seg *data_seg,
-			     uint32_t opcode, int nreq)
+			     uint32_t opcode, int nreq, bool ring_db)
 {
 	struct mlx5_wqe_ctrl_seg *ctrl = NULL;
 	void *qend = dr_qp->sq.qend;
@@ -501,16 +506,27 @@ static void dr_rdma_segments(struct dr_qp *dr_qp, uint64_t remote_addr,
 	dr_qp->sq.wqe_head[idx] = dr_qp->sq.head + nreq;
 	dr_qp->sq.cur_post += DIV_ROUND_UP(size * 16, MLX5_SEND_WQE_BB);
 
-	if (nreq)
+	if (ring_db)
 		dr_post_send_db(dr_qp, size, ctrl);
 }
 
-static void dr_post_send(struct dr_qp *dr_qp, struct postsend_info *send_info)
+/*
+ * The doorbell may be left for a later post, the HW then picks up all the
+ * WQEs written so far with it.  It must not be skipped for a signaled WQE,
+ * dr_handle_pending_wc() waits for those completions.
+ */
+static void dr_post_send(struct dr_qp *dr_qp, struct postsend_info *send_info,
+			 bool ring_db)
 {
+	if ((send_info->write.send_flags | send_info->read.send_flags) &
+	    IBV_SEND_SIGNALED)
+		ring_db = true;
+
 	dr_rdma_segments(dr_qp, send_info->remote_addr, send_info->rkey,
-			 &send_info->write, MLX5_OPCODE_RDMA_WRITE, 0);
+			 &send_info->write, MLX5_OPCODE_RDMA_WRITE, 0, false);
 	dr_rdma_segments(dr_qp, send_info->remote_addr, send_info->rkey,
-			 &send_info->read, MLX5_OPCODE_RDMA_READ, 1);
+			 &send_info->read, MLX5_OPCODE_RDMA_READ, 1, ring_db);
+	dr_qp->sq.head += 2; /* RDMA_WRITE + RDMA_READ */
 }
 
 /*
@@ -622,19 +638,17 @@ static void dr_fill_data_segs(struct dr_send_ring *send_ring,
 		send_info->read.send_flags = 0;
 }
 
-static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
-				struct postsend_info *send_info,
-				int ring_idx)
+static int dr_postsend_icm_data_locked(struct mlx5dv_dr_domain *dmn,
+				       struct dr_send_ring *send_ring,
+				       struct postsend_info *send_info,
+				       bool ring_db)
 {
-	struct dr_send_ring *send_ring =
-		dmn->send_ring[ring_idx % DR_MAX_SEND_RINGS];
 	uint32_t buff_offset;
 	int ret;
 
-	pthread_spin_lock(&send_ring->lock);
 	ret = dr_handle_pending_wc(dmn, send_ring);
 	if (ret)
-		goto out_unlock;
+		return ret;
 
 	if (send_info->write.length > dmn->info.max_inline_size) {
 		buff_offset = (send_ring->tx_head & (send_ring->signal_th - 1)) *
@@ -649,10 +663,23 @@ static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
 
 	send_ring->tx_head++;
 	dr_fill_data_segs(send_ring, send_info);
-	dr_post_send(send_ring->qp, send_info);
+	dr_post_send(send_ring->qp, send_info, ring_db);
+
+	return 0;
+}
+
+static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
+				struct postsend_info *send_info,
+				int ring_idx)
+{
+	struct dr_send_ring *send_ring =
+		dmn->send_ring[ring_idx % DR_MAX_SEND_RINGS];
+	int ret;
 
-out_unlock:
+	pthread_spin_lock(&send_ring->lock);
+	ret = dr_postsend_icm_data_locked(dmn, send_ring, send_info, true);
 	pthread_spin_unlock(&send_ring->lock);
+
 	return ret;
 }
 
@@ -685,6 +712,20 @@ static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
 	return 0;
 }
 
+static void dr_send_fill_ste_info(struct mlx5dv_dr_domain *dmn,
+				  struct dr_ste *ste, uint8_t *data,
+				  uint16_t size, uint16_t offset,
+				  struct postsend_info *send_info)
+{
+	dr_ste_prepare_for_postsend(dmn->ste_ctx, data, size);
+
+	send_info->write.addr    = (uintptr_t) data;
+	send_info->write.length  = size;
+	send_info->write.lkey    = 0;
+	send_info->remote_addr   = dr_ste_get_mr_addr(ste) + offset;
+	send_info->rkey          = ste->htbl->chunk->rkey;
+}
+
 /*
  * dr_postsend_ste: write size bytes into offset from the hw icm.
  *
@@ -704,49 +745,96 @@ int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
 {
 	struct postsend_info send_info = {};
 
-	dr_ste_prepare_for_postsend(dmn->ste_ctx, data, size);
-
-	send_info.write.addr    = (uintptr_t) data;
-	send_info.write.length  = size;
-	send_info.write.lkey    = 0;
-	send_info.remote_addr   = dr_ste_get_mr_addr(ste) + offset;
-	send_info.rkey          = ste->htbl->chunk->rkey;
+	dr_send_fill_ste_info(dmn, ste, data, size, offset, &send_info);
 
 	return dr_postsend_icm_data(dmn, &send_info, ring_idx);
 }
 
-int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
-			  uint8_t *formated_ste, uint8_t *mask,
-			  uint8_t send_ring_idx)
+/*
+ * dr_send_postsend_ste_list: write a list of dr_ste_send_info to the hw
+ * icm, in list order, under a single send ring lock.  The doorbell is rung
+ * for signaled WQEs and after the last entry only.  All the entries are
+ * freed, also on failure.
+ *
+ * Return: 0 on success.
+ */
+int dr_send_postsend_ste_list(struct mlx5dv_dr_domain *dmn,
+			      struct list_head *send_ste_list,
+			      uint8_t ring_idx)
+{
+	struct dr_send_ring *send_ring =
+		dmn->send_ring[ring_idx % DR_MAX_SEND_RINGS];
+	struct dr_ste_send_info *ste_info, *tmp_ste_info;
+	struct postsend_info send_info;
+	int ret = 0;
+
+	pthread_spin_lock(&send_ring->lock);
+	list_for_each_safe(send_ste_list, ste_info, tmp_ste_info, send_list) {
+		list_del(&ste_info->send_list);
+
+		if (!ret) {
+			memset(&send_info, 0, sizeof(send_info));
+			dr_send_fill_ste_info(dmn, ste_info->ste,
+					      ste_info->data, ste_info->size,
+					      ste_info->offset, &send_info);
+			ret = dr_postsend_icm_data_locked(dmn, send_ring,
+							  &send_info,
+							  list_empty(send_ste_list));
+		}
+
+		free(ste_info);
+	}
+	pthread_spin_unlock(&send_ring->lock);
+
+	return ret;
+}
+
+/*
+ * dr_send_postsend_htbl_range: write num entries of htbl starting at first,
+ * the unused entries as formated_ste and the used ones from their hw_ste
+ * plus the mask on legacy tables.
+ *
+ * Return: 0 on success.
+ */
+int dr_send_postsend_htbl_range(struct mlx5dv_dr_domain *dmn,
+				struct dr_ste_htbl *htbl,
+				uint8_t *formated_ste, uint8_t *mask,
+				uint32_t first, uint32_t num,
+				uint8_t send_ring_idx)
 {
 	bool legacy_htbl = htbl->type == DR_STE_HTBL_TYPE_LEGACY;
-	uint32_t byte_size = htbl->chunk->byte_size;
-	int i, j, num_stes_per_iter, iterations;
+	uint32_t max_stes = dmn->info.max_send_size / DR_STE_SIZE;
 	uint8_t ste_sz = htbl->ste_arr->size;
+	uint8_t init_ste[DR_STE_SIZE];
+	uint32_t i, j, num_stes;
 	uint8_t *data;
-	int ret;
+	int ret = 0;
 
-	ret = dr_get_tbl_copy_details(dmn, htbl, &data, &byte_size,
-				      &iterations, &num_stes_per_iter);
-	if (ret)
-		return ret;
+	data = calloc(min_t(uint32_t, num, max_stes), DR_STE_SIZE);
+	if (!data) {
+		errno = ENOMEM;
+		return errno;
+	}
 
-	dr_ste_prepare_for_postsend(dmn->ste_ctx, formated_ste, DR_STE_SIZE);
+	/* The caller's STE is left in SW format, it may write more ranges */
+	memcpy(init_ste, formated_ste, DR_STE_SIZE);
+	dr_ste_prepare_for_postsend(dmn->ste_ctx, init_ste, DR_STE_SIZE);
 
-	/* Send the data iteration times */
-	for (i = 0; i < iterations; i++) {
-		uint32_t ste_index = i * (byte_size / DR_STE_SIZE);
+	/* Send the data in chunks of up to max_send_size */
+	for (i = first; i < first + num; i += num_stes) {
 		struct postsend_info send_info = {};
 
+		num_stes = min_t(uint32_t, first + num - i, max_stes);
+
 		/* Copy all ste's on the data buffer, need to add the bit_mask */
-		for (j = 0; j < num_stes_per_iter; j++) {
-			if (dr_ste_is_not_used(&htbl->ste_arr[ste_index + j])) {
+		for (j = 0; j < num_stes; j++) {
+			if (dr_ste_is_not_used(&htbl->ste_arr[i + j])) {
 				memcpy(data + (j * DR_STE_SIZE),
-				       formated_ste, DR_STE_SIZE);
+				       init_ste, DR_STE_SIZE);
 			} else {
 				/* Copy data */
 				memcpy(data + (j * DR_STE_SIZE),
-				       htbl->ste_arr[ste_index + j].hw_ste,
+				       htbl->ste_arr[i + j].hw_ste,
 				       ste_sz);
 				/* Copy bit_mask on legacy tables */
 				if (legacy_htbl)
@@ -761,21 +849,29 @@ int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl
 		}
 
 		send_info.write.addr	= (uintptr_t) data;
-		send_info.write.length	= byte_size;
+		send_info.write.length	= num_stes * DR_STE_SIZE;
 		send_info.write.lkey	= 0;
-		send_info.remote_addr	= dr_ste_get_mr_addr(htbl->ste_arr + ste_index);
+		send_info.remote_addr	= dr_ste_get_mr_addr(htbl->ste_arr + i);
 		send_info.rkey		= htbl->chunk->rkey;
 
 		ret = dr_postsend_icm_data(dmn, &send_info, send_ring_idx);
 		if (ret)
-			goto out_free;
+			break;
 	}
 
-out_free:
 	free(data);
 	return ret;
 }
 
+int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
+			  uint8_t *formated_ste, uint8_t *mask,
+			  uint8_t send_ring_idx)
+{
+	return dr_send_postsend_htbl_range(dmn, htbl, formated_ste, mask, 0,
+					   htbl->chunk->num_of_entries,
+					   send_ring_idx);
+}
+
 /* Initialize htble with default STEs */
 int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 				   struct dr_ste_htbl *htbl,
@@ -41,7 +41,7 @@ struct dr_hw_ste_format {
 uint32_t dr_ste_calc_hash_index(uint8_t *hw_ste_p, struct dr_ste_htbl *htbl)
 {
 	struct dr_hw_ste_format *hw_ste = (struct dr_hw_ste_format *)hw_ste_p;
-	uint8_t masked[DR_STE_SIZE_TAG] = {};
+	uint8_t masked[DR_STE_SIZE_TAG];
 	uint32_t crc32, index;
 	uint8_t *p_masked;
 	uint16_t bit;
@@ -58,12 +58,9 @@ uint32_t dr_ste_calc_hash_index(uint8_t *hw_ste_p, struct dr_ste_htbl *htbl)
 
 		len = DR_STE_SIZE_TAG;
 		/* Mask tag using byte mask, bit per byte */
-		bit = 1 << (DR_STE_SIZE_TAG - 1);
 		for (i = 0; i < DR_STE_SIZE_TAG; i++) {
-			if (htbl->byte_mask & bit)
-				masked[i] = hw_ste->tag[i];
-
-			bit = bit >> 1;
+			bit = (htbl->byte_mask >> (DR_STE_SIZE_TAG - 1 - i)) & 1;
+			masked[i] = hw_ste->tag[i] & -bit;
 		}
 		p_masked = masked;
 	} else {
@@ -71,7 +68,7 @@ uint32_t dr_ste_calc_hash_index(uint8_t *hw_ste_p, struct dr_ste_htbl *htbl)
 		p_masked = hw_ste->tag;
 	}
 
-	crc32 = dr_crc32_slice8_calc(p_masked, len);
+	crc32 = dr_crc32_calc(p_masked, len);
 	index = crc32 % htbl->chunk->num_of_entries;
 
 	return index;
@@ -385,6 +382,10 @@ void dr_ste_free(struct dr_ste *ste,
 					 &send_ste_list, stats_tbl);
 	}
 
+	/* A copy of this miss list in the bigger table is now stale */
+	if (stats_tbl->rehash)
+		dr_rule_rehash_update(stats_tbl, first_ste - stats_tbl->ste_arr);
+
 	/* Update HW */
 	list_for_each_safe(&send_ste_list, cur_ste_info, tmp_ste_info, send_list) {
 		list_del(&cur_ste_info->send_list);
@@ -403,8 +404,17 @@ bool dr_ste_equal_tag(void *src, void *dst, uint8_t tag_size)
 {
 	struct dr_hw_ste_format *s_hw_ste = (struct dr_hw_ste_format *)src;
 	struct dr_hw_ste_format *d_hw_ste = (struct dr_hw_ste_format *)dst;
+	uint64_t s_val, d_val, diff = 0;
+	uint8_t i;
+
+	/* Tags are 16B or 32B, compare them a word at a time */
+	for (i = 0; i < tag_size; i += sizeof(s_val)) {
+		memcpy(&s_val, s_hw_ste->tag + i, sizeof(s_val));
+		memcpy(&d_val, d_hw_ste->tag + i, sizeof(d_val));
+		diff |= s_val ^ d_val;
+	}
 
-	return !memcmp(s_hw_ste->tag, d_hw_ste->tag, tag_size);
+	return !diff;
 }
 
 void dr_ste_set_hit_addr_by_next_htbl(struct dr_ste_ctx *ste_ctx,
@@ -514,15 +524,41 @@ free_table:
 	return ENOENT;
 }
 
-struct dr_ste_htbl *dr_ste_htbl_alloc(struct dr_icm_pool *pool,
-				      enum dr_icm_chunk_size chunk_size,
-				      enum dr_ste_htbl_type type,
-				      uint16_t lu_type, uint16_t byte_mask)
+/*
+ * Set up the entries first..first + num - 1 of a table from
+ * dr_ste_htbl_alloc_lazy(), before they are used.  Until then they are only
+ * known to be unused.
+ */
+void dr_ste_htbl_init_entries(struct dr_ste_htbl *htbl, uint32_t first,
+			      uint32_t num)
+{
+	uint8_t ste_size;
+	uint32_t i;
+
+	if (htbl->type == DR_STE_HTBL_TYPE_LEGACY)
+		ste_size = DR_STE_SIZE_REDUCED;
+	else
+		ste_size = DR_STE_SIZE;
+
+	for (i = first; i < first + num; i++) {
+		struct dr_ste *ste = &htbl->ste_arr[i];
+
+		ste->hw_ste = htbl->hw_ste_arr + i * ste_size;
+		ste->htbl = htbl;
+		ste->size = ste_size;
+		atomic_init(&ste->refcount, 0);
+		list_node_init(&ste->miss_list_node);
+		list_head_init(&htbl->miss_list[i]);
+	}
+}
+
+struct dr_ste_htbl *dr_ste_htbl_alloc_lazy(struct dr_icm_pool *pool,
+					   enum dr_icm_chunk_size chunk_size,
+					   enum dr_ste_htbl_type type,
+					   uint16_t lu_type, uint16_t byte_mask)
 {
 	struct dr_icm_chunk *chunk;
 	struct dr_ste_htbl *htbl;
-	uint8_t ste_size;
-	int i;
 
 	htbl = calloc(1, sizeof(struct dr_ste_htbl));
 	if (!htbl) {
@@ -534,11 +570,6 @@ struct dr_ste_htbl *dr_ste_htbl_alloc(struct dr_icm_pool *pool,
 	if (!chunk)
 		goto out_free_htbl;
 
-	if (type == DR_STE_HTBL_TYPE_LEGACY)
-		ste_size = DR_STE_SIZE_REDUCED;
-	else
-		ste_size = DR_STE_SIZE;
-
 	htbl->type = type;
 	htbl->chunk = chunk;
 	htbl->lu_type = lu_type;
@@ -547,18 +578,6 @@ struct dr_ste_htbl *dr_ste_htbl_alloc(struct dr_icm_pool *pool,
 	htbl->hw_ste_arr = chunk->hw_ste_arr;
 	htbl->miss_list = chunk->miss_list;
 	atomic_init(&htbl->refcount, 0);
-
-	for (i = 0; i < chunk->num_of_entries; i++) {
-		struct dr_ste *ste = &htbl->ste_arr[i];
-
-		ste->hw_ste = htbl->hw_ste_arr + i * ste_size;
-		ste->htbl = htbl;
-		ste->size = ste_size;
-		atomic_init(&ste->refcount, 0);
-		list_node_init(&ste->miss_list_node);
-		list_head_init(&htbl->miss_list[i]);
-	}
-
 	htbl->chunk_size = chunk_size;
 
 	return htbl;
@@ -568,6 +587,21 @@ out_free_htbl:
 	return NULL;
 }
 
+struct dr_ste_htbl *dr_ste_htbl_alloc(struct dr_icm_pool *pool,
+				      enum dr_icm_chunk_size chunk_size,
+				      enum dr_ste_htbl_type type,
+				      uint16_t lu_type, uint16_t byte_mask)
+{
+	struct dr_ste_htbl *htbl;
+
+	htbl = dr_ste_htbl_alloc_lazy(pool, chunk_size, type, lu_type,
+				      byte_mask);
+	if (htbl)
+		dr_ste_htbl_init_entries(htbl, 0, htbl->chunk->num_of_entries);
+
+	return htbl;
+}
+
 int dr_ste_htbl_free(struct dr_ste_htbl *htbl)
 {
 	if (atomic_load(&htbl->refcount))
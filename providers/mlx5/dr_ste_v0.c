@@ -325,6 +325,18 @@ static void dr_ste_v0_set_hit_addr(uint8_t *hw_ste_p, uint64_t icm_addr, uint32_
 	DR_STE_SET(general, hw_ste_p, next_table_base_31_5_size, index);
 }
 
+static uint64_t dr_ste_v0_get_hit_addr(uint8_t *hw_ste_p, uint32_t *ht_size)
+{
+	uint64_t index =
+		(DR_STE_GET(general, hw_ste_p, next_table_base_31_5_size) |
+		 (uint64_t)DR_STE_GET(general, hw_ste_p, next_table_base_39_32_size) << 27);
+
+	/* The table size is the lowest set bit, the base is size aligned */
+	*ht_size = index & -index;
+
+	return (index & ~(uint64_t)*ht_size) << 5;
+}
+
 static void dr_ste_v0_init_full(uint8_t *hw_ste_p, uint16_t lu_type,
 				enum dr_ste_v0_entry_type entry_type,
 				uint16_t gvmi)
@@ -1902,6 +1914,7 @@ static struct dr_ste_ctx ste_ctx_v0 = {
 	.set_miss_addr			= &dr_ste_v0_set_miss_addr,
 	.get_miss_addr			= &dr_ste_v0_get_miss_addr,
 	.set_hit_addr			= &dr_ste_v0_set_hit_addr,
+	.get_hit_addr			= &dr_ste_v0_get_hit_addr,
 	.set_byte_mask			= &dr_ste_v0_set_byte_mask,
 	.get_byte_mask			= &dr_ste_v0_get_byte_mask,
 	.set_ctrl_always_hit_htbl	= &dr_ste_v0_set_ctrl_always_hit_htbl,
@@ -381,6 +381,18 @@ static void dr_ste_v1_set_hit_addr(uint8_t *hw_ste_p, uint64_t icm_addr, uint32_
 	DR_STE_SET(match_bwc_v1, hw_ste_p, next_table_base_31_5_size, index);
 }
 
+static uint64_t dr_ste_v1_get_hit_addr(uint8_t *hw_ste_p, uint32_t *ht_size)
+{
+	uint64_t index =
+		(DR_STE_GET(match_bwc_v1, hw_ste_p, next_table_base_31_5_size) |
+		 (uint64_t)DR_STE_GET(match_bwc_v1, hw_ste_p, next_table_base_39_32_size) << 27);
+
+	/* The table size is the lowest set bit, the base is size aligned */
+	*ht_size = index & -index;
+
+	return (index & ~(uint64_t)*ht_size) << 5;
+}
+
 static bool dr_ste_v1_is_match_ste(uint16_t lu_type)
 {
 	return ((lu_type >> 8) == DR_STE_V1_TYPE_MATCH);
@@ -3109,6 +3121,7 @@ static struct dr_ste_ctx ste_ctx_v1 = {
 	.set_miss_addr			= &dr_ste_v1_set_miss_addr,
 	.get_miss_addr			= &dr_ste_v1_get_miss_addr,
 	.set_hit_addr			= &dr_ste_v1_set_hit_addr,
+	.get_hit_addr			= &dr_ste_v1_get_hit_addr,
 	.set_byte_mask			= &dr_ste_v1_set_byte_mask,
 	.get_byte_mask			= &dr_ste_v1_get_byte_mask,
 	.set_ctrl_always_hit_htbl	= &dr_ste_v1_set_ctrl_always_hit_htbl,
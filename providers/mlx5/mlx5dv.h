@@ -1948,6 +1948,20 @@ mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 
 int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule);
 
+struct mlx5dv_dr_rule_bulk_entry {
+	struct mlx5dv_flow_match_parameters *value;
+	size_t num_actions;
+	struct mlx5dv_dr_action **actions;
+	struct mlx5dv_dr_rule *rule; /* out */
+};
+
+int mlx5dv_dr_rule_create_bulk(struct mlx5dv_dr_matcher *matcher,
+			       struct mlx5dv_dr_rule_bulk_entry *entries,
+			       size_t num_entries);
+
+int mlx5dv_dr_rule_destroy_bulk(struct mlx5dv_dr_rule *rules[],
+				size_t num_rules);
+
 enum mlx5dv_dr_action_flags {
 	MLX5DV_DR_ACTION_FLAGS_ROOT_LEVEL	= 1 << 0,
 };
@@ -2066,6 +2080,13 @@ int mlx5dv_dump_dr_table(FILE *fout, struct mlx5dv_dr_table *table);
 int mlx5dv_dump_dr_matcher(FILE *fout, struct mlx5dv_dr_matcher *matcher);
 int mlx5dv_dump_dr_rule(FILE *fout, struct mlx5dv_dr_rule *rule);
 
+enum mlx5dv_dump_dr_flags {
+	MLX5DV_DUMP_DR_FLAGS_BINARY = 1 << 0,
+};
+
+int mlx5dv_dump_dr_domain_ex(FILE *fout, struct mlx5dv_dr_domain *domain,
+			     uint32_t flags);
+
 struct mlx5dv_pp {
 	uint16_t index;
 };
@@ -187,6 +187,7 @@ struct dr_devx_caps;
 struct dr_rule_rx_tx;
 struct dr_matcher_rx_tx;
 struct dr_ste_ctx;
+struct dr_rule_rehash;
 
 struct dr_data_seg {
 	uint64_t	addr;
@@ -253,6 +254,9 @@ struct dr_ste_htbl {
 	struct dr_ste		*pointing_ste;
 
 	struct dr_ste_htbl_ctrl ctrl;
+
+	/* set while the table is being migrated into a bigger one */
+	struct dr_rule_rehash	*rehash;
 };
 
 struct dr_ste_send_info {
@@ -296,6 +300,12 @@ struct dr_ste_htbl *dr_ste_htbl_alloc(struct dr_icm_pool *pool,
 				      enum dr_icm_chunk_size chunk_size,
 				      enum dr_ste_htbl_type type,
 				      uint16_t lu_type, uint16_t byte_mask);
+struct dr_ste_htbl *dr_ste_htbl_alloc_lazy(struct dr_icm_pool *pool,
+					   enum dr_icm_chunk_size chunk_size,
+					   enum dr_ste_htbl_type type,
+					   uint16_t lu_type, uint16_t byte_mask);
+void dr_ste_htbl_init_entries(struct dr_ste_htbl *htbl, uint32_t first,
+			      uint32_t num);
 int dr_ste_htbl_free(struct dr_ste_htbl *htbl);
 
 static inline void dr_htbl_put(struct dr_ste_htbl *htbl)
@@ -1063,6 +1073,8 @@ struct dr_matcher_rx_tx {
 	uint64_t			default_icm_addr;
 	struct dr_table_rx_tx		*nic_tbl;
 	bool				fixed_size;
+	/* hash tables being rehashed, see dr_rule_rehash_step() */
+	struct list_head		rehash_list;
 };
 
 struct mlx5dv_dr_matcher {
@@ -1222,18 +1234,26 @@ struct mlx5dv_dr_rule {
 	uint16_t		num_actions;
 };
 
+static inline void
+dr_rule_set_lock_index(struct dr_rule_rx_tx *nic_rule, uint8_t *hw_ste)
+{
+	struct dr_matcher_rx_tx *nic_matcher = nic_rule->nic_matcher;
+	uint32_t index;
+
+	if (nic_matcher->fixed_size && hw_ste) {
+		index = dr_ste_calc_hash_index(hw_ste, nic_matcher->s_htbl);
+		nic_rule->lock_index = index % NUM_OF_LOCKS;
+	}
+}
+
 static inline void
 dr_rule_lock(struct dr_rule_rx_tx *nic_rule, uint8_t *hw_ste)
 {
 	struct dr_matcher_rx_tx *nic_matcher = nic_rule->nic_matcher;
 	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
-	uint32_t index;
 
 	if (nic_matcher->fixed_size) {
-		if (hw_ste) {
-			index = dr_ste_calc_hash_index(hw_ste, nic_matcher->s_htbl);
-			nic_rule->lock_index = index % NUM_OF_LOCKS;
-		}
+		dr_rule_set_lock_index(nic_rule, hw_ste);
 		pthread_spin_lock(&nic_dmn->locks[nic_rule->lock_index]);
 	} else {
 		pthread_spin_lock(&nic_dmn->locks[0]);
@@ -1255,13 +1275,19 @@ dr_rule_unlock(struct dr_rule_rx_tx *nic_rule)
 void dr_rule_set_last_member(struct dr_rule_rx_tx *nic_rule,
 			     struct dr_ste *ste,
 			     bool force);
+void dr_rule_rehash_update(struct dr_ste_htbl *htbl, uint32_t index);
+void dr_rule_rehash_abort_all(struct dr_matcher_rx_tx *nic_matcher);
 
 void dr_rule_get_reverse_rule_members(struct dr_ste **ste_arr,
 				      struct dr_ste *curr_ste,
 				      int *num_of_stes);
 
+struct dr_icm_cache;
+
 struct dr_icm_chunk {
 	struct dr_icm_buddy_mem *buddy_mem;
+	/* The per thread cache it was allocated from, its lists hold it */
+	struct dr_icm_cache	*cache;
 	struct list_node	chunk_list;
 	uint32_t		rkey;
 	uint32_t		num_of_entries;
@@ -1476,6 +1502,9 @@ void dr_ste_copy_param(uint8_t match_criteria,
 
 void dr_crc32_init_table(void);
 uint32_t dr_crc32_slice8_calc(const void *input_data, size_t length);
+uint32_t dr_crc32_calc(const void *input_data, size_t length);
+void dr_crc32_calc_batch(const void *input_data, size_t length, size_t stride,
+			 uint32_t *crc, uint32_t num);
 
 struct dr_wq {
 	unsigned	*wqe_head;
@@ -1544,9 +1573,17 @@ bool dr_send_allow_fl(struct dr_devx_caps *caps);
 int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
 			 uint8_t *data, uint16_t size, uint16_t offset,
 			 uint8_t ring_idx);
+int dr_send_postsend_ste_list(struct mlx5dv_dr_domain *dmn,
+			      struct list_head *send_ste_list,
+			      uint8_t ring_idx);
 int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
 			  uint8_t *formated_ste, uint8_t *mask,
 			  uint8_t send_ring_idx);
+int dr_send_postsend_htbl_range(struct mlx5dv_dr_domain *dmn,
+				struct dr_ste_htbl *htbl,
+				uint8_t *formated_ste, uint8_t *mask,
+				uint32_t first, uint32_t num,
+				uint8_t send_ring_idx);
 int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 				   struct dr_ste_htbl *htbl,
 				   uint8_t *ste_init_data,
@@ -1566,15 +1603,9 @@ struct dr_icm_buddy_mem {
 	struct dr_icm_mr	*icm_mr;
 	struct dr_icm_pool	*pool;
 
-	/* This is the list of used chunks. HW may be accessing this memory */
-	struct list_head	used_list;
+	/* Memory of the chunks taken from this buddy and not given back yet */
 	size_t			used_memory;
 
-	/* hardware may be accessing this memory but at some future,
-	 * undetermined time, it might cease to do so.
-	 * sync_ste command sets them free.
-	 */
-	struct list_head	hot_list;
 	/* HW STE cache entry size */
 	uint8_t                 hw_ste_sz;
 };
@@ -0,0 +1,118 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * STE hash CRC: dr_crc32_calc() and dr_crc32_calc_batch(), which use the CPU
+ * CRC instructions when there are, must match the slicing-by-8 tables for
+ * every length.  Then the three are timed on STE tag sized buffers.
+ */
+#include <config.h>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../mlx5dv_dr.h"
+
+#define NUM_TAGS 4096
+#define MAX_LEN 256
+
+static uint8_t bufs[NUM_TAGS][MAX_LEN];
+static uint32_t crcs[NUM_TAGS];
+static volatile uint32_t sink;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int verify(void)
+{
+	uint32_t len, i, ref;
+
+	for (len = 0; len <= MAX_LEN; len++) {
+		dr_crc32_calc_batch(bufs, len, MAX_LEN, crcs, NUM_TAGS);
+		for (i = 0; i < NUM_TAGS; i++) {
+			ref = dr_crc32_slice8_calc(bufs[i], len);
+			if (dr_crc32_calc(bufs[i], len) != ref ||
+			    crcs[i] != ref) {
+				fprintf(stderr,
+					"CRC mismatch, length %u buffer %u\n",
+					len, i);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void bench(const char *name, unsigned int iters, size_t len,
+		  uint32_t (*calc)(const void *, size_t))
+{
+	unsigned int i, j;
+	uint32_t sum = 0;
+	double t;
+
+	t = now_sec();
+	for (i = 0; i < iters; i++) {
+		if (calc) {
+			for (j = 0; j < NUM_TAGS; j++)
+				sum += calc(bufs[j], len);
+		} else {
+			dr_crc32_calc_batch(bufs, len, MAX_LEN, crcs,
+					    NUM_TAGS);
+			sum += crcs[i % NUM_TAGS];
+		}
+	}
+	t = now_sec() - t;
+	sink = sum;
+
+	printf("%-8s %2zuB %8.2f ns/tag %10.2f M tags/s\n", name, len,
+	       t * 1e9 / ((double)iters * NUM_TAGS),
+	       (double)iters * NUM_TAGS / t / 1e6);
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-n iterations]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t tag_len[] = {
+		DR_STE_SIZE_TAG, DR_STE_SIZE_MATCH_TAG,
+	};
+	unsigned int iters = 1000;
+	unsigned int i, j;
+	int op;
+
+	while ((op = getopt(argc, argv, "n:h")) != -1) {
+		switch (op) {
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return op == 'h' ? 0 : 1;
+		}
+	}
+
+	srand(1);
+	for (i = 0; i < NUM_TAGS; i++)
+		for (j = 0; j < MAX_LEN; j++)
+			bufs[i][j] = rand();
+
+	dr_crc32_init_table();
+	if (verify())
+		return 1;
+
+	for (i = 0; i < sizeof(tag_len) / sizeof(tag_len[0]); i++) {
+		bench("tables", iters, tag_len[i], dr_crc32_slice8_calc);
+		bench("calc", iters, tag_len[i], dr_crc32_calc);
+		bench("batch", iters, tag_len[i], NULL);
+	}
+	return 0;
+}
@@ -0,0 +1,201 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * ICM chunk allocation rate: the buddy allocator alone, then the STE ICM
+ * pool of a domain on the in-memory device of dr_emu.c with several threads
+ * allocating and freeing at once.  The chunk sizes follow rule insertion,
+ * mostly single STEs with some small hash tables.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dr_emu.h"
+
+#define WINDOW 64
+#define MAX_THREADS 64
+
+static const enum dr_icm_chunk_size sizes[] = {
+	DR_CHUNK_SIZE_1, DR_CHUNK_SIZE_1, DR_CHUNK_SIZE_1, DR_CHUNK_SIZE_1,
+	DR_CHUNK_SIZE_1, DR_CHUNK_SIZE_4, DR_CHUNK_SIZE_1, DR_CHUNK_SIZE_16,
+};
+
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+struct thread_arg {
+	struct dr_icm_pool *pool;
+	unsigned int iters;
+	pthread_barrier_t *barrier;
+	int ret;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_buddy(unsigned int iters, double *t)
+{
+	struct dr_icm_buddy_mem buddy = {};
+	int seg[WINDOW];
+	unsigned int i, j;
+
+	if (dr_buddy_init(&buddy, DR_CHUNK_SIZE_1024K))
+		return -1;
+
+	*t = now_sec();
+	for (i = 0; i < iters; i++) {
+		for (j = 0; j < WINDOW; j++) {
+			seg[j] = dr_buddy_alloc_mem(&buddy, sizes[j % NUM_SIZES]);
+			if (seg[j] == -1) {
+				fprintf(stderr, "dr_buddy_alloc_mem failed\n");
+				return -1;
+			}
+		}
+		for (j = 0; j < WINDOW; j++)
+			dr_buddy_free_mem(&buddy, seg[j], sizes[j % NUM_SIZES]);
+	}
+	*t = now_sec() - *t;
+
+	dr_buddy_cleanup(&buddy);
+	return 0;
+}
+
+static void *pool_thread(void *arg)
+{
+	struct dr_icm_chunk *chunk[WINDOW];
+	struct thread_arg *ta = arg;
+	unsigned int i, j;
+
+	pthread_barrier_wait(ta->barrier);
+	for (i = 0; i < ta->iters; i++) {
+		for (j = 0; j < WINDOW; j++) {
+			chunk[j] = dr_icm_alloc_chunk(ta->pool,
+						      sizes[j % NUM_SIZES]);
+			if (!chunk[j]) {
+				ta->ret = errno;
+				return NULL;
+			}
+		}
+		for (j = 0; j < WINDOW; j++)
+			dr_icm_free_chunk(chunk[j]);
+	}
+	return NULL;
+}
+
+static int bench_pool(struct mlx5dv_dr_domain *dmn, unsigned int nthreads,
+		      unsigned int iters, double *t)
+{
+	struct thread_arg ta[MAX_THREADS] = {};
+	pthread_t thread[MAX_THREADS];
+	pthread_barrier_t barrier;
+	unsigned int i;
+	int ret = 0;
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		ta[i].pool = dmn->ste_icm_pool;
+		ta[i].iters = iters;
+		ta[i].barrier = &barrier;
+		if (pthread_create(&thread[i], NULL, pool_thread, &ta[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	*t = now_sec();
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(thread[i], NULL);
+		if (ta[i].ret) {
+			fprintf(stderr, "dr_icm_alloc_chunk: %s\n",
+				strerror(ta[i].ret));
+			ret = -1;
+		}
+	}
+	*t = now_sec() - *t;
+	pthread_barrier_destroy(&barrier);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-n iterations] [-t max threads]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct dr_emu_attr attr = {
+		.sw_format_ver = MLX5_HW_CONNECTX_5,
+	};
+	unsigned int nthreads = 4, iters = 20000;
+	struct mlx5dv_dr_domain *dmn;
+	struct ibv_context *ctx;
+	unsigned int n;
+	int ret = 1;
+	double t;
+	int op;
+
+	while ((op = getopt(argc, argv, "n:t:h")) != -1) {
+		switch (op) {
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return op == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!nthreads || nthreads > MAX_THREADS) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (bench_buddy(iters, &t))
+		return 1;
+	printf("%-12s %10.1f ns/chunk %10.2f M chunks/s\n", "buddy",
+	       t * 1e9 / ((double)iters * WINDOW),
+	       iters * WINDOW / t / 1e6);
+
+	ctx = dr_emu_open(&attr);
+	if (!ctx) {
+		perror("dr_emu_open");
+		return 1;
+	}
+
+	dmn = mlx5dv_dr_domain_create(ctx, MLX5DV_DR_DOMAIN_TYPE_NIC_RX);
+	if (!dmn) {
+		perror("mlx5dv_dr_domain_create");
+		goto close_emu;
+	}
+
+	for (n = 1; n <= nthreads; n *= 2) {
+		if (bench_pool(dmn, n, iters, &t))
+			goto destroy_dmn;
+		printf("pool %2u thr %10.1f ns/chunk %10.2f M chunks/s\n", n,
+		       t * 1e9 / ((double)iters * WINDOW * n),
+		       (double)iters * WINDOW * n / t / 1e6);
+	}
+	ret = 0;
+
+destroy_dmn:
+	mlx5dv_dr_domain_destroy(dmn);
+close_emu:
+	if (dr_emu_close(ctx)) {
+		fprintf(stderr, "dr_emu_close: objects leaked\n");
+		ret = 1;
+	}
+	return ret;
+}
@@ -0,0 +1,361 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * SW steering rule insertion and deletion rate against the in-memory device
+ * of dr_emu.c.  Rules match an IPv4 TCP 5-tuple on a NIC RX table; every
+ * inserted tuple must then be found by walking the STEs written to ICM, and
+ * must be gone once its rule is destroyed.  With -b the rules are created
+ * and destroyed with the bulk calls, otherwise the latency of each insertion
+ * is recorded and its percentiles are reported.  With -d the domain is
+ * dumped once as CSV and once in binary, into <prefix>.csv and <prefix>.bin.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dr_emu.h"
+
+#define MATCH_SZ DEVX_ST_SZ_BYTES(dr_match_spec)
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_latency(double *lat, uint32_t n)
+{
+	static const double pct[] = { 50, 99, 99.9, 99.99 };
+	unsigned int i;
+
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	printf("insert latency:");
+	for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+		printf(" p%g %.2f us,", pct[i],
+		       lat[(uint32_t)((n - 1) * pct[i] / 100)] * 1e6);
+	printf(" max %.2f us\n", lat[n - 1] * 1e6);
+}
+
+static struct mlx5dv_flow_match_parameters *alloc_match(void)
+{
+	struct mlx5dv_flow_match_parameters *p;
+
+	p = calloc(1, sizeof(*p) + MATCH_SZ);
+	if (p)
+		p->match_sz = MATCH_SZ;
+	return p;
+}
+
+static void set_tuple(struct mlx5dv_flow_match_parameters *p, uint32_t i)
+{
+	void *spec = p->match_buf;
+
+	memset(spec, 0, MATCH_SZ);
+	DEVX_SET(dr_match_spec, spec, ip_version, 4);
+	DEVX_SET(dr_match_spec, spec, ip_protocol, 6);
+	DEVX_SET(dr_match_spec, spec, src_ip_31_0, 0x0a000000 | (i >> 8));
+	DEVX_SET(dr_match_spec, spec, dst_ip_31_0, 0xc0a80001);
+	DEVX_SET(dr_match_spec, spec, tcp_sport, 1024 + (i & 0xff));
+	DEVX_SET(dr_match_spec, spec, tcp_dport, 80);
+}
+
+static int create_rules(struct mlx5dv_dr_matcher *matcher,
+			struct mlx5dv_dr_action *drop,
+			struct mlx5dv_dr_rule **rules, uint32_t nrules,
+			uint32_t bulk)
+{
+	struct mlx5dv_dr_rule_bulk_entry *entries;
+	struct mlx5dv_flow_match_parameters **values;
+	uint32_t i, j, num;
+	int ret = 0;
+
+	entries = calloc(bulk, sizeof(*entries));
+	values = calloc(bulk, sizeof(*values));
+	if (!entries || !values) {
+		ret = ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < bulk; i++) {
+		values[i] = alloc_match();
+		if (!values[i]) {
+			ret = ENOMEM;
+			goto out;
+		}
+		entries[i].value = values[i];
+		entries[i].num_actions = 1;
+		entries[i].actions = &drop;
+	}
+
+	for (i = 0; i < nrules; i += num) {
+		num = nrules - i < bulk ? nrules - i : bulk;
+		for (j = 0; j < num; j++)
+			set_tuple(values[j], i + j);
+
+		ret = mlx5dv_dr_rule_create_bulk(matcher, entries, num);
+		for (j = 0; j < num; j++)
+			rules[i + j] = entries[j].rule;
+		if (ret)
+			break;
+	}
+
+out:
+	if (values)
+		for (i = 0; i < bulk; i++)
+			free(values[i]);
+	free(values);
+	free(entries);
+	return ret;
+}
+
+static int check_lookups(struct mlx5dv_dr_matcher *matcher,
+			 struct mlx5dv_flow_match_parameters *value,
+			 uint32_t first, uint32_t last, int expect)
+{
+	uint64_t icm_addr;
+	uint32_t i;
+	int ret;
+
+	for (i = first; i < last; i++) {
+		set_tuple(value, i);
+		ret = dr_emu_lookup(matcher, value, &icm_addr);
+		if (ret != expect) {
+			fprintf(stderr, "lookup of tuple %u: %s, expected %s\n",
+				i, ret ? strerror(ret) : "hit",
+				expect ? strerror(expect) : "hit");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int dump_domain(struct mlx5dv_dr_domain *dmn, const char *prefix,
+		       uint32_t flags)
+{
+	char path[4096];
+	double t;
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s.%s", prefix,
+		 flags & MLX5DV_DUMP_DR_FLAGS_BINARY ? "bin" : "csv");
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	t = now_sec();
+	ret = mlx5dv_dump_dr_domain_ex(f, dmn, flags);
+	if (fclose(f) && !ret)
+		ret = -errno;
+	t = now_sec() - t;
+	if (ret) {
+		fprintf(stderr, "mlx5dv_dump_dr_domain_ex: %s\n",
+			strerror(-ret));
+		return -1;
+	}
+
+	printf("%-8s %10.3f s %s\n", "dump", t, path);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-n rules] [-b bulk size] [-v steering format version (0 or 1)] [-d dump file prefix]\n",
+	       prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct mlx5dv_flow_match_parameters *mask, *value;
+	struct dr_emu_attr attr = {
+		.sw_format_ver = MLX5_HW_CONNECTX_5,
+	};
+	struct mlx5dv_dr_matcher *matcher;
+	struct mlx5dv_dr_action *drop;
+	struct mlx5dv_dr_domain *dmn;
+	struct mlx5dv_dr_rule **rules;
+	struct mlx5dv_dr_table *tbl;
+	struct dr_emu_stats stats;
+	struct ibv_context *ctx;
+	double t, t_ins, t_del;
+	double *lat = NULL;
+	unsigned int nrules = 100000;
+	unsigned int bulk = 0;
+	const char *dump = NULL;
+	int ret = 1;
+	uint32_t i;
+	int op;
+
+	while ((op = getopt(argc, argv, "n:b:v:d:h")) != -1) {
+		switch (op) {
+		case 'n':
+			nrules = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bulk = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			dump = optarg;
+			break;
+		case 'v':
+			attr.sw_format_ver = strtoul(optarg, NULL, 0) ?
+				MLX5_HW_CONNECTX_6DX : MLX5_HW_CONNECTX_5;
+			break;
+		default:
+			usage(argv[0]);
+			return op == 'h' ? 0 : 1;
+		}
+	}
+
+	rules = calloc(nrules, sizeof(*rules));
+	mask = alloc_match();
+	value = alloc_match();
+	if (!rules || !mask || !value)
+		return 1;
+
+	ctx = dr_emu_open(&attr);
+	if (!ctx) {
+		perror("dr_emu_open");
+		return 1;
+	}
+
+	dmn = mlx5dv_dr_domain_create(ctx, MLX5DV_DR_DOMAIN_TYPE_NIC_RX);
+	if (!dmn) {
+		perror("mlx5dv_dr_domain_create");
+		goto close_emu;
+	}
+
+	tbl = mlx5dv_dr_table_create(dmn, 1);
+	if (!tbl) {
+		perror("mlx5dv_dr_table_create");
+		goto destroy_dmn;
+	}
+
+	/* The mask ip_version selects the IPv4 builders */
+	DEVX_SET(dr_match_spec, mask->match_buf, ip_version, 4);
+	DEVX_SET(dr_match_spec, mask->match_buf, ip_protocol, 0xff);
+	DEVX_SET(dr_match_spec, mask->match_buf, src_ip_31_0, 0xffffffff);
+	DEVX_SET(dr_match_spec, mask->match_buf, dst_ip_31_0, 0xffffffff);
+	DEVX_SET(dr_match_spec, mask->match_buf, tcp_sport, 0xffff);
+	DEVX_SET(dr_match_spec, mask->match_buf, tcp_dport, 0xffff);
+	matcher = mlx5dv_dr_matcher_create(tbl, 0, DR_MATCHER_CRITERIA_OUTER,
+					   mask);
+	if (!matcher) {
+		perror("mlx5dv_dr_matcher_create");
+		goto destroy_tbl;
+	}
+
+	drop = mlx5dv_dr_action_create_drop();
+	if (!drop) {
+		perror("mlx5dv_dr_action_create_drop");
+		goto destroy_matcher;
+	}
+
+	t = now_sec();
+	if (bulk) {
+		op = create_rules(matcher, drop, rules, nrules, bulk);
+		if (op) {
+			fprintf(stderr, "mlx5dv_dr_rule_create_bulk: %s\n",
+				strerror(op));
+			goto destroy_rules;
+		}
+	} else {
+		lat = calloc(nrules, sizeof(*lat));
+		if (!lat)
+			goto destroy_rules;
+		for (i = 0; i < nrules; i++) {
+			set_tuple(value, i);
+			lat[i] = now_sec();
+			rules[i] = mlx5dv_dr_rule_create(matcher, value, 1,
+							 &drop);
+			lat[i] = now_sec() - lat[i];
+			if (!rules[i]) {
+				perror("mlx5dv_dr_rule_create");
+				goto destroy_rules;
+			}
+		}
+	}
+	t_ins = now_sec() - t;
+
+	if (check_lookups(matcher, value, 0, nrules, 0) ||
+	    check_lookups(matcher, value, nrules, nrules + 1000, ENOENT))
+		goto destroy_rules;
+
+	dr_emu_get_stats(ctx, &stats);
+
+	if (dump && (dump_domain(dmn, dump, 0) ||
+		     dump_domain(dmn, dump, MLX5DV_DUMP_DR_FLAGS_BINARY)))
+		goto destroy_rules;
+
+	t = now_sec();
+	if (bulk) {
+		for (i = 0; i < nrules; i += bulk)
+			mlx5dv_dr_rule_destroy_bulk(rules + i,
+						    nrules - i < bulk ?
+						    nrules - i : bulk);
+		memset(rules, 0, nrules * sizeof(*rules));
+	} else {
+		for (i = 0; i < nrules; i++) {
+			mlx5dv_dr_rule_destroy(rules[i]);
+			rules[i] = NULL;
+		}
+	}
+	t_del = now_sec() - t;
+
+	if (check_lookups(matcher, value, 0, nrules, ENOENT))
+		goto destroy_rules;
+
+	printf("STE v%u, %u IPv4 5-tuple rules, %s\n",
+	       attr.sw_format_ver == MLX5_HW_CONNECTX_5 ? 0 : 1, nrules,
+	       bulk ? "bulk" : "one by one");
+	printf("%-8s %10.2f us/rule %10.2f K rules/s\n", "insert",
+	       t_ins * 1e6 / nrules, nrules / t_ins / 1e3);
+	printf("%-8s %10.2f us/rule %10.2f K rules/s\n", "delete",
+	       t_del * 1e6 / nrules, nrules / t_del / 1e3);
+	if (lat && nrules)
+		print_latency(lat, nrules);
+	printf("after insert: %llu commands, %llu doorbells, %llu WQEs, %llu bytes written, %llu ICM bytes\n",
+	       (unsigned long long)stats.cmds,
+	       (unsigned long long)stats.doorbells,
+	       (unsigned long long)stats.wqes,
+	       (unsigned long long)stats.bytes_written,
+	       (unsigned long long)stats.icm_bytes);
+	ret = 0;
+
+destroy_rules:
+	for (i = 0; i < nrules; i++)
+		if (rules[i])
+			mlx5dv_dr_rule_destroy(rules[i]);
+	mlx5dv_dr_action_destroy(drop);
+destroy_matcher:
+	mlx5dv_dr_matcher_destroy(matcher);
+destroy_tbl:
+	mlx5dv_dr_table_destroy(tbl);
+destroy_dmn:
+	mlx5dv_dr_domain_destroy(dmn);
+close_emu:
+	if (dr_emu_close(ctx)) {
+		fprintf(stderr, "dr_emu_close: objects leaked\n");
+		ret = 1;
+	}
+	free(lat);
+	free(value);
+	free(mask);
+	free(rules);
+	return ret;
+}
@@ -0,0 +1,730 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Cost of the libmlx5 data path without a device.  An RC QP and two CQs are
+ * created by the provider's own mlx5_create_qp_ex() and mlx5_create_cq_ex(),
+ * with the few kernel commands they issue answered below, so the SQ, RQ and
+ * CQ rings and doorbell records are the host memory that libmlx5 allocates
+ * for a device.  The UAR is a host page that nothing reads.
+ *
+ * A thread stands in for the HCA: it follows the SQ and RQ doorbell records,
+ * parses the WQEs, and writes REQ CQEs for signaled WQEs and RESP_SEND CQEs
+ * for the receive WQEs consumed by SENDs, with the owner bit of each pass
+ * over the CQ.  Payloads are not moved.
+ *
+ * post_send (ibv_post_send() and the ibv_wr_*() builders), post_recv and
+ * poll_cq (ibv_poll_cq() and ibv_start_poll()) are timed in blocks of one
+ * queue depth, with the other side of each block done untimed, and every
+ * completion is checked for its status and wr_id order.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mlx5.h"
+
+#define MAX_POLL_BATCH 64
+
+struct fake_hca {
+	struct mlx5_qp		*qp;
+	struct mlx5_cq		*send_cq;
+	struct mlx5_cq		*recv_cq;
+	/* SQ WQEBBs executed and receive WQEs consumed */
+	uint16_t		sq_ci;
+	uint16_t		rq_ci;
+	uint32_t		send_pi;
+	uint32_t		recv_pi;
+	/* CQEs written to either CQ */
+	_Atomic(uint64_t)	cqes;
+	atomic_bool		stop;
+	pthread_t		thread;
+};
+
+struct bench {
+	struct mlx5_context	*ctx;
+	struct mlx5_pd		*pd;
+	struct ibv_cq_ex	*send_cq;
+	struct ibv_cq_ex	*recv_cq;
+	struct ibv_qp		*qp;
+	struct ibv_qp_ex	*qpx;
+	struct fake_hca		hca;
+	char			*buf;
+	uint32_t		depth;
+	uint32_t		size;
+	uint32_t		poll_batch;
+	unsigned int		rounds;
+	bool			inl;
+	/* Next wr_id to post and to be completed */
+	uint64_t		send_id;
+	uint64_t		send_done;
+	uint64_t		recv_id;
+	uint64_t		recv_done;
+	uint64_t		cqes;
+};
+
+struct result {
+	uint64_t		ns;
+	uint64_t		cycles;
+	uint64_t		ops;
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+static const bool have_cycles = true;
+
+static inline uint64_t get_cycles(void)
+{
+	uint32_t low, high;
+
+	asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+	return (uint64_t)high << 32 | low;
+}
+#else
+static const bool have_cycles;
+
+static inline uint64_t get_cycles(void)
+{
+	return 0;
+}
+#endif
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void timer_start(struct result *res)
+{
+	res->ns -= now_ns();
+	res->cycles -= get_cycles();
+}
+
+static inline void timer_stop(struct result *res, uint64_t ops)
+{
+	res->cycles += get_cycles();
+	res->ns += now_ns();
+	res->ops += ops;
+}
+
+/*
+ * The kernel commands of QP and CQ creation and destruction.  These take
+ * the place of the libibverbs ones for the provider sources linked in here.
+ */
+static uint32_t next_qpn = 0x100;
+static uint32_t next_cqn = 0x10;
+
+int ibv_cmd_create_qp_ex(struct ibv_context *context,
+			 struct verbs_qp *qp,
+			 struct ibv_qp_init_attr_ex *attr_ex,
+			 struct ibv_create_qp *cmd, size_t cmd_size,
+			 struct ib_uverbs_create_qp_resp *resp, size_t resp_size)
+{
+	struct ibv_qp *ibqp = &qp->qp;
+
+	ibqp->context = context;
+	ibqp->qp_context = attr_ex->qp_context;
+	ibqp->pd = attr_ex->pd;
+	ibqp->send_cq = attr_ex->send_cq;
+	ibqp->recv_cq = attr_ex->recv_cq;
+	ibqp->srq = attr_ex->srq;
+	ibqp->qp_type = attr_ex->qp_type;
+	ibqp->state = IBV_QPS_RESET;
+	pthread_mutex_init(&ibqp->mutex, NULL);
+	pthread_cond_init(&ibqp->cond, NULL);
+	qp->comp_mask = 0;
+
+	resp->qpn = next_qpn++;
+	ibqp->qp_num = resp->qpn;
+	return 0;
+}
+
+int ibv_cmd_create_cq_ex(struct ibv_context *context,
+			 const struct ibv_cq_init_attr_ex *cq_attr,
+			 struct verbs_cq *cq,
+			 struct ibv_create_cq_ex *cmd,
+			 size_t cmd_size,
+			 struct ib_uverbs_ex_create_cq_resp *resp,
+			 size_t resp_size,
+			 uint32_t cmd_flags)
+{
+	struct mlx5_create_cq_ex_resp *mresp =
+		container_of(resp, struct mlx5_create_cq_ex_resp, ibv_resp);
+
+	cq->cq.context = context;
+	cq->cq.cqe = cq_attr->cqe;
+	cq->cq.channel = cq_attr->channel;
+	cq->cq.cq_context = cq_attr->cq_context;
+	cq->cq.comp_events_completed = 0;
+	cq->cq.async_events_completed = 0;
+	pthread_mutex_init(&cq->cq.mutex, NULL);
+	pthread_cond_init(&cq->cq.cond, NULL);
+
+	mresp->drv_payload.cqn = next_cqn++;
+	return 0;
+}
+
+int ibv_cmd_destroy_qp(struct ibv_qp *qp)
+{
+	return 0;
+}
+
+int ibv_cmd_destroy_cq(struct ibv_cq *cq)
+{
+	return 0;
+}
+
+static inline uint32_t read_db(__be32 *db)
+{
+	uint32_t val = be32toh(*(volatile __be32 *)db);
+
+	atomic_thread_fence(memory_order_acquire);
+	return val;
+}
+
+/* The 16 byte unit of the WQE at WQEBB index 'bb', wrapping at the SQ end */
+static void *sq_unit(struct mlx5_qp *qp, uint32_t bb, uint32_t unit)
+{
+	uint32_t units = qp->sq.wqe_cnt * (MLX5_SEND_WQE_BB / 16);
+
+	return qp->sq_start + ((bb * (MLX5_SEND_WQE_BB / 16) + unit) &
+			       (units - 1)) * 16;
+}
+
+static uint32_t wqe_byte_count(struct mlx5_qp *qp, uint32_t bb,
+			       uint8_t opcode, uint32_t ds)
+{
+	struct mlx5_wqe_data_seg *dseg;
+	uint32_t unit = 1, len = 0;
+	uint32_t bcount;
+
+	if (opcode == MLX5_OPCODE_RDMA_WRITE ||
+	    opcode == MLX5_OPCODE_RDMA_WRITE_IMM ||
+	    opcode == MLX5_OPCODE_RDMA_READ)
+		unit++;
+
+	while (unit < ds) {
+		dseg = sq_unit(qp, bb, unit);
+		bcount = be32toh(dseg->byte_count);
+		if (bcount & MLX5_INLINE_SEG) {
+			bcount &= ~MLX5_INLINE_SEG;
+			unit += DIV_ROUND_UP(sizeof(bcount) + bcount, 16);
+		} else {
+			unit++;
+		}
+		len += bcount;
+	}
+	return len;
+}
+
+static bool hca_write_cqe(struct fake_hca *hca, struct mlx5_cq *cq,
+			  uint32_t *pi, uint8_t cqe_opcode, uint8_t wqe_opcode,
+			  uint16_t wqe_counter, uint32_t byte_cnt)
+{
+	uint32_t ncqe = cq->verbs_cq.cq.cqe + 1;
+	struct mlx5_cqe64 *cqe64;
+	void *cqe;
+
+	/* A device would overflow the CQ, this HCA waits for room */
+	while (((*pi - read_db(&cq->dbrec[MLX5_CQ_SET_CI])) & 0xffffff) >=
+	       ncqe) {
+		if (atomic_load_explicit(&hca->stop, memory_order_relaxed))
+			return false;
+		sched_yield();
+	}
+
+	cqe = cq->active_buf->buf + (*pi & (ncqe - 1)) * cq->cqe_sz;
+	cqe64 = cq->cqe_sz == 64 ? cqe : cqe + 64;
+	memset(cqe64, 0, offsetof(struct mlx5_cqe64, op_own));
+	cqe64->byte_cnt = htobe32(byte_cnt);
+	cqe64->sop_drop_qpn = htobe32((uint32_t)wqe_opcode << 24 |
+				      hca->qp->ibv_qp->qp_num);
+	cqe64->wqe_counter = htobe16(wqe_counter);
+
+	/* The CQE must be complete when the poller sees its owner bit */
+	atomic_thread_fence(memory_order_release);
+	cqe64->op_own = cqe_opcode << 4 | !!(*pi & ncqe);
+	(*pi)++;
+	atomic_fetch_add_explicit(&hca->cqes, 1, memory_order_release);
+	return true;
+}
+
+/* A SEND arriving on the QP itself, false if no receive WQE is posted */
+static bool hca_receive(struct fake_hca *hca, uint32_t len)
+{
+	struct mlx5_qp *qp = hca->qp;
+	uint16_t rq_pi = read_db(&qp->db[MLX5_RCV_DBR]) & 0xffff;
+
+	if (hca->rq_ci == rq_pi)
+		return false;
+
+	if (!hca_write_cqe(hca, hca->recv_cq, &hca->recv_pi,
+			   MLX5_CQE_RESP_SEND, 0, hca->rq_ci, len))
+		return false;
+	hca->rq_ci++;
+	return true;
+}
+
+static bool hca_execute(struct fake_hca *hca)
+{
+	struct mlx5_qp *qp = hca->qp;
+	struct mlx5_wqe_ctrl_seg *ctrl;
+	uint32_t opmod_idx_opcode, ds, len;
+	bool busy = false;
+	uint16_t sq_pi;
+	uint8_t opcode;
+
+	sq_pi = read_db(&qp->db[MLX5_SND_DBR]) & 0xffff;
+	while (hca->sq_ci != sq_pi) {
+		ctrl = sq_unit(qp, hca->sq_ci, 0);
+		opmod_idx_opcode = be32toh(ctrl->opmod_idx_opcode);
+		opcode = opmod_idx_opcode & 0xff;
+		ds = be32toh(ctrl->qpn_ds) & 0x3f;
+		len = wqe_byte_count(qp, hca->sq_ci, opcode, ds);
+
+		/* Without a receive WQE the SEND is retried, as after an RNR */
+		if ((opcode == MLX5_OPCODE_SEND ||
+		     opcode == MLX5_OPCODE_SEND_IMM) &&
+		    !hca_receive(hca, len))
+			break;
+
+		if ((ctrl->fm_ce_se & MLX5_WQE_CTRL_CQ_UPDATE) &&
+		    !hca_write_cqe(hca, hca->send_cq, &hca->send_pi,
+				   MLX5_CQE_REQ, opcode,
+				   (opmod_idx_opcode >> 8) & 0xffff, len))
+			break;
+
+		hca->sq_ci += DIV_ROUND_UP(ds * 16, MLX5_SEND_WQE_BB);
+		busy = true;
+	}
+	return busy;
+}
+
+static void *hca_thread(void *arg)
+{
+	struct fake_hca *hca = arg;
+
+	while (!atomic_load_explicit(&hca->stop, memory_order_relaxed))
+		if (!hca_execute(hca))
+			sched_yield();
+	return NULL;
+}
+
+static struct mlx5_context *fake_context(void)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct mlx5_device *mdev;
+	struct mlx5_context *ctx;
+	void *uar;
+
+	mdev = calloc(1, sizeof(*mdev));
+	ctx = calloc(1, sizeof(*ctx));
+	if (!mdev || !ctx)
+		goto err;
+	ctx->bfs = calloc(1, sizeof(*ctx->bfs));
+	if (!ctx->bfs || posix_memalign(&uar, page_size, page_size))
+		goto err;
+
+	mdev->page_size = page_size;
+	ctx->ibv_ctx.context.device = &mdev->verbs_dev.device;
+	ctx->ibv_ctx.context.ops.post_send = mlx5_post_send;
+	ctx->ibv_ctx.context.ops.post_recv = mlx5_post_recv;
+	ctx->ibv_ctx.context.ops.poll_cq = mlx5_poll_cq;
+	ctx->dbg_fp = stderr;
+	ctx->cache_line_size = 64;
+	ctx->max_sq_desc_sz = 512;
+	ctx->max_rq_desc_sz = 512;
+	ctx->max_send_wqebb = 1 << 15;
+	ctx->max_recv_wr = 1 << 15;
+	ctx->atomic_cap = IBV_ATOMIC_HCA;
+	ctx->bf_reg_size = 512;
+	/* QPs get the BlueFlame register below */
+	ctx->flags = MLX5_CTX_FLAGS_NO_KERN_DYN_UAR;
+	pthread_mutex_init(&ctx->qp_table_mutex, NULL);
+	pthread_mutex_init(&ctx->srq_table_mutex, NULL);
+	pthread_mutex_init(&ctx->uidx_table_mutex, NULL);
+	pthread_mutex_init(&ctx->mkey_table_mutex, NULL);
+	pthread_mutex_init(&ctx->db_list_mutex, NULL);
+	pthread_mutex_init(&ctx->dyn_bfregs_mutex, NULL);
+
+	ctx->bfs[0].reg = uar + MLX5_BF_OFFSET;
+	ctx->bfs[0].uar = uar;
+	ctx->bfs[0].buf_size = ctx->bf_reg_size / 2;
+	ctx->bfs[0].uuarn = 1;
+	mlx5_spinlock_init(&ctx->bfs[0].lock, 0);
+	return ctx;
+
+err:
+	if (ctx)
+		free(ctx->bfs);
+	free(ctx);
+	free(mdev);
+	return NULL;
+}
+
+static void free_context(struct mlx5_context *ctx)
+{
+	free(ctx->bfs[0].uar);
+	free(ctx->bfs);
+	free(to_mdev(ctx->ibv_ctx.context.device));
+	free(ctx);
+}
+
+static int bench_open(struct bench *b)
+{
+	struct ibv_cq_init_attr_ex cq_attr = {
+		.cqe = b->depth,
+		.wc_flags = IBV_WC_EX_WITH_BYTE_LEN,
+	};
+	struct ibv_qp_init_attr_ex attr = {
+		.qp_type = IBV_QPT_RC,
+		.cap = {
+			.max_send_wr = b->depth,
+			.max_recv_wr = b->depth,
+			.max_send_sge = 1,
+			.max_recv_sge = 1,
+			.max_inline_data = b->inl ? b->size : 0,
+		},
+		.comp_mask = IBV_QP_INIT_ATTR_PD |
+			     IBV_QP_INIT_ATTR_SEND_OPS_FLAGS,
+		.send_ops_flags = IBV_QP_EX_WITH_SEND |
+				  IBV_QP_EX_WITH_RDMA_WRITE,
+	};
+	struct ibv_context *context;
+
+	b->ctx = fake_context();
+	b->pd = calloc(1, sizeof(*b->pd));
+	b->buf = calloc(1, b->size);
+	if (!b->ctx || !b->pd || !b->buf)
+		return ENOMEM;
+	context = &b->ctx->ibv_ctx.context;
+	b->pd->ibv_pd.context = context;
+
+	b->send_cq = mlx5_create_cq_ex(context, &cq_attr);
+	b->recv_cq = mlx5_create_cq_ex(context, &cq_attr);
+	if (!b->send_cq || !b->recv_cq)
+		return errno;
+
+	attr.pd = &b->pd->ibv_pd;
+	attr.send_cq = ibv_cq_ex_to_cq(b->send_cq);
+	attr.recv_cq = ibv_cq_ex_to_cq(b->recv_cq);
+	b->qp = mlx5_create_qp_ex(context, &attr);
+	if (!b->qp)
+		return errno ? errno : EINVAL;
+	b->qpx = ibv_qp_to_qp_ex(b->qp);
+	/* Nothing checks the state, there is no modify QP here */
+	b->qp->state = IBV_QPS_RTS;
+
+	b->hca.qp = to_mqp(b->qp);
+	b->hca.send_cq = to_mcq(attr.send_cq);
+	b->hca.recv_cq = to_mcq(attr.recv_cq);
+	return pthread_create(&b->hca.thread, NULL, hca_thread, &b->hca);
+}
+
+static void bench_close(struct bench *b)
+{
+	if (b->hca.qp) {
+		atomic_store(&b->hca.stop, true);
+		pthread_join(b->hca.thread, NULL);
+	}
+	if (b->qp)
+		mlx5_destroy_qp(b->qp);
+	if (b->send_cq)
+		mlx5_destroy_cq(ibv_cq_ex_to_cq(b->send_cq));
+	if (b->recv_cq)
+		mlx5_destroy_cq(ibv_cq_ex_to_cq(b->recv_cq));
+	if (b->ctx)
+		free_context(b->ctx);
+	free(b->pd);
+	free(b->buf);
+}
+
+static int post_send(struct bench *b, enum ibv_wr_opcode opcode)
+{
+	struct ibv_sge sge = {
+		.addr = (uintptr_t)b->buf,
+		.length = b->size,
+		.lkey = 0x1234,
+	};
+	struct ibv_send_wr wr = {
+		.wr_id = b->send_id,
+		.sg_list = &sge,
+		.num_sge = 1,
+		.opcode = opcode,
+		.send_flags = IBV_SEND_SIGNALED |
+			      (b->inl ? IBV_SEND_INLINE : 0),
+		.wr.rdma = {
+			.remote_addr = 0x10000,
+			.rkey = 0x5678,
+		},
+	};
+	struct ibv_send_wr *bad_wr;
+	int ret;
+
+	ret = ibv_post_send(b->qp, &wr, &bad_wr);
+	if (!ret)
+		b->send_id++;
+	return ret;
+}
+
+static int post_send_ex(struct bench *b)
+{
+	struct ibv_qp_ex *qpx = b->qpx;
+
+	ibv_wr_start(qpx);
+	qpx->wr_id = b->send_id;
+	qpx->wr_flags = IBV_SEND_SIGNALED;
+	ibv_wr_rdma_write(qpx, 0x5678, 0x10000);
+	if (b->inl)
+		ibv_wr_set_inline_data(qpx, b->buf, b->size);
+	else
+		ibv_wr_set_sge(qpx, 0x1234, (uintptr_t)b->buf, b->size);
+	if (ibv_wr_complete(qpx))
+		return EINVAL;
+	b->send_id++;
+	return 0;
+}
+
+static int post_recv(struct bench *b)
+{
+	struct ibv_sge sge = {
+		.addr = (uintptr_t)b->buf,
+		.length = b->size,
+		.lkey = 0x1234,
+	};
+	struct ibv_recv_wr wr = {
+		.wr_id = b->recv_id,
+		.sg_list = &sge,
+		.num_sge = 1,
+	};
+	struct ibv_recv_wr *bad_wr;
+	int ret;
+
+	ret = ibv_post_recv(b->qp, &wr, &bad_wr);
+	if (!ret)
+		b->recv_id++;
+	return ret;
+}
+
+static int check_wc(enum ibv_wc_status status, uint64_t wr_id, uint64_t *done)
+{
+	if (status != IBV_WC_SUCCESS || wr_id != *done) {
+		fprintf(stderr, "Bad completion: status %d wr_id %llu, expected %llu\n",
+			status, (unsigned long long)wr_id,
+			(unsigned long long)*done);
+		return -1;
+	}
+	(*done)++;
+	return 0;
+}
+
+static int poll_cq(struct bench *b, struct ibv_cq_ex *cq, uint32_t n,
+		   uint64_t *done)
+{
+	struct ibv_wc wc[MAX_POLL_BATCH];
+	int ne, i;
+
+	while (n) {
+		ne = ibv_poll_cq(ibv_cq_ex_to_cq(cq), min(n, b->poll_batch), wc);
+		if (ne < 0)
+			return -1;
+		for (i = 0; i < ne; i++)
+			if (check_wc(wc[i].status, wc[i].wr_id, done))
+				return -1;
+		n -= ne;
+	}
+	return 0;
+}
+
+static int poll_cq_ex(struct ibv_cq_ex *cq, uint32_t n, uint64_t *done)
+{
+	struct ibv_poll_cq_attr attr = {};
+	int ret;
+
+	while (n) {
+		ret = ibv_start_poll(cq, &attr);
+		if (ret == ENOENT)
+			continue;
+		if (ret)
+			return -1;
+		do {
+			if (check_wc(cq->status, cq->wr_id, done))
+				ret = -1;
+			n--;
+		} while (!ret && n && !(ret = ibv_next_poll(cq)));
+		ibv_end_poll(cq);
+		if (ret && ret != ENOENT)
+			return -1;
+	}
+	return 0;
+}
+
+/* Wait until the HCA wrote every CQE that is due, for timing the poll alone */
+static void wait_cqes(struct bench *b)
+{
+	while (atomic_load_explicit(&b->hca.cqes, memory_order_acquire) !=
+	       b->cqes)
+		sched_yield();
+}
+
+static int run_post_send(struct bench *b, bool ex, struct result *res)
+{
+	unsigned int r;
+	uint32_t i;
+	int ret = 0;
+
+	for (r = 0; r < b->rounds; r++) {
+		timer_start(res);
+		for (i = 0; i < b->depth && !ret; i++)
+			ret = ex ? post_send_ex(b) :
+				   post_send(b, IBV_WR_RDMA_WRITE);
+		timer_stop(res, b->depth);
+		if (ret)
+			return ret;
+		b->cqes += b->depth;
+
+		if (poll_cq(b, b->send_cq, b->depth, &b->send_done))
+			return -1;
+	}
+	return 0;
+}
+
+static int run_post_recv(struct bench *b, struct result *res)
+{
+	unsigned int r;
+	uint32_t i;
+	int ret = 0;
+
+	for (r = 0; r < b->rounds; r++) {
+		timer_start(res);
+		for (i = 0; i < b->depth && !ret; i++)
+			ret = post_recv(b);
+		timer_stop(res, b->depth);
+		if (ret)
+			return ret;
+
+		for (i = 0; i < b->depth; i++)
+			if (post_send(b, IBV_WR_SEND))
+				return -1;
+		b->cqes += 2 * b->depth;
+
+		if (poll_cq(b, b->send_cq, b->depth, &b->send_done) ||
+		    poll_cq(b, b->recv_cq, b->depth, &b->recv_done))
+			return -1;
+	}
+	return 0;
+}
+
+static int run_poll_cq(struct bench *b, bool ex, struct result *res)
+{
+	unsigned int r;
+	uint32_t i;
+	int ret;
+
+	for (r = 0; r < b->rounds; r++) {
+		for (i = 0; i < b->depth; i++)
+			if (post_send(b, IBV_WR_RDMA_WRITE))
+				return -1;
+		b->cqes += b->depth;
+		wait_cqes(b);
+
+		timer_start(res);
+		ret = ex ? poll_cq_ex(b->send_cq, b->depth, &b->send_done) :
+			   poll_cq(b, b->send_cq, b->depth, &b->send_done);
+		timer_stop(res, b->depth);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static void print_result(const char *name, const struct result *res)
+{
+	printf("%-14s %8.2f ns/op", name, (double)res->ns / res->ops);
+	if (have_cycles)
+		printf(" %8.1f cycles/op", (double)res->cycles / res->ops);
+	printf(" %8.2f M ops/s\n", res->ops * 1e3 / res->ns);
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-d depth] [-n rounds] [-s size] [-b poll batch] [-i]\n",
+	       prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.depth = 64,
+		.size = 8,
+		.poll_batch = 16,
+		.rounds = 10000,
+	};
+	struct result res[5] = {};
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "d:n:s:b:ih")) != -1) {
+		switch (op) {
+		case 'd':
+			b.depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			b.rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			b.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			b.poll_batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			b.inl = true;
+			break;
+		default:
+			usage(argv[0]);
+			return op == 'h' ? 0 : 1;
+		}
+	}
+	if (!b.depth || !b.rounds || !b.size || !b.poll_batch ||
+	    b.poll_batch > MAX_POLL_BATCH) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ret = bench_open(&b);
+	if (ret) {
+		fprintf(stderr, "Failed to set up the QP and CQs: %s\n",
+			strerror(ret));
+		bench_close(&b);
+		return 1;
+	}
+
+	ret = run_post_send(&b, false, &res[0]) ||
+	      run_post_send(&b, true, &res[1]) ||
+	      run_post_recv(&b, &res[2]) ||
+	      run_poll_cq(&b, false, &res[3]) ||
+	      run_poll_cq(&b, true, &res[4]);
+	bench_close(&b);
+	if (ret) {
+		fprintf(stderr, "Data path failed\n");
+		return 1;
+	}
+
+	printf("depth %u, %u byte%s messages\n", b.depth, b.size,
+	       b.inl ? " inline" : "");
+	print_result("post_send", &res[0]);
+	print_result("post_send_ex", &res[1]);
+	print_result("post_recv", &res[2]);
+	print_result("poll_cq", &res[3]);
+	print_result("poll_cq_ex", &res[4]);
+	return 0;
+}
@@ -0,0 +1,408 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+/*
+ * Convert a binary steering dump of mlx5dv_dump_dr_domain_ex() to the CSV
+ * lines mlx5dv_dump_dr_domain() writes for the same domain.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../dr_dump.h"
+
+struct dump_rec {
+	uint16_t type;
+	uint16_t len;
+	/* One more byte to NUL terminate a trailing string */
+	uint8_t data[UINT16_MAX + 1];
+};
+
+static void print_hex(FILE *f, const uint8_t *src, size_t size)
+{
+	static const char digits[] = "0123456789abcdef";
+	static char line[2 * UINT16_MAX];
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		line[2 * i] = digits[src[i] >> 4];
+		line[2 * i + 1] = digits[src[i] & 0xf];
+	}
+	fwrite(line, 1, 2 * size, f);
+}
+
+static int print_domain(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_domain d;
+	const char *version, *dev_name;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	version = (const char *)rec->data + sizeof(d);
+	dev_name = version + strlen(version);
+	if (dev_name < (const char *)rec->data + rec->len)
+		dev_name++;
+
+	fprintf(f, "%d,0x%" PRIx64 ",%d,0%x,%d,%s,%s\n",
+		rec->type, d.domain_id, d.type, d.gvmi, d.supp_sw_steering,
+		version, dev_name);
+	return 0;
+}
+
+static int print_flex_parser(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_flex_parser d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",%s,0x%x\n",
+		rec->type, d.domain_id, (const char *)rec->data + sizeof(d),
+		d.value);
+	return 0;
+}
+
+static int print_dev_attr(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_dev_attr d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",%u,%s\n",
+		rec->type, d.domain_id, d.num_ports,
+		(const char *)rec->data + sizeof(d));
+	return 0;
+}
+
+static int print_vport(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_vport d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",%d,0x%x,0x%" PRIx64 ",0x%" PRIx64 "\n",
+		rec->type, d.domain_id, d.num, d.vport_gvmi,
+		d.icm_address_rx, d.icm_address_tx);
+	return 0;
+}
+
+static int print_caps(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_caps d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",0x%x,0x%" PRIx64 ",0x%" PRIx64 ",0x%x,%d,%d\n",
+		rec->type, d.domain_id, d.gvmi, d.nic_rx_drop_address,
+		d.nic_tx_drop_address, d.flex_protocols, d.num_ports,
+		d.eswitch_manager);
+	return 0;
+}
+
+static int print_send_ring(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_send_ring d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x,0x%x\n",
+		rec->type, d.ring_id, d.domain_id, d.cqn, d.qpn);
+	return 0;
+}
+
+static int print_table(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_table d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",%d,%d\n",
+		rec->type, d.table_id, d.domain_id, d.table_type, d.level);
+	return 0;
+}
+
+static int print_table_rx_tx(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_table_rx_tx d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 "\n",
+		rec->type, d.table_id, d.s_anchor_idx);
+	return 0;
+}
+
+static int print_matcher(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_matcher d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",%d\n",
+		rec->type, d.matcher_id, d.table_id, d.prio);
+	return 0;
+}
+
+static int print_matcher_mask(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_matcher_mask d;
+	size_t offset, len = 0;
+	int i;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	for (i = 0; i < DR_DUMP_MASK_PARTS; i++)
+		len += d.part_len[i];
+	if (rec->len < sizeof(d) + len)
+		return -1;
+
+	fprintf(f, "%d,0x%" PRIx64 ",", rec->type, d.matcher_id);
+
+	/* A present MISC5 mask ends the line without the comma */
+	offset = sizeof(d);
+	for (i = 0; i < DR_DUMP_MASK_PARTS; i++) {
+		if (!d.part_len[i]) {
+			fputc(',', f);
+			continue;
+		}
+
+		print_hex(f, rec->data + offset, d.part_len[i]);
+		offset += d.part_len[i];
+		if (i != DR_DUMP_MASK_MISC5)
+			fputc(',', f);
+	}
+	fputc('\n', f);
+	return 0;
+}
+
+static int print_matcher_rx_tx(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_matcher_rx_tx d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",%d,0x%" PRIx64 ",0x%" PRIx64 "\n",
+		rec->type, d.matcher_rx_tx_id, d.matcher_id,
+		d.num_of_builders, d.s_htbl_idx, d.e_anchor_idx);
+	return 0;
+}
+
+static int print_matcher_builder(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_matcher_builder d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	/* No comma after the matcher ID, as in the CSV dump */
+	fprintf(f, "%d,0x%" PRIx64 "%d,%d,0x%x,%d\n",
+		rec->type, d.matcher_id, d.index, d.is_rx, d.lu_type,
+		d.format_id);
+	return 0;
+}
+
+static int print_rule(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_rule d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 "\n",
+		rec->type, d.rule_id, d.matcher_id);
+	return 0;
+}
+
+static int print_rule_mem(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_rule_mem d;
+
+	if (rec->len < sizeof(d))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",",
+		rec->type, d.icm_idx, d.rule_id);
+	print_hex(f, rec->data + sizeof(d), rec->len - sizeof(d));
+	fputc('\n', f);
+	return 0;
+}
+
+static int print_action(FILE *f, struct dump_rec *rec)
+{
+	struct dr_dump_bin_action d;
+	uint64_t arg;
+	size_t offset;
+
+	if (rec->len < sizeof(d) || (rec->len - sizeof(d)) % sizeof(arg))
+		return -1;
+
+	memcpy(&d, rec->data, sizeof(d));
+	fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64,
+		rec->type, d.action_id, d.rule_id);
+	for (offset = sizeof(d); offset < rec->len; offset += sizeof(arg)) {
+		memcpy(&arg, rec->data + offset, sizeof(arg));
+		fprintf(f, ",0x%" PRIx64, arg);
+	}
+	fputc('\n', f);
+	return 0;
+}
+
+static int print_rec(FILE *f, struct dump_rec *rec)
+{
+	switch (rec->type) {
+	case DR_DUMP_REC_TYPE_DOMAIN:
+		return print_domain(f, rec);
+	case DR_DUMP_REC_TYPE_DOMAIN_INFO_FLEX_PARSER:
+		return print_flex_parser(f, rec);
+	case DR_DUMP_REC_TYPE_DOMAIN_INFO_DEV_ATTR:
+		return print_dev_attr(f, rec);
+	case DR_DUMP_REC_TYPE_DOMAIN_INFO_VPORT:
+		return print_vport(f, rec);
+	case DR_DUMP_REC_TYPE_DOMAIN_INFO_CAPS:
+		return print_caps(f, rec);
+	case DR_DUMP_REC_TYPE_DOMAIN_SEND_RING:
+		return print_send_ring(f, rec);
+	case DR_DUMP_REC_TYPE_TABLE:
+		return print_table(f, rec);
+	case DR_DUMP_REC_TYPE_TABLE_RX:
+	case DR_DUMP_REC_TYPE_TABLE_TX:
+		return print_table_rx_tx(f, rec);
+	case DR_DUMP_REC_TYPE_MATCHER:
+		return print_matcher(f, rec);
+	case DR_DUMP_REC_TYPE_MATCHER_MASK:
+		return print_matcher_mask(f, rec);
+	case DR_DUMP_REC_TYPE_MATCHER_RX:
+	case DR_DUMP_REC_TYPE_MATCHER_TX:
+		return print_matcher_rx_tx(f, rec);
+	case DR_DUMP_REC_TYPE_MATCHER_BUILDER:
+		return print_matcher_builder(f, rec);
+	case DR_DUMP_REC_TYPE_RULE:
+		return print_rule(f, rec);
+	case DR_DUMP_REC_TYPE_RULE_RX_ENTRY_V0:
+	case DR_DUMP_REC_TYPE_RULE_TX_ENTRY_V0:
+	case DR_DUMP_REC_TYPE_RULE_RX_ENTRY_V1:
+	case DR_DUMP_REC_TYPE_RULE_TX_ENTRY_V1:
+		return print_rule_mem(f, rec);
+	default:
+		if (rec->type >= DR_DUMP_REC_TYPE_ACTION_ENCAP_L2 &&
+		    rec->type <= DR_DUMP_REC_TYPE_ACTION_MISS)
+			return print_action(f, rec);
+		/* Unknown records of a newer library are skipped */
+		return 0;
+	}
+}
+
+static int convert(FILE *in, FILE *out)
+{
+	static struct dump_rec rec;
+	struct dr_dump_bin_hdr hdr;
+	struct dr_dump_bin_rec rec_hdr;
+	size_t ret;
+
+	if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+	    memcmp(hdr.magic, DR_DUMP_BIN_MAGIC, sizeof(hdr.magic))) {
+		fprintf(stderr, "Not a binary steering dump\n");
+		return -1;
+	}
+
+	if (hdr.version != DR_DUMP_BIN_VERSION) {
+		fprintf(stderr, "Unsupported dump version 0x%x\n", hdr.version);
+		return -1;
+	}
+
+	while ((ret = fread(&rec_hdr, sizeof(rec_hdr), 1, in)) == 1) {
+		rec.type = rec_hdr.type;
+		rec.len = rec_hdr.len;
+		if (fread(rec.data, 1, rec.len, in) != rec.len)
+			break;
+
+		rec.data[rec.len] = '\0';
+		if (print_rec(out, &rec)) {
+			fprintf(stderr, "Bad record of type %u\n", rec.type);
+			return -1;
+		}
+	}
+
+	if (ferror(in) || ret) {
+		fprintf(stderr, "Truncated dump\n");
+		return -1;
+	}
+
+	if (fflush(out)) {
+		perror("Write");
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-o output.csv] [dump]\n", prog);
+	printf("Convert a binary mlx5 steering dump to CSV, from stdin if no dump file is given.\n");
+}
+
+int main(int argc, char **argv)
+{
+	FILE *in = stdin, *out = stdout;
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "o:h")) != -1) {
+		switch (op) {
+		case 'o':
+			out = fopen(optarg, "w");
+			if (!out) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return op == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind < argc) {
+		in = fopen(argv[optind], "r");
+		if (!in) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	ret = convert(in, out);
+
+	if (in != stdin)
+		fclose(in);
+	if (out != stdout && fclose(out) && !ret) {
+		perror("Write");
+		ret = -1;
+	}
+	return ret ? 1 : 0;
+}
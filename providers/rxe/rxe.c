@@ -102,32 +102,124 @@ static struct ibv_pd *rxe_alloc_pd(struct ibv_context *context)
 {
 	struct ibv_alloc_pd cmd;
 	struct ib_uverbs_alloc_pd_resp resp;
-	struct ibv_pd *pd;
+	struct rxe_pd *pd;
 
 	pd = calloc(1, sizeof(*pd));
 	if (!pd)
 		return NULL;
 
-	if (ibv_cmd_alloc_pd(context, pd, &cmd, sizeof(cmd),
+	if (ibv_cmd_alloc_pd(context, &pd->ibv_pd, &cmd, sizeof(cmd),
 					&resp, sizeof(resp))) {
 		free(pd);
 		return NULL;
 	}
 
-	return pd;
+	atomic_init(&pd->refcount, 1);
+
+	return &pd->ibv_pd;
+}
+
+static int rxe_dealloc_parent_domain(struct rxe_pd *parent_domain)
+{
+	if (atomic_load(&parent_domain->refcount) > 1)
+		return EBUSY;
+
+	atomic_fetch_sub(&parent_domain->protection_domain->refcount, 1);
+	if (parent_domain->td)
+		atomic_fetch_sub(&parent_domain->td->refcount, 1);
+
+	free(parent_domain);
+	return 0;
 }
 
-static int rxe_dealloc_pd(struct ibv_pd *pd)
+static int rxe_dealloc_pd(struct ibv_pd *ibpd)
 {
+	struct rxe_pd *parent_domain = to_rparent_domain(ibpd);
+	struct rxe_pd *pd = to_rpd(ibpd);
 	int ret;
 
-	ret = ibv_cmd_dealloc_pd(pd);
+	if (parent_domain)
+		return rxe_dealloc_parent_domain(parent_domain);
+
+	if (atomic_load(&pd->refcount) > 1)
+		return EBUSY;
+
+	ret = ibv_cmd_dealloc_pd(ibpd);
 	if (!ret)
 		free(pd);
 
 	return ret;
 }
 
+static struct ibv_td *rxe_alloc_td(struct ibv_context *context,
+				   struct ibv_td_init_attr *attr)
+{
+	struct rxe_td *td;
+
+	if (attr->comp_mask) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	td = calloc(1, sizeof(*td));
+	if (!td) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	td->ibv_td.context = context;
+	atomic_init(&td->refcount, 1);
+
+	return &td->ibv_td;
+}
+
+static int rxe_dealloc_td(struct ibv_td *ibtd)
+{
+	struct rxe_td *td = to_rtd(ibtd);
+
+	if (atomic_load(&td->refcount) > 1)
+		return EBUSY;
+
+	free(td);
+	return 0;
+}
+
+static struct ibv_pd *
+rxe_alloc_parent_domain(struct ibv_context *context,
+			struct ibv_parent_domain_init_attr *attr)
+{
+	struct rxe_pd *parent_domain;
+
+	if (ibv_check_alloc_parent_domain(attr))
+		return NULL;
+
+	/* Custom allocators have no use, the queues are mapped from the kernel */
+	if (attr->comp_mask) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	parent_domain = calloc(1, sizeof(*parent_domain));
+	if (!parent_domain) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (attr->td) {
+		parent_domain->td = to_rtd(attr->td);
+		atomic_fetch_add(&parent_domain->td->refcount, 1);
+	}
+
+	parent_domain->protection_domain = to_rpd(attr->pd);
+	atomic_fetch_add(&parent_domain->protection_domain->refcount, 1);
+	atomic_init(&parent_domain->refcount, 1);
+
+	ibv_initialize_parent_domain(&parent_domain->ibv_pd,
+				     &parent_domain->protection_domain->ibv_pd);
+
+	return &parent_domain->ibv_pd;
+}
+
 static struct ibv_mw *rxe_alloc_mw(struct ibv_pd *ibpd, enum ibv_mw_type type)
 {
 	int ret;
@@ -256,12 +348,12 @@ static int cq_start_poll(struct ibv_cq_ex *current,
 {
 	struct rxe_cq *cq = container_of(current, struct rxe_cq, vcq.cq_ex);
 
-	pthread_spin_lock(&cq->lock);
+	rxe_spin_lock(&cq->lock);
 
 	cq->cur_index = load_consumer_index(cq->queue);
 
 	if (check_cq_queue_empty(cq)) {
-		pthread_spin_unlock(&cq->lock);
+		rxe_spin_unlock(&cq->lock);
 		errno = ENOENT;
 		return errno;
 	}
@@ -281,7 +373,7 @@ static int cq_next_poll(struct ibv_cq_ex *current)
 
 	if (check_cq_queue_empty(cq)) {
 		store_consumer_index(cq->queue, cq->cur_index);
-		pthread_spin_unlock(&cq->lock);
+		rxe_spin_unlock(&cq->lock);
 		errno = ENOENT;
 		return errno;
 	}
@@ -299,7 +391,7 @@ static void cq_end_poll(struct ibv_cq_ex *current)
 
 	advance_cq_cur_index(cq);
 	store_consumer_index(cq->queue, cq->cur_index);
-	pthread_spin_unlock(&cq->lock);
+	rxe_spin_unlock(&cq->lock);
 }
 
 static enum ibv_wc_opcode cq_read_opcode(struct ibv_cq_ex *current)
@@ -410,7 +502,7 @@ static struct ibv_cq *rxe_create_cq(struct ibv_context *context, int cqe,
 	}
 
 	cq->mmap_info = resp.mi;
-	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
+	rxe_spinlock_init(&cq->lock, true);
 
 	return &cq->vcq.cq;
 }
@@ -434,12 +526,29 @@ static struct ibv_cq_ex *rxe_create_cq_ex(struct ibv_context *context,
 	struct rxe_cq *cq;
 	struct urxe_create_cq_ex_resp resp = {};
 
+	struct rxe_pd *parent_domain = NULL;
+	bool need_lock = true;
+
 	/* user is asking for flags we don't support */
 	if (attr->wc_flags & ~RXE_SUP_WC_EX_FLAGS) {
 		errno = EOPNOTSUPP;
 		goto err;
 	}
 
+	if ((attr->comp_mask & IBV_CQ_INIT_ATTR_MASK_FLAGS) &&
+	    (attr->flags & IBV_CREATE_CQ_ATTR_SINGLE_THREADED))
+		need_lock = false;
+
+	if (attr->comp_mask & IBV_CQ_INIT_ATTR_MASK_PD) {
+		parent_domain = to_rparent_domain(attr->parent_domain);
+		if (!parent_domain) {
+			errno = EINVAL;
+			goto err;
+		}
+		if (parent_domain->td)
+			need_lock = false;
+	}
+
 	cq = calloc(1, sizeof(*cq));
 	if (!cq)
 		goto err;
@@ -461,7 +570,12 @@ static struct ibv_cq_ex *rxe_create_cq_ex(struct ibv_context *context,
 		goto err_unmap;
 
 	cq->mmap_info = resp.mi;
-	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
+	rxe_spinlock_init(&cq->lock, need_lock);
+
+	if (parent_domain) {
+		cq->parent_domain = attr->parent_domain;
+		atomic_fetch_add(&parent_domain->refcount, 1);
+	}
 
 	cq->vcq.cq_ex.start_poll	= cq_start_poll;
 	cq->vcq.cq_ex.next_poll		= cq_next_poll;
@@ -518,12 +632,12 @@ static int rxe_resize_cq(struct ibv_cq *ibcq, int cqe)
 	struct urxe_resize_cq_resp resp;
 	int ret;
 
-	pthread_spin_lock(&cq->lock);
+	rxe_spin_lock(&cq->lock);
 
 	ret = ibv_cmd_resize_cq(ibcq, cqe, &cmd, sizeof(cmd),
 				&resp.ibv_resp, sizeof(resp));
 	if (ret) {
-		pthread_spin_unlock(&cq->lock);
+		rxe_spin_unlock(&cq->lock);
 		return ret;
 	}
 
@@ -534,7 +648,7 @@ static int rxe_resize_cq(struct ibv_cq *ibcq, int cqe)
 			 ibcq->context->cmd_fd, resp.mi.offset);
 
 	ret = errno;
-	pthread_spin_unlock(&cq->lock);
+	rxe_spin_unlock(&cq->lock);
 
 	if ((void *)cq->queue == MAP_FAILED) {
 		cq->queue = NULL;
@@ -558,6 +672,8 @@ static int rxe_destroy_cq(struct ibv_cq *ibcq)
 
 	if (cq->mmap_info.size)
 		munmap(cq->queue, cq->mmap_info.size);
+	if (cq->parent_domain)
+		atomic_fetch_sub(&to_rpd(cq->parent_domain)->refcount, 1);
 	free(cq);
 
 	return 0;
@@ -570,7 +686,7 @@ static int rxe_poll_cq(struct ibv_cq *ibcq, int ne, struct ibv_wc *wc)
 	int npolled;
 	uint8_t *src;
 
-	pthread_spin_lock(&cq->lock);
+	rxe_spin_lock(&cq->lock);
 	q = cq->queue;
 
 	for (npolled = 0; npolled < ne; ++npolled, ++wc) {
@@ -582,13 +698,14 @@ static int rxe_poll_cq(struct ibv_cq *ibcq, int ne, struct ibv_wc *wc)
 		advance_consumer(q);
 	}
 
-	pthread_spin_unlock(&cq->lock);
+	rxe_spin_unlock(&cq->lock);
 	return npolled;
 }
 
 static struct ibv_srq *rxe_create_srq(struct ibv_pd *pd,
 				      struct ibv_srq_init_attr *attr)
 {
+	struct rxe_pd *parent_domain = to_rparent_domain(pd);
 	struct rxe_srq *srq;
 	struct ibv_create_srq cmd;
 	struct urxe_create_srq_resp resp;
@@ -616,7 +733,10 @@ static struct ibv_srq *rxe_create_srq(struct ibv_pd *pd,
 
 	srq->mmap_info = resp.mi;
 	srq->rq.max_sge = attr->attr.max_sge;
-	pthread_spin_init(&srq->rq.lock, PTHREAD_PROCESS_PRIVATE);
+	rxe_spinlock_init(&srq->rq.lock, rxe_pd_need_lock(pd));
+
+	if (parent_domain)
+		atomic_fetch_add(&parent_domain->refcount, 1);
 
 	return &srq->ibv_srq;
 }
@@ -633,7 +753,7 @@ static int rxe_modify_srq(struct ibv_srq *ibsrq,
 	mi.size = 0;
 
 	if (attr_mask & IBV_SRQ_MAX_WR)
-		pthread_spin_lock(&srq->rq.lock);
+		rxe_spin_lock(&srq->rq.lock);
 
 	cmd.mmap_info_addr = (__u64)(uintptr_t) &mi;
 	rc = ibv_cmd_modify_srq(ibsrq, attr, attr_mask,
@@ -659,7 +779,7 @@ static int rxe_modify_srq(struct ibv_srq *ibsrq,
 
 out:
 	if (attr_mask & IBV_SRQ_MAX_WR)
-		pthread_spin_unlock(&srq->rq.lock);
+		rxe_spin_unlock(&srq->rq.lock);
 	return rc;
 }
 
@@ -675,11 +795,14 @@ static int rxe_destroy_srq(struct ibv_srq *ibvsrq)
 	int ret;
 	struct rxe_srq *srq = to_rsrq(ibvsrq);
 	struct rxe_queue_buf *q = srq->rq.queue;
+	struct rxe_pd *parent_domain = to_rparent_domain(ibvsrq->pd);
 
 	ret = ibv_cmd_destroy_srq(ibvsrq);
 	if (!ret) {
 		if (srq->mmap_info.size)
 			munmap(q, srq->mmap_info.size);
+		if (parent_domain)
+			atomic_fetch_sub(&parent_domain->refcount, 1);
 		free(srq);
 	}
 
@@ -734,7 +857,7 @@ static int rxe_post_srq_recv(struct ibv_srq *ibvsrq,
 	struct rxe_srq *srq = to_rsrq(ibvsrq);
 	int rc = 0;
 
-	pthread_spin_lock(&srq->rq.lock);
+	rxe_spin_lock(&srq->rq.lock);
 
 	while (recv_wr) {
 		rc = rxe_post_one_recv(&srq->rq, recv_wr);
@@ -746,11 +869,49 @@ static int rxe_post_srq_recv(struct ibv_srq *ibvsrq,
 		recv_wr = recv_wr->next;
 	}
 
-	pthread_spin_unlock(&srq->rq.lock);
+	rxe_spin_unlock(&srq->rq.lock);
 
 	return rc;
 }
 
+/*
+ * Send WQEs are built in place in the send queue slot.  A reused slot holds
+ * the previous WQE, so only the fields which the kernel reads for the new
+ * opcode are written, and the AV of a UD send only when the slot holds the
+ * AV of another AH.
+ */
+static inline void init_send_wqe_hdr(struct rxe_qp *qp,
+				     struct rxe_send_wqe *wqe, uint64_t wr_id,
+				     enum ibv_wr_opcode opcode,
+				     unsigned int send_flags)
+{
+	wqe->wr.wr_id = wr_id;
+	wqe->wr.num_sge = 0;
+	wqe->wr.opcode = opcode;
+	wqe->wr.send_flags = send_flags;
+
+	/* status up to the SGEs, the state that the kernel keeps in the WQE */
+	memset(&wqe->status, 0, offsetof(struct rxe_send_wqe, dma.sge) -
+				offsetof(struct rxe_send_wqe, status));
+	wqe->ssn = qp->ssn++;
+}
+
+/*
+ * The AV of a slot is only copied when the slot last held another AH's.
+ * This relies on the kernel never writing wqe->av; it does wipe the whole
+ * ring when the QP moves to RESET, so rxe_modify_qp() clears the ids then.
+ */
+static inline void set_send_wqe_av(struct rxe_qp *qp,
+				   struct rxe_send_wqe *wqe, struct rxe_ah *ah)
+{
+	uint32_t *av_id = &qp->sq_av_ids[index_from_addr(qp->sq.queue, wqe)];
+
+	if (*av_id != ah->av_id) {
+		memcpy(&wqe->av, &ah->av, sizeof(wqe->av));
+		*av_id = ah->av_id;
+	}
+}
+
 /*
  * builders always consume one send queue slot
  * setters (below) reach back and adjust previous build
@@ -765,18 +926,14 @@ static void wr_atomic_cmp_swp(struct ibv_qp_ex *ibqp, uint32_t rkey,
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
-
-	wqe->wr.wr_id = ibqp->wr_id;
-	wqe->wr.send_flags = ibqp->wr_flags;
-	wqe->wr.opcode = IBV_WR_ATOMIC_CMP_AND_SWP;
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_ATOMIC_CMP_AND_SWP,
+			  ibqp->wr_flags);
 
 	wqe->wr.wr.atomic.remote_addr = remote_addr;
 	wqe->wr.wr.atomic.compare_add = compare;
 	wqe->wr.wr.atomic.swap = swap;
 	wqe->wr.wr.atomic.rkey = rkey;
 	wqe->iova = remote_addr;
-	wqe->ssn = qp->ssn++;
 
 	advance_qp_cur_index(qp);
 }
@@ -790,16 +947,13 @@ static void wr_atomic_fetch_add(struct ibv_qp_ex *ibqp, uint32_t rkey,
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_ATOMIC_FETCH_AND_ADD,
+			  ibqp->wr_flags);
 
-	wqe->wr.wr_id = qp->vqp.qp_ex.wr_id;
-	wqe->wr.opcode = IBV_WR_ATOMIC_FETCH_AND_ADD;
-	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags;
 	wqe->wr.wr.atomic.remote_addr = remote_addr;
 	wqe->wr.wr.atomic.compare_add = add;
 	wqe->wr.wr.atomic.rkey = rkey;
 	wqe->iova = remote_addr;
-	wqe->ssn = qp->ssn++;
 
 	advance_qp_cur_index(qp);
 }
@@ -813,18 +967,14 @@ static void wr_bind_mw(struct ibv_qp_ex *ibqp, struct ibv_mw *ibmw,
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_BIND_MW, ibqp->wr_flags);
 
-	wqe->wr.wr_id = ibqp->wr_id;
-	wqe->wr.opcode = IBV_WR_BIND_MW;
-	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags;
 	wqe->wr.wr.mw.addr = info->addr;
 	wqe->wr.wr.mw.length = info->length;
 	wqe->wr.wr.mw.mr_lkey = info->mr->lkey;
 	wqe->wr.wr.mw.mw_rkey = ibmw->rkey;
 	wqe->wr.wr.mw.rkey = rkey;
 	wqe->wr.wr.mw.access = info->mw_access_flags;
-	wqe->ssn = qp->ssn++;
 
 	advance_qp_cur_index(qp);
 }
@@ -837,13 +987,10 @@ static void wr_local_inv(struct ibv_qp_ex *ibqp, uint32_t invalidate_rkey)
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_LOCAL_INV,
+			  ibqp->wr_flags);
 
-	wqe->wr.wr_id = qp->vqp.qp_ex.wr_id;
-	wqe->wr.opcode = IBV_WR_LOCAL_INV;
-	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags;
 	wqe->wr.ex.invalidate_rkey = invalidate_rkey;
-	wqe->ssn = qp->ssn++;
 
 	advance_qp_cur_index(qp);
 }
@@ -857,15 +1004,12 @@ static void wr_rdma_read(struct ibv_qp_ex *ibqp, uint32_t rkey,
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_RDMA_READ,
+			  ibqp->wr_flags);
 
-	wqe->wr.wr_id = qp->vqp.qp_ex.wr_id;
-	wqe->wr.opcode = IBV_WR_RDMA_READ;
-	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags;
 	wqe->wr.wr.rdma.remote_addr = remote_addr;
 	wqe->wr.wr.rdma.rkey = rkey;
 	wqe->iova = remote_addr;
-	wqe->ssn = qp->ssn++;
 
 	advance_qp_cur_index(qp);
 }
@@ -879,15 +1023,12 @@ static void wr_rdma_write(struct ibv_qp_ex *ibqp, uint32_t rkey,
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_RDMA_WRITE,
+			  ibqp->wr_flags);
 
-	wqe->wr.wr_id = qp->vqp.qp_ex.wr_id;
-	wqe->wr.opcode = IBV_WR_RDMA_WRITE;
-	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags;
 	wqe->wr.wr.rdma.remote_addr = remote_addr;
 	wqe->wr.wr.rdma.rkey = rkey;
 	wqe->iova = remote_addr;
-	wqe->ssn = qp->ssn++;
 
 	advance_qp_cur_index(qp);
 }
@@ -901,16 +1042,13 @@ static void wr_rdma_write_imm(struct ibv_qp_ex *ibqp, uint32_t rkey,
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_RDMA_WRITE_WITH_IMM,
+			  ibqp->wr_flags);
 
-	wqe->wr.wr_id = qp->vqp.qp_ex.wr_id;
-	wqe->wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
-	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags;
 	wqe->wr.wr.rdma.remote_addr = remote_addr;
 	wqe->wr.wr.rdma.rkey = rkey;
 	wqe->wr.ex.imm_data = imm_data;
 	wqe->iova = remote_addr;
-	wqe->ssn = qp->ssn++;
 
 	advance_qp_cur_index(qp);
 }
@@ -923,12 +1061,7 @@ static void wr_send(struct ibv_qp_ex *ibqp)
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
-
-	wqe->wr.wr_id = qp->vqp.qp_ex.wr_id;
-	wqe->wr.opcode = IBV_WR_SEND;
-	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags;
-	wqe->ssn = qp->ssn++;
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_SEND, ibqp->wr_flags);
 
 	advance_qp_cur_index(qp);
 }
@@ -941,13 +1074,10 @@ static void wr_send_imm(struct ibv_qp_ex *ibqp, __be32 imm_data)
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_SEND_WITH_IMM,
+			  ibqp->wr_flags);
 
-	wqe->wr.wr_id = qp->vqp.qp_ex.wr_id;
-	wqe->wr.opcode = IBV_WR_SEND_WITH_IMM;
-	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags;
 	wqe->wr.ex.imm_data = imm_data;
-	wqe->ssn = qp->ssn++;
 
 	advance_qp_cur_index(qp);
 }
@@ -960,13 +1090,10 @@ static void wr_send_inv(struct ibv_qp_ex *ibqp, uint32_t invalidate_rkey)
 	if (check_qp_queue_full(qp))
 		return;
 
-	memset(wqe, 0, sizeof(*wqe));
+	init_send_wqe_hdr(qp, wqe, ibqp->wr_id, IBV_WR_SEND_WITH_INV,
+			  ibqp->wr_flags);
 
-	wqe->wr.wr_id = qp->vqp.qp_ex.wr_id;
-	wqe->wr.opcode = IBV_WR_SEND_WITH_INV;
-	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags;
 	wqe->wr.ex.invalidate_rkey = invalidate_rkey;
-	wqe->ssn = qp->ssn++;
 
 	advance_qp_cur_index(qp);
 }
@@ -982,9 +1109,10 @@ static void wr_set_ud_addr(struct ibv_qp_ex *ibqp, struct ibv_ah *ibah,
 	if (qp->err)
 		return;
 
-	memcpy(&wqe->av, &ah->av, sizeof(ah->av));
+	set_send_wqe_av(qp, wqe, ah);
 	wqe->wr.wr.ud.remote_qpn = remote_qpn;
 	wqe->wr.wr.ud.remote_qkey = remote_qkey;
+	wqe->wr.wr.ud.pkey_index = 0;
 }
 
 static void wr_set_inline_data(struct ibv_qp_ex *ibqp, void *addr,
@@ -1003,6 +1131,7 @@ static void wr_set_inline_data(struct ibv_qp_ex *ibqp, void *addr,
 	}
 
 	memcpy(wqe->dma.inline_data, addr, length);
+	wqe->wr.send_flags |= IBV_SEND_INLINE;
 	wqe->dma.length = length;
 	wqe->dma.resid = length;
 }
@@ -1032,8 +1161,10 @@ static void wr_set_inline_data_list(struct ibv_qp_ex *ibqp, size_t num_buf,
 
 		buf_list++;
 		data += length;
+		tot_length += length;
 	}
 
+	wqe->wr.send_flags |= IBV_SEND_INLINE;
 	wqe->dma.length = tot_length;
 	wqe->dma.resid = tot_length;
 }
@@ -1079,7 +1210,7 @@ static void wr_set_sge_list(struct ibv_qp_ex *ibqp, size_t num_sge,
 	memcpy(wqe->dma.sge, sg_list, num_sge*sizeof(*sg_list));
 
 	while (num_sge--)
-		tot_length += sg_list->length;
+		tot_length += sg_list++->length;
 
 	wqe->dma.length = tot_length;
 	wqe->dma.resid = tot_length;
@@ -1090,7 +1221,7 @@ static void wr_start(struct ibv_qp_ex *ibqp)
 {
 	struct rxe_qp *qp = container_of(ibqp, struct rxe_qp, vqp.qp_ex);
 
-	pthread_spin_lock(&qp->sq.lock);
+	rxe_spin_lock(&qp->sq.lock);
 
 	qp->err = 0;
 	qp->cur_index = load_producer_index(qp->sq.queue);
@@ -1104,14 +1235,14 @@ static int wr_complete(struct ibv_qp_ex *ibqp)
 	struct rxe_qp *qp = container_of(ibqp, struct rxe_qp, vqp.qp_ex);
 
 	if (qp->err) {
-		pthread_spin_unlock(&qp->sq.lock);
+		rxe_spin_unlock(&qp->sq.lock);
 		return qp->err;
 	}
 
 	store_producer_index(qp->sq.queue, qp->cur_index);
 	ret = post_send_db(&qp->vqp.qp);
 
-	pthread_spin_unlock(&qp->sq.lock);
+	rxe_spin_unlock(&qp->sq.lock);
 	return ret;
 }
 
@@ -1119,13 +1250,15 @@ static void wr_abort(struct ibv_qp_ex *ibqp)
 {
 	struct rxe_qp *qp = container_of(ibqp, struct rxe_qp, vqp.qp_ex);
 
-	pthread_spin_unlock(&qp->sq.lock);
+	rxe_spin_unlock(&qp->sq.lock);
 }
 
 static int map_queue_pair(int cmd_fd, struct rxe_qp *qp,
 			  struct ibv_qp_init_attr *attr,
 			  struct rxe_create_qp_resp *resp)
 {
+	bool need_lock = rxe_pd_need_lock(qp->vqp.qp.pd);
+
 	if (attr->srq) {
 		qp->rq.max_sge = 0;
 		qp->rq.queue = NULL;
@@ -1139,7 +1272,7 @@ static int map_queue_pair(int cmd_fd, struct rxe_qp *qp,
 			return errno;
 
 		qp->rq_mmap_info = resp->rq_mi;
-		pthread_spin_init(&qp->rq.lock, PTHREAD_PROCESS_PRIVATE);
+		rxe_spinlock_init(&qp->rq.lock, need_lock);
 	}
 
 	qp->sq.max_sge = attr->cap.max_send_sge;
@@ -1153,8 +1286,19 @@ static int map_queue_pair(int cmd_fd, struct rxe_qp *qp,
 		return errno;
 	}
 
+	if (attr->qp_type == IBV_QPT_UD) {
+		qp->sq_av_ids = calloc(qp->sq.queue->index_mask + 1,
+				       sizeof(*qp->sq_av_ids));
+		if (!qp->sq_av_ids) {
+			munmap(qp->sq.queue, resp->sq_mi.size);
+			if (qp->rq_mmap_info.size)
+				munmap(qp->rq.queue, qp->rq_mmap_info.size);
+			return ENOMEM;
+		}
+	}
+
 	qp->sq_mmap_info = resp->sq_mi;
-	pthread_spin_init(&qp->sq.lock, PTHREAD_PROCESS_PRIVATE);
+	rxe_spinlock_init(&qp->sq.lock, need_lock);
 
 	return 0;
 }
@@ -1164,6 +1308,7 @@ static struct ibv_qp *rxe_create_qp(struct ibv_pd *ibpd,
 {
 	struct ibv_create_qp cmd = {};
 	struct urxe_create_qp_resp resp = {};
+	struct rxe_pd *parent_domain;
 	struct rxe_qp *qp;
 	int ret;
 
@@ -1181,8 +1326,9 @@ static struct ibv_qp *rxe_create_qp(struct ibv_pd *ibpd,
 	if (ret)
 		goto err_destroy;
 
-	qp->sq_mmap_info = resp.sq_mi;
-	pthread_spin_init(&qp->sq.lock, PTHREAD_PROCESS_PRIVATE);
+	parent_domain = to_rparent_domain(ibpd);
+	if (parent_domain)
+		atomic_fetch_add(&parent_domain->refcount, 1);
 
 	return &qp->vqp.qp;
 
@@ -1302,11 +1448,15 @@ static struct ibv_qp *rxe_create_qp_ex(struct ibv_context *context,
 	struct urxe_create_qp_ex_resp resp = {};
 	size_t cmd_size = sizeof(cmd);
 	size_t resp_size = sizeof(resp);
+	struct rxe_pd *parent_domain = NULL;
 
 	ret = check_qp_init_attr(attr);
 	if (ret)
 		goto err;
 
+	if (attr->comp_mask & IBV_QP_INIT_ATTR_PD)
+		parent_domain = to_rparent_domain(attr->pd);
+
 	qp = calloc(1, sizeof(*qp));
 	if (!qp)
 		goto err;
@@ -1328,6 +1478,9 @@ static struct ibv_qp *rxe_create_qp_ex(struct ibv_context *context,
 	if (ret)
 		goto err_destroy;
 
+	if (parent_domain)
+		atomic_fetch_add(&parent_domain->refcount, 1);
+
 	return &qp->vqp.qp;
 
 err_destroy:
@@ -1350,8 +1503,15 @@ static int rxe_query_qp(struct ibv_qp *ibqp, struct ibv_qp_attr *attr,
 static int rxe_modify_qp(struct ibv_qp *ibqp, struct ibv_qp_attr *attr,
 		  int attr_mask)
 {
+	struct rxe_qp *qp = to_rqp(ibqp);
 	struct ibv_modify_qp cmd = {};
 
+	/* The kernel zeroes the send queue, and the AVs with it, on RESET */
+	if (qp->sq_av_ids && (attr_mask & IBV_QP_STATE) &&
+	    attr->qp_state == IBV_QPS_RESET)
+		memset(qp->sq_av_ids, 0, (qp->sq.queue->index_mask + 1) *
+					 sizeof(*qp->sq_av_ids));
+
 	return ibv_cmd_modify_qp(ibqp, attr, attr_mask, &cmd, sizeof(cmd));
 }
 
@@ -1359,6 +1519,10 @@ static int rxe_destroy_qp(struct ibv_qp *ibqp)
 {
 	int ret;
 	struct rxe_qp *qp = to_rqp(ibqp);
+	struct rxe_pd *parent_domain = NULL;
+
+	if (ibqp->pd)
+		parent_domain = to_rparent_domain(ibqp->pd);
 
 	ret = ibv_cmd_destroy_qp(ibqp);
 	if (!ret) {
@@ -1366,7 +1530,10 @@ static int rxe_destroy_qp(struct ibv_qp *ibqp)
 			munmap(qp->rq.queue, qp->rq_mmap_info.size);
 		if (qp->sq_mmap_info.size)
 			munmap(qp->sq.queue, qp->sq_mmap_info.size);
+		if (parent_domain)
+			atomic_fetch_sub(&parent_domain->refcount, 1);
 
+		free(qp->sq_av_ids);
 		free(qp);
 	}
 
@@ -1405,71 +1572,59 @@ static int validate_send_wr(struct rxe_qp *qp, struct ibv_send_wr *ibwr,
 	return 0;
 }
 
-static void convert_send_wr(struct rxe_send_wr *kwr, struct ibv_send_wr *uwr)
+static void init_send_wqe(struct rxe_qp *qp, struct ibv_send_wr *ibwr,
+			  unsigned int length, struct rxe_send_wqe *wqe)
 {
-	struct ibv_mw *ibmw;
-	struct ibv_mr *ibmr;
-
-	memset(kwr, 0, sizeof(*kwr));
+	int num_sge = ibwr->num_sge;
+	int i;
 
-	kwr->wr_id		= uwr->wr_id;
-	kwr->num_sge		= uwr->num_sge;
-	kwr->opcode		= uwr->opcode;
-	kwr->send_flags		= uwr->send_flags;
-	kwr->ex.imm_data	= uwr->imm_data;
+	init_send_wqe_hdr(qp, wqe, ibwr->wr_id, ibwr->opcode,
+			  ibwr->send_flags);
+	wqe->wr.num_sge = num_sge;
+	/* imm_data and invalidate_rkey share the union */
+	wqe->wr.ex.imm_data = ibwr->imm_data;
 
-	switch (uwr->opcode) {
+	switch (ibwr->opcode) {
 	case IBV_WR_RDMA_WRITE:
 	case IBV_WR_RDMA_WRITE_WITH_IMM:
 	case IBV_WR_RDMA_READ:
-		kwr->wr.rdma.remote_addr	= uwr->wr.rdma.remote_addr;
-		kwr->wr.rdma.rkey		= uwr->wr.rdma.rkey;
+		wqe->wr.wr.rdma.remote_addr = ibwr->wr.rdma.remote_addr;
+		wqe->wr.wr.rdma.rkey = ibwr->wr.rdma.rkey;
+		wqe->iova = ibwr->wr.rdma.remote_addr;
 		break;
 
 	case IBV_WR_SEND:
 	case IBV_WR_SEND_WITH_IMM:
-		kwr->wr.ud.remote_qpn		= uwr->wr.ud.remote_qpn;
-		kwr->wr.ud.remote_qkey		= uwr->wr.ud.remote_qkey;
+		if (qp_type(qp) == IBV_QPT_UD) {
+			set_send_wqe_av(qp, wqe, to_rah(ibwr->wr.ud.ah));
+			wqe->wr.wr.ud.remote_qpn = ibwr->wr.ud.remote_qpn;
+			wqe->wr.wr.ud.remote_qkey = ibwr->wr.ud.remote_qkey;
+			wqe->wr.wr.ud.pkey_index = 0;
+		}
 		break;
 
 	case IBV_WR_ATOMIC_CMP_AND_SWP:
 	case IBV_WR_ATOMIC_FETCH_AND_ADD:
-		kwr->wr.atomic.remote_addr	= uwr->wr.atomic.remote_addr;
-		kwr->wr.atomic.compare_add	= uwr->wr.atomic.compare_add;
-		kwr->wr.atomic.swap		= uwr->wr.atomic.swap;
-		kwr->wr.atomic.rkey		= uwr->wr.atomic.rkey;
+		wqe->wr.wr.atomic.remote_addr = ibwr->wr.atomic.remote_addr;
+		wqe->wr.wr.atomic.compare_add = ibwr->wr.atomic.compare_add;
+		wqe->wr.wr.atomic.swap = ibwr->wr.atomic.swap;
+		wqe->wr.wr.atomic.rkey = ibwr->wr.atomic.rkey;
+		wqe->iova = ibwr->wr.atomic.remote_addr;
 		break;
 
 	case IBV_WR_BIND_MW:
-		ibmr = uwr->bind_mw.bind_info.mr;
-		ibmw = uwr->bind_mw.mw;
-
-		kwr->wr.mw.addr = uwr->bind_mw.bind_info.addr;
-		kwr->wr.mw.length = uwr->bind_mw.bind_info.length;
-		kwr->wr.mw.mr_lkey = ibmr->lkey;
-		kwr->wr.mw.mw_rkey = ibmw->rkey;
-		kwr->wr.mw.rkey = uwr->bind_mw.rkey;
-		kwr->wr.mw.access = uwr->bind_mw.bind_info.mw_access_flags;
+		wqe->wr.wr.mw.addr = ibwr->bind_mw.bind_info.addr;
+		wqe->wr.wr.mw.length = ibwr->bind_mw.bind_info.length;
+		wqe->wr.wr.mw.mr_lkey = ibwr->bind_mw.bind_info.mr->lkey;
+		wqe->wr.wr.mw.mw_rkey = ibwr->bind_mw.mw->rkey;
+		wqe->wr.wr.mw.rkey = ibwr->bind_mw.rkey;
+		wqe->wr.wr.mw.access =
+			ibwr->bind_mw.bind_info.mw_access_flags;
 		break;
 
 	default:
 		break;
 	}
-}
-
-static int init_send_wqe(struct rxe_qp *qp, struct rxe_wq *sq,
-		  struct ibv_send_wr *ibwr, unsigned int length,
-		  struct rxe_send_wqe *wqe)
-{
-	int num_sge = ibwr->num_sge;
-	int i;
-	unsigned int opcode = ibwr->opcode;
-
-	convert_send_wr(&wqe->wr, ibwr);
-
-	if (qp_type(qp) == IBV_QPT_UD)
-		memcpy(&wqe->av, &to_rah(ibwr->wr.ud.ah)->av,
-		       sizeof(struct rxe_av));
 
 	if (ibwr->send_flags & IBV_SEND_INLINE) {
 		uint8_t *inline_data = wqe->dma.inline_data;
@@ -1480,35 +1635,27 @@ static int init_send_wqe(struct rxe_qp *qp, struct rxe_wq *sq,
 			       ibwr->sg_list[i].length);
 			inline_data += ibwr->sg_list[i].length;
 		}
-	} else
+	} else {
 		memcpy(wqe->dma.sge, ibwr->sg_list,
 		       num_sge*sizeof(struct ibv_sge));
-
-	if ((opcode == IBV_WR_ATOMIC_CMP_AND_SWP)
-	    || (opcode == IBV_WR_ATOMIC_FETCH_AND_ADD))
-		wqe->iova	= ibwr->wr.atomic.remote_addr;
-	else
-		wqe->iova	= ibwr->wr.rdma.remote_addr;
+	}
 
 	wqe->dma.length		= length;
 	wqe->dma.resid		= length;
 	wqe->dma.num_sge	= num_sge;
-	wqe->dma.cur_sge	= 0;
-	wqe->dma.sge_offset	= 0;
-	wqe->state		= 0;
-	wqe->ssn		= qp->ssn++;
-
-	return 0;
 }
 
 static int post_one_send(struct rxe_qp *qp, struct rxe_wq *sq,
 			 struct ibv_send_wr *ibwr)
 {
 	int err;
-	struct rxe_send_wqe *wqe;
 	unsigned int length = 0;
 	int i;
 
+	/* the producer slot is still owned by the kernel when full */
+	if (queue_full(sq->queue))
+		return -ENOMEM;
+
 	for (i = 0; i < ibwr->num_sge; i++)
 		length += ibwr->sg_list[i].length;
 
@@ -1518,15 +1665,7 @@ static int post_one_send(struct rxe_qp *qp, struct rxe_wq *sq,
 		return err;
 	}
 
-	wqe = (struct rxe_send_wqe *)producer_addr(sq->queue);
-
-	err = init_send_wqe(qp, sq, ibwr, length, wqe);
-	if (err)
-		return err;
-
-	if (queue_full(sq->queue))
-		return -ENOMEM;
-
+	init_send_wqe(qp, ibwr, length, producer_addr(sq->queue));
 	advance_producer(sq->queue);
 
 	return 0;
@@ -1573,7 +1712,7 @@ static int rxe_post_send(struct ibv_qp *ibqp,
 	if (!sq || !wr_list || !sq->queue)
 		return EINVAL;
 
-	pthread_spin_lock(&sq->lock);
+	rxe_spin_lock(&sq->lock);
 
 	while (wr_list) {
 		rc = post_one_send(qp, sq, wr_list);
@@ -1585,7 +1724,7 @@ static int rxe_post_send(struct ibv_qp *ibqp,
 		wr_list = wr_list->next;
 	}
 
-	pthread_spin_unlock(&sq->lock);
+	rxe_spin_unlock(&sq->lock);
 
 	err =  post_send_db(ibqp);
 	return err ? err : rc;
@@ -1607,7 +1746,7 @@ static int rxe_post_recv(struct ibv_qp *ibqp,
 	if (!rq || !recv_wr || !rq->queue)
 		return EINVAL;
 
-	pthread_spin_lock(&rq->lock);
+	rxe_spin_lock(&rq->lock);
 
 	while (recv_wr) {
 		rc = rxe_post_one_recv(rq, recv_wr);
@@ -1619,7 +1758,7 @@ static int rxe_post_recv(struct ibv_qp *ibqp,
 		recv_wr = recv_wr->next;
 	}
 
-	pthread_spin_unlock(&rq->lock);
+	rxe_spin_unlock(&rq->lock);
 
 	return rc;
 }
@@ -1683,6 +1822,9 @@ static struct ibv_ah *rxe_create_ah(struct ibv_pd *pd, struct ibv_ah_attr *attr)
 		return NULL;
 	}
 
+	/* 0 is left for send queue slots that never held an AV */
+	ah->av_id = atomic_fetch_add(&to_rctx(pd->context)->next_av_id, 1) + 1;
+
 	return &ah->ibv_ah;
 }
 
@@ -1704,6 +1846,9 @@ static const struct verbs_context_ops rxe_ctx_ops = {
 	.query_port = rxe_query_port,
 	.alloc_pd = rxe_alloc_pd,
 	.dealloc_pd = rxe_dealloc_pd,
+	.alloc_td = rxe_alloc_td,
+	.dealloc_td = rxe_dealloc_td,
+	.alloc_parent_domain = rxe_alloc_parent_domain,
 	.reg_mr = rxe_reg_mr,
 	.dereg_mr = rxe_dereg_mr,
 	.alloc_mw = rxe_alloc_mw,
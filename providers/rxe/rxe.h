@@ -36,6 +36,9 @@
 #ifndef RXE_H
 #define RXE_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <infiniband/driver.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -49,6 +52,29 @@ struct rxe_device {
 
 struct rxe_context {
 	struct verbs_context	ibv_ctx;
+	atomic_uint		next_av_id;
+};
+
+/*
+ * Objects created under a parent domain with a thread domain are only used
+ * by one thread at a time, so their locks are never taken.
+ */
+struct rxe_spinlock {
+	pthread_spinlock_t	lock;
+	bool			need_lock;
+};
+
+struct rxe_td {
+	struct ibv_td		ibv_td;
+	atomic_int		refcount;
+};
+
+struct rxe_pd {
+	struct ibv_pd		ibv_pd;
+	atomic_int		refcount;
+	/* Set for a parent domain, to the PD that it was allocated on */
+	struct rxe_pd		*protection_domain;
+	struct rxe_td		*td;
 };
 
 /* common between cq and cq_ex */
@@ -56,7 +82,8 @@ struct rxe_cq {
 	struct verbs_cq		vcq;
 	struct mminfo		mmap_info;
 	struct rxe_queue_buf	*queue;
-	pthread_spinlock_t	lock;
+	struct rxe_spinlock	lock;
+	struct ibv_pd		*parent_domain;
 
 	/* new API support */
 	struct ib_uverbs_wc	*wc;
@@ -67,11 +94,13 @@ struct rxe_cq {
 struct rxe_ah {
 	struct ibv_ah		ibv_ah;
 	struct rxe_av		av;
+	/* Unique in the context, tags the copies of av in UD send queues */
+	uint32_t		av_id;
 };
 
 struct rxe_wq {
 	struct rxe_queue_buf	*queue;
-	pthread_spinlock_t	lock;
+	struct rxe_spinlock	lock;
 	unsigned int		max_sge;
 	unsigned int		max_inline;
 };
@@ -83,6 +112,8 @@ struct rxe_qp {
 	struct mminfo		sq_mmap_info;
 	struct rxe_wq		sq;
 	unsigned int		ssn;
+	/* UD only, the av_id of the AV held by each send queue slot */
+	uint32_t		*sq_av_ids;
 
 	/* new API support */
 	uint32_t		cur_index;
@@ -110,6 +141,24 @@ static inline struct rxe_device *to_rdev(struct ibv_device *ibdev)
 	return container_of(ibdev, struct rxe_device, ibv_dev.device);
 }
 
+static inline struct rxe_td *to_rtd(struct ibv_td *ibtd)
+{
+	return to_rxxx(td, td);
+}
+
+static inline struct rxe_pd *to_rpd(struct ibv_pd *ibpd)
+{
+	return to_rxxx(pd, pd);
+}
+
+/* Returns NULL unless ibpd is a parent domain */
+static inline struct rxe_pd *to_rparent_domain(struct ibv_pd *ibpd)
+{
+	struct rxe_pd *pd = to_rpd(ibpd);
+
+	return pd->protection_domain ? pd : NULL;
+}
+
 static inline struct rxe_cq *to_rcq(struct ibv_cq *ibcq)
 {
 	return container_of(ibcq, struct rxe_cq, vcq.cq);
@@ -130,4 +179,34 @@ static inline struct rxe_ah *to_rah(struct ibv_ah *ibah)
 	return to_rxxx(ah, ah);
 }
 
+static inline void rxe_spinlock_init(struct rxe_spinlock *lock, bool need_lock)
+{
+	lock->need_lock = need_lock;
+	pthread_spin_init(&lock->lock, PTHREAD_PROCESS_PRIVATE);
+}
+
+/* A PD without a thread domain may be shared between threads */
+static inline bool rxe_pd_need_lock(struct ibv_pd *ibpd)
+{
+	struct rxe_pd *parent_domain;
+
+	if (!ibpd)
+		return true;
+
+	parent_domain = to_rparent_domain(ibpd);
+	return !parent_domain || !parent_domain->td;
+}
+
+static inline void rxe_spin_lock(struct rxe_spinlock *lock)
+{
+	if (lock->need_lock)
+		pthread_spin_lock(&lock->lock);
+}
+
+static inline void rxe_spin_unlock(struct rxe_spinlock *lock)
+{
+	if (lock->need_lock)
+		pthread_spin_unlock(&lock->lock);
+}
+
 #endif /* RXE_H */
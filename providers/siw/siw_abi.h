@@ -14,6 +14,8 @@ DECLARE_DRV_CMD(siw_cmd_alloc_context, IB_USER_VERBS_CMD_GET_CONTEXT,
 		empty, siw_uresp_alloc_ctx);
 DECLARE_DRV_CMD(siw_cmd_create_cq, IB_USER_VERBS_CMD_CREATE_CQ,
 		empty, siw_uresp_create_cq);
+DECLARE_DRV_CMD(siw_cmd_create_cq_ex, IB_USER_VERBS_EX_CMD_CREATE_CQ,
+		empty, siw_uresp_create_cq);
 DECLARE_DRV_CMD(siw_cmd_create_srq, IB_USER_VERBS_CMD_CREATE_SRQ,
 		empty, siw_uresp_create_srq);
 DECLARE_DRV_CMD(siw_cmd_create_qp, IB_USER_VERBS_CMD_CREATE_QP,
@@ -572,6 +572,8 @@ fi
 %files -n libibverbs-utils
 %{_bindir}/ibv_*
 %{_mandir}/man1/ibv_*
+%{_bindir}/mlx5_dr_dump2csv
+%{_mandir}/man1/mlx5_dr_dump2csv.*
 
 %files -n ibacm
 %config(noreplace) %{_sysconfdir}/rdma/ibacm_opts.cfg
@@ -608,6 +610,7 @@ fi
 
 %files -n librdmacm-utils
 %{_bindir}/cmtime
+%{_bindir}/cqpool
 %{_bindir}/mckey
 %{_bindir}/rcopy
 %{_bindir}/rdma_client
@@ -621,6 +624,7 @@ fi
 %{_bindir}/udaddy
 %{_bindir}/udpong
 %{_mandir}/man1/cmtime.*
+%{_mandir}/man1/cqpool.*
 %{_mandir}/man1/mckey.*
 %{_mandir}/man1/rcopy.*
 %{_mandir}/man1/rdma_client.*
@@ -677,6 +677,8 @@ rm -rf %{buildroot}/%{_sbindir}/srp_daemon.sh
 %defattr(-,root,root)
 %{_bindir}/ibv_*
 %{_mandir}/man1/ibv_*
+%{_bindir}/mlx5_dr_dump2csv
+%{_mandir}/man1/mlx5_dr_dump2csv.*
 
 %files -n ibacm
 %defattr(-,root,root)
@@ -792,6 +794,7 @@ rm -rf %{buildroot}/%{_sbindir}/srp_daemon.sh
 %files -n librdmacm-utils
 %defattr(-,root,root)
 %{_bindir}/cmtime
+%{_bindir}/cqpool
 %{_bindir}/mckey
 %{_bindir}/rcopy
 %{_bindir}/rdma_client
@@ -805,6 +808,7 @@ rm -rf %{buildroot}/%{_sbindir}/srp_daemon.sh
 %{_bindir}/udaddy
 %{_bindir}/udpong
 %{_mandir}/man1/cmtime.*
+%{_mandir}/man1/cqpool.*
 %{_mandir}/man1/mckey.*
 %{_mandir}/man1/rcopy.*
 %{_mandir}/man1/rdma_client.*
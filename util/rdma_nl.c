@@ -130,11 +130,13 @@ int rdmanl_get_devices(struct nl_sock *nl, nl_recvmsg_msg_cb_t cb_func,
 	return 0;
 }
 
-int rdmanl_get_chardev(struct nl_sock *nl, int ibidx, const char *name,
-		       nl_recvmsg_msg_cb_t cb_func, void *data)
-
+/*
+ * Send a GET_CHARDEV request without waiting for the reply, which carries
+ * the returned sequence number.
+ */
+int rdmanl_send_get_chardev(struct nl_sock *nl, int ibidx, const char *name,
+			    uint32_t *seq)
 {
-	bool failed = false;
 	struct nl_msg *msg;
 	int ret;
 
@@ -146,9 +148,27 @@ int rdmanl_get_chardev(struct nl_sock *nl, int ibidx, const char *name,
 		NLA_PUT_U32(msg, RDMA_NLDEV_ATTR_DEV_INDEX, ibidx);
 	NLA_PUT_STRING(msg, RDMA_NLDEV_ATTR_CHARDEV_TYPE, name);
 	ret = nl_send_auto(nl, msg);
+	if (seq)
+		*seq = nlmsg_hdr(msg)->nlmsg_seq;
 	nlmsg_free(msg);
 	if (ret < 0)
 		return -1;
+	return 0;
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return -1;
+}
+
+int rdmanl_get_chardev(struct nl_sock *nl, int ibidx, const char *name,
+		       nl_recvmsg_msg_cb_t cb_func, void *data)
+
+{
+	bool failed = false;
+	int ret;
+
+	if (rdmanl_send_get_chardev(nl, ibidx, name, NULL))
+		return -1;
 
 	if (nl_socket_modify_err_cb(nl, NL_CB_CUSTOM, rdmanl_saw_err_cb,
 				    &failed))
@@ -163,8 +183,4 @@ int rdmanl_get_chardev(struct nl_sock *nl, int ibidx, const char *name,
 	if (ret || failed)
 		return -1;
 	return 0;
-
-nla_put_failure:
-	nlmsg_free(msg);
-	return -1;
 }
@@ -43,6 +43,8 @@ extern struct nla_policy rdmanl_policy[RDMA_NLDEV_ATTR_MAX];
 struct nl_sock *rdmanl_socket_alloc(void);
 int rdmanl_get_devices(struct nl_sock *nl, nl_recvmsg_msg_cb_t cb_func,
 		       void *data);
+int rdmanl_send_get_chardev(struct nl_sock *nl, int ibidx, const char *name,
+			    uint32_t *seq);
 int rdmanl_get_chardev(struct nl_sock *nl, int ibidx, const char *name,
 		       nl_recvmsg_msg_cb_t cb_func, void *data);
 bool get_copy_on_fork(void);